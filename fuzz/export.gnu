@@ -16,12 +16,14 @@
 		fido_assert_clientdata_hash_len;
 		fido_assert_clientdata_hash_ptr;
 		fido_assert_count;
+		fido_assert_export;
 		fido_assert_flags;
 		fido_assert_free;
 		fido_assert_hmac_secret_len;
 		fido_assert_hmac_secret_ptr;
 		fido_assert_id_len;
 		fido_assert_id_ptr;
+		fido_assert_import;
 		fido_assert_new;
 		fido_assert_rp_id;
 		fido_assert_set_authdata;
@@ -44,17 +46,23 @@
 		fido_assert_user_id_ptr;
 		fido_assert_user_name;
 		fido_assert_verify;
+		fido_assert_verify_with_store;
 		fido_bio_dev_enroll_begin;
 		fido_bio_dev_enroll_cancel;
 		fido_bio_dev_enroll_continue;
 		fido_bio_dev_enroll_remove;
+		fido_bio_dev_enroll_start;
 		fido_bio_dev_get_info;
 		fido_bio_dev_get_template_array;
 		fido_bio_dev_set_template_name;
+		fido_bio_enroll_cancel;
+		fido_bio_enroll_fd;
 		fido_bio_enroll_free;
 		fido_bio_enroll_last_status;
 		fido_bio_enroll_new;
 		fido_bio_enroll_remaining_samples;
+		fido_bio_enroll_set_cb;
+		fido_bio_enroll_wait;
 		fido_bio_info_free;
 		fido_bio_info_max_samples;
 		fido_bio_info_new;
@@ -70,6 +78,12 @@
 		fido_bio_template_new;
 		fido_bio_template_set_id;
 		fido_bio_template_set_name;
+		fido_broker_free;
+		fido_broker_listen;
+		fido_broker_new;
+		fido_broker_run;
+		fido_broker_set_hold_timeout;
+		fido_broker_stop;
 		fido_cbor_info_aaguid_len;
 		fido_cbor_info_aaguid_ptr;
 		fido_cbor_info_extensions_len;
@@ -93,6 +107,7 @@
 		fido_cred_clientdata_hash_ptr;
 		fido_cred_display_name;
 		fido_cred_exclude;
+		fido_cred_export;
 		fido_cred_flags;
 		fido_cred_fmt;
 		fido_cred_free;
@@ -100,10 +115,27 @@
 		fido_cred_id_ptr;
 		fido_cred_aaguid_len;
 		fido_cred_aaguid_ptr;
+		fido_cred_import;
+		fido_cred_store_add;
+		fido_cred_store_free;
+		fido_cred_store_load;
+		fido_cred_store_lookup;
+		fido_cred_store_new;
+		fido_cred_store_save;
+		fido_cred_store_set_sigcount_tracking;
 		fido_credman_del_dev_rk;
+		fido_credman_del_dev_rk_list;
+		fido_credman_get_dev_inventory;
 		fido_credman_get_dev_metadata;
 		fido_credman_get_dev_rk;
 		fido_credman_get_dev_rp;
+		fido_credman_inventory_free;
+		fido_credman_inventory_metadata;
+		fido_credman_inventory_new;
+		fido_credman_inventory_rk;
+		fido_credman_inventory_rp;
+		fido_credman_iter_dev_rk;
+		fido_credman_iter_dev_rp;
 		fido_credman_metadata_free;
 		fido_credman_metadata_new;
 		fido_credman_rk;
@@ -149,6 +181,7 @@
 		fido_cred_verify_self;
 		fido_cred_x5c_len;
 		fido_cred_x5c_ptr;
+		fido_credman_sync_dev_inventory;
 		fido_dev_build;
 		fido_dev_cancel;
 		fido_dev_close;
@@ -157,8 +190,10 @@
 		fido_dev_force_u2f;
 		fido_dev_free;
 		fido_dev_get_assert;
+		fido_dev_get_assert_batch;
 		fido_dev_get_cbor_info;
 		fido_dev_get_retry_count;
+		fido_dev_get_stats;
 		fido_dev_get_touch_begin;
 		fido_dev_get_touch_status;
 		fido_dev_has_pin;
@@ -170,22 +205,66 @@
 		fido_dev_info_product;
 		fido_dev_info_product_string;
 		fido_dev_info_ptr;
+		fido_dev_info_set;
 		fido_dev_info_vendor;
 		fido_dev_is_fido2;
+		fido_dev_lock;
 		fido_dev_major;
 		fido_dev_make_cred;
 		fido_dev_minor;
+		fido_dev_mux_close;
+		fido_dev_mux_free;
+		fido_dev_mux_new;
+		fido_dev_mux_open;
+		fido_dev_mux_set_io_functions;
 		fido_dev_new;
 		fido_dev_open;
+		fido_dev_open_many;
+		fido_dev_open_mux;
+		fido_dev_ping;
 		fido_dev_protocol;
 		fido_dev_reset;
+		fido_dev_reset_stats;
+		fido_dev_set_arbitration;
+		fido_dev_set_auto_lock;
+		fido_dev_set_broker;
 		fido_dev_set_io_functions;
+		fido_dev_set_keepalive_handler;
 		fido_dev_set_pin;
+		fido_dev_set_retry_policy;
 		fido_dev_set_transport_functions;
+		fido_dev_stats_errors;
+		fido_dev_stats_free;
+		fido_dev_stats_keepalives;
+		fido_dev_stats_latency_bucket;
+		fido_dev_stats_latency_count;
+		fido_dev_stats_latency_max_us;
+		fido_dev_stats_latency_total_us;
+		fido_dev_stats_new;
+		fido_dev_stats_retries;
+		fido_dev_stats_rx_bytes;
+		fido_dev_stats_rx_reports;
+		fido_dev_stats_timeouts;
+		fido_dev_stats_tx_bytes;
+		fido_dev_stats_tx_reports;
 		fido_dev_supports_cred_prot;
 		fido_dev_supports_pin;
+		fido_dev_unlock;
+		fido_dev_wink;
+		fido_ecdh_pool_start;
+		fido_ecdh_pool_stop;
 		fido_init;
+		fido_log_async_start;
+		fido_log_async_stop;
+		fido_log_record_dev;
+		fido_log_record_level;
+		fido_log_record_msg;
+		fido_log_record_thread;
+		fido_log_record_time_us;
+		fido_set_allocator;
 		fido_set_log_handler;
+		fido_set_log_level;
+		fido_set_log_record_handler;
 		fido_strerr;
 		rs256_pk_free;
 		rs256_pk_from_ptr;
@@ -7,6 +7,15 @@
 /*
  * cc -fPIC -D_GNU_SOURCE -shared -o preload-snoop.so preload-snoop.c
  * LD_PRELOAD=$(realpath preload-snoop.so)
+ *
+ * Besides the raw "-in" and "-out" streams, a "-session" file is written
+ * with one line per report, in the order they crossed the device:
+ *
+ *	< usec hex	(report read from the device)
+ *	> usec hex	(report written to the device)
+ *
+ * where usec is the time since the device was opened. Sessions can be
+ * played back with regress/replay.c.
  */
 
 #include <sys/types.h>
@@ -21,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SNOOP_DEV_PREFIX	"/dev/hidraw"
@@ -28,7 +38,9 @@
 struct fd_tuple {
 	int snoop_in;
 	int snoop_out;
+	int snoop_session;
 	int real_dev;
+	struct timespec t0;
 };
 
 static struct fd_tuple  *fd_tuple;
@@ -72,6 +84,37 @@ get_fd(const char *hid_path, const char *suffix)
 	return (fd);
 }
 
+static void
+record(char dir, const void *buf, ssize_t n)
+{
+	const unsigned char	*ptr = buf;
+	struct timespec		 ts;
+	char			 line[32 + 2 * 1024];
+	unsigned long long	 us;
+	size_t			 len;
+	int			 r;
+
+	if (n < 0 || (size_t)n > (sizeof(line) - 32) / 2 ||
+	    clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return;
+
+	us = (unsigned long long)(ts.tv_sec - fd_tuple->t0.tv_sec) * 1000000ULL;
+	us += (unsigned long long)(ts.tv_nsec / 1000);
+	us -= (unsigned long long)(fd_tuple->t0.tv_nsec / 1000);
+
+	if ((r = snprintf(line, sizeof(line), "%c %llu ", dir, us)) < 0 ||
+	    (size_t)r >= sizeof(line))
+		return;
+
+	len = (size_t)r;
+	for (ssize_t i = 0; i < n; i++, len += 2)
+		snprintf(line + len, sizeof(line) - len, "%02x", ptr[i]);
+	line[len++] = '\n';
+
+	if (write_f(fd_tuple->snoop_session, line, len) != (ssize_t)len)
+		warnx("%s: write", __func__);
+}
+
 int
 open(const char *path, int flags, ...)
 {
@@ -108,11 +151,14 @@ open(const char *path, int flags, ...)
 
 	fd_tuple->snoop_in = -1;
 	fd_tuple->snoop_out = -1;
+	fd_tuple->snoop_session = -1;
 	fd_tuple->real_dev = -1;
 
 	if ((fd_tuple->snoop_in = get_fd(path, "in")) < 0 ||
 	    (fd_tuple->snoop_out = get_fd(path, "out")) < 0 ||
-	    (fd_tuple->real_dev = open_f(path, flags, mode)) < 0) {
+	    (fd_tuple->snoop_session = get_fd(path, "session")) < 0 ||
+	    (fd_tuple->real_dev = open_f(path, flags, mode)) < 0 ||
+	    clock_gettime(CLOCK_MONOTONIC, &fd_tuple->t0) < 0) {
 		warn("%s: get_fd/open", __func__);
 		goto fail;
 	}
@@ -123,6 +169,8 @@ fail:
 		close(fd_tuple->snoop_in);
 	if (fd_tuple->snoop_out != -1)
 		close(fd_tuple->snoop_out);
+	if (fd_tuple->snoop_session != -1)
+		close(fd_tuple->snoop_session);
 	if (fd_tuple->real_dev != -1)
 		close(fd_tuple->real_dev);
 
@@ -151,6 +199,7 @@ close(int fd)
 
 	close_f(fd_tuple->snoop_in);
 	close_f(fd_tuple->snoop_out);
+	close_f(fd_tuple->snoop_session);
 	close_f(fd_tuple->real_dev);
 
 	free(fd_tuple);
@@ -189,6 +238,8 @@ read(int fd, void *buf, size_t nbytes)
 	    write_f(fd_tuple->snoop_in, buf, n) != n)
 		return (-1);
 
+	record('<', buf, n);
+
 	return (n);
 }
 
@@ -213,5 +264,7 @@ write(int fd, const void *buf, size_t nbytes)
 	    write_f(fd_tuple->snoop_out, buf, n) != n)
 		return (-1);
 
+	record('>', buf, n);
+
 	return (n);
 }
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Cross-process arbitration (fido_dev_set_arbitration): a pseudo-terminal
+ * stands in for a hidraw node, served by a minimal authenticator
+ * (softkey.c) in a child process. While libfido2 is in the middle of an operation, the
+ * authenticator starts a competitor that blocks on the lock, and records
+ * how many replies had been sent once it got it: the lock must not be
+ * handed over between the transactions of an operation. Then, processes
+ * queueing up for the lock while a touch request holds it must get it in
+ * the order they arrived.
+ *
+ * Without a pseudo-terminal, the test is skipped.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fido.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "softkey.h"
+
+#define WAIT_MS		5000
+#define TOUCH_MS	300
+#define NWAITERS	4
+
+#define CTAP_MAKE_CRED	0x01
+
+/* versions: FIDO_2_0, aaguid: "regress-arb-key!" */
+static const unsigned char get_info_reply[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x03, 0x50, 0x72,
+	0x65, 0x67, 0x72, 0x65, 0x73, 0x73, 0x2d, 0x61,
+	0x72, 0x62, 0x2d, 0x6b, 0x65, 0x79, 0x21,
+};
+
+/* shared between the test, the authenticator and its competitors */
+struct arb {
+	int	served;		/* replies sent */
+	int	seen[2];	/* 'served' when a competitor got the lock */
+	int	queue;		/* no competitors; touch held until cleared */
+	int	order[NWAITERS];/* waiters, in the order they pinged */
+	int	norder;
+};
+
+static struct arb	*arb;
+static const char	*path;
+
+static void
+competitor(int n)
+{
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_NOCTTY)) < 0)
+		_exit(1);
+	if (flock(fd, LOCK_EX) != 0)
+		_exit(1);
+
+	__atomic_store_n(&arb->seen[n], __atomic_load_n(&arb->served,
+	    __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	_exit(0);
+}
+
+/* start a competitor, and give it time to block on the lock */
+static void
+compete(int n)
+{
+	struct timespec	ts;
+	pid_t		pid;
+
+	if ((pid = fork()) < 0)
+		err(1, "fork");
+	if (pid == 0)
+		competitor(n);
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100 * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+static void
+reply(int fd, uint32_t cid, uint8_t cmd, const unsigned char *ptr,
+    size_t len)
+{
+	/* counted first: once written, the reply may release the lock */
+	__atomic_add_fetch(&arb->served, 1, __ATOMIC_SEQ_CST);
+
+	softkey_reply(fd, cid, cmd, ptr, len);
+}
+
+/*
+ * answer CTAPHID_INIT, authenticatorGetInfo, and a touch request
+ * (authenticatorMakeCredential), the latter after TOUCH_MS
+ */
+static void
+softkey_cb(void *arg, int fd, uint32_t cid, uint8_t cmd,
+    const unsigned char *ptr, size_t len)
+{
+	unsigned char status = 0;
+
+	(void)arg;
+
+	switch (cmd) {
+	case SOFTKEY_CMD_PING:
+		assert(len == 1);
+		assert(arb->norder < NWAITERS);
+		arb->order[arb->norder++] = ptr[0];
+		reply(fd, cid, SOFTKEY_CMD_PING, ptr, 1);
+		break;
+	case SOFTKEY_CMD_INIT:
+		if (!__atomic_load_n(&arb->queue, __ATOMIC_SEQ_CST))
+			compete(0);
+		/* counted as in reply() */
+		__atomic_add_fetch(&arb->served, 1, __ATOMIC_SEQ_CST);
+		softkey_init(fd, cid, ptr);
+		break;
+	case SOFTKEY_CMD_CBOR:
+		if (ptr[0] == CTAP_MAKE_CRED &&
+		    __atomic_load_n(&arb->queue, __ATOMIC_SEQ_CST)) {
+			while (__atomic_load_n(&arb->queue, __ATOMIC_SEQ_CST))
+				usleep(1000);
+			reply(fd, cid, SOFTKEY_CMD_CBOR, &status, 1);
+		} else if (ptr[0] == CTAP_MAKE_CRED) {
+			compete(1);
+			usleep(TOUCH_MS * 1000);
+			reply(fd, cid, SOFTKEY_CMD_CBOR, &status, 1);
+		} else
+			reply(fd, cid, SOFTKEY_CMD_CBOR, get_info_reply,
+			    sizeof(get_info_reply));
+		break;
+	default:
+		errx(1, "unexpected cmd 0x%02x", cmd);
+	}
+}
+
+static int
+wait_seen(int n)
+{
+	struct timespec	ts;
+	int		seen;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 10 * 1000000L;
+
+	for (int ms = 0; ms < WAIT_MS; ms += 10) {
+		if ((seen = __atomic_load_n(&arb->seen[n],
+		    __ATOMIC_SEQ_CST)) >= 0)
+			return (seen);
+		nanosleep(&ts, NULL);
+	}
+
+	return (-1);
+}
+
+/*
+ * a libfido2 process: open the device, say so on 'ready', and once told
+ * to on 'go', ping it with arbitration
+ */
+static void
+waiter(int n, int ready, int go)
+{
+	fido_dev_t	*dev;
+	unsigned char	 c = (unsigned char)n;
+	unsigned char	 x;
+
+	if ((dev = fido_dev_new()) == NULL ||
+	    fido_dev_open(dev, path) != FIDO_OK ||
+	    write(ready, &c, 1) != 1 || read(go, &x, 1) != 1 ||
+	    fido_dev_set_arbitration(dev, true, WAIT_MS) != FIDO_OK ||
+	    fido_dev_ping(dev, &c, 1) != FIDO_OK ||
+	    fido_dev_close(dev) != FIDO_OK)
+		_exit(1);
+
+	fido_dev_free(&dev);
+
+	_exit(0);
+}
+
+/* waiters queueing up behind a touch request are served in order */
+static void
+arrival_order(void)
+{
+	fido_dev_t	*dev;
+	pid_t		 pid[NWAITERS];
+	int		 ready[2];
+	int		 go[NWAITERS][2];
+	int		 status;
+	int		 touched = 0;
+	unsigned char	 c;
+
+	__atomic_store_n(&arb->queue, 1, __ATOMIC_SEQ_CST);
+
+	/* one at a time, as they share the pseudo-terminal */
+	if (pipe(ready) < 0)
+		err(1, "pipe");
+	for (int i = 0; i < NWAITERS; i++) {
+		if (pipe(go[i]) < 0 || (pid[i] = fork()) < 0)
+			err(1, "pipe/fork");
+		if (pid[i] == 0)
+			waiter(i, ready[1], go[i][0]);
+		assert(read(ready[0], &c, 1) == 1 && c == i);
+	}
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_arbitration(dev, true, -1) == FIDO_OK);
+	assert(fido_dev_open(dev, path) == FIDO_OK);
+	assert(fido_dev_get_touch_begin(dev) == FIDO_OK);
+
+	/* in reverse order of pid, lest the kernel favours either */
+	for (int i = 0; i < NWAITERS; i++) {
+		assert(write(go[NWAITERS - 1 - i][1], &c, 1) == 1);
+		usleep(100 * 1000);
+	}
+
+	__atomic_store_n(&arb->queue, 0, __ATOMIC_SEQ_CST);
+	for (int i = 0; touched == 0 && i < WAIT_MS / 50; i++)
+		assert(fido_dev_get_touch_status(dev, &touched, 50) == FIDO_OK);
+	assert(touched == 1);
+
+	for (int i = 0; i < NWAITERS; i++) {
+		assert(waitpid(pid[i], &status, 0) == pid[i]);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		close(go[i][0]);
+		close(go[i][1]);
+	}
+
+	assert(arb->norder == NWAITERS);
+	for (int i = 0; i < NWAITERS; i++)
+		assert(arb->order[i] == NWAITERS - 1 - i);
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	close(ready[0]);
+	close(ready[1]);
+}
+
+int
+main(void)
+{
+	fido_dev_t	*dev;
+	pid_t		 pid;
+	int		 master;
+	int		 slave;
+	int		 touched = 0;
+
+	if (softkey_open(&master, &slave, &path) < 0) {
+		warn("skipping: posix_openpt");
+		exit(0);
+	}
+
+	if ((arb = mmap(NULL, sizeof(*arb), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		err(1, "mmap");
+	arb->seen[0] = -1;
+	arb->seen[1] = -1;
+
+	if ((pid = fork()) < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		/* reads fail once the test is gone */
+		close(slave);
+		/* competitors are not waited for */
+		signal(SIGCHLD, SIG_IGN);
+		softkey_run(master, softkey_cb, NULL);
+		_exit(0);
+	}
+
+	fido_init(0);
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_arbitration(dev, true, -1) == FIDO_OK);
+
+	/* CTAPHID_INIT and authenticatorGetInfo */
+	assert(fido_dev_open(dev, path) == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+	assert(wait_seen(0) == 2);
+
+	/* held across polls that time out, until the touch is seen */
+	assert(fido_dev_get_touch_begin(dev) == FIDO_OK);
+	assert(fido_dev_set_arbitration(dev, false, -1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	for (int i = 0; touched == 0 && i < WAIT_MS / 50; i++)
+		assert(fido_dev_get_touch_status(dev, &touched, 50) == FIDO_OK);
+	assert(touched == 1);
+	assert(wait_seen(1) == 3);
+	assert(fido_dev_set_arbitration(dev, false, -1) == FIDO_OK);
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+
+	arrival_order();
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	close(slave);
+	close(master);
+
+	exit(0);
+}
@@ -4,10 +4,16 @@
  * license that can be found in the LICENSE file.
  */
 
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+
 #include <assert.h>
 #include <fido.h>
 #include <fido/es256.h>
 #include <fido/rs256.h>
+#include <stdio.h>
 #include <string.h>
 
 #define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
@@ -38,6 +44,11 @@ static const unsigned char authdata[39] = {
 	0x97, 0x63, 0x00, 0x00, 0x00, 0x00, 0x03,
 };
 
+static const unsigned char store_id[16] = {
+	0x6d, 0x0b, 0x93, 0x4e, 0xa8, 0x25, 0x39, 0xf1,
+	0x1c, 0x72, 0xd4, 0x86, 0x0f, 0x5e, 0xb3, 0x47,
+};
+
 static const unsigned char sig[72] = {
 	0x30, 0x46, 0x02, 0x21, 0x00, 0xf6, 0xd1, 0xa3,
 	0xd5, 0x24, 0x2b, 0xde, 0xee, 0xa0, 0x90, 0x89,
@@ -493,6 +504,388 @@ bad_cbor_serialize(void)
 	free_assert(a);
 }
 
+/* offset of 'needle' in 'buf', starting at 'off'; 'len' if not found */
+static size_t
+find(const unsigned char *buf, size_t len, const unsigned char *needle,
+    size_t needle_len, size_t off)
+{
+	for (; off + needle_len <= len; off++)
+		if (memcmp(buf + off, needle, needle_len) == 0)
+			return (off);
+
+	return (len);
+}
+
+/* export/import round trip */
+static void
+export_import(void)
+{
+	fido_assert_t *a, *b;
+	es256_pk_t *pk;
+	unsigned char *buf;
+	size_t len, n, off;
+
+	a = alloc_assert();
+	b = alloc_assert();
+	pk = alloc_es256_pk();
+	assert(es256_pk_from_ptr(pk, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_export(a, NULL, 0, &len) == FIDO_OK);
+	assert((buf = malloc(len)) != NULL);
+	assert(fido_assert_export(a, buf, len - 1,
+	    &n) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_export(a, buf, len, &n) == FIDO_OK && n == len);
+	assert(fido_assert_import(b, buf, len - 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_count(b) == 0);
+	assert(fido_assert_import(b, buf, len) == FIDO_OK);
+	assert(fido_assert_count(b) == 1);
+	assert(strcmp(fido_assert_rp_id(b), "localhost") == 0);
+	assert(fido_assert_authdata_len(b, 0) == sizeof(authdata));
+	assert(memcmp(fido_assert_authdata_ptr(b, 0), authdata,
+	    sizeof(authdata)) == 0);
+	assert(fido_assert_sigcount(b, 0) == fido_assert_sigcount(a, 0));
+	assert(fido_assert_flags(b, 0) == fido_assert_flags(a, 0));
+	assert(fido_assert_verify(b, 0, COSE_ES256, pk) == FIDO_OK);
+	/* the raw authdata is followed by its decoded copy */
+	off = find(buf, len, authdata, sizeof(authdata), 0);
+	assert(off < len);
+	buf[off + sizeof(authdata) - 1] ^= 0x01; /* raw sigcount */
+	assert(fido_assert_import(b, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_count(b) == 0);
+	buf[off + sizeof(authdata) - 1] ^= 0x01;
+	buf[off + sizeof(authdata) + 32] ^= 0x01; /* decoded flags */
+	assert(fido_assert_import(b, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	buf[off + sizeof(authdata) + 32] ^= 0x01;
+	assert(fido_assert_import(b, buf, len) == FIDO_OK);
+	buf[4] ^= 0xff;
+	assert(fido_assert_import(b, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_count(b) == 0);
+	free(buf);
+	free_assert(a);
+	free_assert(b);
+	free_es256_pk(pk);
+}
+
+/* extension outputs are taken from the raw authdata on import */
+static void
+export_import_ext(void)
+{
+	fido_assert_t *a, *b;
+	es256_pk_t *pk;
+	unsigned char ad[sizeof(authdata) + 15 + 32];
+	unsigned char *buf;
+	size_t len, n, off;
+
+	/* authdata, ED set, followed by {"hmac-secret": h'00...00'} */
+	memcpy(ad, authdata, sizeof(authdata));
+	ad[1] = (unsigned char)(sizeof(ad) - 2);
+	ad[2 + 32] |= 0x80;
+	memcpy(ad + sizeof(authdata), "\xa1\x6bhmac-secret\x58\x20", 15);
+	memset(ad + sizeof(authdata) + 15, 0, sizeof(ad) - sizeof(authdata) -
+	    15);
+
+	a = alloc_assert();
+	b = alloc_assert();
+	pk = alloc_es256_pk();
+	assert(es256_pk_from_ptr(pk, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, ad, sizeof(ad)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_export(a, NULL, 0, &len) == FIDO_OK);
+	assert((buf = malloc(len)) != NULL);
+	assert(fido_assert_export(a, buf, len, &n) == FIDO_OK && n == len);
+	/* hmac-secret not asked for, but present */
+	assert(fido_assert_import(b, buf, len) == FIDO_OK);
+	assert(fido_assert_verify(b, 0, COSE_ES256, pk) ==
+	    FIDO_ERR_INVALID_PARAM);
+	free(buf);
+	/* asked for, and present; the signature is over the original */
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_export(a, NULL, 0, &len) == FIDO_OK);
+	assert((buf = malloc(len)) != NULL);
+	assert(fido_assert_export(a, buf, len, &n) == FIDO_OK && n == len);
+	assert(fido_assert_import(b, buf, len) == FIDO_OK);
+	assert(fido_assert_verify(b, 0, COSE_ES256, pk) ==
+	    FIDO_ERR_INVALID_SIG);
+	/* a raw extension map that does not decode is rejected */
+	off = find(buf, len, ad, sizeof(ad), 0);
+	assert(off < len);
+	buf[off + sizeof(authdata)] = 0xff;
+	assert(fido_assert_import(b, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_count(b) == 0);
+	free(buf);
+	free_assert(a);
+	free_assert(b);
+	free_es256_pk(pk);
+}
+
+/* builds a store holding an es256 credential with id store_id */
+static fido_cred_store_t *
+alloc_store(const unsigned char *pk, uint32_t sigcount)
+{
+	static const unsigned char cose_key[] = {
+		0xa5, 0x01, 0x02, 0x03, 0x26, 0x20, 0x01, 0x21, 0x58, 0x20,
+	};
+	fido_cred_store_t *s;
+	fido_cred_t *c;
+	unsigned char cred_authdata[150];
+	unsigned char *p;
+
+	p = cred_authdata;
+	*p++ = 0x58;
+	*p++ = sizeof(cred_authdata) - 2;
+	memcpy(p, authdata + 2, 32); /* rp id hash */
+	p += 32;
+	*p++ = 0x41; /* up, at */
+	*p++ = (unsigned char)(sigcount >> 24);
+	*p++ = (unsigned char)(sigcount >> 16);
+	*p++ = (unsigned char)(sigcount >> 8);
+	*p++ = (unsigned char)sigcount;
+	memset(p, 0, 16); /* aaguid */
+	p += 16;
+	*p++ = 0;
+	*p++ = sizeof(store_id);
+	memcpy(p, store_id, sizeof(store_id));
+	p += sizeof(store_id);
+	memcpy(p, cose_key, sizeof(cose_key));
+	p += sizeof(cose_key);
+	memcpy(p, pk, 32);
+	p += 32;
+	*p++ = 0x22;
+	*p++ = 0x58;
+	*p++ = 0x20;
+	memcpy(p, pk + 32, 32);
+
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, cred_authdata,
+	    sizeof(cred_authdata)) == FIDO_OK);
+	assert((s = fido_cred_store_new()) != NULL);
+	assert(fido_cred_store_add(s, c) == FIDO_OK);
+	fido_cred_free(&c);
+
+	return (s);
+}
+
+static void
+free_store(fido_cred_store_t *s)
+{
+	fido_cred_store_free(&s);
+	assert(s == NULL);
+}
+
+static fido_assert_t *
+alloc_store_assert(const unsigned char *ad, const unsigned char *s,
+    size_t s_len, const unsigned char *id)
+{
+	fido_assert_t *a;
+
+	a = alloc_assert();
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, ad, sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, s, s_len) == FIDO_OK);
+	if (id != NULL)
+		assert(fido_assert_allow_cred(a, id,
+		    sizeof(store_id)) == FIDO_OK);
+
+	return (a);
+}
+
+static void
+verify_with_store(void)
+{
+	fido_assert_t *a;
+	fido_cred_store_t *s, *t;
+	const char *path = "regress_assert.store";
+	unsigned char junk[sizeof(store_id)];
+	unsigned char junk_sig[sizeof(sig)];
+
+	memcpy(junk, store_id, sizeof(store_id));
+	junk[0] ^= 0xff;
+	memcpy(junk_sig, sig, sizeof(sig));
+	junk_sig[sizeof(sig) - 1] ^= 0x01;
+	s = alloc_store(es256_pk, 0);
+	a = alloc_store_assert(authdata, sig, sizeof(sig), store_id);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 1,
+	    s) == FIDO_ERR_INVALID_ARGUMENT);
+	/* the mapped copy of the credential verifies the same statement */
+	assert(fido_cred_store_save(s, path) == FIDO_OK);
+	assert((t = fido_cred_store_new()) != NULL);
+	assert(fido_assert_verify_with_store(a, 0,
+	    t) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_cred_store_load(t, path) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0, t) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0, t) == FIDO_OK);
+	free_assert(a);
+	/* no credential id */
+	a = alloc_store_assert(authdata, sig, sizeof(sig), NULL);
+	assert(fido_assert_verify_with_store(a, 0,
+	    s) == FIDO_ERR_NO_CREDENTIALS);
+	free_assert(a);
+	/* unknown credential */
+	a = alloc_store_assert(authdata, sig, sizeof(sig), junk);
+	assert(fido_assert_verify_with_store(a, 0,
+	    s) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_assert_verify_with_store(a, 0,
+	    t) == FIDO_ERR_NO_CREDENTIALS);
+	free_assert(a);
+	/* bad signature */
+	a = alloc_store_assert(authdata, junk_sig, sizeof(junk_sig), store_id);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_ERR_INVALID_SIG);
+	assert(fido_assert_verify_with_store(a, 0, t) == FIDO_ERR_INVALID_SIG);
+	free_assert(a);
+	assert(remove(path) == 0);
+	free_store(s);
+	free_store(t);
+}
+
+/* signs the fixture statement with its counter set to sigcount */
+static fido_assert_t *
+alloc_signed_assert(EC_KEY *key, uint32_t sigcount)
+{
+	SHA256_CTX ctx;
+	unsigned char ad[sizeof(authdata)];
+	unsigned char dgst[SHA256_DIGEST_LENGTH];
+	unsigned char s[72];
+	unsigned int s_len = sizeof(s);
+
+	memcpy(ad, authdata, sizeof(ad));
+	ad[sizeof(ad) - 4] = (unsigned char)(sigcount >> 24);
+	ad[sizeof(ad) - 3] = (unsigned char)(sigcount >> 16);
+	ad[sizeof(ad) - 2] = (unsigned char)(sigcount >> 8);
+	ad[sizeof(ad) - 1] = (unsigned char)sigcount;
+	assert(SHA256_Init(&ctx) == 1);
+	assert(SHA256_Update(&ctx, ad + 2, sizeof(ad) - 2) == 1);
+	assert(SHA256_Update(&ctx, cdh, sizeof(cdh)) == 1);
+	assert(SHA256_Final(dgst, &ctx) == 1);
+	assert(ECDSA_size(key) <= (int)sizeof(s));
+	assert(ECDSA_sign(0, dgst, sizeof(dgst), s, &s_len, key) == 1);
+
+	return (alloc_store_assert(ad, s, s_len, store_id));
+}
+
+static void
+verify_sigcount(fido_cred_store_t *store, EC_KEY *key, uint32_t sigcount,
+    int r)
+{
+	fido_assert_t *a;
+
+	a = alloc_signed_assert(key, sigcount);
+	assert(fido_assert_verify_with_store(a, 0, store) == r);
+	free_assert(a);
+}
+
+static uint32_t
+store_sigcount(const fido_cred_store_t *store)
+{
+	uint32_t sigcount;
+
+	assert(fido_cred_store_lookup(store, store_id, sizeof(store_id), NULL,
+	    &sigcount) == FIDO_OK);
+
+	return (sigcount);
+}
+
+static void
+sigcount_tracking(void)
+{
+	fido_assert_t *a;
+	fido_cred_store_t *s, *t;
+	EC_KEY *key;
+	const char *path = "regress_assert.store";
+	unsigned char pk[65];
+
+	/* the fixture statement has a counter of 3 */
+	a = alloc_store_assert(authdata, sig, sizeof(sig), store_id);
+	s = alloc_store(es256_pk, 3);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_OK);
+	assert(fido_cred_store_set_sigcount_tracking(s, true) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0,
+	    s) == FIDO_ERR_INVALID_SIGCOUNT);
+	assert(store_sigcount(s) == 3);
+	free_store(s);
+	s = alloc_store(es256_pk, 4);
+	assert(fido_cred_store_set_sigcount_tracking(s, true) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0,
+	    s) == FIDO_ERR_INVALID_SIGCOUNT);
+	assert(store_sigcount(s) == 4);
+	free_store(s);
+	s = alloc_store(es256_pk, 2);
+	assert(fido_cred_store_set_sigcount_tracking(s, true) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_OK);
+	assert(store_sigcount(s) == 3);
+	assert(fido_assert_verify_with_store(a, 0,
+	    s) == FIDO_ERR_INVALID_SIGCOUNT);
+	assert(fido_cred_store_set_sigcount_tracking(s, false) == FIDO_OK);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_OK);
+	free_store(s);
+	free_assert(a);
+
+	/* statements with other counters are signed here */
+	assert((key = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)) != NULL);
+	assert(EC_KEY_generate_key(key) == 1);
+	assert(EC_POINT_point2oct(EC_KEY_get0_group(key),
+	    EC_KEY_get0_public_key(key), POINT_CONVERSION_UNCOMPRESSED, pk,
+	    sizeof(pk), NULL) == sizeof(pk));
+	s = alloc_store(pk + 1, 0);
+	assert(fido_cred_store_set_sigcount_tracking(s, true) == FIDO_OK);
+	/* zero is accepted until a counter is seen */
+	verify_sigcount(s, key, 0, FIDO_OK);
+	verify_sigcount(s, key, 0, FIDO_OK);
+	assert(store_sigcount(s) == 0);
+	verify_sigcount(s, key, 5, FIDO_OK);
+	assert(store_sigcount(s) == 5);
+	verify_sigcount(s, key, 0, FIDO_ERR_INVALID_SIGCOUNT);
+	verify_sigcount(s, key, 5, FIDO_ERR_INVALID_SIGCOUNT);
+	verify_sigcount(s, key, 4, FIDO_ERR_INVALID_SIGCOUNT);
+	/* a statement failing verification leaves the counter alone */
+	a = alloc_store_assert(authdata, sig, sizeof(sig), store_id);
+	assert(fido_assert_verify_with_store(a, 0, s) == FIDO_ERR_INVALID_SIG);
+	assert(store_sigcount(s) == 5);
+	free_assert(a);
+
+	/* counters seen in memory are saved */
+	assert(fido_cred_store_save(s, path) == FIDO_OK);
+	assert((t = fido_cred_store_new()) != NULL);
+	assert(fido_cred_store_set_sigcount_tracking(t, true) == FIDO_OK);
+	assert(fido_cred_store_load(t, path) == FIDO_OK);
+	assert(store_sigcount(t) == 5);
+	verify_sigcount(t, key, 0, FIDO_ERR_INVALID_SIGCOUNT);
+	verify_sigcount(t, key, 5, FIDO_ERR_INVALID_SIGCOUNT);
+	verify_sigcount(t, key, 6, FIDO_OK);
+	assert(store_sigcount(t) == 6);
+	assert(fido_cred_store_save(t, path) == FIDO_OK);
+	free_store(t);
+	assert((t = fido_cred_store_new()) != NULL);
+	assert(fido_cred_store_set_sigcount_tracking(t, true) == FIDO_OK);
+	assert(fido_cred_store_load(t, path) == FIDO_OK);
+	assert(store_sigcount(t) == 6);
+	verify_sigcount(t, key, 6, FIDO_ERR_INVALID_SIGCOUNT);
+	verify_sigcount(t, key, 7, FIDO_OK);
+	assert(remove(path) == 0);
+	free_store(s);
+	free_store(t);
+	EC_KEY_free(key);
+}
+
 int
 main(void)
 {
@@ -510,6 +903,10 @@ main(void)
 	junk_sig();
 	wrong_options();
 	bad_cbor_serialize();
+	export_import();
+	export_import_ext();
+	verify_with_store();
+	sigcount_tracking();
 
 	exit(0);
 }
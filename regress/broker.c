@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Device broker (fido_broker_new): a broker serves a pseudo-terminal that
+ * stands in for a hidraw node, answered by a minimal authenticator
+ * (softkey.c) on a thread, to clients set up with fido_dev_set_broker(). The pty is made
+ * known to the broker through a manifest function, which is internal to
+ * the library; the test is therefore linked against the static library.
+ *
+ * The authenticator logs what reaches it: a ping by its one-byte payload,
+ * authenticatorGetInfo as 'i'. The test checks that a client holding the
+ * device, for a library call or a CTAPHID_LOCK, is not interleaved with
+ * others; that a call stalled for longer than the hold timeout loses the
+ * device; that a client waiting for the device may cancel; and that a
+ * client going away hands the device back.
+ *
+ * Without a pseudo-terminal, or broker support, the test is skipped.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fido.h" /* with _FIDO_INTERNAL; see CMakeLists.txt */
+#include "softkey.h"
+
+#define WAIT_MS		5000
+#define NAP_MS		300
+#define HOLD_MS		1000
+
+/* versions: FIDO_2_0, aaguid: "regress-brokerkey" */
+static const unsigned char get_info_reply[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x03, 0x50, 0x72,
+	0x65, 0x67, 0x72, 0x65, 0x73, 0x73, 0x2d, 0x62,
+	0x72, 0x6f, 0x6b, 0x65, 0x72, 0x6b, 0x65, 0x79,
+};
+
+static struct softkey {
+	pthread_mutex_t	 lock;
+	char		 log[64]; /* what reached the authenticator */
+	size_t		 log_n;
+	const char	*path;
+} soft = {
+	PTHREAD_MUTEX_INITIALIZER, { 0 }, 0, NULL,
+};
+
+/* a client request run on a thread */
+struct client {
+	pthread_t	 thread;
+	fido_dev_t	*dev;
+	unsigned char	 tag;
+	int		 r;
+	int		 done;
+};
+
+static void
+soft_log(char c)
+{
+	pthread_mutex_lock(&soft.lock);
+	assert(soft.log_n < sizeof(soft.log) - 1);
+	soft.log[soft.log_n++] = c;
+	pthread_mutex_unlock(&soft.lock);
+}
+
+/* the log so far must be 'v'; start afresh */
+static void
+soft_expect(const char *v)
+{
+	pthread_mutex_lock(&soft.lock);
+	if (strcmp(soft.log, v) != 0)
+		errx(1, "log \"%s\", expected \"%s\"", soft.log, v);
+	memset(soft.log, 0, sizeof(soft.log));
+	soft.log_n = 0;
+	pthread_mutex_unlock(&soft.lock);
+}
+
+/* answer CTAPHID_INIT, single-frame pings, and authenticatorGetInfo */
+static void
+softkey_cb(void *arg, int fd, uint32_t cid, uint8_t cmd,
+    const unsigned char *ptr, size_t len)
+{
+	(void)arg;
+
+	switch (cmd) {
+	case SOFTKEY_CMD_INIT:
+		softkey_init(fd, cid, ptr);
+		break;
+	case SOFTKEY_CMD_PING:
+		assert(len == 1);
+		soft_log((char)ptr[0]);
+		softkey_reply(fd, cid, SOFTKEY_CMD_PING, ptr, len);
+		break;
+	case SOFTKEY_CMD_CBOR:
+		assert(len == 1 && ptr[0] == CTAP_CBOR_GETINFO);
+		soft_log('i');
+		softkey_reply(fd, cid, SOFTKEY_CMD_CBOR, get_info_reply,
+		    sizeof(get_info_reply));
+		break;
+	case SOFTKEY_CMD_CANCEL:
+		soft_log('c');
+		break;
+	default:
+		errx(1, "unexpected cmd 0x%02x", cmd);
+	}
+}
+
+/* until the pty is closed */
+static void *
+softkey_thread_run(void *arg)
+{
+	softkey_run(*(int *)arg, softkey_cb, NULL);
+
+	return (NULL);
+}
+
+static int
+softkey_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	const fido_dev_io_t io = {
+		fido_hid_open,
+		fido_hid_close,
+		fido_hid_read,
+		fido_hid_write,
+	};
+	int r;
+
+	*olen = 0;
+
+	if (ilen == 0)
+		return (FIDO_OK);
+
+	if ((r = fido_dev_info_set(devlist, 0, soft.path, "regress",
+	    "broker", &io, NULL)) == FIDO_OK)
+		*olen = 1;
+
+	return (r);
+}
+
+static void *
+broker_run(void *arg)
+{
+	assert(fido_broker_run(arg) == FIDO_OK);
+
+	return (NULL);
+}
+
+static fido_dev_t *
+client_new(const char *sockpath)
+{
+	fido_dev_t *dev;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_broker(dev, sockpath) == FIDO_OK);
+	assert(fido_dev_open(dev, soft.path) == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+
+	return (dev);
+}
+
+static void
+client_free(fido_dev_t *dev)
+{
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static void *
+client_ping(void *arg)
+{
+	struct client *c = arg;
+
+	c->r = fido_dev_ping(c->dev, &c->tag, 1);
+	__atomic_store_n(&c->done, 1, __ATOMIC_SEQ_CST);
+
+	return (NULL);
+}
+
+static void *
+client_info(void *arg)
+{
+	struct client		*c = arg;
+	fido_cbor_info_t	*ci;
+
+	assert((ci = fido_cbor_info_new()) != NULL);
+	c->r = fido_dev_get_cbor_info(c->dev, ci);
+	fido_cbor_info_free(&ci);
+	__atomic_store_n(&c->done, 1, __ATOMIC_SEQ_CST);
+
+	return (NULL);
+}
+
+/* start a request that must wait for the device */
+static void
+client_start(struct client *c, fido_dev_t *dev, void *(*f)(void *),
+    unsigned char tag)
+{
+	struct timespec ts;
+
+	memset(c, 0, sizeof(*c));
+	c->dev = dev;
+	c->tag = tag;
+	c->r = -1;
+
+	assert(pthread_create(&c->thread, NULL, f, c) == 0);
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = NAP_MS * 1000000L;
+	nanosleep(&ts, NULL);
+
+	assert(__atomic_load_n(&c->done, __ATOMIC_SEQ_CST) == 0);
+}
+
+static int
+client_join(struct client *c)
+{
+	assert(pthread_join(c->thread, NULL) == 0);
+	assert(c->done);
+
+	return (c->r);
+}
+
+static int
+elapsed_ms(const struct timespec *ts_start)
+{
+	struct timespec ts_now;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts_now) == 0);
+
+	return ((int)((ts_now.tv_sec - ts_start->tv_sec) * 1000 +
+	    (ts_now.tv_nsec - ts_start->tv_nsec) / 1000000L));
+}
+
+/* the device is opened once; unknown paths are refused */
+static void
+open_iff_known(const char *sockpath)
+{
+	fido_dev_t *a;
+	fido_dev_t *b;
+	fido_dev_t *c;
+
+	/* the broker's own authenticatorGetInfo, then the clients' */
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("iii");
+
+	assert((c = fido_dev_new()) != NULL);
+	assert(fido_dev_set_broker(c, sockpath) == FIDO_OK);
+	assert(fido_dev_open(c, "/nonexistent") != FIDO_OK);
+	fido_dev_free(&c);
+
+	assert(fido_dev_ping(a, (const unsigned char *)"a", 1) == FIDO_OK);
+	assert(fido_dev_ping(b, (const unsigned char *)"b", 1) == FIDO_OK);
+	soft_expect("ab");
+
+	client_free(a);
+	client_free(b);
+}
+
+/* a library call is not interleaved with other clients' requests */
+static void
+hold_iff_call(const char *sockpath)
+{
+	struct client	 c;
+	fido_dev_t	*a;
+	fido_dev_t	*b;
+
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("ii");
+
+	assert(fido_tx_hold(a) == 0);
+	assert(fido_dev_ping(a, (const unsigned char *)"1", 1) == FIDO_OK);
+	client_start(&c, b, client_ping, 'b');
+	assert(fido_dev_ping(a, (const unsigned char *)"2", 1) == FIDO_OK);
+	fido_tx_release(a);
+	assert(client_join(&c) == FIDO_OK);
+	soft_expect("12b");
+
+	client_free(a);
+	client_free(b);
+}
+
+/*
+ * a call stalled for longer than the hold timeout loses the device, and
+ * the rest of it fails; the client's next call goes through
+ */
+static void
+hold_iff_recent(const char *sockpath)
+{
+	struct client	 c;
+	struct timespec	 ts;
+	fido_dev_t	*a;
+	fido_dev_t	*b;
+
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("ii");
+
+	assert(fido_tx_hold(a) == 0);
+	assert(fido_dev_ping(a, (const unsigned char *)"1", 1) == FIDO_OK);
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	client_start(&c, b, client_ping, 'b');
+	assert(client_join(&c) == FIDO_OK);
+	assert(elapsed_ms(&ts) >= HOLD_MS / 2 && elapsed_ms(&ts) < WAIT_MS);
+	assert(fido_dev_ping(a, (const unsigned char *)"2", 1) == FIDO_ERR_TX);
+	assert(fido_dev_ping(a, (const unsigned char *)"3", 1) == FIDO_ERR_TX);
+	fido_tx_release(a);
+	soft_expect("1b");
+
+	assert(fido_dev_ping(a, (const unsigned char *)"a", 1) == FIDO_OK);
+	soft_expect("a");
+
+	client_free(a);
+	client_free(b);
+}
+
+/* CTAPHID_LOCK holds the device until released, or it expires */
+static void
+lock_iff_held(const char *sockpath)
+{
+	struct client	 c;
+	struct timespec	 ts;
+	fido_dev_t	*a;
+	fido_dev_t	*b;
+
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("ii");
+
+	assert(fido_dev_lock(a, 10) == FIDO_OK);
+	client_start(&c, b, client_ping, 'b');
+	assert(fido_dev_ping(a, (const unsigned char *)"a", 1) == FIDO_OK);
+	assert(fido_dev_unlock(a) == FIDO_OK);
+	assert(client_join(&c) == FIDO_OK);
+	soft_expect("ab");
+
+	assert(fido_dev_lock(a, 1) == FIDO_OK);
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	assert(fido_dev_ping(b, (const unsigned char *)"b", 1) == FIDO_OK);
+	assert(elapsed_ms(&ts) >= 500 && elapsed_ms(&ts) < WAIT_MS);
+	soft_expect("b");
+
+	client_free(a);
+	client_free(b);
+}
+
+/* a client waiting for the device may cancel; nothing reaches it */
+static void
+cancel_iff_waiting(const char *sockpath)
+{
+	struct client	 c;
+	fido_dev_t	*a;
+	fido_dev_t	*b;
+
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("ii");
+
+	assert(fido_dev_lock(a, 10) == FIDO_OK);
+	client_start(&c, b, client_info, 0);
+	assert(fido_dev_cancel(b) == FIDO_OK);
+	assert(client_join(&c) == FIDO_ERR_KEEPALIVE_CANCEL);
+	soft_expect("");
+
+	/* and may go on once the device is free */
+	assert(fido_dev_unlock(a) == FIDO_OK);
+	assert(fido_dev_ping(b, (const unsigned char *)"b", 1) == FIDO_OK);
+	soft_expect("b");
+
+	client_free(a);
+	client_free(b);
+}
+
+/* a client going away hands the device back, lock and all */
+static void
+disconnect_iff_released(const char *sockpath)
+{
+	struct client	 c;
+	fido_dev_t	*a;
+	fido_dev_t	*b;
+	pid_t		 pid;
+	int		 fd[2];
+	char		 x;
+
+	a = client_new(sockpath);
+	b = client_new(sockpath);
+	soft_expect("ii");
+
+	assert(fido_dev_lock(a, 10) == FIDO_OK);
+	client_start(&c, b, client_ping, 'b');
+	client_free(a);
+	assert(client_join(&c) == FIDO_OK);
+	soft_expect("b");
+
+	/* mid-call, without a word */
+	if (pipe(fd) < 0 || (pid = fork()) < 0)
+		err(1, "pipe/fork");
+	if (pid == 0) {
+		a = client_new(sockpath);
+		assert(fido_tx_hold(a) == 0);
+		assert(fido_dev_ping(a, (const unsigned char *)"a", 1) ==
+		    FIDO_OK);
+		if (write(fd[1], "", 1) != 1)
+			_exit(1);
+		pause();
+		_exit(0);
+	}
+	assert(read(fd[0], &x, 1) == 1);
+	client_start(&c, b, client_ping, 'b');
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	assert(client_join(&c) == FIDO_OK);
+	soft_expect("iab");
+	close(fd[0]);
+	close(fd[1]);
+
+	client_free(b);
+}
+
+int
+main(void)
+{
+	fido_broker_t	*broker;
+	pthread_t	 broker_thread;
+	pthread_t	 softkey_thread;
+	char		 dir[] = "/tmp/regress_broker.XXXXXX";
+	char		 sockpath[64];
+	int		 master;
+	int		 slave;
+
+	fido_init(0);
+
+	if ((broker = fido_broker_new()) == NULL) {
+		warnx("skipping: fido_broker_new");
+		exit(0);
+	}
+
+	if (softkey_open(&master, &slave, &soft.path) < 0) {
+		warn("skipping: posix_openpt");
+		exit(0);
+	}
+
+	assert(pthread_create(&softkey_thread, NULL, softkey_thread_run,
+	    &master) == 0);
+
+	/* ahead of the hid manifest */
+	assert(fido_dev_register_manifest_func(fido_hid_manifest) == FIDO_OK);
+	assert(fido_dev_register_manifest_func(softkey_manifest) == FIDO_OK);
+
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp");
+	assert((size_t)snprintf(sockpath, sizeof(sockpath), "%s/sock",
+	    dir) < sizeof(sockpath));
+	assert(fido_broker_set_hold_timeout(broker, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_broker_set_hold_timeout(broker, HOLD_MS) == FIDO_OK);
+	assert(fido_broker_listen(broker, sockpath) == FIDO_OK);
+	assert(pthread_create(&broker_thread, NULL, broker_run, broker) == 0);
+
+	open_iff_known(sockpath);
+	hold_iff_call(sockpath);
+	hold_iff_recent(sockpath);
+	lock_iff_held(sockpath);
+	cancel_iff_waiting(sockpath);
+	disconnect_iff_released(sockpath);
+
+	assert(fido_broker_stop(broker) == FIDO_OK);
+	assert(pthread_join(broker_thread, NULL) == 0);
+	fido_broker_free(&broker);
+	rmdir(dir);
+
+	/* the authenticator stops once the pty is closed */
+	close(slave);
+	assert(pthread_join(softkey_thread, NULL) == 0);
+	close(master);
+
+	exit(0);
+}
@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <fido.h>
+#include <stdio.h>
 #include <string.h>
 
 #define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
@@ -866,6 +867,331 @@ wrong_credprot(void)
 	free_cred(c);
 }
 
+/* offset of 'needle' in 'buf', starting at 'off'; 'len' if not found */
+static size_t
+find(const unsigned char *buf, size_t len, const unsigned char *needle,
+    size_t needle_len, size_t off)
+{
+	for (; off + needle_len <= len; off++)
+		if (memcmp(buf + off, needle, needle_len) == 0)
+			return (off);
+
+	return (len);
+}
+
+/* export/import round trip */
+static void
+export_import(void)
+{
+	fido_cred_t *c, *d;
+	unsigned char *buf;
+	size_t len, n, off;
+
+	c = alloc_cred();
+	d = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509(c, x509, sizeof(x509)) == FIDO_OK);
+	assert(fido_cred_set_sig(c, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_export(c, NULL, 0, &len) == FIDO_OK);
+	assert((buf = malloc(len)) != NULL);
+	assert(fido_cred_export(c, buf, len, &n) == FIDO_OK && n == len);
+	assert(fido_cred_import(d, buf, len) == FIDO_OK);
+	assert(fido_cred_verify(d) == FIDO_OK);
+	assert(strcmp(fido_cred_fmt(d), "packed") == 0);
+	assert(strcmp(fido_cred_rp_id(d), rp_id) == 0);
+	assert(fido_cred_pubkey_len(d) == sizeof(pubkey));
+	assert(memcmp(fido_cred_pubkey_ptr(d), pubkey, sizeof(pubkey)) == 0);
+	assert(fido_cred_id_len(d) == sizeof(id));
+	assert(memcmp(fido_cred_id_ptr(d), id, sizeof(id)) == 0);
+	assert(fido_cred_aaguid_len(d) == sizeof(aaguid));
+	assert(memcmp(fido_cred_aaguid_ptr(d), aaguid, sizeof(aaguid)) == 0);
+	/* the decoded credential id and key must match the raw authdata */
+	off = find(buf, len, id, sizeof(id), 0);
+	assert(off < len);
+	off = find(buf, len, id, sizeof(id), off + sizeof(id));
+	assert(off < len);
+	buf[off] ^= 0x01;
+	assert(fido_cred_import(d, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_id_len(d) == 0);
+	buf[off] ^= 0x01;
+	off = find(buf, len, pubkey, sizeof(pubkey), 0);
+	assert(off < len);
+	buf[off] ^= 0x01;
+	assert(fido_cred_import(d, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	buf[off] ^= 0x01;
+	assert(fido_cred_import(d, buf, len) == FIDO_OK);
+	assert(fido_cred_import(d, buf, len - 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_id_len(d) == 0);
+	free(buf);
+	free_cred(c);
+	free_cred(d);
+}
+
+/* extension outputs are taken from the raw authdata on import */
+static void
+export_import_ext(void)
+{
+	fido_cred_t *c, *d;
+	unsigned char ad[sizeof(authdata) + 14];
+	unsigned char *buf;
+	size_t len, n, off;
+
+	/* authdata, ED set, followed by {"credProtect": 2} */
+	memcpy(ad, authdata, sizeof(authdata));
+	ad[1] = (unsigned char)(sizeof(ad) - 2);
+	ad[2 + 32] |= 0x80;
+	memcpy(ad + sizeof(authdata), "\xa1\x6b" "credProtect" "\x02", 14);
+
+	c = alloc_cred();
+	d = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, ad, sizeof(ad)) == FIDO_OK);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509(c, x509, sizeof(x509)) == FIDO_OK);
+	assert(fido_cred_set_sig(c, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_set_prot(c, FIDO_CRED_PROT_UV_OPTIONAL_WITH_ID) ==
+	    FIDO_OK);
+	assert(fido_cred_export(c, NULL, 0, &len) == FIDO_OK);
+	assert((buf = malloc(len)) != NULL);
+	assert(fido_cred_export(c, buf, len, &n) == FIDO_OK && n == len);
+	/* as asked for; the signature is over the original authdata */
+	assert(fido_cred_import(d, buf, len) == FIDO_OK);
+	assert(fido_cred_prot(d) == FIDO_CRED_PROT_UV_OPTIONAL_WITH_ID);
+	assert(fido_cred_verify(d) == FIDO_ERR_INVALID_SIG);
+	/* a different credProtect in the raw authdata is noticed */
+	off = find(buf, len, ad, sizeof(ad), 0);
+	assert(off < len);
+	buf[off + sizeof(ad) - 1] = FIDO_CRED_PROT_UV_REQUIRED;
+	assert(fido_cred_import(d, buf, len) == FIDO_OK);
+	assert(fido_cred_verify(d) == FIDO_ERR_INVALID_PARAM);
+	/* as is a raw extension map that does not decode */
+	buf[off + sizeof(authdata)] = 0xff;
+	assert(fido_cred_import(d, buf, len) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_id_len(d) == 0);
+	free(buf);
+	free_cred(c);
+	free_cred(d);
+}
+
+static void
+cred_store(void)
+{
+	fido_cred_store_t *s, *t;
+	fido_cred_t *c;
+	const char *path = "regress_cred.store";
+	unsigned char junk[sizeof(id)];
+	uint32_t sigcount;
+	int type;
+
+	c = alloc_cred();
+	assert((s = fido_cred_store_new()) != NULL);
+	assert((t = fido_cred_store_new()) != NULL);
+	memcpy(junk, id, sizeof(id));
+	junk[0] ^= 0xff;
+	assert(fido_cred_store_add(s, c) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_store_add(s, c) == FIDO_OK);
+	assert(fido_cred_store_add(s, c) == FIDO_OK);
+	assert(fido_cred_store_lookup(s, id, sizeof(id), &type,
+	    &sigcount) == FIDO_OK);
+	assert(type == COSE_ES256 && sigcount == 0);
+	assert(fido_cred_store_lookup(s, junk, sizeof(junk), &type,
+	    &sigcount) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_cred_store_save(s, path) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_cred_store_set_sigcount_tracking(t, true) == FIDO_OK);
+	assert(fido_cred_store_load(t, path) == FIDO_OK);
+	type = 0;
+	sigcount = 1;
+	assert(fido_cred_store_lookup(t, id, sizeof(id), &type,
+	    &sigcount) == FIDO_OK);
+	assert(type == COSE_ES256 && sigcount == 0);
+	assert(fido_cred_store_lookup(t, junk, sizeof(junk), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	/* saving a loaded store carries its credentials over */
+	assert(fido_cred_store_save(t, path) == FIDO_OK);
+	assert(fido_cred_store_load(t, path) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_OK);
+	assert(fido_cred_store_load(t, "regress_cred.missing") ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(remove(path) == 0);
+	fido_cred_store_free(&s);
+	fido_cred_store_free(&t);
+	assert(s == NULL && t == NULL);
+	free_cred(c);
+}
+
+static uint32_t
+get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+static void
+put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static unsigned char *
+read_file(const char *path, size_t *len)
+{
+	FILE *f;
+	unsigned char *buf;
+	long n;
+
+	assert((f = fopen(path, "rb")) != NULL);
+	assert(fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0);
+	rewind(f);
+	assert((buf = malloc((size_t)n)) != NULL);
+	assert(fread(buf, 1, (size_t)n, f) == (size_t)n);
+	assert(fclose(f) == 0);
+	*len = (size_t)n;
+
+	return (buf);
+}
+
+static int
+load_copy(fido_cred_store_t *store, const unsigned char *buf, size_t len)
+{
+	const char *path = "regress_cred.copy";
+	FILE *f;
+	int r;
+
+	assert((f = fopen(path, "wb")) != NULL);
+	assert(fwrite(buf, 1, len, f) == len);
+	assert(fclose(f) == 0);
+	r = fido_cred_store_load(store, path);
+	assert(remove(path) == 0);
+
+	return (r);
+}
+
+static void
+cred_store_corrupt(void)
+{
+	fido_cred_store_t *s, *t;
+	fido_cred_t *c;
+	const char *path = "regress_cred.store";
+	unsigned char *buf, *p;
+	size_t len, e;
+	uint32_t nbuckets;
+
+	c = alloc_cred();
+	assert((s = fido_cred_store_new()) != NULL);
+	assert((t = fido_cred_store_new()) != NULL);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_store_add(s, c) == FIDO_OK);
+	assert(fido_cred_store_save(s, path) == FIDO_OK);
+	buf = read_file(path, &len);
+	assert(remove(path) == 0);
+	assert((p = malloc(len)) != NULL);
+	/* header, buckets, a single entry, its id */
+	nbuckets = get_be32(buf + 12);
+	e = 32 + (size_t)nbuckets * 4;
+	assert(get_be32(buf + 16) == 1);
+	assert(len == e + 24 + 264 + sizeof(id));
+	memcpy(p, buf, len);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_OK);
+	/* truncated */
+	assert(load_copy(t, p, len - 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(load_copy(t, p, e) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(load_copy(t, p, 16) == FIDO_ERR_INVALID_ARGUMENT);
+	/* invalid header */
+	p[0] ^= 0xff;
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	p[4]++;
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	put_be32(p + 12, nbuckets / 2);
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	put_be32(p + 12, nbuckets + 1);
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	put_be32(p + 16, nbuckets);
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	put_be32(p + 20, sizeof(id) + 1);
+	assert(load_copy(t, p, len) == FIDO_ERR_INVALID_ARGUMENT);
+	/* bucket pointing past the last entry */
+	memcpy(p, buf, len);
+	for (size_t i = 0; i < nbuckets; i++)
+		if (get_be32(p + 32 + i * 4) != 0)
+			put_be32(p + 32 + i * 4, 2);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	/* id out of range */
+	memcpy(p, buf, len);
+	put_be32(p + e + 12, 1);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	memcpy(p, buf, len);
+	put_be32(p + e + 12, UINT32_MAX);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	memcpy(p, buf, len);
+	put_be32(p + e + 16, sizeof(id) + 1);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	/* key length or type not matching */
+	memcpy(p, buf, len);
+	put_be32(p + e + 20, 63);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	memcpy(p, buf, len);
+	put_be32(p + e + 20, 265);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_cred_store_save(t, path) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(p, buf, len);
+	put_be32(p + e + 4, (uint32_t)COSE_RS256);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	memcpy(p, buf, len);
+	put_be32(p + e + 4, 0);
+	assert(load_copy(t, p, len) == FIDO_OK);
+	assert(fido_cred_store_lookup(t, id, sizeof(id), NULL,
+	    NULL) == FIDO_ERR_NO_CREDENTIALS);
+	free(buf);
+	free(p);
+	fido_cred_store_free(&s);
+	fido_cred_store_free(&t);
+	free_cred(c);
+}
+
 int
 main(void)
 {
@@ -892,6 +1218,10 @@ main(void)
 	duplicate_keys();
 	unsorted_keys();
 	wrong_credprot();
+	export_import();
+	export_import_ext();
+	cred_store();
+	cred_store_corrupt();
 
 	exit(0);
 }
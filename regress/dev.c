@@ -4,9 +4,20 @@
  * license that can be found in the LICENSE file.
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+
 #include <assert.h>
 #include <fido.h>
+#include <fido/bio.h>
+#include <fido/credman.h>
+#include <poll.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
 #define REPORT_LEN	(64 + 1)
@@ -47,6 +58,636 @@ dummy_write(void *handle, const unsigned char *ptr, size_t len)
 	return ((int)len);
 }
 
+/*
+ * fake authenticator handing out a new channel per CTAPHID_INIT, after
+ * replying ERR_CHANNEL_BUSY to the first 'fake_busy' requests; if
+ * 'fake_mute' is set, the next request goes unanswered
+ */
+static unsigned char	fake_reply[REPORT_LEN - 1];
+static bool		fake_pending;
+static bool		fake_mute;
+static uint32_t		fake_last_cid;
+static int		fake_busy;
+
+/* CTAPHID_INIT reply to the request in 'ptr', handing out 'cid' */
+static void
+fake_init_reply(unsigned char *reply, const unsigned char *ptr, uint32_t cid)
+{
+	memset(reply, 0, REPORT_LEN - 1);
+	memcpy(reply, ptr + 1, 4 + 1);			/* cid, cmd */
+	reply[6] = 17;					/* bcnt */
+	memcpy(reply + 7, ptr + 8, 8);			/* nonce */
+	memcpy(reply + 15, &cid, sizeof(cid));		/* new cid */
+	reply[19] = 2;					/* protocol */
+}
+
+static int
+fake_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	(void)ms;
+
+	assert(handle == FAKE_DEV_HANDLE);
+	assert(len == sizeof(fake_reply));
+
+	if (fake_pending == false)
+		return (-1);
+
+	memcpy(ptr, fake_reply, len);
+	fake_pending = false;
+
+	return ((int)len);
+}
+
+static int
+fake_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	uint32_t cid;
+
+	assert(handle == FAKE_DEV_HANDLE);
+	assert(len == REPORT_LEN);
+	assert(fake_pending == false);
+
+	if (fake_mute) {
+		fake_mute = false;
+		return ((int)len);
+	}
+
+	assert(memcmp(ptr + 1, "\xff\xff\xff\xff\x86\x00\x08", 7) == 0);
+
+	memset(fake_reply, 0, sizeof(fake_reply));
+	fake_pending = true;
+
+	if (fake_busy > 0) {
+		fake_busy--;
+		memcpy(fake_reply, ptr + 1, 4);		/* cid */
+		fake_reply[4] = 0xbf;			/* CTAPHID_ERROR */
+		fake_reply[6] = 1;			/* bcnt */
+		fake_reply[7] = FIDO_ERR_CHANNEL_BUSY;
+		return ((int)len);
+	}
+
+	cid = ++fake_last_cid;
+	fake_init_reply(fake_reply, ptr, cid);
+
+	return ((int)len);
+}
+
+/*
+ * independent fake authenticators for fido_dev_open_many(), opened by
+ * index; a mute one never replies
+ */
+struct fake_dev {
+	unsigned char	reply[REPORT_LEN - 1];
+	bool		pending;
+	bool		mute;
+};
+
+static struct fake_dev	fake_dev[3];
+
+static void *
+many_open(const char *path)
+{
+	size_t idx = (size_t)(path[0] - '0');
+
+	assert(idx < sizeof(fake_dev) / sizeof(fake_dev[0]));
+
+	return (&fake_dev[idx]);
+}
+
+static void
+many_close(void *handle)
+{
+	(void)handle;
+}
+
+static int
+many_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	struct fake_dev *fd = handle;
+
+	assert(len == sizeof(fd->reply));
+
+	if (fd->pending == false) {
+		/* a mute device mustn't be waited on forever */
+		assert(ms >= 0);
+		return (-1);
+	}
+
+	memcpy(ptr, fd->reply, len);
+	fd->pending = false;
+
+	return ((int)len);
+}
+
+static int
+many_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	struct fake_dev *fd = handle;
+
+	assert(len == REPORT_LEN);
+	assert(memcmp(ptr + 1, "\xff\xff\xff\xff\x86\x00\x08", 7) == 0);
+
+	if (fd->mute == false) {
+		fake_init_reply(fd->reply, ptr, (uint32_t)(fd - fake_dev) + 1);
+		fd->pending = true;
+	}
+
+	return ((int)len);
+}
+
+/*
+ * A software authenticator for tests that need complete operations.
+ * Requests are reassembled from the reports written to it, and logged;
+ * authenticator (CTAPHID_CBOR) commands are passed to 'soft.cbor', if
+ * set, which may answer them, leave them unanswered, or fall back to
+ * the defaults: authenticatorGetInfo, and the clientPin key agreement
+ * and pinToken exchanges.
+ */
+#define SOFT_MAXMSG	2048
+#define SOFT_MAXLOG	64
+#define SOFT_REPLY	0	/* reply with what the handler wrote */
+#define SOFT_MUTE	1	/* hold the request; see soft_msg() */
+#define SOFT_DEFAULT	2	/* use the default handler */
+
+struct soft_msg {
+	uint8_t	cmd;	/* CTAPHID command */
+	uint8_t	op;	/* CTAPHID_CBOR: authenticator command */
+	int	sub;	/* subcommand, or CTAPHID_LOCK seconds; -1 if none */
+};
+
+typedef int soft_cbor_t(const struct soft_msg *, const unsigned char *,
+    size_t, unsigned char *, size_t *);
+
+static struct {
+	soft_cbor_t	*cbor;
+	uint8_t		 caps;
+	bool		 no_lock;
+	int		 ping_mangle; /* 1: flip a bit, 2: drop a byte */
+	bool		 wait;	/* reads block until there is a reply */
+	bool		 held;	/* a cbor request awaits its reply */
+	/* keepalive statuses sent ahead of the next cbor reply */
+	const unsigned char *keepalive;
+	size_t		 keepalive_n;
+	/* request being reassembled */
+	unsigned char	 req[SOFT_MAXMSG];
+	unsigned char	 req_cid[4];
+	uint8_t		 req_cmd;
+	size_t		 req_len;
+	size_t		 req_got;
+	/* reply reports, read in order */
+	unsigned char	 rep[SOFT_MAXMSG / 59 + 2][REPORT_LEN - 1];
+	size_t		 rep_n;
+	size_t		 rep_next;
+	/* requests seen */
+	struct soft_msg	 log[SOFT_MAXLOG];
+	size_t		 log_n;
+} soft;
+
+#ifdef HAVE_PTHREAD
+/* taken by soft_read() and soft_write(), which may run on other threads */
+static pthread_mutex_t	soft_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	soft_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/* P-256 generator, as the authenticator's key agreement key */
+static const unsigned char soft_key_agreement[] = {
+	0x00, 0xa1, 0x01, 0xa5, 0x01, 0x02, 0x03, 0x38,
+	0x18, 0x20, 0x01, 0x21, 0x58, 0x20, 0x6b, 0x17,
+	0xd1, 0xf2, 0xe1, 0x2c, 0x42, 0x47, 0xf8, 0xbc,
+	0xe6, 0xe5, 0x63, 0xa4, 0x40, 0xf2, 0x77, 0x03,
+	0x7d, 0x81, 0x2d, 0xeb, 0x33, 0xa0, 0xf4, 0xa1,
+	0x39, 0x45, 0xd8, 0x98, 0xc2, 0x96, 0x22, 0x58,
+	0x20, 0x4f, 0xe3, 0x42, 0xe2, 0xfe, 0x1a, 0x7f,
+	0x9b, 0x8e, 0xe7, 0xeb, 0x4a, 0x7c, 0x0f, 0x9e,
+	0x16, 0x2b, 0xce, 0x33, 0x57, 0x6b, 0x31, 0x5e,
+	0xce, 0xcb, 0xb6, 0x40, 0x68, 0x37, 0xbf, 0x51,
+	0xf5,
+};
+
+/* an encrypted pinToken; we never check what it is used for */
+static const unsigned char soft_pin_token[] = {
+	0x00, 0xa1, 0x02, 0x58, 0x20, 0x01, 0x02, 0x03,
+	0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+	0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13,
+	0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+	0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+};
+
+/* versions: FIDO_2_0, aaguid: "regress-softkey!" */
+static const unsigned char soft_info[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x03, 0x50, 0x72,
+	0x65, 0x67, 0x72, 0x65, 0x73, 0x73, 0x2d, 0x73,
+	0x6f, 0x66, 0x74, 0x6b, 0x65, 0x79, 0x21,
+};
+
+static void
+soft_lock(void)
+{
+#ifdef HAVE_PTHREAD
+	assert(pthread_mutex_lock(&soft_mutex) == 0);
+#endif
+}
+
+static void
+soft_unlock(void)
+{
+#ifdef HAVE_PTHREAD
+	assert(pthread_cond_broadcast(&soft_cond) == 0);
+	assert(pthread_mutex_unlock(&soft_mutex) == 0);
+#endif
+}
+
+static void
+soft_reset(void)
+{
+	memset(&soft, 0, sizeof(soft));
+	soft.caps = 0x05; /* cbor, wink */
+}
+
+/* value of 'key' among the leading small-int entries of a cbor map */
+static int
+soft_arg(const unsigned char *ptr, size_t len, uint8_t key)
+{
+	if (len < 1 || (ptr[0] & 0xe0) != 0xa0)
+		return (-1);
+
+	for (size_t i = 1; i + 1 < len && ptr[i] < 0x18 &&
+	    ptr[i + 1] < 0x18; i += 2)
+		if (ptr[i] == key)
+			return (ptr[i + 1]);
+
+	return (-1);
+}
+
+static void
+soft_reply(uint8_t cmd, const unsigned char *ptr, size_t len)
+{
+	unsigned char	*frame;
+	size_t		 n;
+	uint8_t		 seq = 0;
+
+	/* a reply nobody read is gone */
+	soft.rep_n = soft.rep_next = 0;
+
+	frame = soft.rep[soft.rep_n++];
+	memset(frame, 0, REPORT_LEN - 1);
+	memcpy(frame, soft.req_cid, 4);
+	frame[4] = cmd | 0x80;
+	frame[5] = (unsigned char)(len >> 8);
+	frame[6] = (unsigned char)len;
+	memcpy(frame + 7, ptr, (n = len < 57 ? len : 57));
+
+	for (ptr += n, len -= n; len > 0; ptr += n, len -= n) {
+		assert(soft.rep_n < sizeof(soft.rep) / sizeof(soft.rep[0]));
+		frame = soft.rep[soft.rep_n++];
+		memset(frame, 0, REPORT_LEN - 1);
+		memcpy(frame, soft.req_cid, 4);
+		frame[4] = seq++;
+		memcpy(frame + 5, ptr, (n = len < 59 ? len : 59));
+	}
+}
+
+/* put the keepalive frames in 'soft.keepalive' ahead of the reply */
+static void
+soft_keepalive(void)
+{
+	unsigned char *frame;
+
+	assert(soft.rep_n + soft.keepalive_n <=
+	    sizeof(soft.rep) / sizeof(soft.rep[0]));
+	memmove(soft.rep[soft.keepalive_n], soft.rep[0],
+	    soft.rep_n * sizeof(soft.rep[0]));
+
+	for (size_t i = 0; i < soft.keepalive_n; i++) {
+		frame = soft.rep[i];
+		memset(frame, 0, REPORT_LEN - 1);
+		memcpy(frame, soft.req_cid, 4);
+		frame[4] = 0xbb;			/* CTAPHID_KEEPALIVE */
+		frame[6] = 1;				/* bcnt */
+		frame[7] = soft.keepalive[i];
+	}
+
+	soft.rep_n += soft.keepalive_n;
+	soft.keepalive_n = 0;
+}
+
+static void
+soft_reply_error(uint8_t code)
+{
+	soft_reply(0x3f, &code, 1);
+}
+
+static int
+soft_default(const struct soft_msg *m, unsigned char *reply,
+    size_t *reply_len)
+{
+	const unsigned char	*ptr;
+	size_t			 len;
+
+	if (m->op == 0x04) {
+		ptr = soft_info;
+		len = sizeof(soft_info);
+	} else if (m->op == 0x06 && m->sub == 2) {
+		ptr = soft_key_agreement;
+		len = sizeof(soft_key_agreement);
+	} else if (m->op == 0x06 && m->sub == 5) {
+		ptr = soft_pin_token;
+		len = sizeof(soft_pin_token);
+	} else {
+		ptr = (const unsigned char *)"\x01"; /* invalid command */
+		len = 1;
+	}
+
+	memcpy(reply, ptr, len);
+	*reply_len = len;
+
+	return (SOFT_REPLY);
+}
+
+static void
+soft_cbor_msg(struct soft_msg *m)
+{
+	unsigned char	reply[SOFT_MAXMSG];
+	size_t		reply_len = 0;
+	int		r = SOFT_DEFAULT;
+
+	assert(soft.req_len > 0);
+	m->op = soft.req[0];
+
+	switch (m->op) {
+	case 0x06: /* clientPin */
+	case 0x40: /* bioEnrollment */
+		m->sub = soft_arg(soft.req + 1, soft.req_len - 1, 2);
+		break;
+	case 0x41: /* credentialManagement */
+		m->sub = soft_arg(soft.req + 1, soft.req_len - 1, 1);
+		break;
+	}
+
+	if (soft.cbor != NULL)
+		r = soft.cbor(m, soft.req, soft.req_len, reply, &reply_len);
+	if (r == SOFT_DEFAULT)
+		r = soft_default(m, reply, &reply_len);
+	if (r == SOFT_REPLY) {
+		soft_reply(0x10, reply, reply_len);
+		soft_keepalive();
+	}
+
+	soft.held = r == SOFT_MUTE;
+}
+
+static void
+soft_msg(void)
+{
+	struct soft_msg	*m;
+	unsigned char	 init[17];
+
+	assert(soft.log_n < SOFT_MAXLOG);
+	m = &soft.log[soft.log_n++];
+	m->cmd = soft.req_cmd;
+	m->op = 0;
+	m->sub = -1;
+
+	switch (soft.req_cmd) {
+	case 0x01: /* ping */
+		if (soft.ping_mangle == 1 && soft.req_len > 0)
+			soft.req[soft.req_len - 1] ^= 1;
+		else if (soft.ping_mangle == 2 && soft.req_len > 0)
+			soft.req_len--;
+		soft_reply(soft.req_cmd, soft.req, soft.req_len);
+		break;
+	case 0x08: /* wink */
+		soft_reply(soft.req_cmd, NULL, 0);
+		break;
+	case 0x04: /* lock */
+		assert(soft.req_len == 1);
+		m->sub = soft.req[0];
+		if (soft.no_lock)
+			soft_reply_error(0x01); /* invalid command */
+		else
+			soft_reply(soft.req_cmd, NULL, 0);
+		break;
+	case 0x06: /* init */
+		assert(soft.req_len == 8);
+		memset(init, 0, sizeof(init));
+		memcpy(init, soft.req, 8);
+		memcpy(init + 8, "\x01\x02\x03\x04", 4);
+		init[12] = 2;
+		init[16] = soft.caps;
+		soft_reply(soft.req_cmd, init, sizeof(init));
+		break;
+	case 0x10: /* cbor */
+		soft_cbor_msg(m);
+		break;
+	case 0x11: /* cancel */
+		if (soft.held) {
+			soft.held = false;
+			/* CTAP2_ERR_KEEPALIVE_CANCEL */
+			soft_reply(0x10, (const unsigned char *)"\x2d", 1);
+		}
+		break;
+	default:
+		soft_reply_error(0x01); /* invalid command */
+	}
+}
+
+static int
+soft_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	(void)ms;
+
+	assert(handle == &soft);
+	assert(len == REPORT_LEN - 1);
+
+	soft_lock();
+#ifdef HAVE_PTHREAD
+	while (soft.wait && soft.rep_next == soft.rep_n)
+		assert(pthread_cond_wait(&soft_cond, &soft_mutex) == 0);
+#endif
+	if (soft.rep_next == soft.rep_n) {
+		soft_unlock();
+		return (-1);
+	}
+
+	memcpy(ptr, soft.rep[soft.rep_next++], len);
+	soft_unlock();
+
+	/* let some time pass between keepalives */
+	if (ptr[4] == 0xbb)
+		usleep(2000);
+
+	return ((int)len);
+}
+
+static int
+soft_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	size_t n;
+
+	assert(handle == &soft);
+	assert(len == REPORT_LEN);
+
+	ptr++; /* report id */
+
+	soft_lock();
+
+	if (ptr[4] & 0x80) {
+		memcpy(soft.req_cid, ptr, 4);
+		soft.req_cmd = ptr[4] & 0x7f;
+		soft.req_len = (size_t)((ptr[5] << 8) | ptr[6]);
+		assert(soft.req_len <= sizeof(soft.req));
+		n = soft.req_len < 57 ? soft.req_len : 57;
+		memcpy(soft.req, ptr + 7, n);
+		soft.req_got = n;
+	} else {
+		n = soft.req_len - soft.req_got;
+		n = n < 59 ? n : 59;
+		memcpy(soft.req + soft.req_got, ptr + 5, n);
+		soft.req_got += n;
+	}
+
+	if (soft.req_got == soft.req_len)
+		soft_msg();
+
+	soft_unlock();
+
+	return ((int)len);
+}
+
+static void *
+soft_open(const char *path)
+{
+	(void)path;
+
+	return (&soft);
+}
+
+static void
+soft_close(void *handle)
+{
+	assert(handle == &soft);
+}
+
+static fido_dev_t *
+soft_dev(void)
+{
+	fido_dev_t	*dev;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = soft_open;
+	io.close = soft_close;
+	io.read = soft_read;
+	io.write = soft_write;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "soft") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+	soft.log_n = 0;
+
+	return (dev);
+}
+
+/* the requests seen since the last call */
+static void
+soft_expect(const struct soft_msg *v, size_t n)
+{
+	assert(soft.log_n == n);
+
+	for (size_t i = 0; i < n; i++) {
+		assert(soft.log[i].cmd == v[i].cmd);
+		assert(soft.log[i].op == v[i].op);
+		assert(soft.log[i].sub == v[i].sub);
+	}
+
+	soft.log_n = 0;
+}
+
+/* a credentialManagement reply carrying relying party 'id' */
+static size_t
+soft_rp(unsigned char *reply, char id, int total)
+{
+	size_t n = 0;
+
+	reply[n++] = 0x00;
+	reply[n++] = total < 0 ? 0xa2 : 0xa3;
+	reply[n++] = 0x03;				/* rp */
+	reply[n++] = 0xa1;
+	memcpy(reply + n, "\x62id\x61", 4);
+	n += 4;
+	reply[n++] = (unsigned char)id;
+	reply[n++] = 0x04;				/* rpIDHash */
+	reply[n++] = 0x58;
+	reply[n++] = 0x20;
+	memset(reply + n, id, 32);
+	n += 32;
+	if (total >= 0) {
+		reply[n++] = 0x05;			/* totalRPs */
+		reply[n++] = (unsigned char)total;
+	}
+
+	return (n);
+}
+
+/* a credentialManagement reply carrying credential 'tag' */
+static size_t
+soft_rk(unsigned char *reply, unsigned char tag, int total)
+{
+	size_t n = 0;
+
+	reply[n++] = 0x00;
+	reply[n++] = total < 0 ? 0xa1 : 0xa2;
+	reply[n++] = 0x07;				/* credentialID */
+	reply[n++] = 0xa2;
+	memcpy(reply + n, "\x62id\x42", 4);
+	n += 4;
+	reply[n++] = tag;
+	reply[n++] = tag;
+	memcpy(reply + n, "\x64type\x6apublic-key", 16);
+	n += 16;
+	if (total >= 0) {
+		reply[n++] = 0x09;			/* totalCredentials */
+		reply[n++] = (unsigned char)total;
+	}
+
+	return (n);
+}
+
+/* an authenticatorGetAssertion reply; 'tag' fills id, counter, and so on */
+static size_t
+soft_assert(unsigned char *reply, unsigned char tag)
+{
+	size_t n = 0;
+
+	reply[n++] = 0x00;
+	reply[n++] = 0xa3;
+	reply[n++] = 0x01;				/* credential */
+	reply[n++] = 0xa2;
+	memcpy(reply + n, "\x62id\x42", 4);
+	n += 4;
+	reply[n++] = tag;
+	reply[n++] = tag;
+	memcpy(reply + n, "\x64type\x6apublic-key", 16);
+	n += 16;
+	reply[n++] = 0x02;				/* authData */
+	reply[n++] = 0x58;
+	reply[n++] = 37;
+	memset(reply + n, tag, 32);			/* rpIdHash */
+	n += 32;
+	reply[n++] = 0x01;				/* flags: up */
+	memcpy(reply + n, "\x00\x00\x00", 3);		/* signCount */
+	n += 3;
+	reply[n++] = tag;
+	reply[n++] = 0x03;				/* signature */
+	reply[n++] = 0x41;
+	reply[n++] = tag;
+
+	return (n);
+}
+
 /* gh#56 */
 static void
 open_iff_ok(void)
@@ -69,12 +710,1656 @@ open_iff_ok(void)
 	fido_dev_free(&dev);
 }
 
+static void
+stats_iff_tx(void)
+{
+	fido_dev_t		*dev = NULL;
+	fido_dev_stats_t	*stats = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert((stats = fido_dev_stats_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_ERR_RX);
+	assert(fido_dev_get_stats(dev, stats) == FIDO_OK);
+	assert(fido_dev_stats_tx_reports(stats) == 1);
+	assert(fido_dev_stats_tx_bytes(stats) == REPORT_LEN - 1);
+	assert(fido_dev_stats_rx_reports(stats) == 0);
+	assert(fido_dev_stats_rx_bytes(stats) == 0);
+	assert(fido_dev_stats_latency_count(stats, FIDO_STATS_OP_INIT) == 0);
+	assert(fido_dev_stats_latency_count(stats, FIDO_STATS_NOPS) == 0);
+	fido_dev_reset_stats(dev);
+	assert(fido_dev_get_stats(dev, stats) == FIDO_OK);
+	assert(fido_dev_stats_tx_reports(stats) == 0);
+	assert(fido_dev_stats_tx_bytes(stats) == 0);
+	fido_dev_free(&dev);
+
+	/* CTAPHID_CANCEL isn't counted */
+	soft_reset();
+	dev = soft_dev();
+	fido_dev_reset_stats(dev);
+	assert(fido_dev_cancel(dev) == FIDO_OK);
+	assert(soft.log_n == 1 && soft.log[0].cmd == 0x11);
+	assert(fido_dev_get_stats(dev, stats) == FIDO_OK);
+	assert(fido_dev_stats_tx_reports(stats) == 0);
+	assert(fido_dev_stats_tx_bytes(stats) == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+
+	fido_dev_stats_free(&stats);
+	fido_dev_free(&dev);
+}
+
+static void
+mux_iff_ok(void)
+{
+	fido_dev_mux_t	*mux = NULL;
+	fido_dev_t	*dev[3];
+	fido_cbor_info_t *ci = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = fake_read;
+	io.write = fake_write;
+
+	assert((mux = fido_dev_mux_new()) != NULL);
+	assert(fido_dev_mux_close(mux) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_mux_set_io_functions(mux, &io) == FIDO_OK);
+	assert(fido_dev_mux_open(mux, "dummy") == FIDO_OK);
+	assert(fido_dev_mux_set_io_functions(mux, &io) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < 2; i++) {
+		assert((dev[i] = fido_dev_new()) != NULL);
+		assert(fido_dev_open_mux(dev[i], mux) == FIDO_OK);
+		assert(fido_dev_protocol(dev[i]) == 2);
+	}
+
+	assert(fake_last_cid == 2);
+	assert(fido_dev_mux_close(mux) == FIDO_ERR_INVALID_ARGUMENT);
+
+	/* an abandoned request doesn't hold up the other sessions */
+	fake_mute = true;
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_get_cbor_info(dev[0], ci) == FIDO_ERR_RX);
+	fido_cbor_info_free(&ci);
+	assert((dev[2] = fido_dev_new()) != NULL);
+	assert(fido_dev_open_mux(dev[2], mux) == FIDO_OK);
+	assert(fake_last_cid == 3);
+
+	for (size_t i = 0; i < 3; i++) {
+		assert(fido_dev_close(dev[i]) == FIDO_OK);
+		fido_dev_free(&dev[i]);
+	}
+
+	assert(fido_dev_mux_close(mux) == FIDO_OK);
+	fido_dev_mux_free(&mux);
+
+	/* freeing a mux orphans its sessions, which fail until closed */
+	assert((mux = fido_dev_mux_new()) != NULL);
+	assert(fido_dev_mux_set_io_functions(mux, &io) == FIDO_OK);
+	assert(fido_dev_mux_open(mux, "dummy") == FIDO_OK);
+	assert((dev[0] = fido_dev_new()) != NULL);
+	assert(fido_dev_open_mux(dev[0], mux) == FIDO_OK);
+	fido_dev_mux_free(&mux);
+	assert(mux == NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_get_cbor_info(dev[0], ci) == FIDO_ERR_TX);
+	fido_cbor_info_free(&ci);
+	assert(fido_dev_close(dev[0]) == FIDO_OK);
+
+	/* and a closed session is no longer bound to a mux */
+	assert(fido_dev_open(dev[0], "/nonexistent") == FIDO_ERR_INTERNAL);
+	fido_dev_free(&dev[0]);
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * A fake authenticator for mux sessions on two threads, echoing
+ * CTAPHID_PING on channels 1 and 2. After the first report of a reply,
+ * it slips in a CTAPHID_KEEPALIVE for the other channel, which the mux
+ * must queue for that channel's session while it waits for the device.
+ * The last report of a reply is held back until the other thread has
+ * asked for its next ping, so that it is queued by then.
+ */
+#define ECHO_NITER	50
+
+static pthread_mutex_t	echo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	echo_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	unsigned char	rep[8][REPORT_LEN - 1];
+	size_t		rep_n;
+	size_t		rep_next;
+	unsigned char	req[SOFT_MAXMSG];
+	uint32_t	req_cid;
+	size_t		req_len;
+	size_t		req_got;
+	uint32_t	last_cid;
+	int		asked[3];	/* pings asked for, by channel */
+	int		seen[3];	/* pings received, by channel */
+	int		stray[3];	/* keepalives sent, by channel */
+	uint32_t	log[2 * ECHO_NITER];
+	size_t		log_n;
+} echo;
+
+static unsigned char *
+echo_frame(uint32_t cid, uint8_t cmd)
+{
+	unsigned char *frame;
+
+	assert(echo.rep_n < sizeof(echo.rep) / sizeof(echo.rep[0]));
+	frame = echo.rep[echo.rep_n++];
+	memset(frame, 0, REPORT_LEN - 1);
+	memcpy(frame, &cid, sizeof(cid));
+	frame[4] = cmd;
+
+	return (frame);
+}
+
+static void
+echo_reply(void)
+{
+	const uint32_t	 other = echo.req_cid == 1 ? 2 : 1;
+	unsigned char	*frame;
+	size_t		 n;
+	size_t		 off;
+	uint8_t		 seq = 0;
+
+	assert(echo.rep_next == echo.rep_n);
+	echo.rep_n = echo.rep_next = 0;
+
+	frame = echo_frame(echo.req_cid, 0x81);
+	frame[5] = (unsigned char)(echo.req_len >> 8);
+	frame[6] = (unsigned char)echo.req_len;
+	memcpy(frame + 7, echo.req, (n = echo.req_len < 57 ?
+	    echo.req_len : 57));
+
+	/* only to a session that will read it */
+	if (echo.seen[other] < ECHO_NITER) {
+		frame = echo_frame(other, 0xbb);
+		frame[6] = 1;
+		frame[7] = 0x01; /* processing */
+		echo.stray[other]++;
+	}
+
+	for (off = n; off < echo.req_len; off += n) {
+		frame = echo_frame(echo.req_cid, seq++);
+		n = echo.req_len - off < 59 ? echo.req_len - off : 59;
+		memcpy(frame + 5, echo.req + off, n);
+	}
+}
+
+static int
+echo_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	const uint32_t	other = echo.req_cid == 1 ? 2 : 1;
+	struct timespec	ts;
+
+	assert(handle == &echo);
+	assert(len == REPORT_LEN - 1);
+
+	assert(pthread_mutex_lock(&echo_mutex) == 0);
+	while (echo.rep_next == echo.rep_n) {
+		if (ms < 0) {
+			assert(pthread_cond_wait(&echo_cond, &echo_mutex) == 0);
+			continue;
+		}
+		/* rounded up to the next second */
+		assert(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+		ts.tv_sec += ms / 1000 + 1;
+		if (pthread_cond_timedwait(&echo_cond, &echo_mutex,
+		    &ts) != 0) {
+			assert(pthread_mutex_unlock(&echo_mutex) == 0);
+			return (-1);
+		}
+	}
+
+	/* the last report of a reply, with the other thread in the queue */
+	if (echo.rep_next == echo.rep_n - 1 && echo.req_cid != 0 &&
+	    echo.seen[other] < ECHO_NITER) {
+		while (echo.asked[other] == echo.seen[other])
+			assert(pthread_cond_wait(&echo_cond, &echo_mutex) == 0);
+		assert(pthread_mutex_unlock(&echo_mutex) == 0);
+		usleep(5000);
+		assert(pthread_mutex_lock(&echo_mutex) == 0);
+	}
+
+	memcpy(ptr, echo.rep[echo.rep_next++], len);
+	assert(pthread_mutex_unlock(&echo_mutex) == 0);
+
+	return ((int)len);
+}
+
+static int
+echo_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	size_t n;
+
+	assert(handle == &echo);
+	assert(len == REPORT_LEN);
+
+	ptr++; /* report id */
+
+	assert(pthread_mutex_lock(&echo_mutex) == 0);
+
+	if (ptr[4] == 0x86) {
+		/* CTAPHID_INIT on the broadcast channel */
+		assert(memcmp(ptr, "\xff\xff\xff\xff", 4) == 0);
+		assert(echo.rep_next == echo.rep_n);
+		echo.rep_n = echo.rep_next = 0;
+		echo.req_cid = 0;
+		fake_init_reply(echo_frame(0, 0), ptr - 1, ++echo.last_cid);
+	} else if (ptr[4] == 0x81) {
+		memcpy(&echo.req_cid, ptr, 4);
+		assert(echo.req_cid == 1 || echo.req_cid == 2);
+		echo.req_len = (size_t)((ptr[5] << 8) | ptr[6]);
+		assert(echo.req_len > 57 && echo.req_len <= sizeof(echo.req));
+		memcpy(echo.req, ptr + 7, 57);
+		echo.req_got = 57;
+	} else {
+		assert((ptr[4] & 0x80) == 0);
+		assert(memcmp(ptr, &echo.req_cid, 4) == 0);
+		n = echo.req_len - echo.req_got;
+		n = n < 59 ? n : 59;
+		memcpy(echo.req + echo.req_got, ptr + 5, n);
+		if ((echo.req_got += n) == echo.req_len) {
+			assert(echo.log_n < sizeof(echo.log) /
+			    sizeof(echo.log[0]));
+			echo.log[echo.log_n++] = echo.req_cid;
+			echo.seen[echo.req_cid]++;
+			echo_reply();
+		}
+	}
+
+	assert(pthread_cond_broadcast(&echo_cond) == 0);
+	assert(pthread_mutex_unlock(&echo_mutex) == 0);
+
+	return ((int)len);
+}
+
+static void *
+echo_open(const char *path)
+{
+	(void)path;
+
+	return (&echo);
+}
+
+static void
+echo_close(void *handle)
+{
+	assert(handle == &echo);
+}
+
+struct echo_session {
+	fido_dev_t	*dev;
+	uint32_t	 cid;
+};
+
+static void *
+echo_worker(void *arg)
+{
+	struct echo_session	*s = arg;
+	unsigned char		 payload[150];
+
+	for (int i = 0; i < ECHO_NITER; i++) {
+		memset(payload, (int)s->cid << 6 | i, sizeof(payload));
+		assert(pthread_mutex_lock(&echo_mutex) == 0);
+		echo.asked[s->cid]++;
+		assert(pthread_cond_broadcast(&echo_cond) == 0);
+		assert(pthread_mutex_unlock(&echo_mutex) == 0);
+		assert(fido_dev_ping(s->dev, payload, sizeof(payload)) ==
+		    FIDO_OK);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Two sessions pinging from their own threads: replies reach the session
+ * they are meant for, reports for a session that waits for the device are
+ * queued for it, and the sessions take turns.
+ */
+static void
+mux_iff_interleaved(void)
+{
+	fido_dev_mux_t		*mux;
+	fido_dev_stats_t	*stats;
+	struct echo_session	 s[2];
+	pthread_t		 thread[2];
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+	memset(&echo, 0, sizeof(echo));
+
+	io.open = echo_open;
+	io.close = echo_close;
+	io.read = echo_read;
+	io.write = echo_write;
+
+	assert((mux = fido_dev_mux_new()) != NULL);
+	assert((stats = fido_dev_stats_new()) != NULL);
+	assert(fido_dev_mux_set_io_functions(mux, &io) == FIDO_OK);
+	assert(fido_dev_mux_open(mux, "echo") == FIDO_OK);
+
+	for (size_t i = 0; i < 2; i++) {
+		assert((s[i].dev = fido_dev_new()) != NULL);
+		assert(fido_dev_open_mux(s[i].dev, mux) == FIDO_OK);
+		s[i].cid = echo.last_cid;
+	}
+
+	assert(s[0].cid == 1 && s[1].cid == 2);
+
+	for (size_t i = 0; i < 2; i++)
+		assert(pthread_create(&thread[i], NULL, echo_worker,
+		    &s[i]) == 0);
+	for (size_t i = 0; i < 2; i++)
+		assert(pthread_join(thread[i], NULL) == 0);
+
+	/* every ping was answered; the sessions alternated */
+	assert(echo.log_n == 2 * ECHO_NITER);
+	for (size_t i = 1; i < echo.log_n; i++)
+		assert(echo.log[i] != echo.log[i - 1]);
+
+	/* the keepalives slipped in reached their session */
+	for (size_t i = 0; i < 2; i++) {
+		assert(echo.stray[s[i].cid] > 0);
+		assert(fido_dev_get_stats(s[i].dev, stats) == FIDO_OK);
+		assert(fido_dev_stats_keepalives(stats) ==
+		    (uint64_t)echo.stray[s[i].cid]);
+		assert(fido_dev_close(s[i].dev) == FIDO_OK);
+		fido_dev_free(&s[i].dev);
+	}
+
+	fido_dev_stats_free(&stats);
+	assert(fido_dev_mux_close(mux) == FIDO_OK);
+	fido_dev_mux_free(&mux);
+}
+#endif /* HAVE_PTHREAD */
+
+static void
+busy_iff_retry(void)
+{
+	fido_dev_t		*dev = NULL;
+	fido_dev_stats_t	*stats = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = fake_read;
+	io.write = fake_write;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	fake_busy = 1;
+	assert(fido_dev_open(dev, "dummy") == FIDO_ERR_CHANNEL_BUSY);
+	assert(fido_dev_set_retry_policy(dev, 1, 0, 100) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_retry_policy(dev, 1, 4, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_retry_policy(dev, 1, 4, 1000) == FIDO_OK);
+	fido_dev_reset_stats(dev);
+	fake_busy = 3;
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fake_busy == 0);
+	assert((stats = fido_dev_stats_new()) != NULL);
+	assert(fido_dev_get_stats(dev, stats) == FIDO_OK);
+	assert(fido_dev_stats_retries(stats) == 3);
+	assert(fido_dev_close(dev) == FIDO_OK);
+
+	fido_dev_stats_free(&stats);
+	fido_dev_free(&dev);
+}
+
+static void
+open_many_iff_timeout(void)
+{
+	fido_dev_info_t	*devlist = NULL;
+	fido_dev_t	*dev[3];
+	fido_dev_io_t	 io;
+	int		 status[3];
+	char		 path[2];
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = many_open;
+	io.close = many_close;
+	io.read = many_read;
+	io.write = many_write;
+
+	assert((devlist = fido_dev_info_new(3)) != NULL);
+	assert(fido_dev_info_set(devlist, 0, "0", "fake", "fake", NULL,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	for (size_t i = 0; i < 3; i++) {
+		path[0] = (char)('0' + i);
+		path[1] = '\0';
+		assert(fido_dev_info_set(devlist, i, path, "fake", "fake", &io,
+		    NULL) == FIDO_OK);
+		assert(strcmp(fido_dev_info_path(fido_dev_info_ptr(devlist,
+		    i)), path) == 0);
+	}
+
+	/* an unresponsive device doesn't hold up the others */
+	fake_dev[1].mute = true;
+	assert(fido_dev_open_many(devlist, 3, dev, status, 100) == FIDO_OK);
+	assert(status[0] == FIDO_OK && dev[0] != NULL);
+	assert(status[1] == FIDO_ERR_RX && dev[1] == NULL);
+	assert(status[2] == FIDO_OK && dev[2] != NULL);
+	assert(fido_dev_protocol(dev[2]) == 2);
+
+	for (size_t i = 0; i < 3; i += 2) {
+		assert(fido_dev_close(dev[i]) == FIDO_OK);
+		fido_dev_free(&dev[i]);
+	}
+
+	fido_dev_info_free(&devlist, 3);
+}
+
+static int
+lock_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	(void)req;
+	(void)req_len;
+
+	if (m->op == 0x41 && m->sub == 2)
+		*reply_len = soft_rp(reply, 'a', 2);
+	else if (m->op == 0x41 && m->sub == 3)
+		*reply_len = soft_rp(reply, 'b', -1);
+	else if (m->op == 0x40 && m->sub == 1) {
+		/* templateId, lastEnrollSampleStatus, remainingSamples */
+		memcpy(reply, "\x00\xa3\x04\x42\x01\x02\x05\x00\x06\x01", 10);
+		*reply_len = 10;
+	} else if (m->op == 0x40 && m->sub == 2) {
+		memcpy(reply, "\x00\xa2\x05\x00\x06\x00", 6);
+		*reply_len = 6;
+	} else
+		return (SOFT_DEFAULT);
+
+	return (SOFT_REPLY);
+}
+
+static void
+lock_iff_ok(void)
+{
+	const struct soft_msg lock[] = {
+		{ 0x04, 0, 3 }, { 0x04, 0, 0 },
+	};
+	const struct soft_msg auto_lock[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x04, 0, 5 },
+		{ 0x10, 0x41, 2 }, { 0x10, 0x41, 3 }, { 0x04, 0, 0 },
+	};
+	const struct soft_msg user_lock[] = {
+		{ 0x04, 0, 10 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+	};
+	const struct soft_msg unlock[] = {
+		{ 0x04, 0, 0 },
+	};
+	const struct soft_msg bio_begin[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x04, 0, 5 },
+		{ 0x10, 0x40, 1 },
+	};
+	const struct soft_msg bio_continue[] = {
+		{ 0x10, 0x40, 2 }, { 0x04, 0, 0 },
+	};
+	const struct soft_msg no_lock[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x04, 0, 5 },
+		{ 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+	};
+	const struct soft_msg no_lock_again[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 2 },
+		{ 0x10, 0x41, 3 },
+	};
+	fido_dev_t		*dev;
+	fido_credman_rp_t	*rp;
+	fido_bio_template_t	*t;
+	fido_bio_enroll_t	*e;
+
+	soft_reset();
+	soft.cbor = lock_cbor;
+	dev = soft_dev();
+	assert((rp = fido_credman_rp_new()) != NULL);
+	assert((t = fido_bio_template_new()) != NULL);
+	assert((e = fido_bio_enroll_new()) != NULL);
+
+	assert(fido_dev_lock(dev, 0) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_lock(dev, 11) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_lock(dev, 3) == FIDO_OK);
+	assert(fido_dev_unlock(dev) == FIDO_OK);
+	soft_expect(lock, sizeof(lock) / sizeof(lock[0]));
+
+	/* taken before RP_BEGIN, released after the last RP_NEXT */
+	assert(fido_dev_set_auto_lock(dev, 11) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_auto_lock(dev, 5) == FIDO_OK);
+	assert(fido_credman_get_dev_rp(dev, rp, "1234") == FIDO_OK);
+	assert(fido_credman_rp_count(rp) == 2);
+	soft_expect(auto_lock, sizeof(auto_lock) / sizeof(auto_lock[0]));
+
+	/* a lock taken by the caller outlives the enumeration */
+	assert(fido_dev_lock(dev, 10) == FIDO_OK);
+	assert(fido_credman_get_dev_rp(dev, rp, "1234") == FIDO_OK);
+	assert(fido_credman_rp_count(rp) == 2);
+	soft_expect(user_lock, sizeof(user_lock) / sizeof(user_lock[0]));
+	assert(fido_dev_unlock(dev) == FIDO_OK);
+	soft_expect(unlock, sizeof(unlock) / sizeof(unlock[0]));
+
+	/* held from the first sample to the last */
+	assert(fido_bio_dev_enroll_begin(dev, t, e, 1000, "1234") == FIDO_OK);
+	assert(fido_bio_enroll_remaining_samples(e) == 1);
+	soft_expect(bio_begin, sizeof(bio_begin) / sizeof(bio_begin[0]));
+	assert(fido_bio_dev_enroll_continue(dev, t, e, 1000) == FIDO_OK);
+	assert(fido_bio_enroll_remaining_samples(e) == 0);
+	soft_expect(bio_continue, sizeof(bio_continue) /
+	    sizeof(bio_continue[0]));
+
+	/* not implemented; carry on unlocked, and don't ask again */
+	soft.no_lock = true;
+	assert(fido_credman_get_dev_rp(dev, rp, "1234") == FIDO_OK);
+	soft_expect(no_lock, sizeof(no_lock) / sizeof(no_lock[0]));
+	assert(fido_credman_get_dev_rp(dev, rp, "1234") == FIDO_OK);
+	assert(fido_credman_rp_count(rp) == 2);
+	soft_expect(no_lock_again, sizeof(no_lock_again) /
+	    sizeof(no_lock_again[0]));
+	assert(fido_dev_lock(dev, 1) == FIDO_ERR_INVALID_COMMAND);
+
+	fido_bio_enroll_free(&e);
+	fido_bio_template_free(&t);
+	fido_credman_rp_free(&rp);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static void
+ping_iff_echo(void)
+{
+	const struct soft_msg ping[] = {
+		{ 0x01, 0, -1 }, { 0x01, 0, -1 },
+	};
+	const struct soft_msg wink[] = {
+		{ 0x08, 0, -1 },
+	};
+	fido_dev_t	*dev;
+	unsigned char	 payload[300];
+
+	for (size_t i = 0; i < sizeof(payload); i++)
+		payload[i] = (unsigned char)i;
+
+	soft_reset();
+	dev = soft_dev();
+
+	/* empty, and spanning several reports */
+	assert(fido_dev_ping(dev, NULL, 0) == FIDO_OK);
+	assert(fido_dev_ping(dev, payload, sizeof(payload)) == FIDO_OK);
+	assert(fido_dev_ping(dev, NULL, 1) == FIDO_ERR_INVALID_ARGUMENT);
+	soft_expect(ping, sizeof(ping) / sizeof(ping[0]));
+
+	/* the echo must match */
+	soft.ping_mangle = 1;
+	assert(fido_dev_ping(dev, payload, sizeof(payload)) == FIDO_ERR_RX);
+	soft.ping_mangle = 2;
+	assert(fido_dev_ping(dev, payload, sizeof(payload)) == FIDO_ERR_RX);
+	assert(fido_dev_ping(dev, payload, 1) == FIDO_ERR_RX);
+	soft.ping_mangle = 0;
+	assert(fido_dev_ping(dev, payload, 1) == FIDO_OK);
+
+	soft.log_n = 0;
+	assert(fido_dev_wink(dev) == FIDO_OK);
+	soft_expect(wink, sizeof(wink) / sizeof(wink[0]));
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+
+	/* not sent to a device without FIDO_CAP_WINK */
+	soft_reset();
+	soft.caps = 0x04; /* cbor */
+	dev = soft_dev();
+	assert(fido_dev_wink(dev) == FIDO_ERR_INVALID_COMMAND);
+	soft_expect(NULL, 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+struct keepalive_log {
+	uint8_t	status[8];
+	int	elapsed_ms[8];
+	size_t	n;
+};
+
+static void
+keepalive_cb(void *arg, uint8_t status, int elapsed_ms)
+{
+	struct keepalive_log *log = arg;
+
+	assert(log->n < sizeof(log->status));
+	log->status[log->n] = status;
+	log->elapsed_ms[log->n] = elapsed_ms;
+	log->n++;
+}
+
+static void
+keepalive_iff_ok(void)
+{
+	const unsigned char keepalive[] = {
+		CTAP_KEEPALIVE_PROCESSING, CTAP_KEEPALIVE_PROCESSING,
+		CTAP_KEEPALIVE_UPNEEDED,
+	};
+	struct keepalive_log	 log;
+	fido_dev_t		*dev;
+	fido_dev_stats_t	*stats;
+	fido_cbor_info_t	*ci;
+
+	memset(&log, 0, sizeof(log));
+
+	soft_reset();
+	dev = soft_dev();
+	assert((stats = fido_dev_stats_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+
+	/* skipped without a handler */
+	soft.keepalive = keepalive;
+	soft.keepalive_n = sizeof(keepalive);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(log.n == 0);
+
+	assert(fido_dev_set_keepalive_handler(dev, keepalive_cb,
+	    &log) == FIDO_OK);
+	soft.keepalive_n = sizeof(keepalive);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(log.n == sizeof(keepalive));
+	assert(memcmp(log.status, keepalive, sizeof(keepalive)) == 0);
+	assert(log.elapsed_ms[0] >= 0);
+	for (size_t i = 1; i < log.n; i++)
+		assert(log.elapsed_ms[i] >= log.elapsed_ms[i - 1]);
+	assert(log.elapsed_ms[log.n - 1] >= 4);
+
+	assert(fido_dev_get_stats(dev, stats) == FIDO_OK);
+	assert(fido_dev_stats_keepalives(stats) == 2 * sizeof(keepalive));
+
+	/* and no longer called once cleared */
+	log.n = 0;
+	assert(fido_dev_set_keepalive_handler(dev, NULL, NULL) == FIDO_OK);
+	soft.keepalive_n = sizeof(keepalive);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(log.n == 0);
+
+	fido_cbor_info_free(&ci);
+	fido_dev_stats_free(&stats);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/* the x coordinate of the platform key of the last getPinToken */
+static unsigned char ecdh_x[32];
+
+static int
+ecdh_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	if (m->op == 0x06 && m->sub == 5) {
+		for (size_t i = 0; i + 3 + sizeof(ecdh_x) <= req_len; i++)
+			if (memcmp(req + i, "\x21\x58\x20", 3) == 0) {
+				memcpy(ecdh_x, req + i + 3, sizeof(ecdh_x));
+				break;
+			}
+		return (SOFT_DEFAULT);
+	}
+
+	if (m->op == 0x41 && m->sub == 1) {
+		/* existingResidentCredentialsCount, max remaining */
+		memcpy(reply, "\x00\xa2\x01\x00\x02\x08", 6);
+		*reply_len = 6;
+		return (SOFT_REPLY);
+	}
+
+	return (SOFT_DEFAULT);
+}
+
+/* run a key agreement on 'dev', and return the platform key used */
+static void
+ecdh_key(fido_dev_t *dev, unsigned char *x)
+{
+	fido_credman_metadata_t *metadata;
+
+	memset(ecdh_x, 0, sizeof(ecdh_x));
+	assert((metadata = fido_credman_metadata_new()) != NULL);
+	assert(fido_credman_get_dev_metadata(dev, metadata, "1234") == FIDO_OK);
+	assert(fido_credman_rk_remaining(metadata) == 8);
+	fido_credman_metadata_free(&metadata);
+	memcpy(x, ecdh_x, sizeof(ecdh_x));
+}
+
+static void
+ecdh_pool_fill(void)
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 200 * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+static void
+ecdh_pool_iff_ok(void)
+{
+	fido_dev_t	*dev;
+	unsigned char	 x[4][32];
+	unsigned char	 zero[32];
+	pid_t		 pid;
+	int		 fd[2];
+	int		 r;
+	int		 status;
+
+	memset(zero, 0, sizeof(zero));
+
+	soft_reset();
+	soft.cbor = ecdh_cbor;
+	dev = soft_dev();
+
+	/* inline */
+	fido_ecdh_pool_stop();
+	ecdh_key(dev, x[0]);
+	assert(memcmp(x[0], zero, sizeof(zero)) != 0);
+
+	assert(fido_ecdh_pool_start(0) == FIDO_ERR_INVALID_ARGUMENT);
+	if ((r = fido_ecdh_pool_start(2)) == FIDO_ERR_INTERNAL) {
+		/* built without threads */
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+		return;
+	}
+	assert(r == FIDO_OK);
+	assert(fido_ecdh_pool_start(2) == FIDO_ERR_INVALID_ARGUMENT);
+
+	/* pooled keys are handed out once, and replenished */
+	ecdh_pool_fill();
+	for (size_t i = 1; i < 4; i++) {
+		ecdh_key(dev, x[i]);
+		for (size_t j = 0; j < i; j++)
+			assert(memcmp(x[i], x[j], sizeof(x[i])) != 0);
+	}
+
+	/* a child doesn't get its parent's keys */
+	ecdh_pool_fill();
+	assert(pipe(fd) == 0);
+	assert((pid = fork()) >= 0);
+	if (pid == 0) {
+		ecdh_key(dev, x[0]);
+		_exit(write(fd[1], x[0], sizeof(x[0])) != sizeof(x[0]));
+	}
+	ecdh_key(dev, x[1]);
+	assert(read(fd[0], x[0], sizeof(x[0])) == sizeof(x[0]));
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	assert(memcmp(x[0], x[1], sizeof(x[0])) != 0);
+	close(fd[0]);
+	close(fd[1]);
+
+	/* inline again */
+	fido_ecdh_pool_stop();
+	fido_ecdh_pool_stop();
+	ecdh_key(dev, x[2]);
+	assert(memcmp(x[2], x[1], sizeof(x[2])) != 0);
+	assert(fido_ecdh_pool_start(1) == FIDO_OK);
+	fido_ecdh_pool_stop();
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static unsigned char	batch_tag;
+static unsigned char	batch_fail;
+
+static int
+batch_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	(void)req;
+	(void)req_len;
+
+	if (m->op != 0x02)
+		return (SOFT_DEFAULT);
+
+	if (++batch_tag == batch_fail) {
+		reply[0] = FIDO_ERR_NO_CREDENTIALS;
+		*reply_len = 1;
+	} else
+		*reply_len = soft_assert(reply, batch_tag);
+
+	return (SOFT_REPLY);
+}
+
+static void
+assert_batch_iff_ok(void)
+{
+	const struct soft_msg batch[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x02, -1 },
+		{ 0x10, 0x02, -1 }, { 0x10, 0x02, -1 },
+	};
+	const struct soft_msg batch_fail_2[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x02, -1 },
+		{ 0x10, 0x02, -1 },
+	};
+	const unsigned char	 cdh[32] = { 0 };
+	fido_dev_t		*dev;
+	fido_assert_t		*a[3];
+
+	soft_reset();
+	soft.cbor = batch_cbor;
+	dev = soft_dev();
+
+	for (size_t i = 0; i < 3; i++) {
+		assert((a[i] = fido_assert_new()) != NULL);
+		assert(fido_assert_set_rp(a[i], "localhost") == FIDO_OK);
+		assert(fido_assert_set_clientdata_hash(a[i], cdh,
+		    sizeof(cdh)) == FIDO_OK);
+	}
+
+	assert(fido_dev_get_assert_batch(dev, NULL, 3, "1234") ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_get_assert_batch(dev, a, 0, "1234") ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	soft_expect(NULL, 0);
+
+	/* one key agreement, one pinToken */
+	batch_tag = 0;
+	batch_fail = 0;
+	assert(fido_dev_get_assert_batch(dev, a, 3, "1234") == FIDO_OK);
+	soft_expect(batch, sizeof(batch) / sizeof(batch[0]));
+	for (size_t i = 0; i < 3; i++) {
+		assert(fido_assert_count(a[i]) == 1);
+		assert(fido_assert_sigcount(a[i], 0) == i + 1);
+		assert(fido_assert_id_len(a[i], 0) == 2);
+		assert(fido_assert_id_ptr(a[i], 0)[0] == i + 1);
+	}
+
+	/* a failure stops the batch; earlier assertions stand */
+	for (size_t i = 0; i < 3; i++) {
+		fido_assert_free(&a[i]);
+		assert((a[i] = fido_assert_new()) != NULL);
+		assert(fido_assert_set_rp(a[i], "localhost") == FIDO_OK);
+		assert(fido_assert_set_clientdata_hash(a[i], cdh,
+		    sizeof(cdh)) == FIDO_OK);
+	}
+	batch_tag = 0;
+	batch_fail = 2;
+	assert(fido_dev_get_assert_batch(dev, a, 3, "1234") ==
+	    FIDO_ERR_NO_CREDENTIALS);
+	soft_expect(batch_fail_2, sizeof(batch_fail_2) /
+	    sizeof(batch_fail_2[0]));
+	assert(fido_assert_count(a[0]) == 1);
+	assert(fido_assert_sigcount(a[0], 0) == 1);
+	assert(fido_assert_id_ptr(a[0], 0)[0] == 1);
+	assert(fido_assert_count(a[2]) == 0);
+
+	for (size_t i = 0; i < 3; i++)
+		fido_assert_free(&a[i]);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/*
+ * Resident credentials kept by the software authenticator: relying party
+ * 'rp[i]' holds 'rk[i]' credentials, tagged head[i], head[i] + 1, ...
+ */
+#define CM_MAXRP	4
+
+static struct {
+	char		rp[CM_MAXRP];
+	int		rk[CM_MAXRP];
+	unsigned char	head[CM_MAXRP];
+	size_t		nrp;
+	size_t		rp_next;
+	size_t		rk_rp;
+	int		rk_next;
+} cm;
+
+/* the relying party whose rpIDHash is in an RK_BEGIN request */
+static size_t
+cm_find_rp(const unsigned char *req, size_t req_len)
+{
+	for (size_t i = 0; i + 4 < req_len; i++)
+		if (memcmp(req + i, "\xa1\x01\x58\x20", 4) == 0)
+			for (size_t j = 0; j < cm.nrp; j++)
+				if (req[i + 4] == (unsigned char)cm.rp[j])
+					return (j);
+
+	return (0); /* not one of ours: the first */
+}
+
+static int
+cm_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	int n = 0;
+
+	if (m->op != 0x41)
+		return (SOFT_DEFAULT);
+
+	switch (m->sub) {
+	case 1: /* getCredsMetadata */
+		for (size_t i = 0; i < cm.nrp; i++)
+			n += cm.rk[i];
+		assert(n < 0x18);
+		memcpy(reply, "\x00\xa2\x01\x00\x02\x08", 6);
+		reply[3] = (unsigned char)n;
+		*reply_len = 6;
+		break;
+	case 2: /* enumerateRPsBegin */
+		if (cm.nrp == 0)
+			goto none;
+		cm.rp_next = 1;
+		*reply_len = soft_rp(reply, cm.rp[0], (int)cm.nrp);
+		break;
+	case 3: /* enumerateRPsGetNextRP */
+		assert(cm.rp_next < cm.nrp);
+		*reply_len = soft_rp(reply, cm.rp[cm.rp_next++], -1);
+		break;
+	case 4: /* enumerateCredentialsBegin */
+		cm.rk_rp = cm_find_rp(req, req_len);
+		if (cm.nrp == 0 || cm.rk[cm.rk_rp] == 0)
+			goto none;
+		cm.rk_next = 1;
+		*reply_len = soft_rk(reply, cm.head[cm.rk_rp],
+		    cm.rk[cm.rk_rp]);
+		break;
+	case 5: /* enumerateCredentialsGetNextCredential */
+		assert(cm.rk_next < cm.rk[cm.rk_rp]);
+		*reply_len = soft_rk(reply, (unsigned char)(cm.head[cm.rk_rp] +
+		    cm.rk_next++), -1);
+		break;
+	default:
+		return (SOFT_DEFAULT);
+	}
+
+	return (SOFT_REPLY);
+none:
+	reply[0] = FIDO_ERR_NO_CREDENTIALS;
+	*reply_len = 1;
+
+	return (SOFT_REPLY);
+}
+
+static void
+cm_reset(void)
+{
+	memset(&cm, 0, sizeof(cm));
+	cm.rp[0] = 'a';
+	cm.rk[0] = 3;
+	cm.head[0] = 1;
+	cm.rp[1] = 'b';
+	cm.rk[1] = 1;
+	cm.head[1] = 9;
+	cm.nrp = 2;
+}
+
+struct iter {
+	int		stop;	/* stop at this call; 0 if never */
+	int		calls;
+	unsigned char	seen[CM_MAXRP];
+};
+
+static int
+iter_rk_cb(void *arg, const fido_cred_t *cred, size_t total)
+{
+	struct iter *it = arg;
+
+	assert(total == 3);
+	assert(fido_cred_id_len(cred) == 2);
+	it->seen[it->calls++] = fido_cred_id_ptr(cred)[0];
+
+	return (it->calls == it->stop);
+}
+
+static int
+iter_rp_cb(void *arg, const fido_credman_rp_t *rp, size_t total)
+{
+	struct iter *it = arg;
+
+	assert(total == 2);
+	assert(fido_credman_rp_count(rp) == 1);
+	it->seen[it->calls++] = (unsigned char)fido_credman_rp_id(rp, 0)[0];
+
+	return (it->calls == it->stop ? -1 : 0);
+}
+
+static void
+iter_iff_stop(void)
+{
+	const struct soft_msg rk_first[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 4 },
+	};
+	const struct soft_msg rk_second[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 5 },
+	};
+	const struct soft_msg rk_all[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 5 }, { 0x10, 0x41, 5 },
+	};
+	const struct soft_msg rp_first[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 2 },
+	};
+	const struct soft_msg rp_all[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 2 },
+		{ 0x10, 0x41, 3 },
+	};
+	fido_dev_t	*dev;
+	struct iter	 it;
+
+	soft_reset();
+	soft.cbor = cm_cbor;
+	cm_reset();
+	dev = soft_dev();
+
+	assert(fido_credman_iter_dev_rk(dev, NULL, iter_rk_cb, &it,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_credman_iter_dev_rk(dev, "a", NULL, &it,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_credman_iter_dev_rp(dev, NULL, &it,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	soft_expect(NULL, 0);
+
+	/* a non-zero return stops before the next RK_NEXT */
+	memset(&it, 0, sizeof(it));
+	it.stop = 1;
+	assert(fido_credman_iter_dev_rk(dev, "a", iter_rk_cb, &it,
+	    "1234") == FIDO_OK);
+	assert(it.calls == 1 && it.seen[0] == 1);
+	soft_expect(rk_first, sizeof(rk_first) / sizeof(rk_first[0]));
+
+	memset(&it, 0, sizeof(it));
+	it.stop = 2;
+	assert(fido_credman_iter_dev_rk(dev, "a", iter_rk_cb, &it,
+	    "1234") == FIDO_OK);
+	assert(it.calls == 2 && it.seen[0] == 1 && it.seen[1] == 2);
+	soft_expect(rk_second, sizeof(rk_second) / sizeof(rk_second[0]));
+
+	/* stopping at the last one costs nothing either */
+	memset(&it, 0, sizeof(it));
+	it.stop = 3;
+	assert(fido_credman_iter_dev_rk(dev, "a", iter_rk_cb, &it,
+	    "1234") == FIDO_OK);
+	assert(it.calls == 3 && it.seen[2] == 3);
+	soft_expect(rk_all, sizeof(rk_all) / sizeof(rk_all[0]));
+
+	/* likewise for RP_NEXT */
+	memset(&it, 0, sizeof(it));
+	it.stop = 1;
+	assert(fido_credman_iter_dev_rp(dev, iter_rp_cb, &it,
+	    "1234") == FIDO_OK);
+	assert(it.calls == 1 && it.seen[0] == 'a');
+	soft_expect(rp_first, sizeof(rp_first) / sizeof(rp_first[0]));
+
+	memset(&it, 0, sizeof(it));
+	assert(fido_credman_iter_dev_rp(dev, iter_rp_cb, &it,
+	    "1234") == FIDO_OK);
+	assert(it.calls == 2 && it.seen[0] == 'a' && it.seen[1] == 'b');
+	soft_expect(rp_all, sizeof(rp_all) / sizeof(rp_all[0]));
+
+	/* nothing to iterate over */
+	cm.nrp = 0;
+	memset(&it, 0, sizeof(it));
+	assert(fido_credman_iter_dev_rp(dev, iter_rp_cb, &it,
+	    "1234") == FIDO_ERR_NO_CREDENTIALS);
+	assert(it.calls == 0);
+	soft_expect(rp_first, sizeof(rp_first) / sizeof(rp_first[0]));
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/* 'inv' mirrors the software authenticator */
+static void
+cm_check(const fido_credman_inventory_t *inv)
+{
+	const fido_credman_rp_t	*rp;
+	const fido_credman_rk_t	*rk;
+	const fido_cred_t	*cred;
+
+	rp = fido_credman_inventory_rp(inv);
+	assert(fido_credman_rp_count(rp) == cm.nrp);
+	assert(fido_credman_inventory_rk(inv, cm.nrp) == NULL);
+
+	for (size_t i = 0; i < cm.nrp; i++) {
+		assert(fido_credman_rp_id(rp, i)[0] == cm.rp[i]);
+		assert((rk = fido_credman_inventory_rk(inv, i)) != NULL);
+		assert(fido_credman_rk_count(rk) == (size_t)cm.rk[i]);
+		for (size_t j = 0; j < (size_t)cm.rk[i]; j++) {
+			assert((cred = fido_credman_rk(rk, j)) != NULL);
+			assert(fido_cred_id_len(cred) == 2);
+			assert(fido_cred_id_ptr(cred)[0] == cm.head[i] + j);
+		}
+	}
+}
+
+static void
+inventory_iff_ok(void)
+{
+	const struct soft_msg inventory[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 2 },
+		{ 0x10, 0x41, 3 }, { 0x10, 0x41, 3 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 5 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 5 }, { 0x10, 0x41, 5 },
+	};
+	const struct soft_msg empty[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 2 },
+	};
+	fido_dev_t			*dev;
+	fido_credman_inventory_t	*inv;
+
+	soft_reset();
+	soft.cbor = cm_cbor;
+	cm_reset();
+	cm.rk[0] = 2;
+	cm.rp[2] = 'c';
+	cm.rk[2] = 3;
+	cm.head[2] = 17;
+	cm.nrp = 3;
+	dev = soft_dev();
+	assert((inv = fido_credman_inventory_new()) != NULL);
+
+	assert(fido_credman_get_dev_inventory(dev, inv, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	soft_expect(NULL, 0);
+
+	/* one pinToken for every relying party */
+	assert(fido_credman_get_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(inventory, sizeof(inventory) / sizeof(inventory[0]));
+	cm_check(inv);
+
+	/* no resident credentials: an empty inventory, not an error */
+	cm.nrp = 0;
+	assert(fido_credman_get_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(empty, sizeof(empty) / sizeof(empty[0]));
+	cm_check(inv);
+	assert(fido_credman_inventory_rk(inv, 0) == NULL);
+
+	fido_credman_inventory_free(&inv);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/* deletions seen, and how to answer them */
+static struct {
+	unsigned char	id[16];		/* ids asked for, in order */
+	size_t		n;
+	unsigned char	reject_id;	/* reject the token at this id ... */
+	int		reject;		/* ... this many times */
+	uint8_t		reject_code;
+	unsigned char	missing_id;	/* answer NO_CREDENTIALS */
+} del;
+
+static int
+del_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	unsigned char id = 0;
+
+	if (m->op != 0x41 || m->sub != 6)
+		return (SOFT_DEFAULT);
+
+	for (size_t i = 0; i + 4 < req_len; i++)
+		if (memcmp(req + i, "\x62id\x41", 4) == 0)
+			id = req[i + 4];
+
+	assert(id != 0 && del.n < sizeof(del.id));
+	del.id[del.n++] = id;
+
+	if (id == del.reject_id && del.reject > 0) {
+		del.reject--;
+		reply[0] = del.reject_code;
+	} else if (id == del.missing_id)
+		reply[0] = FIDO_ERR_NO_CREDENTIALS;
+	else
+		reply[0] = FIDO_OK;
+
+	*reply_len = 1;
+
+	return (SOFT_REPLY);
+}
+
+static void
+del_list_iff_reauth(void)
+{
+	const struct soft_msg reauth[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 6 },
+		{ 0x10, 0x41, 6 }, { 0x10, 0x41, 6 }, { 0x10, 0x06, 2 },
+		{ 0x10, 0x06, 5 }, { 0x10, 0x41, 6 }, { 0x10, 0x41, 6 },
+	};
+	const struct soft_msg stop[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 6 },
+		{ 0x10, 0x41, 6 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 6 },
+	};
+	const struct soft_msg missing[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x41, 6 },
+		{ 0x10, 0x41, 6 }, { 0x10, 0x41, 6 }, { 0x10, 0x41, 6 },
+	};
+	const unsigned char	 id[4][1] = { { 1 }, { 2 }, { 3 }, { 4 } };
+	const unsigned char	*id_ptr[4];
+	size_t			 id_len[4];
+	int			 status[4];
+	fido_dev_t		*dev;
+	const uint8_t		 code[2] = {
+		FIDO_ERR_PIN_AUTH_INVALID, FIDO_ERR_PIN_TOKEN_EXPIRED,
+	};
+
+	for (size_t i = 0; i < 4; i++) {
+		id_ptr[i] = id[i];
+		id_len[i] = sizeof(id[i]);
+	}
+
+	soft_reset();
+	soft.cbor = del_cbor;
+	dev = soft_dev();
+
+	assert(fido_credman_del_dev_rk_list(dev, id_ptr, id_len, 4, NULL,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_credman_del_dev_rk_list(dev, id_ptr, id_len, 0, status,
+	    "1234") == FIDO_OK);
+	soft_expect(NULL, 0);
+
+	for (size_t k = 0; k < 2; k++) {
+		/* token rejected at the third id: refetch once, retry it */
+		memset(&del, 0, sizeof(del));
+		del.reject_id = 3;
+		del.reject = 1;
+		del.reject_code = code[k];
+		memset(status, 0xff, sizeof(status));
+		assert(fido_credman_del_dev_rk_list(dev, id_ptr, id_len, 4,
+		    status, "1234") == FIDO_OK);
+		soft_expect(reauth, sizeof(reauth) / sizeof(reauth[0]));
+		assert(del.n == 5);
+		assert(memcmp(del.id, "\x01\x02\x03\x03\x04", 5) == 0);
+		for (size_t i = 0; i < 4; i++)
+			assert(status[i] == FIDO_OK);
+
+		/* rejected again after the refetch: stop there */
+		memset(&del, 0, sizeof(del));
+		del.reject_id = 2;
+		del.reject = 2;
+		del.reject_code = code[k];
+		memset(status, 0xff, sizeof(status));
+		assert(fido_credman_del_dev_rk_list(dev, id_ptr, id_len, 4,
+		    status, "1234") == code[k]);
+		soft_expect(stop, sizeof(stop) / sizeof(stop[0]));
+		assert(del.n == 3);
+		assert(memcmp(del.id, "\x01\x02\x02", 3) == 0);
+		assert(status[0] == FIDO_OK);
+		for (size_t i = 1; i < 4; i++)
+			assert(status[i] == code[k]);
+	}
+
+	/* other errors are per id, and the batch goes on */
+	memset(&del, 0, sizeof(del));
+	del.missing_id = 2;
+	memset(status, 0xff, sizeof(status));
+	assert(fido_credman_del_dev_rk_list(dev, id_ptr, id_len, 4, status,
+	    "1234") == FIDO_OK);
+	soft_expect(missing, sizeof(missing) / sizeof(missing[0]));
+	assert(del.n == 4);
+	assert(status[0] == FIDO_OK);
+	assert(status[1] == FIDO_ERR_NO_CREDENTIALS);
+	assert(status[2] == FIDO_OK);
+	assert(status[3] == FIDO_OK);
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static bool sync_other_aaguid;
+
+static int
+sync_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	if (m->op == 0x04 && sync_other_aaguid) {
+		memcpy(reply, soft_info, sizeof(soft_info));
+		reply[sizeof(soft_info) - 1] = '?';
+		*reply_len = sizeof(soft_info);
+		return (SOFT_REPLY);
+	}
+
+	return (cm_cbor(m, req, req_len, reply, reply_len));
+}
+
+static void
+sync_iff_changed(void)
+{
+	const struct soft_msg full[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 4 }, { 0x10, 0x41, 5 }, { 0x10, 0x41, 5 },
+		{ 0x10, 0x41, 4 },
+	};
+	const struct soft_msg same[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+	};
+	const struct soft_msg new_rp[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 3 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 4 }, { 0x10, 0x41, 5 },
+	};
+	const struct soft_msg new_head[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 3 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 5 },
+		{ 0x10, 0x41, 5 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+	};
+	const struct soft_msg new_aaguid[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 3 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 5 },
+		{ 0x10, 0x41, 5 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 5 },
+	};
+	const struct soft_msg same_aaguid[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 }, { 0x10, 0x41, 2 }, { 0x10, 0x41, 3 },
+		{ 0x10, 0x41, 3 }, { 0x10, 0x41, 4 }, { 0x10, 0x41, 4 },
+		{ 0x10, 0x41, 4 },
+	};
+	const struct soft_msg none[] = {
+		{ 0x10, 0x04, -1 }, { 0x10, 0x06, 2 }, { 0x10, 0x06, 5 },
+		{ 0x10, 0x41, 1 },
+	};
+	fido_dev_t			*dev;
+	fido_credman_inventory_t	*inv;
+
+	soft_reset();
+	soft.cbor = sync_cbor;
+	sync_other_aaguid = false;
+	cm_reset();
+	dev = soft_dev();
+	assert((inv = fido_credman_inventory_new()) != NULL);
+
+	assert(fido_credman_sync_dev_inventory(dev, inv, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	soft_expect(NULL, 0);
+
+	/* nothing to start from */
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(full, sizeof(full) / sizeof(full[0]));
+	cm_check(inv);
+	assert(fido_credman_rk_existing(fido_credman_inventory_metadata(inv))
+	    == 4);
+
+	/* unchanged: one RK_BEGIN per relying party */
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(same, sizeof(same) / sizeof(same[0]));
+	cm_check(inv);
+
+	/* a new relying party is fetched; the others are kept */
+	cm.rp[2] = 'c';
+	cm.rk[2] = 2;
+	cm.head[2] = 17;
+	cm.nrp = 3;
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(new_rp, sizeof(new_rp) / sizeof(new_rp[0]));
+	cm_check(inv);
+
+	/* same count, different first credential: refetched */
+	cm.head[0] = 5;
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(new_head, sizeof(new_head) / sizeof(new_head[0]));
+	cm_check(inv);
+
+	/* another authenticator: everything is refetched, once */
+	sync_other_aaguid = true;
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(new_aaguid, sizeof(new_aaguid) / sizeof(new_aaguid[0]));
+	cm_check(inv);
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(same_aaguid, sizeof(same_aaguid) /
+	    sizeof(same_aaguid[0]));
+	cm_check(inv);
+
+	/* rk_existing == 0: nothing is enumerated */
+	cm.nrp = 0;
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(none, sizeof(none) / sizeof(none[0]));
+	cm_check(inv);
+	assert(fido_credman_rk_existing(fido_credman_inventory_metadata(inv))
+	    == 0);
+
+	/* ... nor on a full sync */
+	fido_credman_inventory_free(&inv);
+	assert((inv = fido_credman_inventory_new()) != NULL);
+	assert(fido_credman_sync_dev_inventory(dev, inv, "1234") == FIDO_OK);
+	soft_expect(none, sizeof(none) / sizeof(none[0]));
+	cm_check(inv);
+
+	fido_credman_inventory_free(&inv);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+#ifdef HAVE_PTHREAD
+static int
+bio_cbor(const struct soft_msg *m, const unsigned char *req, size_t req_len,
+    unsigned char *reply, size_t *reply_len)
+{
+	(void)req;
+	(void)req_len;
+
+	if (m->op != 0x40)
+		return (SOFT_DEFAULT);
+	if (m->sub == 1 || m->sub == 2)
+		return (SOFT_MUTE); /* until bio_touch() */
+
+	reply[0] = FIDO_OK;
+	*reply_len = 1;
+
+	return (SOFT_REPLY);
+}
+
+/* wait for the worker to ask for a sample; returns the subcommand */
+static int
+bio_held(void)
+{
+	struct timespec	ts;
+	int		sub;
+
+	assert(clock_gettime(CLOCK_REALTIME, &ts) == 0);
+	ts.tv_sec += 5;
+
+	soft_lock();
+	while (soft.held == false)
+		assert(pthread_cond_timedwait(&soft_cond, &soft_mutex,
+		    &ts) == 0);
+	assert(soft.log_n > 0);
+	sub = soft.log[soft.log_n - 1].sub;
+	soft_unlock();
+
+	return (sub);
+}
+
+/* complete the sample asked for by 'sub' */
+static void
+bio_touch(int sub, int remaining)
+{
+	unsigned char	reply[10];
+	size_t		len;
+
+	assert(remaining < 0x18);
+
+	if (sub == 1) {
+		/* templateId, lastEnrollSampleStatus, remainingSamples */
+		memcpy(reply, "\x00\xa3\x04\x42\x01\x02\x05\x00\x06", 9);
+		len = 9;
+	} else {
+		memcpy(reply, "\x00\xa2\x05\x00\x06", 5);
+		len = 5;
+	}
+	reply[len++] = (unsigned char)remaining;
+
+	soft_lock();
+	assert(soft.held);
+	soft.held = false;
+	soft_reply(0x10, reply, len);
+	soft_unlock();
+}
+
+/* whether 'fd' becomes readable within 'ms'; drains it */
+static bool
+bio_readable(int fd, int ms)
+{
+	struct pollfd	pfd;
+	unsigned char	buf[16];
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, ms) != 1)
+		return (false);
+
+	assert((pfd.revents & POLLIN) != 0);
+	assert(read(fd, buf, sizeof(buf)) > 0);
+
+	return (true);
+}
+
+static void
+bio_sample_cb(void *arg, uint8_t last_status, uint8_t remaining)
+{
+	int *n = arg;
+
+	assert(last_status == 0);
+	(void)remaining;
+	(*n)++;
+}
+
+static void
+bio_async_iff_ok(void)
+{
+	const struct soft_msg done[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x40, 1 },
+		{ 0x10, 0x40, 2 }, { 0x10, 0x40, 2 },
+	};
+	const struct soft_msg cancel[] = {
+		{ 0x10, 0x06, 2 }, { 0x10, 0x06, 5 }, { 0x10, 0x40, 1 },
+		{ 0x10, 0x40, 2 }, { 0x11, 0, -1 }, { 0x10, 0x40, 3 },
+	};
+	fido_dev_t		*dev;
+	fido_bio_template_t	*t;
+	fido_bio_enroll_t	*e;
+	struct timespec		 ts[2];
+	int			 fd;
+	int			 samples = 0;
+	long			 ms;
+
+	soft_reset();
+	soft.cbor = bio_cbor;
+	dev = soft_dev();
+	soft.wait = true;
+
+	assert((t = fido_bio_template_new()) != NULL);
+	assert((e = fido_bio_enroll_new()) != NULL);
+	assert(fido_bio_enroll_set_cb(e, bio_sample_cb, &samples) == FIDO_OK);
+	assert(fido_bio_enroll_fd(e) == -1);
+	assert(fido_bio_enroll_wait(e, 0) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_bio_enroll_cancel(e) == FIDO_ERR_INVALID_ARGUMENT);
+
+	/* begin and continue, to the last sample */
+	assert(fido_bio_dev_enroll_start(dev, t, e, 1000, "1234") == FIDO_OK);
+	assert((fd = fido_bio_enroll_fd(e)) >= 0);
+	assert(fido_bio_dev_enroll_start(dev, t, e, 1000, "1234") ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_bio_enroll_set_cb(e, NULL, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(bio_held() == 1);
+
+	/* nothing to report while a capture is pending */
+	assert(bio_readable(fd, 0) == false);
+	assert(fido_bio_enroll_wait(e, 0) == FIDO_ERR_TIMEOUT);
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts[0]) == 0);
+	assert(fido_bio_enroll_wait(e, 100) == FIDO_ERR_TIMEOUT);
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts[1]) == 0);
+	ms = (ts[1].tv_sec - ts[0].tv_sec) * 1000L +
+	    (ts[1].tv_nsec - ts[0].tv_nsec) / 1000000L;
+	assert(ms >= 99);
+
+	for (int remaining = 2; remaining >= 0; remaining--) {
+		bio_touch(remaining == 2 ? 1 : 2, remaining);
+		assert(bio_readable(fd, 5000));
+		assert(fido_bio_enroll_remaining_samples(e) == remaining);
+		if (remaining > 0)
+			assert(bio_held() == 2);
+	}
+
+	assert(fido_bio_enroll_wait(e, -1) == FIDO_OK);
+	assert(fido_bio_enroll_fd(e) == -1);
+	assert(samples == 3);
+	assert(fido_bio_template_id_len(t) == 2);
+	soft_expect(done, sizeof(done) / sizeof(done[0]));
+
+	fido_bio_enroll_free(&e);
+	fido_bio_template_free(&t);
+
+	/* cancelled while waiting for the second sample */
+	assert((t = fido_bio_template_new()) != NULL);
+	assert((e = fido_bio_enroll_new()) != NULL);
+	assert(fido_bio_dev_enroll_start(dev, t, e, 1000, "1234") == FIDO_OK);
+	assert((fd = fido_bio_enroll_fd(e)) >= 0);
+	assert(bio_held() == 1);
+	bio_touch(1, 2);
+	assert(bio_readable(fd, 5000));
+	assert(bio_held() == 2);
+	assert(fido_bio_enroll_cancel(e) == FIDO_OK);
+	assert(bio_readable(fd, 5000));
+	assert(fido_bio_enroll_wait(e, -1) == FIDO_ERR_KEEPALIVE_CANCEL);
+	assert(fido_bio_enroll_remaining_samples(e) == 2);
+	soft_expect(cancel, sizeof(cancel) / sizeof(cancel[0]));
+
+	fido_bio_enroll_free(&e);
+	fido_bio_template_free(&t);
+	soft.wait = false;
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+#endif /* HAVE_PTHREAD */
+
 int
 main(void)
 {
 	fido_init(0);
 
 	open_iff_ok();
+	stats_iff_tx();
+	mux_iff_ok();
+#ifdef HAVE_PTHREAD
+	mux_iff_interleaved();
+#endif
+	busy_iff_retry();
+	open_many_iff_timeout();
+	lock_iff_ok();
+	ping_iff_echo();
+	keepalive_iff_ok();
+	ecdh_pool_iff_ok();
+	assert_batch_iff_ok();
+	iter_iff_stop();
+	inventory_iff_ok();
+	del_list_iff_reauth();
+	sync_iff_changed();
+#ifdef HAVE_PTHREAD
+	bio_async_iff_ok();
+#endif
 
 	exit(0);
 }
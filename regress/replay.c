@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Replay of a session recorded by fuzz/preload-snoop.c through a
+ * fido_dev_io_t. Reports read by libfido2 are served from the session,
+ * either as fast as possible or, with -r, respecting the delays between
+ * them; reports written by libfido2 are consumed, but their contents
+ * are not checked. The nonce of CTAPHID_INIT replies is patched to
+ * match the request, so that fido_dev_open() succeeds.
+ *
+ * Without arguments, a synthetic session is replayed as a self-test.
+ * Otherwise:
+ *
+ *	regress_replay [-r] [-n count] [-p pin] session info|retries|rp
+ *
+ * opens the session 'count' times, performs the given operation, and
+ * reports the latency of each iteration.
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <fido.h>
+#include <fido/credman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fuzz/wiredata_fido2.h"
+
+#define REPORT_LEN	64
+#define MAXRECLEN	1024
+
+struct rec {
+	char		 dir;	/* '<' from the device, '>' to the device */
+	unsigned long long us;	/* time since open */
+	size_t		 len;
+	unsigned char	*ptr;
+};
+
+static struct session {
+	struct rec	*rec;
+	size_t		 n;
+	int		 realtime;
+} session;
+
+struct cursor {
+	size_t		pos;
+	unsigned long long prev_us;
+	struct timespec	prev_ts;
+	unsigned char	nonce[8];
+};
+
+static unsigned long long
+elapsed_us(const struct timespec *since)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+		err(1, "clock_gettime");
+
+	return ((unsigned long long)(now.tv_sec - since->tv_sec) * 1000000ULL +
+	    (unsigned long long)(now.tv_nsec / 1000) -
+	    (unsigned long long)(since->tv_nsec / 1000));
+}
+
+static void
+sleep_us(unsigned long long us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(us / 1000000ULL);
+	ts.tv_nsec = (long)(us % 1000000ULL) * 1000L;
+
+	while (nanosleep(&ts, &ts) < 0)
+		continue;
+}
+
+static int
+unhex(const char *s, unsigned char *ptr, size_t *len)
+{
+	size_t n = strlen(s);
+	unsigned int x;
+
+	if (n % 2 != 0 || n / 2 > *len)
+		return (-1);
+
+	for (size_t i = 0; i < n / 2; i++) {
+		if (sscanf(s + 2 * i, "%2x", &x) != 1)
+			return (-1);
+		ptr[i] = (unsigned char)x;
+	}
+
+	*len = n / 2;
+
+	return (0);
+}
+
+static void
+session_add(char dir, unsigned long long us, const unsigned char *ptr,
+    size_t len)
+{
+	struct rec *r;
+
+	if ((session.rec = realloc(session.rec, (session.n + 1) *
+	    sizeof(*session.rec))) == NULL)
+		err(1, "realloc");
+
+	r = &session.rec[session.n++];
+	r->dir = dir;
+	r->us = us;
+	r->len = len;
+
+	if ((r->ptr = malloc(len)) == NULL)
+		err(1, "malloc");
+
+	memcpy(r->ptr, ptr, len);
+}
+
+static void
+session_load(FILE *f)
+{
+	char			line[2 * MAXRECLEN + 64];
+	char			hex[2 * MAXRECLEN + 1];
+	unsigned char		buf[MAXRECLEN];
+	unsigned long long	us;
+	size_t			len;
+	char			dir;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		len = sizeof(buf);
+		if (sscanf(line, "%c %llu %2048s", &dir, &us, hex) != 3 ||
+		    (dir != '<' && dir != '>') || unhex(hex, buf, &len) < 0)
+			errx(1, "invalid session line: %s", line);
+		session_add(dir, us, buf, len);
+	}
+}
+
+static void
+session_free(void)
+{
+	for (size_t i = 0; i < session.n; i++)
+		free(session.rec[i].ptr);
+
+	free(session.rec);
+	memset(&session, 0, sizeof(session));
+}
+
+static int
+is_init(const unsigned char *ptr, size_t len)
+{
+	return (len >= 15 && memcmp(ptr, "\xff\xff\xff\xff\x86", 5) == 0);
+}
+
+static void *
+replay_open(const char *path)
+{
+	struct cursor *c;
+
+	(void)path;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL ||
+	    clock_gettime(CLOCK_MONOTONIC, &c->prev_ts) < 0)
+		err(1, "replay_open");
+
+	return (c);
+}
+
+static void
+replay_close(void *handle)
+{
+	free(handle);
+}
+
+static int
+replay_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	struct cursor		*c = handle;
+	const struct rec	*r;
+	unsigned long long	 due;
+	unsigned long long	 now;
+
+	if (c->pos >= session.n || (r = &session.rec[c->pos])->dir != '<') {
+		/* nothing recorded here; the original read timed out */
+		if (session.realtime && ms > 0)
+			sleep_us((unsigned long long)ms * 1000ULL);
+		return (-1);
+	}
+
+	if (session.realtime) {
+		due = r->us > c->prev_us ? r->us - c->prev_us : 0;
+		if ((now = elapsed_us(&c->prev_ts)) < due) {
+			if (ms >= 0 && due - now > (unsigned long long)ms *
+			    1000ULL) {
+				sleep_us((unsigned long long)ms * 1000ULL);
+				return (-1);
+			}
+			sleep_us(due - now);
+		}
+	}
+
+	if (len > r->len)
+		len = r->len;
+
+	memcpy(ptr, r->ptr, len);
+
+	if (is_init(ptr, len))
+		memcpy(ptr + 7, c->nonce, sizeof(c->nonce));
+
+	c->pos++;
+	c->prev_us = r->us;
+	if (clock_gettime(CLOCK_MONOTONIC, &c->prev_ts) < 0)
+		return (-1);
+
+	return ((int)len);
+}
+
+static int
+replay_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	struct cursor		*c = handle;
+	const struct rec	*r;
+
+	if (c->pos >= session.n || (r = &session.rec[c->pos])->dir != '>') {
+		warnx("%s: session diverged at record %zu", __func__, c->pos);
+		return (-1);
+	}
+
+	/* skip the report id */
+	if (len > 1 && is_init(ptr + 1, len - 1))
+		memcpy(c->nonce, ptr + 8, sizeof(c->nonce));
+
+	c->pos++;
+	c->prev_us = r->us;
+	if (clock_gettime(CLOCK_MONOTONIC, &c->prev_ts) < 0)
+		return (-1);
+
+	return ((int)len);
+}
+
+static fido_dev_t *
+replay_dev(void)
+{
+	fido_dev_t	*dev;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = replay_open;
+	io.close = replay_close;
+	io.read = replay_read;
+	io.write = replay_write;
+
+	if ((dev = fido_dev_new()) == NULL ||
+	    fido_dev_set_io_functions(dev, &io) != FIDO_OK)
+		errx(1, "replay_dev");
+
+	return (dev);
+}
+
+static void
+add_reports(char dir, unsigned long long us, const unsigned char *ptr,
+    size_t len)
+{
+	unsigned char report[REPORT_LEN + 1];
+
+	for (size_t i = 0; i < len; i += REPORT_LEN) {
+		if (dir == '>') {
+			memset(report, 0, sizeof(report));
+			memcpy(report + 1, ptr + i, REPORT_LEN);
+			session_add(dir, us, report, sizeof(report));
+		} else
+			session_add(dir, us, ptr + i, REPORT_LEN);
+	}
+}
+
+/* open + authenticatorGetInfo, with 'gap_us' before each reply */
+static void
+synthetic_session(unsigned long long gap_us)
+{
+	const unsigned char	init[] = { WIREDATA_CTAP_INIT };
+	const unsigned char	info[] = { WIREDATA_CTAP_CBOR_INFO };
+	unsigned char		req[REPORT_LEN];
+	unsigned long long	us = 0;
+
+	memset(req, 0, sizeof(req));
+
+	add_reports('>', us, req, sizeof(req));
+	add_reports('<', us += gap_us, init, sizeof(init));
+
+	for (int i = 0; i < 2; i++) {
+		add_reports('>', us, req, sizeof(req));
+		add_reports('<', us += gap_us, info, sizeof(info));
+	}
+}
+
+static void
+replay_iff_ok(void)
+{
+	fido_dev_t		*dev;
+	fido_cbor_info_t	*ci;
+	struct timespec		 ts;
+
+	synthetic_session(0);
+	dev = replay_dev();
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_open(dev, "session") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_cbor_info_versions_len(ci) == 3);
+	assert(fido_cbor_info_aaguid_len(ci) == 16);
+	/* the session is exhausted */
+	assert(fido_dev_get_cbor_info(dev, ci) != FIDO_OK);
+	fido_dev_close(dev);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	session_free();
+
+	/* at original speed, two 50ms gaps take at least 100ms */
+	synthetic_session(50000);
+	session.realtime = 1;
+	dev = replay_dev();
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	assert(fido_dev_open(dev, "session") == FIDO_OK);
+	assert(elapsed_us(&ts) >= 100000);
+	fido_dev_close(dev);
+	fido_dev_free(&dev);
+	session_free();
+}
+
+static int
+run_op(fido_dev_t *dev, const char *op, const char *pin)
+{
+	fido_cbor_info_t	*ci = NULL;
+	fido_credman_rp_t	*rp = NULL;
+	int			 n;
+	int			 r;
+
+	if (strcmp(op, "info") == 0) {
+		if ((ci = fido_cbor_info_new()) == NULL)
+			errx(1, "fido_cbor_info_new");
+		r = fido_dev_get_cbor_info(dev, ci);
+		fido_cbor_info_free(&ci);
+	} else if (strcmp(op, "retries") == 0) {
+		r = fido_dev_get_retry_count(dev, &n);
+	} else if (strcmp(op, "rp") == 0) {
+		if ((rp = fido_credman_rp_new()) == NULL)
+			errx(1, "fido_credman_rp_new");
+		r = fido_credman_get_dev_rp(dev, rp, pin);
+		fido_credman_rp_free(&rp);
+	} else
+		errx(1, "unknown operation %s", op);
+
+	return (r);
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+	const unsigned long long x = *(const unsigned long long *)a;
+	const unsigned long long y = *(const unsigned long long *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: regress_replay [-r] [-n count] [-p pin] "
+	    "session info|retries|rp\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	fido_dev_t		*dev;
+	FILE			*f;
+	struct timespec		 ts;
+	unsigned long long	*us;
+	const char		*pin = NULL;
+	long			 count = 1;
+	int			 ch;
+	int			 r;
+
+	fido_init(0);
+
+	if (argc == 1) {
+		replay_iff_ok();
+		exit(0);
+	}
+
+	while ((ch = getopt(argc, argv, "n:p:r")) != -1) {
+		switch (ch) {
+		case 'n':
+			if ((count = strtol(optarg, NULL, 10)) < 1 ||
+			    count > 1000000)
+				errx(1, "invalid count");
+			break;
+		case 'p':
+			pin = optarg;
+			break;
+		case 'r':
+			session.realtime = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2)
+		usage();
+	if ((f = fopen(argv[0], "r")) == NULL)
+		err(1, "%s", argv[0]);
+
+	session_load(f);
+	fclose(f);
+
+	if ((us = calloc((size_t)count, sizeof(*us))) == NULL)
+		err(1, "calloc");
+
+	for (long i = 0; i < count; i++) {
+		dev = replay_dev();
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+			err(1, "clock_gettime");
+		if ((r = fido_dev_open(dev, "session")) != FIDO_OK ||
+		    (r = run_op(dev, argv[1], pin)) != FIDO_OK)
+			errx(1, "iteration %ld: %s", i, fido_strerr(r));
+		us[i] = elapsed_us(&ts);
+		fido_dev_close(dev);
+		fido_dev_free(&dev);
+	}
+
+	qsort(us, (size_t)count, sizeof(*us), cmp_ull);
+	printf("%ld iteration(s): min %lluus, median %lluus, max %lluus\n",
+	    count, us[0], us[count / 2], us[count - 1]);
+
+	free(us);
+	session_free();
+
+	exit(0);
+}
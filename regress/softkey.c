@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "softkey.h"
+
+/*
+ * Open a pseudo-terminal; the slave is kept open and raw, so that it
+ * reads like hidraw. Returns -1 if there are no pseudo-terminals.
+ */
+int
+softkey_open(int *master, int *slave, const char **path)
+{
+	struct termios tio;
+
+	if ((*master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+	    grantpt(*master) < 0 || unlockpt(*master) < 0 ||
+	    (*path = ptsname(*master)) == NULL)
+		return (-1);
+
+	if ((*slave = open(*path, O_RDWR | O_NOCTTY)) < 0 ||
+	    tcgetattr(*slave, &tio) < 0)
+		err(1, "%s", *path);
+	cfmakeraw(&tio);
+	tio.c_cc[VMIN] = SOFTKEY_REPORT_LEN;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(*slave, TCSANOW, &tio) < 0)
+		err(1, "tcsetattr");
+
+	return (0);
+}
+
+void
+softkey_reply(int fd, uint32_t cid, uint8_t cmd, const unsigned char *ptr,
+    size_t len)
+{
+	unsigned char frame[SOFTKEY_REPORT_LEN];
+
+	assert(len <= sizeof(frame) - 7);
+
+	memset(frame, 0, sizeof(frame));
+	memcpy(frame, &cid, 4);
+	frame[4] = cmd | 0x80;
+	frame[5] = (unsigned char)((len >> 8) & 0xff);
+	frame[6] = (unsigned char)(len & 0xff);
+	if (len > 0)
+		memcpy(frame + 7, ptr, len);
+
+	if (write(fd, frame, sizeof(frame)) != (ssize_t)sizeof(frame))
+		err(1, "write");
+}
+
+/* answer CTAPHID_INIT: a new cid, and the cbor capability */
+void
+softkey_init(int fd, uint32_t cid, const unsigned char *nonce)
+{
+	unsigned char init[17];
+
+	memset(init, 0, sizeof(init));
+	memcpy(init, nonce, 8);
+	init[8] = 0x01;		/* cid */
+	init[12] = 2;		/* protocol */
+	init[16] = 0x04;	/* caps: cbor */
+
+	softkey_reply(fd, cid, SOFTKEY_CMD_INIT, init, sizeof(init));
+}
+
+static int
+softkey_read(int fd, unsigned char *ptr, size_t len)
+{
+	ssize_t r;
+
+	for (size_t got = 0; got < len; got += (size_t)r)
+		if ((r = read(fd, ptr + got, len - got)) <= 0)
+			return (-1);
+
+	return (0);
+}
+
+/*
+ * hand requests to 'cb' until the pty is closed; only the first frame of
+ * a request is looked at
+ */
+void
+softkey_run(int fd, softkey_cb_t *cb, void *arg)
+{
+	unsigned char	report[SOFTKEY_REPORT_LEN + 1]; /* report id */
+	uint32_t	cid;
+
+	while (softkey_read(fd, report, sizeof(report)) == 0) {
+		if ((report[5] & 0x80) == 0)
+			continue;
+		memcpy(&cid, report + 1, 4);
+		cb(arg, fd, cid, report[5] & 0x7f, report + 8,
+		    (size_t)((report[6] << 8) | report[7]));
+	}
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#ifndef _SOFTKEY_H
+#define _SOFTKEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A minimal authenticator behind a pseudo-terminal, which stands in for
+ * a hidraw node: the slave is opened by libfido2 as a device, and the
+ * authenticator reads and writes 64-byte reports on the master.
+ */
+#define SOFTKEY_REPORT_LEN	64
+
+#define SOFTKEY_CMD_PING	0x01
+#define SOFTKEY_CMD_INIT	0x06
+#define SOFTKEY_CMD_CBOR	0x10
+#define SOFTKEY_CMD_CANCEL	0x11
+
+/*
+ * Called with the first frame of each request; 'ptr' points to the
+ * payload it carries, and 'len' is the length of the whole payload.
+ */
+typedef void softkey_cb_t(void *, int, uint32_t, uint8_t,
+    const unsigned char *, size_t);
+
+int softkey_open(int *, int *, const char **);
+void softkey_init(int, uint32_t, const unsigned char *);
+void softkey_reply(int, uint32_t, uint8_t, const unsigned char *, size_t);
+void softkey_run(int, softkey_cb_t *, void *);
+
+#endif /* !_SOFTKEY_H */
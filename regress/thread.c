@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <assert.h>
+#include <fido.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REPORT_LEN	(64 + 1)
+#define NTHREADS	16
+#define NITER		200
+
+/*
+ * Per-handle fake authenticator answering CTAPHID_INIT, CTAPHID_PING and
+ * CTAPHID_MSG with single-frame replies. Each fido_dev_t gets its own
+ * handle, so handles are never shared between threads.
+ */
+struct fake {
+	unsigned char	reply[REPORT_LEN - 1];
+	bool		pending;
+	int		gate[2];	/* if armed, read blocks on gate[0] */
+	int		armed;
+	int		reading;
+};
+
+static struct fake	*gated_fake;
+static uint64_t		 log_records;
+static int		 msg_sw = 0x9000;	/* CTAPHID_MSG status word */
+static int		 call_gate;		/* see dev_call() */
+
+/* records seen by tally_record() */
+static struct {
+	pthread_t	main;
+	const void	*dev;		/* compared, never dereferenced */
+	uint64_t	level[3];
+	uint64_t	dev_records;
+	uint64_t	dropped;
+	bool		on_main;	/* a record was delivered on 'main' */
+	int		gate;		/* if set, block until cleared */
+} tally;
+
+static void *
+fake_open(const char *path)
+{
+	struct fake *f;
+
+	(void)path;
+
+	assert((f = calloc(1, sizeof(*f))) != NULL);
+	f->gate[0] = f->gate[1] = -1;
+
+	return (f);
+}
+
+static void *
+fake_open_gated(const char *path)
+{
+	struct fake *f = fake_open(path);
+
+	assert(pipe(f->gate) == 0);
+	gated_fake = f;
+
+	return (f);
+}
+
+static void
+fake_close(void *handle)
+{
+	struct fake *f = handle;
+
+	if (f->gate[0] != -1) {
+		close(f->gate[0]);
+		close(f->gate[1]);
+	}
+
+	free(f);
+}
+
+static int
+fake_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	struct fake	*f = handle;
+	char		 c;
+
+	(void)ms;
+
+	assert(len == sizeof(f->reply));
+
+	if (f->pending == false)
+		return (-1);
+
+	if (__atomic_load_n(&f->armed, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&f->reading, 1, __ATOMIC_RELEASE);
+		assert(read(f->gate[0], &c, 1) == 1);
+	}
+
+	memcpy(ptr, f->reply, len);
+	f->pending = false;
+
+	return ((int)len);
+}
+
+static int
+fake_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	struct fake	*f = handle;
+	uint32_t	 cid = 0x01020304;
+
+	assert(len == REPORT_LEN);
+
+	/* a request sent before the previous reply was read replaces it */
+	if ((ptr[5] & 0x80) == 0)				/* CONT */
+		return ((int)len);
+
+	memset(f->reply, 0, sizeof(f->reply));
+	memcpy(f->reply, ptr + 1, 4 + 1);			/* cid, cmd */
+	f->pending = true;
+
+	if (ptr[5] == 0x86) {					/* INIT */
+		f->reply[6] = 17;				/* bcnt */
+		memcpy(f->reply + 7, ptr + 8, 8);		/* nonce */
+		memcpy(f->reply + 15, &cid, sizeof(cid));	/* new cid */
+		f->reply[19] = 2;				/* protocol */
+	} else if (ptr[5] == 0x83) {				/* MSG */
+		f->reply[6] = 2;				/* bcnt */
+		f->reply[7] = (unsigned char)(msg_sw >> 8);
+		f->reply[8] = (unsigned char)(msg_sw & 0xff);
+	} else {						/* PING */
+		assert(ptr[5] == 0x81 && ptr[6] == 0 && ptr[7] <= 57);
+		memcpy(f->reply + 5, ptr + 6, 2 + ptr[7]);	/* echo */
+	}
+
+	return ((int)len);
+}
+
+static void
+count_record(const fido_log_record_t *rec)
+{
+	if (fido_log_record_dev(rec) != NULL)
+		__atomic_add_fetch(&log_records, 1, __ATOMIC_RELAXED);
+}
+
+static void
+tally_record(const fido_log_record_t *rec)
+{
+	unsigned long long	n;
+	int			level = fido_log_record_level(rec);
+
+	while (__atomic_load_n(&tally.gate, __ATOMIC_ACQUIRE))
+		usleep(1000);
+
+	if (pthread_equal(pthread_self(), tally.main))
+		tally.on_main = true;
+	if (sscanf(fido_log_record_msg(rec), "ring_drain: %llu records dropped",
+	    &n) == 1) {
+		assert(fido_log_record_dev(rec) == NULL);
+		tally.dropped += n;
+		return;
+	}
+
+	assert(level == FIDO_LOG_DEBUG || level == FIDO_LOG_XXD);
+	assert(fido_log_record_thread(rec) != 0);
+	assert(fido_log_record_time_us(rec) != 0);
+	tally.level[level]++;
+	if (fido_log_record_dev(rec) == tally.dev && tally.dev != NULL)
+		tally.dev_records++;
+}
+
+static void
+tally_reset(void)
+{
+	memset(&tally, 0, sizeof(tally));
+	tally.main = pthread_self();
+}
+
+static uint64_t
+tally_total(void)
+{
+	return (tally.level[FIDO_LOG_DEBUG] + tally.level[FIDO_LOG_XXD]);
+}
+
+/* once armed, stop the first thread past a credential lookup */
+static void
+gate_record(const fido_log_record_t *rec)
+{
+	int armed = 1;
+
+	if (strstr(fido_log_record_msg(rec), ": not found") == NULL ||
+	    __atomic_compare_exchange_n(&call_gate, &armed, 2, false,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false)
+		return;
+
+	while (__atomic_load_n(&call_gate, __ATOMIC_ACQUIRE) == 2)
+		usleep(1000);
+}
+
+static fido_dev_t *
+open_fake(bool gated)
+{
+	fido_dev_t	*dev;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = gated ? fake_open_gated : fake_open;
+	io.close = fake_close;
+	io.read = fake_read;
+	io.write = fake_write;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "fake") == FIDO_OK);
+
+	return (dev);
+}
+
+static void *
+manifest_worker(void *arg)
+{
+	fido_dev_info_t	*devlist;
+	size_t		 ndevs;
+
+	(void)arg;
+
+	assert((devlist = fido_dev_info_new(64)) != NULL);
+
+	for (int i = 0; i < NITER; i++)
+		assert(fido_dev_info_manifest(devlist, 64, &ndevs) == FIDO_OK);
+
+	fido_dev_info_free(&devlist, 64);
+
+	return (NULL);
+}
+
+static void *
+dev_worker(void *arg)
+{
+	const unsigned char	 data[] = "libfido2";
+	fido_dev_t		*dev;
+
+	(void)arg;
+
+	for (int i = 0; i < NITER / 10; i++) {
+		dev = open_fake(false);
+		for (int j = 0; j < 10; j++)
+			assert(fido_dev_ping(dev, data, sizeof(data)) ==
+			    FIDO_OK);
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+	}
+
+	return (NULL);
+}
+
+static void *
+ping_worker(void *arg)
+{
+	const unsigned char data[] = "handoff";
+
+	assert(fido_dev_ping(arg, data, sizeof(data)) == FIDO_OK);
+
+	return (NULL);
+}
+
+static int
+get_assert(fido_dev_t *dev)
+{
+	const unsigned char	 cdh[32] = { 0 };
+	const unsigned char	 id[2][16] = { { 1 }, { 2 } };
+	fido_assert_t		*assert;
+	int			 r;
+
+	assert((assert = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(assert, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(assert, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	for (size_t i = 0; i < 2; i++)
+		assert(fido_assert_allow_cred(assert, id[i],
+		    sizeof(id[i])) == FIDO_OK);
+
+	r = fido_dev_get_assert(dev, assert, NULL);
+	fido_assert_free(&assert);
+
+	return (r);
+}
+
+static void *
+assert_worker(void *arg)
+{
+	assert(get_assert(arg) == FIDO_ERR_NO_CREDENTIALS);
+
+	return (NULL);
+}
+
+static void *
+touch_worker(void *arg)
+{
+	assert(fido_dev_get_touch_begin(arg) == FIDO_OK);
+
+	return (NULL);
+}
+
+/* concurrent fido_dev_info_manifest() calls */
+static void
+manifest_concurrent(void)
+{
+	pthread_t thread[NTHREADS];
+
+	for (size_t i = 0; i < NTHREADS; i++)
+		assert(pthread_create(&thread[i], NULL, manifest_worker,
+		    NULL) == 0);
+	for (size_t i = 0; i < NTHREADS; i++)
+		assert(pthread_join(thread[i], NULL) == 0);
+}
+
+/* one device per thread; log settings made here apply to the workers */
+static void
+dev_per_thread(void)
+{
+	pthread_t thread[NTHREADS];
+
+	fido_init(FIDO_DEBUG);
+	fido_set_log_level(FIDO_LOG_DEBUG);
+	fido_set_log_record_handler(count_record);
+
+	for (size_t i = 0; i < NTHREADS; i++)
+		assert(pthread_create(&thread[i], NULL, dev_worker,
+		    NULL) == 0);
+	for (size_t i = 0; i < NTHREADS; i++)
+		assert(pthread_join(thread[i], NULL) == 0);
+
+	assert(__atomic_load_n(&log_records, __ATOMIC_RELAXED) > 0);
+
+	fido_set_log_record_handler(NULL);
+	fido_set_log_level(FIDO_LOG_NONE);
+}
+
+/* a device may be handed from one thread to another between calls */
+static void
+dev_handoff(void)
+{
+	const unsigned char	 data[] = "handoff";
+	fido_dev_t		*dev;
+	pthread_t		 thread;
+
+	dev = open_fake(false);
+
+	for (int i = 0; i < 10; i++) {
+		assert(pthread_create(&thread, NULL, ping_worker, dev) == 0);
+		assert(pthread_join(thread, NULL) == 0);
+		assert(fido_dev_ping(dev, data, sizeof(data)) == FIDO_OK);
+	}
+
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/*
+ * Overlapping use of a device is refused, and aborts the process in debug
+ * builds; run it in a child and accept either outcome.
+ */
+static void
+dev_overlap(void)
+{
+	const unsigned char	 data[] = "overlap";
+	fido_dev_t		*dev;
+	pthread_t		 thread;
+	pid_t			 pid;
+	int			 status;
+
+	assert((pid = fork()) != -1);
+
+	if (pid == 0) {
+		dev = open_fake(true);
+		__atomic_store_n(&gated_fake->armed, 1, __ATOMIC_RELEASE);
+		assert(pthread_create(&thread, NULL, ping_worker, dev) == 0);
+		while (__atomic_load_n(&gated_fake->reading,
+		    __ATOMIC_ACQUIRE) == 0)
+			usleep(1000);
+		assert(fido_dev_ping(dev, data, sizeof(data)) == FIDO_ERR_TX);
+		assert(write(gated_fake->gate[1], "", 1) == 1);
+		assert(pthread_join(thread, NULL) == 0);
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+		_exit(0);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert((WIFEXITED(status) && WEXITSTATUS(status) == 0) ||
+	    (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT));
+}
+
+/*
+ * A transaction belongs to the thread that sent its request: another
+ * thread may not send a request of its own before the reply has been
+ * read. The reply to a request handed off by fido_dev_get_touch_begin()
+ * may be read by any thread. As above, the refusal may abort the child.
+ */
+static void
+dev_interleave(void)
+{
+	const unsigned char	 data[] = "interleave";
+	fido_dev_t		*dev;
+	pthread_t		 thread;
+	pid_t			 pid;
+	int			 status;
+	int			 touched;
+
+	assert((pid = fork()) != -1);
+
+	if (pid == 0) {
+		dev = open_fake(false);
+		assert(pthread_create(&thread, NULL, touch_worker, dev) == 0);
+		assert(pthread_join(thread, NULL) == 0);
+		/* not assert(), whose failure would pass for a refusal */
+		if (fido_dev_ping(dev, data, sizeof(data)) != FIDO_ERR_TX)
+			_exit(1);
+		assert(fido_dev_get_touch_status(dev, &touched, -1) ==
+		    FIDO_OK);
+		assert(touched == 1);
+		assert(fido_dev_ping(dev, data, sizeof(data)) == FIDO_OK);
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+		_exit(0);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert((WIFEXITED(status) && WEXITSTATUS(status) == 0) ||
+	    (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT));
+}
+
+/*
+ * A library call belongs to the thread that started it until it
+ * completes: another thread may not start a call of its own between the
+ * call's transactions. Here, the first thread is stopped between the
+ * lookups of two credentials, whose transactions are complete; the other
+ * call is refused, which may abort the child as above.
+ */
+static void
+dev_call(void)
+{
+	fido_dev_t	*dev;
+	pthread_t	 thread;
+	pid_t		 pid;
+	int		 status;
+
+	assert((pid = fork()) != -1);
+
+	if (pid == 0) {
+		msg_sw = 0x6a80;				/* SW_WRONG_DATA */
+		dev = open_fake(false);
+		fido_init(FIDO_DEBUG);
+		fido_set_log_level(FIDO_LOG_DEBUG);
+		fido_set_log_record_handler(gate_record);
+		__atomic_store_n(&call_gate, 1, __ATOMIC_RELEASE);
+		assert(pthread_create(&thread, NULL, assert_worker, dev) == 0);
+		while (__atomic_load_n(&call_gate, __ATOMIC_ACQUIRE) != 2)
+			usleep(1000);
+		/* not assert(), whose failure would pass for a refusal */
+		if (get_assert(dev) != FIDO_ERR_TX)
+			_exit(1);
+		__atomic_store_n(&call_gate, 0, __ATOMIC_RELEASE);
+		assert(pthread_join(thread, NULL) == 0);
+		assert(get_assert(dev) == FIDO_ERR_NO_CREDENTIALS);
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+		_exit(0);
+	}
+
+	assert(waitpid(pid, &status, 0) == pid);
+	assert((WIFEXITED(status) && WEXITSTATUS(status) == 0) ||
+	    (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT));
+}
+
+/* open a device, ping it, and free it; tally.dev is set to its address */
+static void
+log_workload(void)
+{
+	const unsigned char	 data[] = "log";
+	fido_dev_t		*dev;
+
+	dev = open_fake(false);
+	tally.dev = dev;
+	assert(fido_dev_ping(dev, data, sizeof(data)) == FIDO_OK);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/* records below the log level are not emitted */
+static void
+log_level_filter(void)
+{
+	fido_init(FIDO_DEBUG);
+	fido_set_log_record_handler(tally_record);
+
+	tally_reset();
+	fido_set_log_level(FIDO_LOG_XXD);
+	log_workload();
+	assert(tally.level[FIDO_LOG_DEBUG] > 0);
+	assert(tally.level[FIDO_LOG_XXD] > 0);
+	assert(tally.dev_records > 0);
+	assert(tally.on_main);
+
+	tally_reset();
+	fido_set_log_level(FIDO_LOG_DEBUG);
+	log_workload();
+	assert(tally.level[FIDO_LOG_DEBUG] > 0);
+	assert(tally.level[FIDO_LOG_XXD] == 0);
+
+	tally_reset();
+	fido_set_log_level(FIDO_LOG_NONE);
+	log_workload();
+	assert(tally_total() == 0);
+
+	fido_set_log_record_handler(NULL);
+}
+
+/*
+ * Asynchronous delivery hands the same records to the handler on another
+ * thread, also once their device is gone; records that don't fit in the
+ * ring are counted, and the count is delivered.
+ */
+static void
+log_async(void)
+{
+	uint64_t n;
+
+	fido_init(FIDO_DEBUG);
+	fido_set_log_level(FIDO_LOG_XXD);
+	fido_set_log_record_handler(tally_record);
+
+	tally_reset();
+	log_workload();
+	n = tally_total();
+	assert(n > 4);
+
+	tally_reset();
+	assert(fido_log_async_start(1024) == FIDO_OK);
+	log_workload();
+	fido_log_async_stop();
+	assert(tally_total() == n);
+	assert(tally.dev_records > 0);
+	assert(tally.dropped == 0);
+	assert(tally.on_main == false);
+
+	/* a ring of two, whose consumer is stuck on the first record */
+	tally_reset();
+	__atomic_store_n(&tally.gate, 1, __ATOMIC_RELEASE);
+	assert(fido_log_async_start(2) == FIDO_OK);
+	log_workload();
+	__atomic_store_n(&tally.gate, 0, __ATOMIC_RELEASE);
+	fido_log_async_stop();
+	assert(tally.dropped > 0);
+	assert(tally_total() + tally.dropped == n);
+	assert(tally.on_main == false);
+
+	/* only one ring at a time; records emitted after stop are synchronous */
+	fido_set_log_level(FIDO_LOG_NONE);
+	assert(fido_log_async_start(16) == FIDO_OK);
+	assert(fido_log_async_start(16) == FIDO_ERR_INVALID_ARGUMENT);
+	fido_log_async_stop();
+	fido_log_async_stop();
+
+	tally_reset();
+	fido_set_log_level(FIDO_LOG_XXD);
+	log_workload();
+	assert(tally_total() == n);
+	assert(tally.on_main);
+
+	fido_set_log_record_handler(NULL);
+	fido_set_log_level(FIDO_LOG_NONE);
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	dev_overlap();
+	dev_interleave();
+	dev_call();
+	manifest_concurrent();
+	dev_per_thread();
+	dev_handoff();
+	log_level_filter();
+	log_async();
+
+	exit(0);
+}
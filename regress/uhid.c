@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * A virtual FIDO HID device, created through /dev/uhid and backed by a
+ * minimal software authenticator, used to exercise libfido2 through the
+ * kernel: enumeration, report descriptor parsing, open, and complete
+ * CTAPHID transactions on hidraw.
+ *
+ *	regress_uhid [-l latency_ms] [-n count] [-r report_len] [-D hex]
+ *
+ * -l delays every reply; -r sets the report length announced by the
+ * default report descriptor, which -D replaces altogether. The
+ * authenticator answers CTAPHID_INIT, PING, WINK, CANCEL, and, over
+ * CTAPHID_CBOR, authenticatorGetInfo and clientPin getRetries.
+ *
+ * Without /dev/uhid (or permission to use it), the test is skipped.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fido.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UHID_VENDOR	0x1209	/* pid.codes */
+#define UHID_PRODUCT	0x0f1d
+#define UHID_NAME	"libfido2 regress uhid"
+#define MAXREPORT	64
+#define MAXMSG		7609
+#define WAIT_MS		5000
+
+#define CMD_PING	0x01
+#define CMD_INIT	0x06
+#define CMD_WINK	0x08
+#define CMD_CBOR	0x10
+#define CMD_CANCEL	0x11
+#define CMD_ERROR	0x3f
+
+#define ERR_INVALID_CMD	0x01
+#define ERR_INVALID_LEN	0x03
+#define ERR_INVALID_SEQ	0x04
+
+#define CTAP_GET_INFO	0x04
+#define CTAP_CLIENT_PIN	0x06
+
+/* versions: FIDO_2_0, aaguid: "regress-uhid-key" */
+static const unsigned char get_info_reply[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x03, 0x50, 0x72,
+	0x65, 0x67, 0x72, 0x65, 0x73, 0x73, 0x2d, 0x75,
+	0x68, 0x69, 0x64, 0x2d, 0x6b, 0x65, 0x79,
+};
+
+/* retries = 8 */
+static const unsigned char get_retries_reply[] = {
+	0x00, 0xa1, 0x03, 0x08,
+};
+
+static struct softkey {
+	int		fd;
+	size_t		report_len;
+	int		latency_ms;
+	uint32_t	last_cid;
+	/* message being reassembled */
+	uint32_t	cid;
+	uint8_t		cmd;
+	size_t		bcnt;
+	size_t		got;
+	uint8_t		seq;
+	unsigned char	msg[MAXMSG];
+} sk;
+
+static void
+send_report(const unsigned char *ptr)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = (uint16_t)sk.report_len;
+	memcpy(ev.u.input2.data, ptr, sk.report_len);
+
+	if (write(sk.fd, &ev, sizeof(ev)) != sizeof(ev))
+		err(1, "%s: write", __func__);
+}
+
+static void
+reply(uint32_t cid, uint8_t cmd, const unsigned char *ptr, size_t len)
+{
+	unsigned char	report[MAXREPORT];
+	size_t		n;
+	uint8_t		seq = 0;
+
+	if (sk.latency_ms > 0)
+		poll(NULL, 0, sk.latency_ms);
+
+	memset(report, 0, sizeof(report));
+	memcpy(report, &cid, sizeof(cid));
+	report[4] = 0x80 | cmd;
+	report[5] = (uint8_t)(len >> 8);
+	report[6] = (uint8_t)len;
+	n = len < sk.report_len - 7 ? len : sk.report_len - 7;
+	if (n > 0)
+		memcpy(report + 7, ptr, n);
+	send_report(report);
+
+	for (ptr += n, len -= n; len > 0; ptr += n, len -= n) {
+		memset(report + 4, 0, sizeof(report) - 4);
+		report[4] = seq++;
+		n = len < sk.report_len - 5 ? len : sk.report_len - 5;
+		memcpy(report + 5, ptr, n);
+		send_report(report);
+	}
+}
+
+static void
+reply_error(uint32_t cid, uint8_t code)
+{
+	reply(cid, CMD_ERROR, &code, sizeof(code));
+}
+
+static void
+handle_init(uint32_t cid, const unsigned char *nonce, size_t len)
+{
+	unsigned char body[17];
+
+	if (len != 8) {
+		reply_error(cid, ERR_INVALID_LEN);
+		return;
+	}
+
+	memcpy(body, nonce, 8);
+	if (cid == 0xffffffff) {
+		if (++sk.last_cid == 0xffffffff)
+			sk.last_cid = 1;
+		cid = sk.last_cid;
+	}
+	memcpy(body + 8, &cid, sizeof(cid));
+	body[12] = 2;		/* CTAPHID protocol */
+	body[13] = 1;		/* major */
+	body[14] = 0;		/* minor */
+	body[15] = 0;		/* build */
+	body[16] = 0x05;	/* wink, cbor */
+
+	reply(0xffffffff, CMD_INIT, body, sizeof(body));
+}
+
+static void
+handle_cbor(uint32_t cid, const unsigned char *ptr, size_t len)
+{
+	const unsigned char status = 0x01; /* CTAP1_ERR_INVALID_COMMAND */
+
+	if (len == 1 && ptr[0] == CTAP_GET_INFO)
+		reply(cid, CMD_CBOR, get_info_reply, sizeof(get_info_reply));
+	/* clientPin { pinProtocol: 1, subCommand: getRetries } */
+	else if (len == 6 && ptr[0] == CTAP_CLIENT_PIN &&
+	    memcmp(ptr + 1, "\xa2\x01\x01\x02\x01", 5) == 0)
+		reply(cid, CMD_CBOR, get_retries_reply,
+		    sizeof(get_retries_reply));
+	else
+		reply(cid, CMD_CBOR, &status, sizeof(status));
+}
+
+static void
+handle_msg(void)
+{
+	switch (sk.cmd) {
+	case CMD_INIT:
+		handle_init(sk.cid, sk.msg, sk.bcnt);
+		break;
+	case CMD_PING:
+		reply(sk.cid, CMD_PING, sk.msg, sk.bcnt);
+		break;
+	case CMD_WINK:
+		reply(sk.cid, CMD_WINK, NULL, 0);
+		break;
+	case CMD_CBOR:
+		handle_cbor(sk.cid, sk.msg, sk.bcnt);
+		break;
+	case CMD_CANCEL:
+		break;
+	default:
+		reply_error(sk.cid, ERR_INVALID_CMD);
+		break;
+	}
+}
+
+/* reassemble CTAPHID messages from output reports */
+static void
+handle_report(const unsigned char *ptr, size_t len)
+{
+	uint32_t	cid;
+	size_t		n;
+
+	if (len < 7 || len > sk.report_len)
+		return;
+
+	memcpy(&cid, ptr, sizeof(cid));
+
+	if (ptr[4] & 0x80) {
+		sk.cid = cid;
+		sk.cmd = ptr[4] & 0x7f;
+		sk.bcnt = ((size_t)ptr[5] << 8) | ptr[6];
+		sk.got = 0;
+		sk.seq = 0;
+		if (sk.bcnt > sizeof(sk.msg)) {
+			reply_error(cid, ERR_INVALID_LEN);
+			sk.cmd = 0;
+			return;
+		}
+		n = len - 7;
+		ptr += 7;
+	} else {
+		if (sk.cmd == 0 || cid != sk.cid)
+			return;
+		if (ptr[4] != sk.seq++) {
+			reply_error(cid, ERR_INVALID_SEQ);
+			sk.cmd = 0;
+			return;
+		}
+		n = len - 5;
+		ptr += 5;
+	}
+
+	if (n > sk.bcnt - sk.got)
+		n = sk.bcnt - sk.got;
+
+	memcpy(sk.msg + sk.got, ptr, n);
+	sk.got += n;
+
+	if (sk.got == sk.bcnt) {
+		handle_msg();
+		sk.cmd = 0;
+	}
+}
+
+static void
+softkey_run(void)
+{
+	struct uhid_event	ev;
+	const unsigned char	*ptr;
+	size_t			 len;
+	ssize_t			 n;
+
+	for (;;) {
+		if ((n = read(sk.fd, &ev, sizeof(ev))) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "%s: read", __func__);
+		}
+		if (n == 0)
+			return;
+		if (ev.type != UHID_OUTPUT)
+			continue;
+		ptr = ev.u.output.data;
+		len = ev.u.output.size;
+		/* hidraw writes are prefixed by the report number */
+		if (len == sk.report_len + 1) {
+			ptr++;
+			len--;
+		}
+		handle_report(ptr, len);
+	}
+}
+
+static size_t
+make_descriptor(unsigned char *rd, size_t report_len)
+{
+	const unsigned char tmpl[] = {
+		0x06, 0xd0, 0xf1,	/* usage page (FIDO alliance) */
+		0x09, 0x01,		/* usage (CTAPHID) */
+		0xa1, 0x01,		/* collection (application) */
+		0x09, 0x20,		/*   usage (data in) */
+		0x15, 0x00,		/*   logical minimum (0) */
+		0x26, 0xff, 0x00,	/*   logical maximum (255) */
+		0x75, 0x08,		/*   report size (8) */
+		0x95, 0x40,		/*   report count */
+		0x81, 0x02,		/*   input (data, var, abs) */
+		0x09, 0x21,		/*   usage (data out) */
+		0x15, 0x00,		/*   logical minimum (0) */
+		0x26, 0xff, 0x00,	/*   logical maximum (255) */
+		0x75, 0x08,		/*   report size (8) */
+		0x95, 0x40,		/*   report count */
+		0x91, 0x02,		/*   output (data, var, abs) */
+		0xc0,			/* end collection */
+	};
+
+	memcpy(rd, tmpl, sizeof(tmpl));
+	rd[17] = (unsigned char)report_len;
+	rd[30] = (unsigned char)report_len;
+
+	return (sizeof(tmpl));
+}
+
+static int
+unhex(const char *s, unsigned char *ptr, size_t *len)
+{
+	size_t n = strlen(s);
+	unsigned int x;
+
+	if (n % 2 != 0 || n / 2 > *len)
+		return (-1);
+
+	for (size_t i = 0; i < n / 2; i++) {
+		if (sscanf(s + 2 * i, "%2x", &x) != 1)
+			return (-1);
+		ptr[i] = (unsigned char)x;
+	}
+
+	*len = n / 2;
+
+	return (0);
+}
+
+static pid_t
+softkey_create(const unsigned char *rd, size_t rd_len)
+{
+	struct uhid_event	ev;
+	pid_t			pid;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	strncpy((char *)ev.u.create2.name, UHID_NAME,
+	    sizeof(ev.u.create2.name) - 1);
+	ev.u.create2.rd_size = (uint16_t)rd_len;
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = UHID_VENDOR;
+	ev.u.create2.product = UHID_PRODUCT;
+	memcpy(ev.u.create2.rd_data, rd, rd_len);
+
+	if (write(sk.fd, &ev, sizeof(ev)) != sizeof(ev))
+		err(1, "UHID_CREATE2");
+
+	if ((pid = fork()) < 0)
+		err(1, "fork");
+	if (pid == 0) {
+		softkey_run();
+		_exit(0);
+	}
+
+	/* the device lives for as long as the child holds the fd */
+	close(sk.fd);
+	sk.fd = -1;
+
+	return (pid);
+}
+
+static unsigned long long
+elapsed_us(const struct timespec *since)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+		err(1, "clock_gettime");
+
+	return ((unsigned long long)(now.tv_sec - since->tv_sec) * 1000000ULL +
+	    (unsigned long long)(now.tv_nsec / 1000) -
+	    (unsigned long long)(since->tv_nsec / 1000));
+}
+
+/* wait for the virtual device to be enumerated; return its path */
+static char *
+find_dev(unsigned long long *us)
+{
+	fido_dev_info_t		*devlist;
+	const fido_dev_info_t	*di;
+	struct timespec		 ts;
+	char			*path = NULL;
+	size_t			 ndevs;
+
+	if ((devlist = fido_dev_info_new(64)) == NULL)
+		errx(1, "fido_dev_info_new");
+
+	for (int i = 0; i < WAIT_MS / 50 && path == NULL; i++) {
+		if (i > 0)
+			poll(NULL, 0, 50);
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+			err(1, "clock_gettime");
+		if (fido_dev_info_manifest(devlist, 64, &ndevs) != FIDO_OK)
+			continue;
+		*us = elapsed_us(&ts);
+		for (size_t j = 0; j < ndevs; j++) {
+			di = fido_dev_info_ptr(devlist, j);
+			if (fido_dev_info_vendor(di) == UHID_VENDOR &&
+			    fido_dev_info_product(di) == UHID_PRODUCT &&
+			    (path = strdup(fido_dev_info_path(di))) == NULL)
+				err(1, "strdup");
+		}
+	}
+
+	fido_dev_info_free(&devlist, 64);
+
+	return (path);
+}
+
+static int
+cmp_ull(const void *a, const void *b)
+{
+	const unsigned long long x = *(const unsigned long long *)a;
+	const unsigned long long y = *(const unsigned long long *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static void
+report(const char *what, unsigned long long *us, size_t n)
+{
+	qsort(us, n, sizeof(*us), cmp_ull);
+	printf("%-8s median %lluus, max %lluus\n", what, us[n / 2], us[n - 1]);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: regress_uhid [-l latency_ms] [-n count] "
+	    "[-r report_len] [-D hex]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	fido_dev_t		*dev;
+	fido_cbor_info_t	*ci;
+	unsigned char		 rd[HID_MAX_DESCRIPTOR_SIZE];
+	unsigned char		 payload[1024];
+	unsigned long long	*us_open;
+	unsigned long long	*us_ping;
+	unsigned long long	*us_info;
+	unsigned long long	 us_manifest = 0;
+	struct timespec		 ts;
+	const char		*rd_hex = NULL;
+	char			*path;
+	size_t			 rd_len;
+	long			 count = 10;
+	pid_t			 pid;
+	int			 retries;
+	int			 ch;
+
+	sk.report_len = MAXREPORT;
+
+	while ((ch = getopt(argc, argv, "D:l:n:r:")) != -1) {
+		switch (ch) {
+		case 'D':
+			rd_hex = optarg;
+			break;
+		case 'l':
+			if ((sk.latency_ms = atoi(optarg)) < 0)
+				usage();
+			break;
+		case 'n':
+			if ((count = strtol(optarg, NULL, 10)) < 1 ||
+			    count > 1000000)
+				usage();
+			break;
+		case 'r':
+			sk.report_len = (size_t)strtoul(optarg, NULL, 10);
+			if (sk.report_len < 8 || sk.report_len > MAXREPORT)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((sk.fd = open("/dev/uhid", O_RDWR | O_CLOEXEC)) < 0) {
+		warn("skipping: /dev/uhid");
+		exit(0);
+	}
+
+	if (rd_hex != NULL) {
+		rd_len = sizeof(rd);
+		if (unhex(rd_hex, rd, &rd_len) < 0)
+			errx(1, "invalid report descriptor");
+	} else
+		rd_len = make_descriptor(rd, sk.report_len);
+
+	fido_init(0);
+
+	pid = softkey_create(rd, rd_len);
+
+	if ((path = find_dev(&us_manifest)) == NULL) {
+		kill(pid, SIGTERM);
+		errx(1, "virtual device not found");
+	}
+
+	printf("%s: manifest %lluus\n", path, us_manifest);
+
+	if ((us_open = calloc((size_t)count, sizeof(*us_open))) == NULL ||
+	    (us_ping = calloc((size_t)count, sizeof(*us_ping))) == NULL ||
+	    (us_info = calloc((size_t)count, sizeof(*us_info))) == NULL)
+		err(1, "calloc");
+
+	for (size_t i = 0; i < sizeof(payload); i++)
+		payload[i] = (unsigned char)i;
+
+	for (long i = 0; i < count; i++) {
+		assert((dev = fido_dev_new()) != NULL);
+		assert((ci = fido_cbor_info_new()) != NULL);
+
+		assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+		assert(fido_dev_open(dev, path) == FIDO_OK);
+		us_open[i] = elapsed_us(&ts);
+		assert(fido_dev_is_fido2(dev));
+
+		assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+		assert(fido_dev_ping(dev, payload, sizeof(payload)) == FIDO_OK);
+		us_ping[i] = elapsed_us(&ts);
+
+		assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+		assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+		us_info[i] = elapsed_us(&ts);
+		assert(fido_cbor_info_versions_len(ci) == 1);
+		assert(memcmp(fido_cbor_info_aaguid_ptr(ci),
+		    "regress-uhid-key", 16) == 0);
+
+		assert(fido_dev_get_retry_count(dev, &retries) == FIDO_OK);
+		assert(retries == 8);
+		assert(fido_dev_wink(dev) == FIDO_OK);
+
+		assert(fido_dev_close(dev) == FIDO_OK);
+		fido_dev_free(&dev);
+		fido_cbor_info_free(&ci);
+	}
+
+	report("open", us_open, (size_t)count);
+	report("ping", us_ping, (size_t)count);
+	report("getinfo", us_info, (size_t)count);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	free(us_open);
+	free(us_ping);
+	free(us_info);
+	free(path);
+
+	exit(0);
+}
@@ -23,7 +23,7 @@ aes256_cbc_enc(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
 
 	/* sanity check */
 	if (in->len > INT_MAX || (in->len % 16) != 0 ||
-	    (out->ptr = calloc(1, in->len)) == NULL) {
+	    (out->ptr = fido_calloc(1, in->len)) == NULL) {
 		fido_log_debug("%s: in->len=%zu", __func__, in->len);
 		goto fail;
 	}
@@ -45,7 +45,7 @@ fail:
 		EVP_CIPHER_CTX_free(ctx);
 
 	if (ok < 0) {
-		free(out->ptr);
+		fido_free(out->ptr);
 		out->ptr = NULL;
 		out->len = 0;
 	}
@@ -67,7 +67,7 @@ aes256_cbc_dec(const fido_blob_t *key, const fido_blob_t *in, fido_blob_t *out)
 
 	/* sanity check */
 	if (in->len > INT_MAX || (in->len % 16) != 0 ||
-	    (out->ptr = calloc(1, in->len)) == NULL) {
+	    (out->ptr = fido_calloc(1, in->len)) == NULL) {
 		fido_log_debug("%s: in->len=%zu", __func__, in->len);
 		goto fail;
 	}
@@ -89,7 +89,7 @@ fail:
 		EVP_CIPHER_CTX_free(ctx);
 
 	if (ok < 0) {
-		free(out->ptr);
+		fido_free(out->ptr);
 		out->ptr = NULL;
 		out->len = 0;
 	}
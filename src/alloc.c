@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fido.h"
+
+#if defined(CBOR_CUSTOM_ALLOC) || (defined(CBOR_MAJOR_VERSION) && \
+    (CBOR_MAJOR_VERSION > 0 || CBOR_MINOR_VERSION >= 10))
+#define HAVE_CBOR_SET_ALLOCS
+#endif
+
+#define MUL_NO_OVERFLOW	((size_t)1 << (sizeof(size_t) * 4))
+
+/*
+ * Allocation hooks set by fido_set_allocator(); NULL means libc. The
+ * defaults call libc directly, rather than through pointers to it, so
+ * that allocation wrappers (see fuzz/wrap.c) keep seeing every call.
+ */
+static fido_malloc_t	*alloc_malloc;
+static fido_free_t	*alloc_free;
+#ifdef HAVE_CBOR_SET_ALLOCS
+static fido_realloc_t	*alloc_realloc;
+#endif
+
+static int
+mul_overflow(size_t nmemb, size_t size)
+{
+	return ((nmemb >= MUL_NO_OVERFLOW || size >= MUL_NO_OVERFLOW) &&
+	    nmemb > 0 && SIZE_MAX / nmemb < size);
+}
+
+void *
+fido_malloc(size_t size)
+{
+	if (alloc_malloc == NULL)
+		return (malloc(size));
+
+	return (alloc_malloc(size));
+}
+
+void *
+fido_calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (alloc_malloc == NULL)
+		return (calloc(nmemb, size));
+
+	if (mul_overflow(nmemb, size) || (ptr = alloc_malloc(nmemb *
+	    size)) == NULL)
+		return (NULL);
+
+	memset(ptr, 0, nmemb * size);
+
+	return (ptr);
+}
+
+/*
+ * Like recallocarray(3), but always moves the data so that the old
+ * memory can be zeroed before it is released.
+ */
+void *
+fido_recallocarray(void *ptr, size_t oldnmemb, size_t newnmemb, size_t size)
+{
+	size_t	 oldsize;
+	size_t	 newsize;
+	void	*newptr;
+
+	if (alloc_malloc == NULL)
+		return (recallocarray(ptr, oldnmemb, newnmemb, size));
+
+	if (ptr == NULL)
+		return (fido_calloc(newnmemb, size));
+
+	if (mul_overflow(newnmemb, size) || mul_overflow(oldnmemb, size))
+		return (NULL);
+
+	newsize = newnmemb * size;
+	oldsize = oldnmemb * size;
+
+	if ((newptr = alloc_malloc(newsize)) == NULL)
+		return (NULL);
+
+	if (newsize > oldsize) {
+		memcpy(newptr, ptr, oldsize);
+		memset((char *)newptr + oldsize, 0, newsize - oldsize);
+	} else
+		memcpy(newptr, ptr, newsize);
+
+	fido_freezero(ptr, oldsize);
+
+	return (newptr);
+}
+
+char *
+fido_strdup(const char *s)
+{
+	char	*p;
+	size_t	 n;
+
+	if (alloc_malloc == NULL)
+		return (strdup(s));
+
+	n = strlen(s) + 1;
+	if ((p = alloc_malloc(n)) != NULL)
+		memcpy(p, s, n);
+
+	return (p);
+}
+
+void
+fido_free(void *ptr)
+{
+	if (alloc_free == NULL)
+		free(ptr);
+	else if (ptr != NULL)
+		alloc_free(ptr);
+}
+
+/* release memory that may have held key material */
+void
+fido_freezero(void *ptr, size_t len)
+{
+	if (ptr == NULL)
+		return;
+
+	explicit_bzero(ptr, len);
+	fido_free(ptr);
+}
+
+#ifdef HAVE_CBOR_SET_ALLOCS
+static void *
+alloc_cbor_realloc(void *ptr, size_t size)
+{
+	if (alloc_realloc == NULL)
+		return (realloc(ptr, size));
+
+	return (alloc_realloc(ptr, size));
+}
+#endif
+
+int
+fido_set_allocator(fido_malloc_t *m, fido_realloc_t *r, fido_free_t *f)
+{
+	if (m == NULL || r == NULL || f == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+#ifdef HAVE_CBOR_SET_ALLOCS
+	alloc_malloc = m;
+	alloc_realloc = r;
+	alloc_free = f;
+
+	cbor_set_allocs(fido_malloc, alloc_cbor_realloc, fido_free);
+
+	return (FIDO_OK);
+#else
+	/* buffers from libcbor end up being released by libfido2 */
+	fido_log_debug("%s: libcbor without custom allocators", __func__);
+
+	return (FIDO_ERR_INTERNAL);
+#endif
+}
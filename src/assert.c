@@ -81,7 +81,7 @@ parse_assert_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 static int
 fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin)
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const fido_blob_t *token)
 {
 	fido_blob_t	 f;
 	cbor_item_t	*argv[7];
@@ -136,17 +136,11 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 		}
 
 	/* pin authentication */
-	if (pin) {
-		if (pk == NULL || ecdh == NULL) {
-			fido_log_debug("%s: pin=%p, pk=%p, ecdh=%p", __func__,
-			    (const void *)pin, (const void *)pk,
-			    (const void *)ecdh);
-			r = FIDO_ERR_INVALID_ARGUMENT;
-			goto fail;
-		}
-		if ((r = cbor_add_pin_params(dev, &assert->cdh, pk, ecdh, pin,
-		    &argv[5], &argv[6])) != FIDO_OK) {
-			fido_log_debug("%s: cbor_add_pin_params", __func__);
+	if (token) {
+		if ((argv[5] = cbor_encode_pin_auth(token, &assert->cdh)) == NULL ||
+		    (argv[6] = cbor_encode_pin_opt()) == NULL) {
+			fido_log_debug("%s: cbor encode", __func__);
+			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
 	}
@@ -162,7 +156,7 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -179,11 +173,11 @@ fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* start with room for a single assertion */
-	if ((assert->stmt = calloc(1, sizeof(fido_assert_stmt))) == NULL)
+	if ((assert->stmt = fido_calloc(1, sizeof(fido_assert_stmt))) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	assert->stmt_len = 0;
@@ -231,7 +225,7 @@ fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* sanity check */
@@ -252,22 +246,30 @@ fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 
 static int
 fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int ms)
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const fido_blob_t *token,
+    int ms)
 {
 	int r;
 
-	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin)) != FIDO_OK ||
+	fido_dev_auto_lock(dev, ms);
+
+	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, token)) != FIDO_OK ||
 	    (r = fido_dev_get_assert_rx(dev, assert, ms)) != FIDO_OK)
-		return (r);
+		goto out;
 
 	while (assert->stmt_len < assert->stmt_cnt) {
+		fido_dev_auto_lock(dev, ms);
 		if ((r = fido_get_next_assert_tx(dev)) != FIDO_OK ||
 		    (r = fido_get_next_assert_rx(dev, assert, ms)) != FIDO_OK)
-			return (r);
+			goto out;
 		assert->stmt_len++;
 	}
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+out:
+	fido_dev_auto_unlock(dev, ms);
+
+	return (r);
 }
 
 static int
@@ -288,47 +290,99 @@ decrypt_hmac_secrets(fido_assert_t *assert, const fido_blob_t *key)
 	return (0);
 }
 
+/*
+ * Perform 'n' assertions over a single key agreement and, if 'pin' is
+ * given, a single pinToken. Each assertion may carry its own hmac-secret
+ * salt(s); since the shared secret is reused, deriving many secrets
+ * from the same credential only costs one authenticatorGetAssertion per
+ * one or two salts.
+ */
 int
-fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+fido_dev_get_assert_batch(fido_dev_t *dev, fido_assert_t **assert, size_t n,
+    const char *pin)
 {
 	fido_blob_t	*ecdh = NULL;
+	fido_blob_t	*token = NULL;
 	es256_pk_t	*pk = NULL;
+	int		 ext = 0;
 	int		 r;
 
-	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
-		fido_log_debug("%s: rp_id=%p, cdh.ptr=%p", __func__,
-		    (void *)assert->rp_id, (void *)assert->cdh.ptr);
+	if (assert == NULL || n == 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < n; i++) {
+		if (assert[i] == NULL || assert[i]->rp_id == NULL ||
+		    assert[i]->cdh.ptr == NULL) {
+			fido_log_debug("%s: assert[%zu]", __func__, i);
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		}
+		ext |= assert[i]->ext;
 	}
 
 	if (fido_dev_is_fido2(dev) == false) {
-		if (pin != NULL || assert->ext != 0)
+		if (pin != NULL || ext != 0)
 			return (FIDO_ERR_UNSUPPORTED_OPTION);
-		return (u2f_authenticate(dev, assert, -1));
+		if (fido_tx_hold(dev) < 0)
+			return (FIDO_ERR_TX);
+		for (size_t i = 0; i < n; i++)
+			if ((r = u2f_authenticate(dev, assert[i], -1)) != FIDO_OK)
+				break;
+		fido_tx_release(dev);
+		return (r);
 	}
 
-	if (pin != NULL || assert->ext != 0) {
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+
+	if (pin != NULL || ext != 0) {
 		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
 			fido_log_debug("%s: fido_do_ecdh", __func__);
 			goto fail;
 		}
 	}
 
-	r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, -1);
-	if (r == FIDO_OK && assert->ext & FIDO_EXT_HMAC_SECRET)
-		if (decrypt_hmac_secrets(assert, ecdh) < 0) {
+	if (pin != NULL) {
+		if ((token = fido_blob_new()) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = fido_dev_get_pin_token(dev, pin, ecdh, pk,
+		    token)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_get_pin_token", __func__);
+			goto fail;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if ((r = fido_dev_get_assert_wait(dev, assert[i], pk, ecdh,
+		    token, -1)) != FIDO_OK) {
+			fido_log_debug("%s: assert[%zu]", __func__, i);
+			goto fail;
+		}
+		if (assert[i]->ext & FIDO_EXT_HMAC_SECRET &&
+		    decrypt_hmac_secrets(assert[i], ecdh) < 0) {
 			fido_log_debug("%s: decrypt_hmac_secrets", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+	}
 
+	r = FIDO_OK;
 fail:
+	fido_tx_release(dev);
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
+	fido_blob_free(&token);
 
 	return (r);
 }
 
+int
+fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+{
+	return (fido_dev_get_assert_batch(dev, &assert, 1, pin));
+}
+
 int
 fido_check_flags(uint8_t flags, fido_opt_t up, fido_opt_t uv)
 {
@@ -412,13 +466,10 @@ fail:
 	return (ok);
 }
 
-int
-fido_verify_sig_es256(const fido_blob_t *dgst, const es256_pk_t *pk,
-    const fido_blob_t *sig)
+static int
+verify_es256(const fido_blob_t *dgst, EVP_PKEY *pkey, const fido_blob_t *sig)
 {
-	EVP_PKEY	*pkey = NULL;
-	EC_KEY		*ec = NULL;
-	int		 ok = -1;
+	EC_KEY *ec;
 
 	/* ECDSA_verify needs ints */
 	if (dgst->len > INT_MAX || sig->len > INT_MAX) {
@@ -427,33 +478,24 @@ fido_verify_sig_es256(const fido_blob_t *dgst, const es256_pk_t *pk,
 		return (-1);
 	}
 
-	if ((pkey = es256_pk_to_EVP_PKEY(pk)) == NULL ||
-	    (ec = EVP_PKEY_get0_EC_KEY(pkey)) == NULL) {
-		fido_log_debug("%s: pk -> ec", __func__);
-		goto fail;
+	if ((ec = EVP_PKEY_get0_EC_KEY(pkey)) == NULL) {
+		fido_log_debug("%s: pkey -> ec", __func__);
+		return (-1);
 	}
 
 	if (ECDSA_verify(0, dgst->ptr, (int)dgst->len, sig->ptr,
 	    (int)sig->len, ec) != 1) {
 		fido_log_debug("%s: ECDSA_verify", __func__);
-		goto fail;
+		return (-1);
 	}
 
-	ok = 0;
-fail:
-	if (pkey != NULL)
-		EVP_PKEY_free(pkey);
-
-	return (ok);
+	return (0);
 }
 
-int
-fido_verify_sig_rs256(const fido_blob_t *dgst, const rs256_pk_t *pk,
-    const fido_blob_t *sig)
+static int
+verify_rs256(const fido_blob_t *dgst, EVP_PKEY *pkey, const fido_blob_t *sig)
 {
-	EVP_PKEY	*pkey = NULL;
-	RSA		*rsa = NULL;
-	int		 ok = -1;
+	RSA *rsa;
 
 	/* RSA_verify needs unsigned ints */
 	if (dgst->len > UINT_MAX || sig->len > UINT_MAX) {
@@ -462,31 +504,23 @@ fido_verify_sig_rs256(const fido_blob_t *dgst, const rs256_pk_t *pk,
 		return (-1);
 	}
 
-	if ((pkey = rs256_pk_to_EVP_PKEY(pk)) == NULL ||
-	    (rsa = EVP_PKEY_get0_RSA(pkey)) == NULL) {
-		fido_log_debug("%s: pk -> ec", __func__);
-		goto fail;
+	if ((rsa = EVP_PKEY_get0_RSA(pkey)) == NULL) {
+		fido_log_debug("%s: pkey -> rsa", __func__);
+		return (-1);
 	}
 
 	if (RSA_verify(NID_sha256, dgst->ptr, (unsigned int)dgst->len, sig->ptr,
 	    (unsigned int)sig->len, rsa) != 1) {
 		fido_log_debug("%s: RSA_verify", __func__);
-		goto fail;
+		return (-1);
 	}
 
-	ok = 0;
-fail:
-	if (pkey != NULL)
-		EVP_PKEY_free(pkey);
-
-	return (ok);
+	return (0);
 }
 
-int
-fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
-    const fido_blob_t *sig)
+static int
+verify_eddsa(const fido_blob_t *dgst, EVP_PKEY *pkey, const fido_blob_t *sig)
 {
-	EVP_PKEY	*pkey = NULL;
 	EVP_MD_CTX	*mdctx = NULL;
 	int		 ok = -1;
 
@@ -497,11 +531,6 @@ fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
 		return (-1);
 	}
 
-	if ((pkey = eddsa_pk_to_EVP_PKEY(pk)) == NULL) {
-		fido_log_debug("%s: pk -> pkey", __func__);
-		goto fail;
-	}
-
 	if ((mdctx = EVP_MD_CTX_new()) == NULL) {
 		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
 		goto fail;
@@ -523,15 +552,98 @@ fail:
 	if (mdctx != NULL)
 		EVP_MD_CTX_free(mdctx);
 
-	if (pkey != NULL)
-		EVP_PKEY_free(pkey);
+	return (ok);
+}
+
+/* verify a signature against an already converted public key */
+int
+fido_verify_sig_pkey(int cose_alg, const fido_blob_t *dgst, EVP_PKEY *pkey,
+    const fido_blob_t *sig)
+{
+	int ok;
+
+	fido_trace1(sig__verify__start, cose_alg);
+
+	switch (cose_alg) {
+	case COSE_ES256:
+		ok = verify_es256(dgst, pkey, sig);
+		break;
+	case COSE_RS256:
+		ok = verify_rs256(dgst, pkey, sig);
+		break;
+	case COSE_EDDSA:
+		ok = verify_eddsa(dgst, pkey, sig);
+		break;
+	default:
+		fido_log_debug("%s: unsupported cose_alg %d", __func__,
+		    cose_alg);
+		ok = -1;
+		break;
+	}
+
+	fido_trace2(sig__verify__done, cose_alg, ok);
 
 	return (ok);
 }
 
 int
-fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
-    const void *pk)
+fido_verify_sig_es256(const fido_blob_t *dgst, const es256_pk_t *pk,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY	*pkey;
+	int		 ok;
+
+	if ((pkey = es256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: pk -> pkey", __func__);
+		return (-1);
+	}
+
+	ok = fido_verify_sig_pkey(COSE_ES256, dgst, pkey, sig);
+	EVP_PKEY_free(pkey);
+
+	return (ok);
+}
+
+int
+fido_verify_sig_rs256(const fido_blob_t *dgst, const rs256_pk_t *pk,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY	*pkey;
+	int		 ok;
+
+	if ((pkey = rs256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: pk -> pkey", __func__);
+		return (-1);
+	}
+
+	ok = fido_verify_sig_pkey(COSE_RS256, dgst, pkey, sig);
+	EVP_PKEY_free(pkey);
+
+	return (ok);
+}
+
+int
+fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY	*pkey;
+	int		 ok;
+
+	if ((pkey = eddsa_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: pk -> pkey", __func__);
+		return (-1);
+	}
+
+	ok = fido_verify_sig_pkey(COSE_EDDSA, dgst, pkey, sig);
+	EVP_PKEY_free(pkey);
+
+	return (ok);
+}
+
+/* exactly one of pk and pkey is set */
+static int
+assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
+    const void *pk, EVP_PKEY *pkey)
 {
 	unsigned char		 buf[1024]; /* XXX */
 	fido_blob_t		 dgst;
@@ -542,7 +654,7 @@ fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
 	dgst.ptr = buf;
 	dgst.len = sizeof(buf);
 
-	if (idx >= assert->stmt_len || pk == NULL) {
+	if (idx >= assert->stmt_len || (pk == NULL && pkey == NULL)) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto out;
 	}
@@ -585,6 +697,12 @@ fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
 		goto out;
 	}
 
+	if (pkey != NULL && (cose_alg == COSE_ES256 ||
+	    cose_alg == COSE_RS256 || cose_alg == COSE_EDDSA)) {
+		ok = fido_verify_sig_pkey(cose_alg, &dgst, pkey, &stmt->sig);
+		goto done;
+	}
+
 	switch (cose_alg) {
 	case COSE_ES256:
 		ok = fido_verify_sig_es256(&dgst, pk, &stmt->sig);
@@ -601,7 +719,7 @@ fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
 		r = FIDO_ERR_UNSUPPORTED_OPTION;
 		goto out;
 	}
-
+done:
 	if (ok < 0)
 		r = FIDO_ERR_INVALID_SIG;
 	else
@@ -612,6 +730,26 @@ out:
 	return (r);
 }
 
+int
+fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
+    const void *pk)
+{
+	if (pk == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (assert_verify(assert, idx, cose_alg, pk, NULL));
+}
+
+int
+fido_assert_verify_pkey(const fido_assert_t *assert, size_t idx, int cose_alg,
+    EVP_PKEY *pkey)
+{
+	if (pkey == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (assert_verify(assert, idx, cose_alg, NULL, pkey));
+}
+
 int
 fido_assert_set_clientdata_hash(fido_assert_t *assert,
     const unsigned char *hash, size_t hash_len)
@@ -637,14 +775,14 @@ int
 fido_assert_set_rp(fido_assert_t *assert, const char *id)
 {
 	if (assert->rp_id != NULL) {
-		free(assert->rp_id);
+		fido_free(assert->rp_id);
 		assert->rp_id = NULL;
 	}
 
 	if (id == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((assert->rp_id = strdup(id)) == NULL)
+	if ((assert->rp_id = fido_strdup(id)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	return (FIDO_OK);
@@ -666,7 +804,7 @@ fido_assert_allow_cred(fido_assert_t *assert, const unsigned char *ptr,
 	}
 
 	if (fido_blob_set(&id, ptr, len) < 0 || (list_ptr =
-	    recallocarray(assert->allow_list.ptr, assert->allow_list.len,
+	    fido_recallocarray(assert->allow_list.ptr, assert->allow_list.len,
 	    assert->allow_list.len + 1, sizeof(fido_blob_t))) == NULL) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
@@ -677,7 +815,7 @@ fido_assert_allow_cred(fido_assert_t *assert, const unsigned char *ptr,
 
 	return (FIDO_OK);
 fail:
-	free(id.ptr);
+	fido_free(id.ptr);
 
 	return (r);
 
@@ -734,15 +872,15 @@ fido_assert_clientdata_hash_len(const fido_assert_t *assert)
 fido_assert_t *
 fido_assert_new(void)
 {
-	return (calloc(1, sizeof(fido_assert_t)));
+	return (fido_calloc(1, sizeof(fido_assert_t)));
 }
 
 void
 fido_assert_reset_tx(fido_assert_t *assert)
 {
-	free(assert->rp_id);
-	free(assert->cdh.ptr);
-	free(assert->hmac_salt.ptr);
+	fido_free(assert->rp_id);
+	fido_free(assert->cdh.ptr);
+	fido_free(assert->hmac_salt.ptr);
 	fido_free_blob_array(&assert->allow_list);
 
 	memset(&assert->cdh, 0, sizeof(assert->cdh));
@@ -759,23 +897,22 @@ void
 fido_assert_reset_rx(fido_assert_t *assert)
 {
 	for (size_t i = 0; i < assert->stmt_cnt; i++) {
-		free(assert->stmt[i].user.id.ptr);
-		free(assert->stmt[i].user.icon);
-		free(assert->stmt[i].user.name);
-		free(assert->stmt[i].user.display_name);
-		free(assert->stmt[i].id.ptr);
-		if (assert->stmt[i].hmac_secret.ptr != NULL) {
-			explicit_bzero(assert->stmt[i].hmac_secret.ptr,
-			    assert->stmt[i].hmac_secret.len);
-		}
-		free(assert->stmt[i].hmac_secret.ptr);
-		free(assert->stmt[i].hmac_secret_enc.ptr);
-		free(assert->stmt[i].authdata_cbor.ptr);
-		free(assert->stmt[i].sig.ptr);
+		fido_free(assert->stmt[i].user.id.ptr);
+		fido_free(assert->stmt[i].user.icon);
+		fido_free(assert->stmt[i].user.name);
+		fido_free(assert->stmt[i].user.display_name);
+		fido_free(assert->stmt[i].id.ptr);
+		fido_freezero(assert->stmt[i].hmac_secret.ptr,
+		    assert->stmt[i].hmac_secret.len);
+		fido_freezero(assert->stmt[i].hmac_secret_enc.ptr,
+		    assert->stmt[i].hmac_secret_enc.len);
+		fido_freezero(assert->stmt[i].authdata_cbor.ptr,
+		    assert->stmt[i].authdata_cbor.len);
+		fido_free(assert->stmt[i].sig.ptr);
 		memset(&assert->stmt[i], 0, sizeof(assert->stmt[i]));
 	}
 
-	free(assert->stmt);
+	fido_free(assert->stmt);
 
 	assert->stmt = NULL;
 	assert->stmt_len = 0;
@@ -793,7 +930,7 @@ fido_assert_free(fido_assert_t **assert_p)
 	fido_assert_reset_tx(assert);
 	fido_assert_reset_rx(assert);
 
-	free(assert);
+	fido_free(assert);
 
 	*assert_p = NULL;
 }
@@ -948,8 +1085,8 @@ fido_assert_hmac_secret_len(const fido_assert_t *assert, size_t idx)
 static void
 fido_assert_clean_authdata(fido_assert_stmt *as)
 {
-	free(as->authdata_cbor.ptr);
-	free(as->hmac_secret_enc.ptr);
+	fido_freezero(as->authdata_cbor.ptr, as->authdata_cbor.len);
+	fido_freezero(as->hmac_secret_enc.ptr, as->hmac_secret_enc.len);
 
 	memset(&as->authdata_ext, 0, sizeof(as->authdata_ext));
 	memset(&as->authdata_cbor, 0, sizeof(as->authdata_cbor));
@@ -1037,7 +1174,7 @@ fail:
 static void
 fido_assert_clean_sig(fido_assert_stmt *as)
 {
-	free(as->sig.ptr);
+	fido_free(as->sig.ptr);
 	as->sig.ptr = NULL;
 	as->sig.len = 0;
 }
@@ -1053,7 +1190,7 @@ fido_assert_set_sig(fido_assert_t *a, size_t idx, const unsigned char *ptr,
 
 	fido_assert_clean_sig(&a->stmt[idx]);
 
-	if ((sig = malloc(len)) == NULL)
+	if ((sig = fido_malloc(len)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	memcpy(sig, ptr, len);
@@ -1076,7 +1213,7 @@ fido_assert_set_count(fido_assert_t *assert, size_t n)
 	}
 #endif
 
-	new_stmt = recallocarray(assert->stmt, assert->stmt_cnt, n,
+	new_stmt = fido_recallocarray(assert->stmt, assert->stmt_cnt, n,
 	    sizeof(fido_assert_stmt));
 	if (new_stmt == NULL)
 		return (FIDO_ERR_INTERNAL);
@@ -53,7 +53,7 @@ fido_dev_authkey_tx(fido_dev_t *dev)
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -72,7 +72,7 @@ fido_dev_authkey_rx(fido_dev_t *dev, es256_pk_t *authkey, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	return (cbor_parse_reply(reply, (size_t)reply_len, authkey,
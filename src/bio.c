@@ -5,6 +5,12 @@
  */
 
 #include <string.h>
+#ifdef HAVE_PTHREAD
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #include "fido.h"
 #include "fido/bio.h"
@@ -24,7 +30,7 @@ bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
 {
 	const uint8_t	 prefix[2] = { 0x01 /* modality */, cmd };
 	int		 ok = -1;
-	size_t		 cbor_alloc_len;
+	size_t		 cbor_alloc_len = 0;
 	size_t		 cbor_len;
 	unsigned char	*cbor = NULL;
 
@@ -42,7 +48,7 @@ bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
 		goto fail;
 	}
 
-	if ((hmac_data->ptr = malloc(cbor_len + sizeof(prefix))) == NULL) {
+	if ((hmac_data->ptr = fido_malloc(cbor_len + sizeof(prefix))) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -53,7 +59,7 @@ bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
 
 	ok = 0;
 fail:
-	free(cbor);
+	fido_freezero(cbor, cbor_alloc_len);
 
 	return (ok);
 }
@@ -121,8 +127,8 @@ fail:
 	cbor_vector_free(argv, nitems(argv));
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
-	free(f.ptr);
-	free(hmac.ptr);
+	fido_freezero(f.ptr, f.len);
+	fido_free(hmac.ptr);
 
 	return (r);
 }
@@ -130,8 +136,8 @@ fail:
 static void
 bio_reset_template(fido_bio_template_t *t)
 {
-	free(t->name);
-	free(t->id.ptr);
+	fido_free(t->name);
+	fido_free(t->id.ptr);
 	t->name = NULL;
 	memset(&t->id, 0, sizeof(t->id));
 }
@@ -142,7 +148,7 @@ bio_reset_template_array(fido_bio_template_array_t *ta)
 	for (size_t i = 0; i < ta->n_alloc; i++)
 		bio_reset_template(&ta->ptr[i]);
 
-	free(ta->ptr);
+	fido_free(ta->ptr);
 	ta->ptr = NULL;
 	memset(ta, 0, sizeof(*ta));
 }
@@ -219,7 +225,8 @@ bio_parse_template_array(const cbor_item_t *key, const cbor_item_t *val,
 		return (-1);
 	}
 
-	if ((ta->ptr = calloc(cbor_array_size(val), sizeof(*ta->ptr))) == NULL)
+	if ((ta->ptr = fido_calloc(cbor_array_size(val),
+	    sizeof(*ta->ptr))) == NULL)
 		return (-1);
 
 	ta->n_alloc = cbor_array_size(val);
@@ -244,7 +251,7 @@ bio_rx_template_array(fido_dev_t *dev, fido_bio_template_array_t *ta, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, ta,
@@ -273,10 +280,17 @@ int
 fido_bio_dev_get_template_array(fido_dev_t *dev, fido_bio_template_array_t *ta,
     const char *pin)
 {
+	int r;
+
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (bio_get_template_array_wait(dev, ta, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = bio_get_template_array_wait(dev, ta, pin, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static int
@@ -311,10 +325,17 @@ int
 fido_bio_dev_set_template_name(fido_dev_t *dev, const fido_bio_template_t *t,
     const char *pin)
 {
+	int r;
+
 	if (pin == NULL || t->name == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (bio_set_template_name_wait(dev, t, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = bio_set_template_name_wait(dev, t, pin, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static void
@@ -394,7 +415,7 @@ bio_rx_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, e,
@@ -426,6 +447,9 @@ bio_enroll_begin_wait(fido_dev_t *dev, fido_bio_template_t *t,
 		goto fail;
 	}
 
+	/* keep other channels out until the last sample */
+	fido_dev_auto_lock(dev, ms);
+
 	if ((r = bio_tx(dev, cmd, argv, 3, NULL, e->token)) != FIDO_OK ||
 	    (r = bio_rx_enroll_begin(dev, t, e, ms)) != FIDO_OK) {
 		fido_log_debug("%s: tx/rx", __func__);
@@ -434,23 +458,22 @@ bio_enroll_begin_wait(fido_dev_t *dev, fido_bio_template_t *t,
 
 	r = FIDO_OK;
 fail:
+	if (r != FIDO_OK || e->remaining_samples == 0)
+		fido_dev_auto_unlock(dev, ms);
+
 	cbor_vector_free(argv, nitems(argv));
 
 	return (r);
 }
 
-int
-fido_bio_dev_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
-    fido_bio_enroll_t *e, uint32_t timo_ms, const char *pin)
+static int
+bio_enroll_get_token(fido_dev_t *dev, fido_bio_enroll_t *e, const char *pin)
 {
 	es256_pk_t	*pk = NULL;
 	fido_blob_t	*ecdh = NULL;
 	fido_blob_t	*token = NULL;
 	int		 r;
 
-	if (pin == NULL || e->token != NULL)
-		return (FIDO_ERR_INVALID_ARGUMENT);
-
 	if ((token = fido_blob_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -473,10 +496,25 @@ fail:
 	fido_blob_free(&ecdh);
 	fido_blob_free(&token);
 
-	if (r != FIDO_OK)
-		return (r);
+	return (r);
+}
+
+int
+fido_bio_dev_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
+    fido_bio_enroll_t *e, uint32_t timo_ms, const char *pin)
+{
+	int r;
+
+	if (pin == NULL || e->token != NULL || e->async != NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (bio_enroll_begin_wait(dev, t, e, timo_ms, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = bio_enroll_get_token(dev, e, pin)) == FIDO_OK)
+		r = bio_enroll_begin_wait(dev, t, e, timo_ms, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static int
@@ -492,7 +530,7 @@ bio_rx_enroll_continue(fido_dev_t *dev, fido_bio_enroll_t *e, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, e,
@@ -520,6 +558,8 @@ bio_enroll_continue_wait(fido_dev_t *dev, const fido_bio_template_t *t,
 		goto fail;
 	}
 
+	fido_dev_auto_lock(dev, ms);
+
 	if ((r = bio_tx(dev, cmd, argv, 3, NULL, e->token)) != FIDO_OK ||
 	    (r = bio_rx_enroll_continue(dev, e, ms)) != FIDO_OK) {
 		fido_log_debug("%s: tx/rx", __func__);
@@ -528,6 +568,9 @@ bio_enroll_continue_wait(fido_dev_t *dev, const fido_bio_template_t *t,
 
 	r = FIDO_OK;
 fail:
+	if (r != FIDO_OK || e->remaining_samples == 0)
+		fido_dev_auto_unlock(dev, ms);
+
 	cbor_vector_free(argv, nitems(argv));
 
 	return (r);
@@ -537,7 +580,7 @@ int
 fido_bio_dev_enroll_continue(fido_dev_t *dev, const fido_bio_template_t *t,
     fido_bio_enroll_t *e, uint32_t timo_ms)
 {
-	if (e->token == NULL)
+	if (e->token == NULL || e->async != NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
 	return (bio_enroll_continue_wait(dev, t, e, timo_ms, -1));
@@ -550,18 +593,340 @@ bio_enroll_cancel_wait(fido_dev_t *dev, int ms)
 	int		r;
 
 	if ((r = bio_tx(dev, cmd, NULL, 0, NULL, NULL)) != FIDO_OK ||
-	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
+	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK)
 		fido_log_debug("%s: tx/rx", __func__);
+
+	fido_dev_auto_unlock(dev, ms);
+
+	return (r);
+}
+
+int
+fido_bio_dev_enroll_cancel(fido_dev_t *dev)
+{
+	return (bio_enroll_cancel_wait(dev, -1));
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * An enrollment driven by a worker thread. The worker owns 'dev', 't',
+ * and a private copy of the enrollment state; after each sample, it
+ * publishes the state to 'e' under 'lock', invokes the caller's
+ * callback, and writes a byte to 'fd[1]' so that the caller may poll
+ * 'fd[0]' instead of blocking.
+ */
+struct fido_bio_enroll_async {
+	pthread_t		 thread;
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 cond;
+	fido_dev_t		*dev;
+	fido_bio_template_t	*t;
+	fido_bio_enroll_t	*e;
+	uint32_t		 timo_ms;
+	int			 fd[2];
+	int			 cancel; /* accessed atomically */
+	bool			 done;   /* protected by lock */
+	int			 r;      /* protected by lock */
+};
+
+static bool
+bio_enroll_cancelled(struct fido_bio_enroll_async *a)
+{
+	return (__atomic_load_n(&a->cancel, __ATOMIC_ACQUIRE) != 0);
+}
+
+static void
+bio_enroll_notify(struct fido_bio_enroll_async *a)
+{
+	const unsigned char c = 0;
+
+	/* the pipe is non-blocking; a full pipe is already readable */
+	if (write(a->fd[1], &c, sizeof(c)) < 0 && errno != EAGAIN)
+		fido_log_debug("%s: write", __func__);
+}
+
+static void
+bio_enroll_publish(struct fido_bio_enroll_async *a, const fido_bio_enroll_t *w)
+{
+	fido_bio_enroll_t *e = a->e;
+
+	pthread_mutex_lock(&a->lock);
+	e->last_status = w->last_status;
+	e->remaining_samples = w->remaining_samples;
+	pthread_mutex_unlock(&a->lock);
+
+	if (e->cb != NULL)
+		e->cb(e->cb_arg, w->last_status, w->remaining_samples);
+
+	bio_enroll_notify(a);
+}
+
+static void *
+bio_enroll_worker(void *arg)
+{
+	struct fido_bio_enroll_async	*a = arg;
+	fido_bio_enroll_t		 w;
+	int				 r;
+
+	memset(&w, 0, sizeof(w));
+	w.token = a->e->token; /* borrowed */
+
+	/* passed on by fido_bio_dev_enroll_start() */
+	if (fido_tx_take(a->dev) < 0) {
+		r = FIDO_ERR_TX;
+		goto done;
+	}
+
+	if (bio_enroll_cancelled(a)) {
+		r = FIDO_ERR_KEEPALIVE_CANCEL;
+		goto out;
+	}
+
+	if ((r = bio_enroll_begin_wait(a->dev, a->t, &w, a->timo_ms,
+	    -1)) == FIDO_OK)
+		bio_enroll_publish(a, &w);
+
+	while (r == FIDO_OK && w.remaining_samples > 0) {
+		if (bio_enroll_cancelled(a)) {
+			r = FIDO_ERR_KEEPALIVE_CANCEL;
+			break;
+		}
+		if ((r = bio_enroll_continue_wait(a->dev, a->t, &w,
+		    a->timo_ms, -1)) == FIDO_OK)
+			bio_enroll_publish(a, &w);
+	}
+
+	/* leave the authenticator ready for another enrollment */
+	if (r != FIDO_OK && bio_enroll_cancelled(a)) {
+		fido_log_debug("%s: cancelled, r=%d", __func__, r);
+		if (fido_blob_is_empty(&a->t->id) == 0 &&
+		    bio_enroll_cancel_wait(a->dev, -1) != FIDO_OK)
+			fido_log_debug("%s: bio_enroll_cancel_wait", __func__);
+		r = FIDO_ERR_KEEPALIVE_CANCEL;
+	}
+out:
+	/* taken by fido_bio_dev_enroll_start() */
+	fido_tx_release(a->dev);
+done:
+	pthread_mutex_lock(&a->lock);
+	a->r = r;
+	a->done = true;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+
+	bio_enroll_notify(a);
+
+	return (NULL);
+}
+
+static void
+bio_enroll_async_free(struct fido_bio_enroll_async **ap)
+{
+	struct fido_bio_enroll_async *a;
+
+	if (ap == NULL || (a = *ap) == NULL)
+		return;
+
+	for (size_t i = 0; i < nitems(a->fd); i++)
+		if (a->fd[i] != -1)
+			close(a->fd[i]);
+
+	pthread_cond_destroy(&a->cond);
+	pthread_mutex_destroy(&a->lock);
+	fido_free(a);
+	*ap = NULL;
+}
+
+static struct fido_bio_enroll_async *
+bio_enroll_async_new(void)
+{
+	struct fido_bio_enroll_async *a;
+
+	if ((a = fido_calloc(1, sizeof(*a))) == NULL)
+		return (NULL);
+
+	a->fd[0] = -1;
+	a->fd[1] = -1;
+
+	if (pthread_mutex_init(&a->lock, NULL) != 0) {
+		fido_free(a);
+		return (NULL);
+	}
+	if (pthread_cond_init(&a->cond, NULL) != 0) {
+		pthread_mutex_destroy(&a->lock);
+		fido_free(a);
+		return (NULL);
+	}
+
+	if (pipe(a->fd) < 0 ||
+	    fcntl(a->fd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(a->fd[1], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(a->fd[1], F_SETFL, O_NONBLOCK) < 0) {
+		fido_log_debug("%s: pipe", __func__);
+		bio_enroll_async_free(&a);
+		return (NULL);
+	}
+
+	return (a);
+}
+#endif /* HAVE_PTHREAD */
+
+int
+fido_bio_dev_enroll_start(fido_dev_t *dev, fido_bio_template_t *t,
+    fido_bio_enroll_t *e, uint32_t timo_ms, const char *pin)
+{
+#ifdef HAVE_PTHREAD
+	struct fido_bio_enroll_async	*a = NULL;
+	int				 r;
+
+	if (pin == NULL || e->token != NULL || e->async != NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((a = bio_enroll_async_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	/* held by the worker until the enrollment is over */
+	if (fido_tx_hold(dev) < 0) {
+		bio_enroll_async_free(&a);
+		return (FIDO_ERR_TX);
+	}
+
+	if ((r = bio_enroll_get_token(dev, e, pin)) != FIDO_OK) {
+		fido_tx_release(dev);
+		bio_enroll_async_free(&a);
 		return (r);
 	}
 
+	a->dev = dev;
+	a->t = t;
+	a->e = e;
+	a->timo_ms = timo_ms;
+	e->remaining_samples = 0;
+	e->last_status = 0;
+
+	fido_tx_pass(dev);
+
+	if (pthread_create(&a->thread, NULL, bio_enroll_worker, a) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		if (fido_tx_take(dev) == 0)
+			fido_tx_release(dev);
+		bio_enroll_async_free(&a);
+		fido_blob_free(&e->token);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	e->async = a;
+
 	return (FIDO_OK);
+#else
+	(void)dev;
+	(void)t;
+	(void)e;
+	(void)timo_ms;
+	(void)pin;
+
+	return (FIDO_ERR_INTERNAL);
+#endif
 }
 
 int
-fido_bio_dev_enroll_cancel(fido_dev_t *dev)
+fido_bio_enroll_cancel(fido_bio_enroll_t *e)
 {
-	return (bio_enroll_cancel_wait(dev, -1));
+#ifdef HAVE_PTHREAD
+	struct fido_bio_enroll_async *a;
+
+	if ((a = e->async) == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	__atomic_store_n(&a->cancel, 1, __ATOMIC_RELEASE);
+
+	/* abort a pending capture, if any */
+	pthread_mutex_lock(&a->lock);
+	if (a->done == false && fido_dev_cancel(a->dev) != FIDO_OK)
+		fido_log_debug("%s: fido_dev_cancel", __func__);
+	pthread_mutex_unlock(&a->lock);
+
+	return (FIDO_OK);
+#else
+	(void)e;
+
+	return (FIDO_ERR_INVALID_ARGUMENT);
+#endif
+}
+
+int
+fido_bio_enroll_wait(fido_bio_enroll_t *e, int ms)
+{
+#ifdef HAVE_PTHREAD
+	struct fido_bio_enroll_async	*a;
+	struct timespec			 ts;
+	int				 r;
+
+	if ((a = e->async) == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memset(&ts, 0, sizeof(ts));
+
+	if (ms > 0) {
+		if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+			return (FIDO_ERR_INTERNAL);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+	}
+
+	pthread_mutex_lock(&a->lock);
+	while (a->done == false && ms != 0)
+		if (ms < 0)
+			pthread_cond_wait(&a->cond, &a->lock);
+		else if (pthread_cond_timedwait(&a->cond, &a->lock,
+		    &ts) == ETIMEDOUT)
+			break;
+	if (a->done == false) {
+		pthread_mutex_unlock(&a->lock);
+		return (FIDO_ERR_TIMEOUT);
+	}
+	r = a->r;
+	pthread_mutex_unlock(&a->lock);
+
+	pthread_join(a->thread, NULL);
+	bio_enroll_async_free(&e->async);
+
+	return (r);
+#else
+	(void)e;
+	(void)ms;
+
+	return (FIDO_ERR_INVALID_ARGUMENT);
+#endif
+}
+
+int
+fido_bio_enroll_fd(const fido_bio_enroll_t *e)
+{
+#ifdef HAVE_PTHREAD
+	if (e->async != NULL)
+		return (e->async->fd[0]);
+#else
+	(void)e;
+#endif
+	return (-1);
+}
+
+int
+fido_bio_enroll_set_cb(fido_bio_enroll_t *e, fido_bio_enroll_cb_t *cb,
+    void *arg)
+{
+	if (e->async != NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	e->cb = cb;
+	e->cb_arg = arg;
+
+	return (FIDO_OK);
 }
 
 static int
@@ -596,7 +961,14 @@ int
 fido_bio_dev_enroll_remove(fido_dev_t *dev, const fido_bio_template_t *t,
     const char *pin)
 {
-	return (bio_enroll_remove_wait(dev, t, pin, -1));
+	int r;
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = bio_enroll_remove_wait(dev, t, pin, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static void
@@ -652,7 +1024,7 @@ bio_rx_info(fido_dev_t *dev, fido_bio_info_t *i, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, i,
@@ -711,13 +1083,13 @@ fido_bio_template_array_count(const fido_bio_template_array_t *ta)
 fido_bio_template_array_t *
 fido_bio_template_array_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_template_array_t)));
+	return (fido_calloc(1, sizeof(fido_bio_template_array_t)));
 }
 
 fido_bio_template_t *
 fido_bio_template_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_template_t)));
+	return (fido_calloc(1, sizeof(fido_bio_template_t)));
 }
 
 void
@@ -729,7 +1101,7 @@ fido_bio_template_array_free(fido_bio_template_array_t **tap)
 		return;
 
 	bio_reset_template_array(ta);
-	free(ta);
+	fido_free(ta);
 	*tap = NULL;
 }
 
@@ -742,17 +1114,17 @@ fido_bio_template_free(fido_bio_template_t **tp)
 		return;
 
 	bio_reset_template(t);
-	free(t);
+	fido_free(t);
 	*tp = NULL;
 }
 
 int
 fido_bio_template_set_name(fido_bio_template_t *t, const char *name)
 {
-	free(t->name);
+	fido_free(t->name);
 	t->name = NULL;
 
-	if (name && (t->name = strdup(name)) == NULL)
+	if (name && (t->name = fido_strdup(name)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	return (FIDO_OK);
@@ -762,7 +1134,7 @@ int
 fido_bio_template_set_id(fido_bio_template_t *t, const unsigned char *ptr,
     size_t len)
 {
-	free(t->id.ptr);
+	fido_free(t->id.ptr);
 	t->id.ptr = NULL;
 	t->id.len = 0;
 
@@ -784,13 +1156,13 @@ fido_bio_template(const fido_bio_template_array_t *ta, size_t idx)
 fido_bio_enroll_t *
 fido_bio_enroll_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_enroll_t)));
+	return (fido_calloc(1, sizeof(fido_bio_enroll_t)));
 }
 
 fido_bio_info_t *
 fido_bio_info_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_info_t)));
+	return (fido_calloc(1, sizeof(fido_bio_info_t)));
 }
 
 uint8_t
@@ -813,9 +1185,14 @@ fido_bio_enroll_free(fido_bio_enroll_t **ep)
 	if (ep == NULL || (e = *ep) == NULL)
 		return;
 
+	if (e->async != NULL) {
+		fido_bio_enroll_cancel(e);
+		fido_bio_enroll_wait(e, -1);
+	}
+
 	bio_reset_enroll(e);
 
-	free(e);
+	fido_free(e);
 	*ep = NULL;
 }
 
@@ -827,18 +1204,42 @@ fido_bio_info_free(fido_bio_info_t **ip)
 	if (ip == NULL || (i = *ip) == NULL)
 		return;
 
-	free(i);
+	fido_free(i);
 	*ip = NULL;
 }
 
 uint8_t
 fido_bio_enroll_remaining_samples(const fido_bio_enroll_t *e)
 {
-	return (e->remaining_samples);
+	uint8_t n;
+
+#ifdef HAVE_PTHREAD
+	if (e->async != NULL) {
+		pthread_mutex_lock(&e->async->lock);
+		n = e->remaining_samples;
+		pthread_mutex_unlock(&e->async->lock);
+		return (n);
+	}
+#endif
+	n = e->remaining_samples;
+
+	return (n);
 }
 
 uint8_t
 fido_bio_enroll_last_status(const fido_bio_enroll_t *e)
 {
-	return (e->last_status);
+	uint8_t status;
+
+#ifdef HAVE_PTHREAD
+	if (e->async != NULL) {
+		pthread_mutex_lock(&e->async->lock);
+		status = e->last_status;
+		pthread_mutex_unlock(&e->async->lock);
+		return (status);
+	}
+#endif
+	status = e->last_status;
+
+	return (status);
 }
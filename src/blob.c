@@ -10,15 +10,14 @@
 fido_blob_t *
 fido_blob_new(void)
 {
-	return (calloc(1, sizeof(fido_blob_t)));
+	return (fido_calloc(1, sizeof(fido_blob_t)));
 }
 
 int
 fido_blob_set(fido_blob_t *b, const unsigned char *ptr, size_t len)
 {
 	if (b->ptr != NULL) {
-		explicit_bzero(b->ptr, b->len);
-		free(b->ptr);
+		fido_freezero(b->ptr, b->len);
 		b->ptr = NULL;
 	}
 
@@ -30,7 +29,7 @@ fido_blob_set(fido_blob_t *b, const unsigned char *ptr, size_t len)
 		return (-1);
 	}
 
-	if ((b->ptr = malloc(len)) == NULL) {
+	if ((b->ptr = fido_malloc(len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		return (-1);
 	}
@@ -50,12 +49,10 @@ fido_blob_free(fido_blob_t **bp)
 		return;
 
 	if (b->ptr) {
-		explicit_bzero(b->ptr, b->len);
-		free(b->ptr);
+		fido_freezero(b->ptr, b->len);
 	}
 
-	explicit_bzero(b, sizeof(*b));
-	free(b);
+	fido_freezero(b, sizeof(*b));
 
 	*bp = NULL;
 }
@@ -69,13 +66,12 @@ fido_free_blob_array(fido_blob_array_t *array)
 	for (size_t i = 0; i < array->len; i++) {
 		fido_blob_t *b = &array->ptr[i];
 		if (b->ptr != NULL) {
-			explicit_bzero(b->ptr, b->len);
-			free(b->ptr);
+			fido_freezero(b->ptr, b->len);
 			b->ptr = NULL;
 		}
 	}
 
-	free(array->ptr);
+	fido_free(array->ptr);
 	array->ptr = NULL;
 	array->len = 0;
 }
@@ -0,0 +1,1339 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_PTHREAD)
+#define USE_BROKER
+#endif
+
+#ifdef USE_BROKER
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fido.h"
+
+/*
+ * A fido_broker_t is a daemon-side object that owns the FIDO devices of
+ * a host and serves CTAPHID transactions on them to unprivileged clients
+ * over a Unix domain socket. Each device is opened once, on first use,
+ * and kept open; transactions from different clients are serialised on
+ * the device, and run on the broker's channel.
+ *
+ * A client holds the device across the transactions of a library call
+ * (see fido_tx_hold()): requests sent while the call is under way carry
+ * BROKER_F_HOLD, and the device is handed back once a request without it
+ * has been answered, a BROKER_OP_RELEASE arrives, or the client goes
+ * away. Stateful sequences, such as a credential enumeration, are thus
+ * not interleaved with other clients' requests. CTAPHID_LOCK is emulated
+ * the same way: the device is held for the requested number of seconds.
+ * Likewise, a client that sends nothing for the broker's hold timeout
+ * while holding the device for a call loses it, and the remaining held
+ * requests of that call fail.
+ *
+ * A client is a fido_dev_t set up with fido_dev_set_broker(). Upon
+ * connection, the broker hands the client a sealed memfd holding a ring
+ * of BROKER_NSLOTS message slots. Requests and replies are copied through
+ * the ring; the socket only carries fixed-size control messages naming a
+ * slot. The client uses slot (seq % BROKER_NSLOTS) for request seq, and
+ * the reply overwrites it. Since replies are sent in request order, and a
+ * client never has more than BROKER_NSLOTS requests outstanding, a slot
+ * is not reused before the broker is done with it.
+ *
+ * The broker never trusts the contents of the ring: requests are copied
+ * out of it, and validated, before use.
+ */
+
+#ifdef USE_BROKER
+
+#define BROKER_NSLOTS	8	/* slots in the shared ring */
+#define BROKER_MAXCONN	128	/* concurrent clients */
+#define BROKER_BACKLOG	16	/* listen(2) backlog */
+#define BROKER_MAXDEV	64	/* devices looked up in the manifest */
+
+#define BROKER_OP_HELLO		1 /* broker: here is the ring */
+#define BROKER_OP_OPEN		2 /* client: open the device in slot 0 */
+#define BROKER_OP_XFER		3 /* request/reply */
+#define BROKER_OP_CANCEL	4 /* client: cancel the pending request */
+#define BROKER_OP_KEEPALIVE	5 /* broker: CTAPHID_KEEPALIVE received */
+#define BROKER_OP_RELEASE	6 /* client: library call complete */
+
+#define BROKER_F_HOLD		0x01 /* keep the device after the reply */
+
+#define BROKER_POLL_MS		100 /* cancel check while waiting */
+#define BROKER_HOLD_MS		(CTAP_LOCK_MAX_SECONDS * 1000) /* default */
+
+struct broker_msg {
+	uint32_t	op;     /* BROKER_OP_* */
+	uint32_t	seq;    /* request sequence number */
+	uint32_t	slot;   /* ring slot holding the payload */
+	uint32_t	len;    /* payload length; keepalive: elapsed ms */
+	int32_t		status; /* FIDO_ERR_*; keepalive: status */
+	uint8_t		cmd;    /* CTAPHID command */
+	uint8_t		flags;  /* BROKER_F_* */
+	uint8_t		pad[2];
+};
+
+struct broker_ring {
+	unsigned char	slot[BROKER_NSLOTS][FIDO_MAXMSG];
+};
+
+/* a device served by the broker */
+struct broker_dev {
+	struct broker_dev	*next;
+	char			*path;
+	fido_dev_t		*dev;  /* NULL if not open */
+	pthread_mutex_t		 lock; /* serialises transactions */
+};
+
+/* a connected client */
+struct broker_conn {
+	struct broker_conn	*next;
+	struct fido_broker	*broker;
+	struct broker_dev	*bdev;     /* device opened by the client */
+	int			 fd;       /* client socket */
+	struct broker_ring	*ring;     /* shared with the client */
+	pthread_t		 thread;
+	bool			 done;     /* thread finished */
+	bool			 cancel;   /* request cancelled */
+	bool			 deferred; /* msg read ahead */
+	bool			 held;     /* bdev->lock is ours */
+	bool			 hold;     /* library call under way */
+	bool			 expired;  /* ... and its hold timed out */
+	struct timespec		 hold_ts;  /* held request answered */
+	int			 lock_ms;  /* CTAPHID_LOCK; 0 if none */
+	struct timespec		 lock_ts;  /* CTAPHID_LOCK taken */
+	struct broker_msg	 msg;
+	unsigned char		 req[FIDO_MAXMSG];   /* private copy */
+	unsigned char		 reply[FIDO_MAXMSG];
+};
+
+struct fido_broker {
+	char			*path;   /* socket path */
+	int			 fd;     /* listening socket */
+	int			 stop;   /* fido_broker_stop() called */
+	int			 hold_ms; /* fido_broker_set_hold_timeout() */
+	struct broker_dev	*dev;    /* known devices */
+	struct broker_conn	*conn;   /* connected clients */
+	size_t			 nconns;
+	pthread_mutex_t		 lock;
+};
+
+/* client side */
+struct broker_handle {
+	int			 fd;
+	struct broker_ring	*ring;
+	fido_ctap_info_t	 attr;         /* device attributes */
+	uint64_t		 nonce;        /* CTAPHID_INIT nonce */
+	bool			 init_pending; /* CTAPHID_INIT pending */
+	uint32_t		 seq;          /* last request sent */
+	uint32_t		 done;         /* last reply received */
+	bool			 hold;         /* BROKER_F_HOLD sent */
+};
+
+static int
+msg_send(int fd, const struct broker_msg *msg, int passfd, int flags)
+{
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cmsg;
+	struct msghdr	 mh;
+	struct iovec	 iov;
+	struct cmsghdr	*cp;
+
+	memset(&mh, 0, sizeof(mh));
+	memset(&cmsg, 0, sizeof(cmsg));
+
+	iov.iov_base = (void *)(uintptr_t)msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	if (passfd != -1) {
+		mh.msg_control = cmsg.buf;
+		mh.msg_controllen = sizeof(cmsg.buf);
+		cp = CMSG_FIRSTHDR(&mh);
+		cp->cmsg_level = SOL_SOCKET;
+		cp->cmsg_type = SCM_RIGHTS;
+		cp->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cp), &passfd, sizeof(int));
+	}
+
+	if (sendmsg(fd, &mh, flags | MSG_NOSIGNAL) != (ssize_t)sizeof(*msg)) {
+		fido_log_debug("%s: sendmsg", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Receive a control message, waiting at most ms milliseconds. If passfd is
+ * not NULL, a descriptor passed along is stored in it; any other descriptor
+ * is closed. Returns 1 on success, 0 on timeout, and -1 on error or hangup.
+ */
+static int
+msg_recv(int fd, struct broker_msg *msg, int ms, int *passfd)
+{
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(4 * sizeof(int))];
+	} cmsg;
+	struct pollfd	 pfd;
+	struct msghdr	 mh;
+	struct iovec	 iov;
+	struct cmsghdr	*cp;
+	ssize_t		 n;
+	int		 r;
+
+	if (passfd != NULL)
+		*passfd = -1;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while ((r = poll(&pfd, 1, ms)) < 0 && errno == EINTR)
+		continue;
+	if (r <= 0)
+		return (r);
+
+	memset(&mh, 0, sizeof(mh));
+	memset(msg, 0, sizeof(*msg));
+
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof(cmsg.buf);
+
+	if ((n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC)) < 0)
+		return (-1);
+
+	for (cp = CMSG_FIRSTHDR(&mh); cp != NULL; cp = CMSG_NXTHDR(&mh, cp)) {
+		if (cp->cmsg_level != SOL_SOCKET || cp->cmsg_type != SCM_RIGHTS)
+			continue;
+		for (size_t i = 0; CMSG_LEN((i + 1) * sizeof(int)) <=
+		    cp->cmsg_len; i++) {
+			int xfd;
+			memcpy(&xfd, CMSG_DATA(cp) + i * sizeof(int),
+			    sizeof(xfd));
+			if (passfd != NULL && *passfd == -1)
+				*passfd = xfd;
+			else
+				close(xfd);
+		}
+	}
+
+	if (n != (ssize_t)sizeof(*msg) || (mh.msg_flags & (MSG_TRUNC |
+	    MSG_CTRUNC)) != 0) {
+		fido_log_debug("%s: n=%zd, flags=0x%x", __func__, n,
+		    mh.msg_flags);
+		if (passfd != NULL && *passfd != -1) {
+			close(*passfd);
+			*passfd = -1;
+		}
+		return (-1);
+	}
+
+	return (1);
+}
+
+/*
+ * Create the shared ring. The memfd is sealed at its final size, so that
+ * a client cannot shrink it and fault the broker.
+ */
+static struct broker_ring *
+ring_new(int *fd)
+{
+	struct broker_ring	*ring;
+	const int		 seals = F_SEAL_SHRINK | F_SEAL_GROW |
+				    F_SEAL_SEAL;
+
+	if ((*fd = memfd_create("fido_broker", MFD_CLOEXEC |
+	    MFD_ALLOW_SEALING)) < 0) {
+		fido_log_debug("%s: memfd_create", __func__);
+		return (NULL);
+	}
+
+	if (ftruncate(*fd, (off_t)sizeof(*ring)) < 0 ||
+	    fcntl(*fd, F_ADD_SEALS, seals) < 0) {
+		fido_log_debug("%s: ftruncate/fcntl", __func__);
+		goto fail;
+	}
+
+	if ((ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, *fd, 0)) == MAP_FAILED) {
+		fido_log_debug("%s: mmap", __func__);
+		goto fail;
+	}
+
+	return (ring);
+fail:
+	close(*fd);
+	*fd = -1;
+
+	return (NULL);
+}
+
+static struct broker_ring *
+ring_map(int fd)
+{
+	struct broker_ring	*ring;
+	struct stat		 st;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*ring)) {
+		fido_log_debug("%s: fstat", __func__);
+		return (NULL);
+	}
+
+	if ((ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fido_log_debug("%s: mmap", __func__);
+		return (NULL);
+	}
+
+	return (ring);
+}
+
+static bool
+forward_cmd(uint8_t cmd)
+{
+	switch (cmd) {
+	case CTAP_CMD_PING:
+	case CTAP_CMD_MSG:
+	case CTAP_CMD_WINK:
+	case CTAP_CMD_CBOR:
+		return (true);
+	default:
+		/* CTAPHID_INIT would affect other clients */
+		return (false);
+	}
+}
+
+/* only devices found by fido_dev_info_manifest() are opened */
+static bool
+known_path(const char *path)
+{
+	const fido_dev_info_t	*di;
+	fido_dev_info_t		*devlist;
+	size_t			 ndevs;
+	bool			 ok = false;
+
+	if ((devlist = fido_dev_info_new(BROKER_MAXDEV)) == NULL)
+		return (false);
+
+	if (fido_dev_info_manifest(devlist, BROKER_MAXDEV, &ndevs) == FIDO_OK)
+		for (size_t i = 0; i < ndevs && ok == false; i++) {
+			di = fido_dev_info_ptr(devlist, i);
+			ok = strcmp(fido_dev_info_path(di), path) == 0;
+		}
+
+	fido_dev_info_free(&devlist, BROKER_MAXDEV);
+
+	return (ok);
+}
+
+static struct broker_dev *
+broker_dev_get(fido_broker_t *b, const char *path)
+{
+	struct broker_dev *bdev;
+
+	pthread_mutex_lock(&b->lock);
+
+	for (bdev = b->dev; bdev != NULL; bdev = bdev->next)
+		if (strcmp(bdev->path, path) == 0)
+			goto out;
+
+	if (known_path(path) == false) {
+		fido_log_debug("%s: unknown path %s", __func__, path);
+		goto out;
+	}
+
+	if ((bdev = fido_calloc(1, sizeof(*bdev))) == NULL ||
+	    (bdev->path = fido_strdup(path)) == NULL) {
+		fido_free(bdev);
+		bdev = NULL;
+		goto out;
+	}
+
+	pthread_mutex_init(&bdev->lock, NULL);
+	bdev->next = b->dev;
+	b->dev = bdev;
+out:
+	pthread_mutex_unlock(&b->lock);
+
+	return (bdev);
+}
+
+static void
+broker_dev_close(struct broker_dev *bdev)
+{
+	if (bdev->dev == NULL)
+		return;
+
+	fido_dev_close(bdev->dev);
+	fido_dev_free(&bdev->dev);
+}
+
+/* called with bdev->lock held */
+static int
+broker_dev_open(struct broker_dev *bdev)
+{
+	int r;
+
+	if (bdev->dev != NULL)
+		return (FIDO_OK);
+
+	if ((bdev->dev = fido_dev_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = fido_dev_open(bdev->dev, bdev->path)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_open %s", __func__, bdev->path);
+		fido_dev_free(&bdev->dev);
+	}
+
+	return (r);
+}
+
+/*
+ * Look for a CANCEL from the client, or its going away, while a request
+ * is waiting for the device. Any other message is kept for later.
+ */
+static void
+conn_poll(struct broker_conn *c)
+{
+	struct broker_msg	msg;
+	int			r;
+
+	while (c->cancel == false && c->deferred == false) {
+		if ((r = msg_recv(c->fd, &msg, 0, NULL)) == 0)
+			return;
+		if (r < 0 || msg.op == BROKER_OP_CANCEL) {
+			c->cancel = true;
+			return;
+		}
+		c->msg = msg;
+		c->deferred = true;
+	}
+}
+
+static void
+conn_keepalive(void *arg, uint8_t status, int ms)
+{
+	struct broker_conn	*c = arg;
+	struct broker_msg	 msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = BROKER_OP_KEEPALIVE;
+	msg.status = status;
+	msg.len = ms < 0 ? 0 : (uint32_t)ms;
+	/* never block on a client that does not read */
+	(void)msg_send(c->fd, &msg, -1, MSG_DONTWAIT);
+
+	if (c->cancel)
+		return;
+
+	conn_poll(c);
+
+	if (c->cancel) {
+		fido_log_debug("%s: cancelling", __func__);
+		if (fido_tx(c->bdev->dev, CTAP_CMD_CANCEL, NULL, 0) < 0)
+			fido_log_debug("%s: fido_tx", __func__);
+	}
+}
+
+/* milliseconds left on the client's CTAPHID_LOCK; 0 if none */
+static int
+conn_lock_left(struct broker_conn *c)
+{
+	int elapsed_ms;
+
+	if (c->lock_ms == 0)
+		return (0);
+
+	if (fido_time_delta_ms(&c->lock_ts, &elapsed_ms) < 0 ||
+	    elapsed_ms >= c->lock_ms) {
+		c->lock_ms = 0;
+		return (0);
+	}
+
+	return (c->lock_ms - elapsed_ms);
+}
+
+/*
+ * milliseconds left on the client's hold of the device for a call; 0 if
+ * none. The call's remaining held requests fail once it has expired.
+ */
+static int
+conn_hold_left(struct broker_conn *c)
+{
+	int hold_ms = __atomic_load_n(&c->broker->hold_ms, __ATOMIC_RELAXED);
+	int elapsed_ms;
+
+	if (c->hold == false || c->held == false)
+		return (0);
+
+	if (fido_time_delta_ms(&c->hold_ts, &elapsed_ms) < 0 ||
+	    elapsed_ms >= hold_ms) {
+		fido_log_debug("%s: hold expired", __func__);
+		c->hold = false;
+		c->expired = true;
+		return (0);
+	}
+
+	return (hold_ms - elapsed_ms);
+}
+
+/*
+ * Wait for the device, unless the client holds it already. While we
+ * wait, look for a CANCEL from the client, or its going away, every
+ * BROKER_POLL_MS; once more when the device is ours.
+ */
+static int
+conn_acquire(struct broker_conn *c)
+{
+	struct timespec	ts;
+	int		r;
+
+	c->cancel = false;
+
+	while (c->held == false) {
+		if (clock_gettime(CLOCK_REALTIME, &ts) < 0)
+			return (-1);
+		ts.tv_nsec += BROKER_POLL_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		if ((r = pthread_mutex_timedlock(&c->bdev->lock, &ts)) == 0) {
+			c->held = true;
+			break;
+		}
+		if (r != ETIMEDOUT) {
+			fido_log_debug("%s: pthread_mutex_timedlock", __func__);
+			return (-1);
+		}
+		conn_poll(c);
+		if (c->cancel)
+			return (-1);
+	}
+
+	/* the client may have given up while we waited for the device */
+	conn_poll(c);
+
+	return (c->cancel ? -1 : 0);
+}
+
+/* hand the device back, unless the client's call or lock goes on */
+static void
+conn_release(struct broker_conn *c)
+{
+	if (c->held == false || c->hold || conn_lock_left(c) > 0)
+		return;
+
+	pthread_mutex_unlock(&c->bdev->lock);
+	c->held = false;
+}
+
+static int
+conn_open(struct broker_conn *c, const struct broker_msg *req)
+{
+	struct broker_msg	reply;
+	char			path[FIDO_MAXMSG];
+	int			r;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.op = BROKER_OP_OPEN;
+
+	if (c->bdev != NULL || req->len == 0 || req->len >= sizeof(path)) {
+		fido_log_debug("%s: invalid request", __func__);
+		reply.status = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	memcpy(path, c->ring->slot[0], req->len);
+	path[req->len] = '\0';
+
+	if (strlen(path) != req->len ||
+	    (c->bdev = broker_dev_get(c->broker, path)) == NULL) {
+		reply.status = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	pthread_mutex_lock(&c->bdev->lock);
+	if ((r = broker_dev_open(c->bdev)) == FIDO_OK) {
+		memcpy(c->ring->slot[0], &c->bdev->dev->attr,
+		    sizeof(c->bdev->dev->attr));
+		reply.len = sizeof(c->bdev->dev->attr);
+	}
+	pthread_mutex_unlock(&c->bdev->lock);
+
+	if ((reply.status = r) != FIDO_OK)
+		c->bdev = NULL;
+out:
+	return (msg_send(c->fd, &reply, -1, 0));
+}
+
+static int
+conn_xfer(struct broker_conn *c, const struct broker_msg *req)
+{
+	struct broker_msg	 reply;
+	struct broker_dev	*bdev = c->bdev;
+	int			 n = -1;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.op = BROKER_OP_XFER;
+	reply.seq = req->seq;
+	reply.slot = req->slot;
+	reply.cmd = req->cmd;
+
+	if (bdev == NULL || (forward_cmd(req->cmd) == false &&
+	    req->cmd != CTAP_CMD_LOCK) || req->slot >= BROKER_NSLOTS ||
+	    req->len > FIDO_MAXMSG) {
+		fido_log_debug("%s: invalid request", __func__);
+		reply.status = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	/* the rest of a call whose hold expired */
+	if (c->expired) {
+		if (req->flags & BROKER_F_HOLD) {
+			fido_log_debug("%s: hold expired", __func__);
+			reply.status = FIDO_ERR_TX;
+			goto out;
+		}
+		c->expired = false;
+	}
+
+	memcpy(c->req, c->ring->slot[req->slot], req->len);
+
+	/* CTAPHID_LOCK is emulated; releasing it needs no device */
+	if (req->cmd == CTAP_CMD_LOCK) {
+		if (req->len != 1 || c->req[0] > CTAP_LOCK_MAX_SECONDS) {
+			fido_log_debug("%s: invalid lock", __func__);
+			reply.status = FIDO_ERR_INVALID_ARGUMENT;
+			goto done;
+		}
+		if (c->req[0] == 0) {
+			c->lock_ms = 0;
+			n = 0;
+			goto done;
+		}
+	}
+
+	if (conn_acquire(c) < 0) {
+		if (req->cmd == CTAP_CMD_CBOR) {
+			c->reply[0] = FIDO_ERR_KEEPALIVE_CANCEL;
+			n = 1;
+		} else
+			reply.status = FIDO_ERR_TX;
+		goto done;
+	}
+
+	if (req->cmd == CTAP_CMD_LOCK) {
+		if (fido_time_now(&c->lock_ts) < 0)
+			reply.status = FIDO_ERR_INTERNAL;
+		else {
+			c->lock_ms = c->req[0] * 1000;
+			n = 0;
+		}
+		goto done;
+	}
+
+	if ((reply.status = broker_dev_open(bdev)) != FIDO_OK)
+		goto done;
+
+	fido_dev_set_keepalive_handler(bdev->dev, conn_keepalive, c);
+
+	if (fido_tx(bdev->dev, req->cmd, c->req, req->len) < 0)
+		reply.status = FIDO_ERR_TX;
+	else if ((n = fido_rx(bdev->dev, req->cmd, c->reply,
+	    sizeof(c->reply), -1)) < 0)
+		reply.status = fido_rx_error(bdev->dev);
+
+	fido_dev_set_keepalive_handler(bdev->dev, NULL, NULL);
+
+	/* i/o failure; reopen on the next request */
+	if (reply.status == FIDO_ERR_TX || reply.status == FIDO_ERR_RX)
+		broker_dev_close(bdev);
+done:
+	if ((c->hold = (req->flags & BROKER_F_HOLD) != 0) &&
+	    fido_time_now(&c->hold_ts) < 0)
+		c->hold = false;
+	conn_release(c);
+out:
+	explicit_bzero(c->req, sizeof(c->req));
+
+	if (n >= 0) {
+		memcpy(c->ring->slot[req->slot], c->reply, (size_t)n);
+		reply.len = (uint32_t)n;
+		explicit_bzero(c->reply, (size_t)n);
+	}
+
+	return (msg_send(c->fd, &reply, -1, 0));
+}
+
+static void *
+conn_thread(void *arg)
+{
+	struct broker_conn	*c = arg;
+	struct broker_msg	 msg;
+	int			 lock_ms;
+	int			 hold_ms;
+	int			 ms;
+	int			 r;
+
+	for (;;) {
+		if (c->deferred) {
+			msg = c->msg;
+			c->deferred = false;
+		} else {
+			lock_ms = conn_lock_left(c);
+			hold_ms = conn_hold_left(c);
+			if (lock_ms > 0 && hold_ms > 0)
+				ms = lock_ms < hold_ms ? lock_ms : hold_ms;
+			else
+				ms = lock_ms > 0 ? lock_ms : hold_ms;
+			if ((r = msg_recv(c->fd, &msg, ms > 0 ? ms : -1,
+			    NULL)) < 0)
+				break;
+			if (r == 0) {
+				/* CTAPHID_LOCK or hold expired */
+				(void)conn_hold_left(c);
+				conn_release(c);
+				continue;
+			}
+		}
+
+		switch (msg.op) {
+		case BROKER_OP_OPEN:
+			r = conn_open(c, &msg);
+			break;
+		case BROKER_OP_XFER:
+			r = conn_xfer(c, &msg);
+			break;
+		case BROKER_OP_CANCEL:
+			r = 0; /* nothing pending */
+			break;
+		case BROKER_OP_RELEASE:
+			c->hold = false;
+			c->expired = false;
+			conn_release(c);
+			r = 0;
+			break;
+		default:
+			fido_log_debug("%s: op=%u", __func__, msg.op);
+			r = -1;
+			break;
+		}
+
+		if (r < 0)
+			break;
+	}
+
+	/* the client is gone; so are its call and lock */
+	c->hold = false;
+	c->lock_ms = 0;
+	conn_release(c);
+
+	pthread_mutex_lock(&c->broker->lock);
+	c->done = true;
+	pthread_mutex_unlock(&c->broker->lock);
+
+	return (NULL);
+}
+
+static void
+conn_free(struct broker_conn *c)
+{
+	if (c->ring != NULL)
+		munmap(c->ring, sizeof(*c->ring));
+	if (c->fd != -1)
+		close(c->fd);
+
+	fido_freezero(c, sizeof(*c));
+}
+
+/* join and release finished clients; called with b->lock held */
+static void
+broker_reap(fido_broker_t *b, bool all)
+{
+	struct broker_conn **cp = &b->conn;
+	struct broker_conn  *c;
+
+	while ((c = *cp) != NULL) {
+		if (c->done == false && all == false) {
+			cp = &c->next;
+			continue;
+		}
+		*cp = c->next;
+		b->nconns--;
+		pthread_mutex_unlock(&b->lock);
+		pthread_join(c->thread, NULL);
+		conn_free(c);
+		pthread_mutex_lock(&b->lock);
+	}
+}
+
+static void
+broker_accept(fido_broker_t *b, int fd)
+{
+	struct broker_conn	*c = NULL;
+	struct broker_msg	 msg;
+	struct ucred		 cred;
+	socklen_t		 len = sizeof(cred);
+	int			 ringfd = -1;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0)
+		fido_log_debug("%s: pid=%d, uid=%u", __func__, (int)cred.pid,
+		    (unsigned)cred.uid);
+
+	pthread_mutex_lock(&b->lock);
+	broker_reap(b, false);
+
+	if (b->nconns >= BROKER_MAXCONN) {
+		fido_log_debug("%s: too many clients", __func__);
+		goto fail;
+	}
+
+	if ((c = fido_calloc(1, sizeof(*c))) == NULL)
+		goto fail;
+
+	c->broker = b;
+	c->fd = fd;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = BROKER_OP_HELLO;
+	msg.len = sizeof(*c->ring);
+
+	if ((c->ring = ring_new(&ringfd)) == NULL ||
+	    msg_send(fd, &msg, ringfd, 0) < 0) {
+		fido_log_debug("%s: ring", __func__);
+		goto fail;
+	}
+
+	if (pthread_create(&c->thread, NULL, conn_thread, c) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		goto fail;
+	}
+
+	close(ringfd);
+	c->next = b->conn;
+	b->conn = c;
+	b->nconns++;
+	pthread_mutex_unlock(&b->lock);
+
+	return;
+fail:
+	pthread_mutex_unlock(&b->lock);
+
+	if (ringfd != -1)
+		close(ringfd);
+	if (c != NULL)
+		conn_free(c);
+	else
+		close(fd);
+}
+
+fido_broker_t *
+fido_broker_new(void)
+{
+	fido_broker_t *b;
+
+	if ((b = fido_calloc(1, sizeof(*b))) == NULL)
+		return (NULL);
+
+	b->fd = -1;
+	b->hold_ms = BROKER_HOLD_MS;
+	pthread_mutex_init(&b->lock, NULL);
+
+	return (b);
+}
+
+void
+fido_broker_free(fido_broker_t **b_p)
+{
+	fido_broker_t		*b;
+	struct broker_dev	*bdev;
+
+	if (b_p == NULL || (b = *b_p) == NULL)
+		return;
+
+	/* disconnect clients; pending requests are cancelled */
+	pthread_mutex_lock(&b->lock);
+	for (struct broker_conn *c = b->conn; c != NULL; c = c->next)
+		shutdown(c->fd, SHUT_RDWR);
+	broker_reap(b, true);
+	pthread_mutex_unlock(&b->lock);
+
+	while ((bdev = b->dev) != NULL) {
+		b->dev = bdev->next;
+		broker_dev_close(bdev);
+		pthread_mutex_destroy(&bdev->lock);
+		fido_free(bdev->path);
+		fido_free(bdev);
+	}
+
+	if (b->fd != -1)
+		close(b->fd);
+	if (b->path != NULL) {
+		unlink(b->path);
+		fido_free(b->path);
+	}
+
+	pthread_mutex_destroy(&b->lock);
+	fido_free(b);
+
+	*b_p = NULL;
+}
+
+int
+fido_broker_listen(fido_broker_t *b, const char *path)
+{
+	struct sockaddr_un	sun;
+	int			fd = -1;
+
+	if (b->fd != -1 || path == NULL) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path)) {
+		fido_log_debug("%s: path too long", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((b->path = fido_strdup(path)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+	    bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fido_log_debug("%s: socket/bind %s", __func__, path);
+		goto fail;
+	}
+
+	if (listen(fd, BROKER_BACKLOG) < 0) {
+		fido_log_debug("%s: listen", __func__);
+		unlink(path);
+		goto fail;
+	}
+
+	b->fd = fd;
+
+	return (FIDO_OK);
+fail:
+	if (fd != -1)
+		close(fd);
+
+	fido_free(b->path);
+	b->path = NULL;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
+int
+fido_broker_run(fido_broker_t *b)
+{
+	int fd;
+
+	if (b->fd == -1) {
+		fido_log_debug("%s: not listening", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	while (__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE) == 0) {
+		if ((fd = accept4(b->fd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE))
+				break;
+			fido_log_debug("%s: accept", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+		broker_accept(b, fd);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_broker_set_hold_timeout(fido_broker_t *b, int ms)
+{
+	if (ms <= 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	__atomic_store_n(&b->hold_ms, ms, __ATOMIC_RELAXED);
+
+	return (FIDO_OK);
+}
+
+/* async-signal-safe */
+int
+fido_broker_stop(fido_broker_t *b)
+{
+	if (b->fd == -1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	__atomic_store_n(&b->stop, 1, __ATOMIC_RELEASE);
+	shutdown(b->fd, SHUT_RDWR);
+
+	return (FIDO_OK);
+}
+
+void *
+fido_broker_attach(const char *sockpath, const char *path)
+{
+	struct broker_handle	*h;
+	struct broker_msg	 msg;
+	struct sockaddr_un	 sun;
+	size_t			 len;
+	int			 ringfd = -1;
+
+	if (path == NULL || (len = strlen(path)) == 0 || len >= FIDO_MAXMSG) {
+		fido_log_debug("%s: invalid path", __func__);
+		return (NULL);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+
+	if (strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path)) {
+		fido_log_debug("%s: sockpath too long", __func__);
+		return (NULL);
+	}
+
+	if ((h = fido_calloc(1, sizeof(*h))) == NULL)
+		return (NULL);
+
+	if ((h->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+	    connect(h->fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fido_log_debug("%s: socket/connect %s", __func__, sockpath);
+		goto fail;
+	}
+
+	if (msg_recv(h->fd, &msg, -1, &ringfd) <= 0 ||
+	    msg.op != BROKER_OP_HELLO || ringfd == -1 ||
+	    (h->ring = ring_map(ringfd)) == NULL) {
+		fido_log_debug("%s: hello", __func__);
+		goto fail;
+	}
+
+	close(ringfd);
+	ringfd = -1;
+
+	memcpy(h->ring->slot[0], path, len);
+	memset(&msg, 0, sizeof(msg));
+	msg.op = BROKER_OP_OPEN;
+	msg.len = (uint32_t)len;
+
+	if (msg_send(h->fd, &msg, -1, 0) < 0 ||
+	    msg_recv(h->fd, &msg, -1, NULL) <= 0 ||
+	    msg.op != BROKER_OP_OPEN || msg.status != FIDO_OK ||
+	    msg.len != sizeof(h->attr)) {
+		fido_log_debug("%s: open %s", __func__, path);
+		goto fail;
+	}
+
+	memcpy(&h->attr, h->ring->slot[0], sizeof(h->attr));
+
+	return (h);
+fail:
+	if (ringfd != -1)
+		close(ringfd);
+
+	fido_broker_detach(h);
+
+	return (NULL);
+}
+
+void
+fido_broker_detach(void *handle)
+{
+	struct broker_handle *h = handle;
+
+	if (h == NULL)
+		return;
+
+	if (h->ring != NULL)
+		munmap(h->ring, sizeof(*h->ring));
+	if (h->fd != -1)
+		close(h->fd);
+
+	fido_free(h);
+}
+
+/* pick up replies to requests we no longer wait for */
+static void
+broker_drain(struct broker_handle *h)
+{
+	struct broker_msg msg;
+
+	while (h->done != h->seq && msg_recv(h->fd, &msg, 0, NULL) > 0)
+		if (msg.op == BROKER_OP_XFER)
+			h->done = msg.seq;
+}
+
+int
+fido_broker_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf,
+    size_t count)
+{
+	struct broker_handle	*h = d->io_handle;
+	struct broker_msg	 msg;
+
+	if (h == NULL || count > FIDO_MAXMSG) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (-1);
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.cmd = cmd;
+
+	switch (cmd) {
+	case CTAP_CMD_INIT:
+		/* answered locally from the attributes sent on open */
+		if (count != sizeof(h->nonce))
+			return (-1);
+		memcpy(&h->nonce, buf, sizeof(h->nonce));
+		h->init_pending = true;
+		return (0);
+	case CTAP_CMD_CANCEL:
+		msg.op = BROKER_OP_CANCEL;
+		return (msg_send(h->fd, &msg, -1, 0));
+	}
+
+	broker_drain(h);
+
+	if (h->seq - h->done >= BROKER_NSLOTS) {
+		fido_log_debug("%s: ring full", __func__);
+		return (-1);
+	}
+
+	msg.op = BROKER_OP_XFER;
+	msg.flags = d->arb_depth > 0 ? BROKER_F_HOLD : 0;
+	msg.seq = ++h->seq;
+	msg.slot = msg.seq % BROKER_NSLOTS;
+	msg.len = (uint32_t)count;
+
+	if (count > 0)
+		memcpy(h->ring->slot[msg.slot], buf, count);
+
+	if (msg_send(h->fd, &msg, -1, 0) < 0)
+		return (-1);
+
+	h->hold = msg.flags != 0;
+
+	return (0);
+}
+
+/* hand back a device held for a library call; see fido_tx_unlock() */
+void
+fido_broker_release(void *handle)
+{
+	struct broker_handle	*h = handle;
+	struct broker_msg	 msg;
+
+	if (h == NULL || h->hold == false)
+		return;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.op = BROKER_OP_RELEASE;
+
+	if (msg_send(h->fd, &msg, -1, 0) < 0)
+		fido_log_debug("%s: msg_send", __func__);
+
+	h->hold = false;
+}
+
+int
+fido_broker_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count,
+    int ms)
+{
+	struct broker_handle	*h = d->io_handle;
+	struct broker_msg	 msg;
+	struct timespec		 ts_start;
+	int			 elapsed_ms;
+	int			 left = ms;
+
+	if (h == NULL)
+		return (-1);
+
+	if (h->init_pending) {
+		if (cmd != CTAP_CMD_INIT || count < sizeof(h->attr))
+			return (-1);
+		h->init_pending = false;
+		h->attr.nonce = h->nonce;
+		memcpy(buf, &h->attr, sizeof(h->attr));
+		return ((int)sizeof(h->attr));
+	}
+
+	if (h->done == h->seq || (ms >= 0 && fido_time_now(&ts_start) < 0))
+		return (-1);
+
+	for (;;) {
+		if (msg_recv(h->fd, &msg, left, NULL) <= 0) {
+			fido_log_debug("%s: msg_recv", __func__);
+			return (-1);
+		}
+
+		if (msg.op == BROKER_OP_KEEPALIVE) {
+			d->stats.keepalives++;
+			if (d->keepalive != NULL)
+				d->keepalive(d->keepalive_arg,
+				    (uint8_t)msg.status, (int)msg.len);
+		} else if (msg.op == BROKER_OP_XFER) {
+			h->done = msg.seq;
+			if (msg.seq == h->seq)
+				break;
+		} else {
+			fido_log_debug("%s: op=%u", __func__, msg.op);
+			return (-1);
+		}
+
+		if (ms >= 0) {
+			if (fido_time_delta_ms(&ts_start, &elapsed_ms) < 0 ||
+			    elapsed_ms >= ms)
+				return (-1);
+			left = ms - elapsed_ms;
+		}
+	}
+
+	if (msg.status != FIDO_OK) {
+		if (msg.status != FIDO_ERR_RX)
+			d->rx_err = msg.status;
+		return (-1);
+	}
+
+	if (msg.cmd != cmd || msg.slot != h->seq % BROKER_NSLOTS ||
+	    msg.len > count || msg.len > FIDO_MAXMSG) {
+		fido_log_debug("%s: invalid reply", __func__);
+		return (-1);
+	}
+
+	memcpy(buf, h->ring->slot[msg.slot], msg.len);
+
+	return ((int)msg.len);
+}
+
+#else /* !USE_BROKER */
+
+fido_broker_t *
+fido_broker_new(void)
+{
+	fido_log_debug("%s: not supported", __func__);
+
+	return (NULL);
+}
+
+void
+fido_broker_free(fido_broker_t **b_p)
+{
+	(void)b_p;
+}
+
+int
+fido_broker_listen(fido_broker_t *b, const char *path)
+{
+	(void)b;
+	(void)path;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
+int
+fido_broker_run(fido_broker_t *b)
+{
+	(void)b;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
+int
+fido_broker_set_hold_timeout(fido_broker_t *b, int ms)
+{
+	(void)b;
+	(void)ms;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
+int
+fido_broker_stop(fido_broker_t *b)
+{
+	(void)b;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
+void *
+fido_broker_attach(const char *sockpath, const char *path)
+{
+	(void)sockpath;
+	(void)path;
+
+	fido_log_debug("%s: not supported", __func__);
+
+	return (NULL);
+}
+
+void
+fido_broker_detach(void *handle)
+{
+	(void)handle;
+}
+
+void
+fido_broker_release(void *handle)
+{
+	(void)handle;
+}
+
+int
+fido_broker_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf,
+    size_t count)
+{
+	(void)d;
+	(void)cmd;
+	(void)buf;
+	(void)count;
+
+	return (-1);
+}
+
+int
+fido_broker_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count,
+    int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)buf;
+	(void)count;
+	(void)ms;
+
+	return (-1);
+}
+
+#endif /* USE_BROKER */
@@ -127,6 +127,8 @@ cbor_parse_reply(const unsigned char *blob, size_t blob_len, void *arg,
 	struct cbor_load_result	 cbor;
 	int			 r;
 
+	fido_trace1(cbor__decode__start, blob_len);
+
 	if (blob_len < 1) {
 		fido_log_debug("%s: blob_len=%zu", __func__, blob_len);
 		r = FIDO_ERR_RX;
@@ -163,6 +165,8 @@ fail:
 	if (item != NULL)
 		cbor_decref(&item);
 
+	fido_trace2(cbor__decode__done, blob_len, r);
+
 	return (r);
 }
 
@@ -189,7 +193,7 @@ cbor_bytestring_copy(const cbor_item_t *item, unsigned char **buf, size_t *len)
 	}
 
 	*len = cbor_bytestring_length(item);
-	if ((*buf = malloc(*len)) == NULL) {
+	if ((*buf = fido_malloc(*len)) == NULL) {
 		*len = 0;
 		return (-1);
 	}
@@ -216,7 +220,7 @@ cbor_string_copy(const cbor_item_t *item, char **str)
 	}
 
 	if ((len = cbor_string_length(item)) == SIZE_MAX ||
-	    (*str = malloc(len + 1)) == NULL)
+	    (*str = fido_malloc(len + 1)) == NULL)
 		return (-1);
 
 	memcpy(*str, cbor_string_handle(item), len);
@@ -403,9 +407,11 @@ cbor_build_frame(uint8_t cmd, cbor_item_t *argv[], size_t argc, fido_blob_t *f)
 	cbor_item_t	*flat = NULL;
 	unsigned char	*cbor = NULL;
 	size_t		 cbor_len;
-	size_t		 cbor_alloc_len;
+	size_t		 cbor_alloc_len = 0;
 	int		 ok = -1;
 
+	fido_trace1(cbor__encode__start, cmd);
+
 	if ((flat = cbor_flatten_vector(argv, argc)) == NULL)
 		goto fail;
 
@@ -415,7 +421,7 @@ cbor_build_frame(uint8_t cmd, cbor_item_t *argv[], size_t argc, fido_blob_t *f)
 		goto fail;
 	}
 
-	if ((f->ptr = malloc(cbor_len + 1)) == NULL)
+	if ((f->ptr = fido_malloc(cbor_len + 1)) == NULL)
 		goto fail;
 
 	f->len = cbor_len + 1;
@@ -427,7 +433,9 @@ fail:
 	if (flat != NULL)
 		cbor_decref(&flat);
 
-	free(cbor);
+	fido_freezero(cbor, cbor_alloc_len);
+
+	fido_trace3(cbor__encode__done, cmd, ok == 0 ? f->len : 0, ok);
 
 	return (ok);
 }
@@ -659,7 +667,7 @@ cbor_encode_pin_enc(const fido_blob_t *key, const fido_blob_t *pin)
 		return (NULL);
 
 	item = cbor_build_bytestring(pe.ptr, pe.len);
-	free(pe.ptr);
+	fido_free(pe.ptr);
 
 	return (item);
 }
@@ -667,13 +675,13 @@ cbor_encode_pin_enc(const fido_blob_t *key, const fido_blob_t *pin)
 static int
 sha256(const unsigned char *data, size_t data_len, fido_blob_t *digest)
 {
-	if ((digest->ptr = calloc(1, SHA256_DIGEST_LENGTH)) == NULL)
+	if ((digest->ptr = fido_calloc(1, SHA256_DIGEST_LENGTH)) == NULL)
 		return (-1);
 
 	digest->len = SHA256_DIGEST_LENGTH;
 
 	if (SHA256(data, data_len, digest->ptr) != digest->ptr) {
-		free(digest->ptr);
+		fido_free(digest->ptr);
 		digest->ptr = NULL;
 		digest->len = 0;
 		return (-1);
@@ -905,7 +913,7 @@ cbor_decode_fmt(const cbor_item_t *item, char **fmt)
 
 	if (strcmp(type, "packed") && strcmp(type, "fido-u2f")) {
 		fido_log_debug("%s: type=%s", __func__, type);
-		free(type);
+		fido_free(type);
 		return (-1);
 	}
 
@@ -1073,7 +1081,7 @@ decode_attcred(const unsigned char **buf, size_t *len, int cose_alg,
 	}
 
 	attcred->id.len = (size_t)be16toh(id_len);
-	if ((attcred->id.ptr = malloc(attcred->id.len)) == NULL)
+	if ((attcred->id.ptr = fido_malloc(attcred->id.len)) == NULL)
 		return (-1);
 
 	fido_log_debug("%s: attcred->id.len=%zu", __func__, attcred->id.len);
@@ -1145,7 +1153,7 @@ decode_extension(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(type);
+	fido_free(type);
 
 	return (ok);
 }
@@ -1203,7 +1211,7 @@ decode_hmac_secret_aux(const cbor_item_t *key, const cbor_item_t *val, void *arg
 
 	ok = cbor_bytestring_copy(val, &out->ptr, &out->len);
 out:
-	free(type);
+	fido_free(type);
 
 	return (ok);
 }
@@ -1397,7 +1405,7 @@ decode_attstmt_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -1449,7 +1457,7 @@ decode_cred_id_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -1504,7 +1512,7 @@ decode_user_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -1550,7 +1558,7 @@ decode_rp_entity_entry(const cbor_item_t *key, const cbor_item_t *val,
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -118,7 +118,7 @@ fail:
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -135,7 +135,7 @@ fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, cred,
@@ -169,14 +169,25 @@ fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin, int
 int
 fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 {
+	int r;
+
 	if (fido_dev_is_fido2(dev) == false) {
 		if (pin != NULL || cred->rk == FIDO_OPT_TRUE ||
 		    cred->ext.mask != 0)
 			return (FIDO_ERR_UNSUPPORTED_OPTION);
-		return (u2f_register(dev, cred, -1));
+		if (fido_tx_hold(dev) < 0)
+			return (FIDO_ERR_TX);
+		r = u2f_register(dev, cred, -1);
+		fido_tx_release(dev);
+		return (r);
 	}
 
-	return (fido_dev_make_cred_wait(dev, cred, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = fido_dev_make_cred_wait(dev, cred, pin, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static int
@@ -441,14 +452,14 @@ out:
 fido_cred_t *
 fido_cred_new(void)
 {
-	return (calloc(1, sizeof(fido_cred_t)));
+	return (fido_calloc(1, sizeof(fido_cred_t)));
 }
 
 static void
 fido_cred_clean_authdata(fido_cred_t *cred)
 {
-	free(cred->authdata_cbor.ptr);
-	free(cred->attcred.id.ptr);
+	fido_freezero(cred->authdata_cbor.ptr, cred->authdata_cbor.len);
+	fido_free(cred->attcred.id.ptr);
 
 	memset(&cred->authdata_ext, 0, sizeof(cred->authdata_ext));
 	memset(&cred->authdata_cbor, 0, sizeof(cred->authdata_cbor));
@@ -459,13 +470,13 @@ fido_cred_clean_authdata(fido_cred_t *cred)
 void
 fido_cred_reset_tx(fido_cred_t *cred)
 {
-	free(cred->cdh.ptr);
-	free(cred->rp.id);
-	free(cred->rp.name);
-	free(cred->user.id.ptr);
-	free(cred->user.icon);
-	free(cred->user.name);
-	free(cred->user.display_name);
+	fido_free(cred->cdh.ptr);
+	fido_free(cred->rp.id);
+	fido_free(cred->rp.name);
+	fido_free(cred->user.id.ptr);
+	fido_free(cred->user.icon);
+	fido_free(cred->user.name);
+	fido_free(cred->user.display_name);
 	fido_free_blob_array(&cred->excl);
 
 	memset(&cred->cdh, 0, sizeof(cred->cdh));
@@ -482,7 +493,7 @@ fido_cred_reset_tx(fido_cred_t *cred)
 static void
 fido_cred_clean_x509(fido_cred_t *cred)
 {
-	free(cred->attstmt.x5c.ptr);
+	fido_free(cred->attstmt.x5c.ptr);
 	cred->attstmt.x5c.ptr = NULL;
 	cred->attstmt.x5c.len = 0;
 }
@@ -490,7 +501,7 @@ fido_cred_clean_x509(fido_cred_t *cred)
 static void
 fido_cred_clean_sig(fido_cred_t *cred)
 {
-	free(cred->attstmt.sig.ptr);
+	fido_free(cred->attstmt.sig.ptr);
 	cred->attstmt.sig.ptr = NULL;
 	cred->attstmt.sig.len = 0;
 }
@@ -498,7 +509,7 @@ fido_cred_clean_sig(fido_cred_t *cred)
 void
 fido_cred_reset_rx(fido_cred_t *cred)
 {
-	free(cred->fmt);
+	fido_free(cred->fmt);
 	cred->fmt = NULL;
 
 	fido_cred_clean_authdata(cred);
@@ -517,7 +528,7 @@ fido_cred_free(fido_cred_t **cred_p)
 	fido_cred_reset_tx(cred);
 	fido_cred_reset_rx(cred);
 
-	free(cred);
+	fido_free(cred);
 
 	*cred_p = NULL;
 }
@@ -609,7 +620,7 @@ fido_cred_set_x509(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 
 	if (ptr == NULL || len == 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
-	if ((x509 = malloc(len)) == NULL)
+	if ((x509 = fido_malloc(len)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	memcpy(x509, ptr, len);
@@ -628,7 +639,7 @@ fido_cred_set_sig(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 
 	if (ptr == NULL || len == 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
-	if ((sig = malloc(len)) == NULL)
+	if ((sig = fido_malloc(len)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	memcpy(sig, ptr, len);
@@ -650,13 +661,13 @@ fido_cred_exclude(fido_cred_t *cred, const unsigned char *id_ptr, size_t id_len)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
 	if (cred->excl.len == SIZE_MAX) {
-		free(id_blob.ptr);
+		fido_free(id_blob.ptr);
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	if ((list_ptr = recallocarray(cred->excl.ptr, cred->excl.len,
+	if ((list_ptr = fido_recallocarray(cred->excl.ptr, cred->excl.len,
 	    cred->excl.len + 1, sizeof(fido_blob_t))) == NULL) {
-		free(id_blob.ptr);
+		fido_free(id_blob.ptr);
 		return (FIDO_ERR_INTERNAL);
 	}
 
@@ -682,23 +693,23 @@ fido_cred_set_rp(fido_cred_t *cred, const char *id, const char *name)
 	fido_rp_t *rp = &cred->rp;
 
 	if (rp->id != NULL) {
-		free(rp->id);
+		fido_free(rp->id);
 		rp->id = NULL;
 	}
 	if (rp->name != NULL) {
-		free(rp->name);
+		fido_free(rp->name);
 		rp->name = NULL;
 	}
 
-	if (id != NULL && (rp->id = strdup(id)) == NULL)
+	if (id != NULL && (rp->id = fido_strdup(id)) == NULL)
 		goto fail;
-	if (name != NULL && (rp->name = strdup(name)) == NULL)
+	if (name != NULL && (rp->name = fido_strdup(name)) == NULL)
 		goto fail;
 
 	return (FIDO_OK);
 fail:
-	free(rp->id);
-	free(rp->name);
+	fido_free(rp->id);
+	fido_free(rp->name);
 	rp->id = NULL;
 	rp->name = NULL;
 
@@ -713,43 +724,43 @@ fido_cred_set_user(fido_cred_t *cred, const unsigned char *user_id,
 	fido_user_t *up = &cred->user;
 
 	if (up->id.ptr != NULL) {
-		free(up->id.ptr);
+		fido_free(up->id.ptr);
 		up->id.ptr = NULL;
 		up->id.len = 0;
 	}
 	if (up->name != NULL) {
-		free(up->name);
+		fido_free(up->name);
 		up->name = NULL;
 	}
 	if (up->display_name != NULL) {
-		free(up->display_name);
+		fido_free(up->display_name);
 		up->display_name = NULL;
 	}
 	if (up->icon != NULL) {
-		free(up->icon);
+		fido_free(up->icon);
 		up->icon = NULL;
 	}
 
 	if (user_id != NULL) {
-		if ((up->id.ptr = malloc(user_id_len)) == NULL)
+		if ((up->id.ptr = fido_malloc(user_id_len)) == NULL)
 			goto fail;
 		memcpy(up->id.ptr, user_id, user_id_len);
 		up->id.len = user_id_len;
 	}
-	if (name != NULL && (up->name = strdup(name)) == NULL)
+	if (name != NULL && (up->name = fido_strdup(name)) == NULL)
 		goto fail;
 	if (display_name != NULL &&
-	    (up->display_name = strdup(display_name)) == NULL)
+	    (up->display_name = fido_strdup(display_name)) == NULL)
 		goto fail;
-	if (icon != NULL && (up->icon = strdup(icon)) == NULL)
+	if (icon != NULL && (up->icon = fido_strdup(icon)) == NULL)
 		goto fail;
 
 	return (FIDO_OK);
 fail:
-	free(up->id.ptr);
-	free(up->name);
-	free(up->display_name);
-	free(up->icon);
+	fido_free(up->id.ptr);
+	fido_free(up->name);
+	fido_free(up->display_name);
+	fido_free(up->icon);
 
 	up->id.ptr = NULL;
 	up->id.len = 0;
@@ -822,7 +833,7 @@ fido_cred_set_prot(fido_cred_t *cred, int prot)
 int
 fido_cred_set_fmt(fido_cred_t *cred, const char *fmt)
 {
-	free(cred->fmt);
+	fido_free(cred->fmt);
 	cred->fmt = NULL;
 
 	if (fmt == NULL)
@@ -831,7 +842,7 @@ fido_cred_set_fmt(fido_cred_t *cred, const char *fmt)
 	if (strcmp(fmt, "packed") && strcmp(fmt, "fido-u2f"))
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((cred->fmt = strdup(fmt)) == NULL)
+	if ((cred->fmt = fido_strdup(fmt)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	return (FIDO_OK);
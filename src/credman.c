@@ -42,7 +42,7 @@ credman_grow_array(void **ptr, size_t *n_alloc, size_t *n_rx, size_t n,
 		return (-1);
 	}
 
-	if ((new_ptr = recallocarray(*ptr, *n_alloc, n, size)) == NULL)
+	if ((new_ptr = fido_recallocarray(*ptr, *n_alloc, n, size)) == NULL)
 		return (-1);
 
 	*ptr = new_ptr;
@@ -98,14 +98,60 @@ fail:
 	return (ok);
 }
 
+static int
+credman_get_token(fido_dev_t *dev, const char *pin, fido_blob_t **token)
+{
+	fido_blob_t	*ecdh = NULL;
+	es256_pk_t	*pk = NULL;
+	int		 r;
+
+	if ((*token = fido_blob_new()) == NULL) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+		fido_log_debug("%s: fido_do_ecdh", __func__);
+		goto fail;
+	}
+
+	if ((r = fido_dev_get_pin_token(dev, pin, ecdh, pk,
+	    *token)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_get_pin_token", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	if (r != FIDO_OK)
+		fido_blob_free(token);
+
+	return (r);
+}
+
+static int
+credman_rp_dgst(const char *rp_id, unsigned char *dgst, fido_blob_t *rp_dgst)
+{
+	if (SHA256((const unsigned char *)rp_id, strlen(rp_id), dgst) != dgst) {
+		fido_log_debug("%s: sha256", __func__);
+		return (-1);
+	}
+
+	rp_dgst->ptr = dgst;
+	rp_dgst->len = SHA256_DIGEST_LENGTH;
+
+	return (0);
+}
+
 static int
 credman_tx(fido_dev_t *dev, uint8_t cmd, const fido_blob_t *param,
-    const char *pin)
+    const fido_blob_t *token)
 {
 	fido_blob_t	 f;
-	fido_blob_t	*ecdh = NULL;
 	fido_blob_t	 hmac;
-	es256_pk_t	*pk = NULL;
 	cbor_item_t	*argv[4];
 	int		 r = FIDO_ERR_INTERNAL;
 
@@ -120,18 +166,14 @@ credman_tx(fido_dev_t *dev, uint8_t cmd, const fido_blob_t *param,
 	}
 
 	/* pinProtocol, pinAuth */
-	if (pin != NULL) {
+	if (token != NULL) {
 		if (credman_prepare_hmac(cmd, param, &argv[1], &hmac) < 0) {
 			fido_log_debug("%s: credman_prepare_hmac", __func__);
 			goto fail;
 		}
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
-			goto fail;
-		}
-		if ((r = cbor_add_pin_params(dev, &hmac, pk, ecdh, pin,
-		    &argv[3], &argv[2])) != FIDO_OK) {
-			fido_log_debug("%s: cbor_add_pin_params", __func__);
+		if ((argv[3] = cbor_encode_pin_auth(token, &hmac)) == NULL ||
+		    (argv[2] = cbor_encode_pin_opt()) == NULL) {
+			fido_log_debug("%s: cbor encode", __func__);
 			goto fail;
 		}
 	}
@@ -146,11 +188,9 @@ credman_tx(fido_dev_t *dev, uint8_t cmd, const fido_blob_t *param,
 
 	r = FIDO_OK;
 fail:
-	es256_pk_free(&pk);
-	fido_blob_free(&ecdh);
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
-	free(hmac.ptr);
+	fido_freezero(f.ptr, f.len);
+	fido_free(hmac.ptr);
 
 	return (r);
 }
@@ -190,7 +230,7 @@ credman_rx_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, metadata,
@@ -204,11 +244,11 @@ credman_rx_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata, int ms)
 
 static int
 credman_get_metadata_wait(fido_dev_t *dev, fido_credman_metadata_t *metadata,
-    const char *pin, int ms)
+    const fido_blob_t *token, int ms)
 {
 	int r;
 
-	if ((r = credman_tx(dev, CMD_CRED_METADATA, NULL, pin)) != FIDO_OK ||
+	if ((r = credman_tx(dev, CMD_CRED_METADATA, NULL, token)) != FIDO_OK ||
 	    (r = credman_rx_metadata(dev, metadata, ms)) != FIDO_OK)
 		return (r);
 
@@ -219,12 +259,87 @@ int
 fido_credman_get_dev_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata,
     const char *pin)
 {
+	fido_blob_t	*token = NULL;
+	int		 r;
+
 	if (fido_dev_is_fido2(dev) == false)
 		return (FIDO_ERR_INVALID_COMMAND);
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (credman_get_metadata_wait(dev, metadata, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_get_metadata_wait(dev, metadata, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+struct credman_total {
+	uint8_t		key; /* totalCredentials or totalRPs */
+	uint64_t	n;
+};
+
+static int
+credman_parse_total(const cbor_item_t *key, const cbor_item_t *val,
+    void *arg)
+{
+	struct credman_total *total = arg;
+
+	if (cbor_isa_uint(key) == false ||
+	    cbor_int_get_width(key) != CBOR_INT_8 ||
+	    cbor_get_uint8(key) != total->key) {
+		fido_log_debug("%s: cbor_type", __func__);
+		return (0); /* ignore */
+	}
+
+	if (cbor_decode_uint64(val, &total->n) < 0 || total->n > SIZE_MAX) {
+		fido_log_debug("%s: cbor_decode_uint64", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Receive a single RK or RP into 'item'. If 'total' is not NULL, the
+ * reply is the first of an enumeration and also carries the total
+ * number of entries; if that number is zero, 'item' is left untouched.
+ */
+static int
+credman_rx_item(fido_dev_t *dev, struct credman_total *total, void *item,
+    int (*parse)(const cbor_item_t *, const cbor_item_t *, void *), int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+	int		r;
+
+	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
+	    ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (fido_rx_error(dev));
+	}
+
+	if (total != NULL) {
+		if ((r = cbor_parse_reply(reply, (size_t)reply_len, total,
+		    credman_parse_total)) != FIDO_OK) {
+			fido_log_debug("%s: credman_parse_total", __func__);
+			return (r);
+		}
+		if (total->n == 0)
+			return (FIDO_OK);
+	}
+
+	if ((r = cbor_parse_reply(reply, (size_t)reply_len, item,
+	    parse)) != FIDO_OK) {
+		fido_log_debug("%s: parse", __func__);
+		return (r);
+	}
+
+	return (FIDO_OK);
 }
 
 static int
@@ -269,7 +384,7 @@ credman_reset_rk(fido_credman_rk_t *rk)
 		fido_cred_reset_rx(&rk->ptr[i]);
 	}
 
-	free(rk->ptr);
+	fido_free(rk->ptr);
 	rk->ptr = NULL;
 	memset(rk, 0, sizeof(*rk));
 }
@@ -315,7 +430,7 @@ credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* adjust as needed */
@@ -352,7 +467,7 @@ credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* sanity check */
@@ -371,51 +486,147 @@ credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 	return (FIDO_OK);
 }
 
+/* fetch the remaining rks of an enumeration started by credman_rx_rk() */
 static int
-credman_get_rk_wait(fido_dev_t *dev, const char *rp_id, fido_credman_rk_t *rk,
-    const char *pin, int ms)
+credman_get_next_rk_wait(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 {
-	fido_blob_t	rp_dgst;
-	uint8_t		dgst[SHA256_DIGEST_LENGTH];
-	int		r;
-
-	if (SHA256((const unsigned char *)rp_id, strlen(rp_id), dgst) != dgst) {
-		fido_log_debug("%s: sha256", __func__);
-		return (FIDO_ERR_INTERNAL);
-	}
-
-	rp_dgst.ptr = dgst;
-	rp_dgst.len = sizeof(dgst);
-
-	if ((r = credman_tx(dev, CMD_RK_BEGIN, &rp_dgst, pin)) != FIDO_OK ||
-	    (r = credman_rx_rk(dev, rk, ms)) != FIDO_OK)
-		return (r);
+	int r;
 
 	while (rk->n_rx < rk->n_alloc) {
+		fido_dev_auto_lock(dev, ms);
 		if ((r = credman_tx(dev, CMD_RK_NEXT, NULL, NULL)) != FIDO_OK ||
 		    (r = credman_rx_next_rk(dev, rk, ms)) != FIDO_OK)
-			return (r);
+			goto out;
 		rk->n_rx++;
 	}
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+out:
+	fido_dev_auto_unlock(dev, ms);
+
+	return (r);
+}
+
+static int
+credman_get_rk_wait(fido_dev_t *dev, const fido_blob_t *rp_dgst,
+    fido_credman_rk_t *rk, const fido_blob_t *token, int ms)
+{
+	int r;
+
+	fido_dev_auto_lock(dev, ms);
+
+	if ((r = credman_tx(dev, CMD_RK_BEGIN, rp_dgst, token)) != FIDO_OK ||
+	    (r = credman_rx_rk(dev, rk, ms)) != FIDO_OK) {
+		fido_dev_auto_unlock(dev, ms);
+		return (r);
+	}
+
+	return (credman_get_next_rk_wait(dev, rk, ms));
 }
 
 int
 fido_credman_get_dev_rk(fido_dev_t *dev, const char *rp_id,
     fido_credman_rk_t *rk, const char *pin)
 {
+	fido_blob_t	*token = NULL;
+	fido_blob_t	 rp_dgst;
+	uint8_t		 dgst[SHA256_DIGEST_LENGTH];
+	int		 r;
+
 	if (fido_dev_is_fido2(dev) == false)
 		return (FIDO_ERR_INVALID_COMMAND);
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (credman_rp_dgst(rp_id, dgst, &rp_dgst) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_get_rk_wait(dev, &rp_dgst, rk, token, -1);
+	fido_tx_release(dev);
 
-	return (credman_get_rk_wait(dev, rp_id, rk, pin, -1));
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+static int
+credman_iter_rk_wait(fido_dev_t *dev, const fido_blob_t *rp_dgst,
+    fido_credman_rk_cb_t *cb, void *arg, const fido_blob_t *token, int ms)
+{
+	struct credman_total	total;
+	fido_cred_t		cred;
+	int			r;
+
+	memset(&cred, 0, sizeof(cred));
+	memset(&total, 0, sizeof(total));
+	total.key = 9; /* totalCredentials */
+
+	fido_dev_auto_lock(dev, ms);
+
+	if ((r = credman_tx(dev, CMD_RK_BEGIN, rp_dgst, token)) != FIDO_OK ||
+	    (r = credman_rx_item(dev, &total, &cred, credman_parse_rk,
+	    ms)) != FIDO_OK)
+		goto out;
+
+	for (uint64_t i = 0; i < total.n; i++) {
+		if (i > 0) {
+			fido_cred_reset_tx(&cred);
+			fido_cred_reset_rx(&cred);
+			fido_dev_auto_lock(dev, ms);
+			if ((r = credman_tx(dev, CMD_RK_NEXT, NULL,
+			    NULL)) != FIDO_OK ||
+			    (r = credman_rx_item(dev, NULL, &cred,
+			    credman_parse_rk, ms)) != FIDO_OK)
+				goto out;
+		}
+		if (cb(arg, &cred, (size_t)total.n) != 0) {
+			fido_log_debug("%s: stopped at %llu", __func__,
+			    (unsigned long long)i);
+			break;
+		}
+	}
+
+	r = FIDO_OK;
+out:
+	fido_dev_auto_unlock(dev, ms);
+	fido_cred_reset_tx(&cred);
+	fido_cred_reset_rx(&cred);
+
+	return (r);
+}
+
+int
+fido_credman_iter_dev_rk(fido_dev_t *dev, const char *rp_id,
+    fido_credman_rk_cb_t *cb, void *arg, const char *pin)
+{
+	fido_blob_t	*token = NULL;
+	fido_blob_t	 rp_dgst;
+	uint8_t		 dgst[SHA256_DIGEST_LENGTH];
+	int		 r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (rp_id == NULL || cb == NULL || pin == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (credman_rp_dgst(rp_id, dgst, &rp_dgst) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_iter_rk_wait(dev, &rp_dgst, cb, arg, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	return (r);
 }
 
 static int
 credman_del_rk_wait(fido_dev_t *dev, const unsigned char *cred_id,
-    size_t cred_id_len, const char *pin, int ms)
+    size_t cred_id_len, const fido_blob_t *token, int ms)
 {
 	fido_blob_t cred;
 	int r;
@@ -425,13 +636,13 @@ credman_del_rk_wait(fido_dev_t *dev, const unsigned char *cred_id,
 	if (fido_blob_set(&cred, cred_id, cred_id_len) < 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((r = credman_tx(dev, CMD_DELETE_CRED, &cred, pin)) != FIDO_OK ||
+	if ((r = credman_tx(dev, CMD_DELETE_CRED, &cred, token)) != FIDO_OK ||
 	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK)
 		goto fail;
 
 	r = FIDO_OK;
 fail:
-	free(cred.ptr);
+	fido_free(cred.ptr);
 
 	return (r);
 }
@@ -440,12 +651,102 @@ int
 fido_credman_del_dev_rk(fido_dev_t *dev, const unsigned char *cred_id,
     size_t cred_id_len, const char *pin)
 {
+	fido_blob_t	*token = NULL;
+	int		 r;
+
 	if (fido_dev_is_fido2(dev) == false)
 		return (FIDO_ERR_INVALID_COMMAND);
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (credman_del_rk_wait(dev, cred_id, cred_id_len, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_del_rk_wait(dev, cred_id, cred_id_len, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+static bool
+credman_token_expired(int r)
+{
+	return (r == FIDO_ERR_PIN_AUTH_INVALID || r == FIDO_ERR_PIN_TOKEN_EXPIRED);
+}
+
+/*
+ * Delete 'n' credentials with a single pinToken. Should the token be
+ * rejected midway, a new one is obtained once and the deletion resumed.
+ * Per-ID outcomes are written to 'status'; IDs not attempted are marked
+ * with the error that stopped the batch.
+ */
+static int
+credman_del_rk_list_wait(fido_dev_t *dev, const unsigned char * const *cred_id,
+    const size_t *cred_id_len, size_t n, int *status, const char *pin, int ms)
+{
+	fido_blob_t	*token = NULL;
+	bool		 reauth = false;
+	size_t		 i = 0;
+	int		 r;
+
+	if ((r = credman_get_token(dev, pin, &token)) != FIDO_OK)
+		goto out;
+
+	while (i < n) {
+		r = credman_del_rk_wait(dev, cred_id[i], cred_id_len[i], token,
+		    ms);
+		if (credman_token_expired(r) && reauth == false) {
+			fido_log_debug("%s: token rejected at %zu, reauth",
+			    __func__, i);
+			reauth = true;
+			fido_blob_free(&token);
+			if ((r = credman_get_token(dev, pin, &token)) != FIDO_OK)
+				goto out;
+			continue; /* retry the same id */
+		}
+		status[i++] = r;
+		if (credman_token_expired(r) || r == FIDO_ERR_TX ||
+		    r == FIDO_ERR_RX) {
+			fido_log_debug("%s: stopping at %zu: %d", __func__,
+			    i - 1, r);
+			goto out;
+		}
+	}
+
+	r = FIDO_OK;
+out:
+	for (; i < n; i++)
+		status[i] = r;
+
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+int
+fido_credman_del_dev_rk_list(fido_dev_t *dev,
+    const unsigned char * const *cred_id, const size_t *cred_id_len, size_t n,
+    int *status, const char *pin)
+{
+	int r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (cred_id == NULL || cred_id_len == NULL || status == NULL ||
+	    pin == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (n == 0)
+		return (FIDO_OK);
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = credman_del_rk_list_wait(dev, cred_id, cred_id_len, n, status, pin,
+	    -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static int
@@ -470,20 +771,22 @@ credman_parse_rp(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	}
 }
 
+static void
+credman_reset_single_rp(struct fido_credman_single_rp *rp)
+{
+	fido_free(rp->rp_entity.id);
+	fido_free(rp->rp_entity.name);
+	fido_free(rp->rp_id_hash.ptr);
+	memset(rp, 0, sizeof(*rp));
+}
+
 static void
 credman_reset_rp(fido_credman_rp_t *rp)
 {
-	for (size_t i = 0; i < rp->n_alloc; i++) {
-		free(rp->ptr[i].rp_entity.id);
-		free(rp->ptr[i].rp_entity.name);
-		rp->ptr[i].rp_entity.id = NULL;
-		rp->ptr[i].rp_entity.name = NULL;
-		free(rp->ptr[i].rp_id_hash.ptr);
-		memset(&rp->ptr[i].rp_id_hash, 0,
-		    sizeof(rp->ptr[i].rp_id_hash));
-	}
+	for (size_t i = 0; i < rp->n_alloc; i++)
+		credman_reset_single_rp(&rp->ptr[i]);
 
-	free(rp->ptr);
+	fido_free(rp->ptr);
 	rp->ptr = NULL;
 	memset(rp, 0, sizeof(*rp));
 }
@@ -529,7 +832,7 @@ credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* adjust as needed */
@@ -566,7 +869,7 @@ credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	/* sanity check */
@@ -586,40 +889,373 @@ credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 }
 
 static int
-credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin,
-    int ms)
+credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp,
+    const fido_blob_t *token, int ms)
 {
 	int r;
 
-	if ((r = credman_tx(dev, CMD_RP_BEGIN, NULL, pin)) != FIDO_OK ||
+	fido_dev_auto_lock(dev, ms);
+
+	if ((r = credman_tx(dev, CMD_RP_BEGIN, NULL, token)) != FIDO_OK ||
 	    (r = credman_rx_rp(dev, rp, ms)) != FIDO_OK)
-		return (r);
+		goto out;
 
 	while (rp->n_rx < rp->n_alloc) {
+		fido_dev_auto_lock(dev, ms);
 		if ((r = credman_tx(dev, CMD_RP_NEXT, NULL, NULL)) != FIDO_OK ||
 		    (r = credman_rx_next_rp(dev, rp, ms)) != FIDO_OK)
-			return (r);
+			goto out;
 		rp->n_rx++;
 	}
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+out:
+	fido_dev_auto_unlock(dev, ms);
+
+	return (r);
 }
 
 int
 fido_credman_get_dev_rp(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin)
 {
+	fido_blob_t	*token = NULL;
+	int		 r;
+
 	if (fido_dev_is_fido2(dev) == false)
 		return (FIDO_ERR_INVALID_COMMAND);
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (credman_get_rp_wait(dev, rp, pin, -1));
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_get_rp_wait(dev, rp, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+static int
+credman_iter_rp_wait(fido_dev_t *dev, fido_credman_rp_cb_t *cb, void *arg,
+    const fido_blob_t *token, int ms)
+{
+	struct credman_total		total;
+	struct fido_credman_single_rp	entry;
+	fido_credman_rp_t		rp;
+	int				r;
+
+	memset(&entry, 0, sizeof(entry));
+	memset(&total, 0, sizeof(total));
+	total.key = 5; /* totalRPs */
+
+	/* a one-entry view handed to the callback */
+	rp.ptr = &entry;
+	rp.n_alloc = 1;
+	rp.n_rx = 1;
+
+	fido_dev_auto_lock(dev, ms);
+
+	if ((r = credman_tx(dev, CMD_RP_BEGIN, NULL, token)) != FIDO_OK ||
+	    (r = credman_rx_item(dev, &total, &entry, credman_parse_rp,
+	    ms)) != FIDO_OK)
+		goto out;
+
+	for (uint64_t i = 0; i < total.n; i++) {
+		if (i > 0) {
+			credman_reset_single_rp(&entry);
+			fido_dev_auto_lock(dev, ms);
+			if ((r = credman_tx(dev, CMD_RP_NEXT, NULL,
+			    NULL)) != FIDO_OK ||
+			    (r = credman_rx_item(dev, NULL, &entry,
+			    credman_parse_rp, ms)) != FIDO_OK)
+				goto out;
+		}
+		if (cb(arg, &rp, (size_t)total.n) != 0) {
+			fido_log_debug("%s: stopped at %llu", __func__,
+			    (unsigned long long)i);
+			break;
+		}
+	}
+
+	r = FIDO_OK;
+out:
+	fido_dev_auto_unlock(dev, ms);
+	credman_reset_single_rp(&entry);
+
+	return (r);
+}
+
+int
+fido_credman_iter_dev_rp(fido_dev_t *dev, fido_credman_rp_cb_t *cb, void *arg,
+    const char *pin)
+{
+	fido_blob_t	*token = NULL;
+	int		 r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (cb == NULL || pin == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_iter_rp_wait(dev, cb, arg, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+static void
+credman_reset_inventory(fido_credman_inventory_t *inv)
+{
+	for (size_t i = 0; i < inv->rk_len; i++)
+		credman_reset_rk(&inv->rk[i]);
+
+	fido_free(inv->rk);
+	credman_reset_rp(&inv->rp);
+	memset(inv, 0, sizeof(*inv));
+}
+
+static int
+credman_get_inventory_wait(fido_dev_t *dev, fido_credman_inventory_t *inv,
+    const fido_blob_t *token, int ms)
+{
+	int r;
+
+	credman_reset_inventory(inv);
+
+	if ((r = credman_get_rp_wait(dev, &inv->rp, token, ms)) ==
+	    FIDO_ERR_NO_CREDENTIALS) {
+		/* no resident credentials; nothing to enumerate */
+		credman_reset_rp(&inv->rp);
+		return (FIDO_OK);
+	} else if (r != FIDO_OK)
+		return (r);
+
+	if (inv->rp.n_rx == 0)
+		return (FIDO_OK);
+
+	if ((inv->rk = fido_calloc(inv->rp.n_rx, sizeof(*inv->rk))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	inv->rk_len = inv->rp.n_rx;
+
+	for (size_t i = 0; i < inv->rk_len; i++)
+		if ((r = credman_get_rk_wait(dev, &inv->rp.ptr[i].rp_id_hash,
+		    &inv->rk[i], token, ms)) != FIDO_OK) {
+			fido_log_debug("%s: credman_get_rk_wait %zu", __func__,
+			    i);
+			return (r);
+		}
+
+	return (FIDO_OK);
+}
+
+int
+fido_credman_get_dev_inventory(fido_dev_t *dev, fido_credman_inventory_t *inv,
+    const char *pin)
+{
+	fido_blob_t	*token = NULL;
+	int		 r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (pin == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	if ((r = credman_get_token(dev, pin, &token)) == FIDO_OK)
+		r = credman_get_inventory_wait(dev, inv, token, -1);
+	fido_tx_release(dev);
+
+	fido_blob_free(&token);
+
+	if (r != FIDO_OK)
+		credman_reset_inventory(inv);
+
+	return (r);
+}
+
+/* 'rk' holds the first reply of an enumeration; 'old' a complete set */
+static bool
+credman_rk_same_head(const fido_credman_rk_t *rk, const fido_credman_rk_t *old)
+{
+	const fido_blob_t *id;
+	const fido_blob_t *old_id;
+
+	if (rk->n_alloc != old->n_rx)
+		return (false);
+	if (rk->n_rx == 0 || old->n_rx == 0)
+		return (rk->n_rx == old->n_rx);
+
+	id = &rk->ptr[0].attcred.id;
+	old_id = &old->ptr[0].attcred.id;
+
+	return (id->len == old_id->len && (id->len == 0 ||
+	    memcmp(id->ptr, old_id->ptr, id->len) == 0));
+}
+
+static size_t
+credman_find_rp(const fido_credman_rp_t *rp, const fido_blob_t *rp_id_hash)
+{
+	for (size_t i = 0; i < rp->n_rx; i++)
+		if (rp->ptr[i].rp_id_hash.len == rp_id_hash->len &&
+		    memcmp(rp->ptr[i].rp_id_hash.ptr, rp_id_hash->ptr,
+		    rp_id_hash->len) == 0)
+			return (i);
+
+	return (SIZE_MAX);
+}
+
+/*
+ * Bring 'old', a mirror of a previous sync, up to date with 'dev'. The
+ * list of relying parties is always refetched. Credential sets are only
+ * refetched for relying parties that are new, or whose credential count
+ * or first credential id differ from the mirror; telling that is a
+ * single round trip per relying party, since the first reply of an
+ * enumeration carries both. Checking the first credential id also keeps
+ * a mirror of another authenticator of the same model from being taken
+ * for this one's.
+ */
+static int
+credman_sync_inventory_wait(fido_dev_t *dev, fido_credman_inventory_t *old,
+    const fido_credman_metadata_t *metadata, const fido_blob_t *token, int ms)
+{
+	fido_credman_inventory_t	 inv;
+	size_t				*from = NULL;
+	size_t				 j;
+	size_t				 nfetch = 0;
+	int				 r;
+
+	memset(&inv, 0, sizeof(inv));
+
+	/* no resident credentials; nothing to enumerate */
+	if (metadata->rk_existing > 0 &&
+	    (r = credman_get_rp_wait(dev, &inv.rp, token, ms)) != FIDO_OK) {
+		if (r != FIDO_ERR_NO_CREDENTIALS)
+			goto fail;
+		credman_reset_rp(&inv.rp);
+	}
+
+	if (inv.rp.n_rx > 0 &&
+	    ((inv.rk = fido_calloc(inv.rp.n_rx, sizeof(*inv.rk))) == NULL ||
+	    (from = fido_calloc(inv.rp.n_rx, sizeof(*from))) == NULL)) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	inv.rk_len = inv.rp.n_rx;
+
+	for (size_t i = 0; i < inv.rp.n_rx; i++) {
+		from[i] = credman_find_rp(&old->rp, &inv.rp.ptr[i].rp_id_hash);
+		fido_dev_auto_lock(dev, ms);
+		if ((r = credman_tx(dev, CMD_RK_BEGIN,
+		    &inv.rp.ptr[i].rp_id_hash, token)) != FIDO_OK ||
+		    (r = credman_rx_rk(dev, &inv.rk[i], ms)) != FIDO_OK)
+			goto fail;
+		if ((j = from[i]) != SIZE_MAX && j < old->rk_len &&
+		    credman_rk_same_head(&inv.rk[i], &old->rk[j])) {
+			fido_dev_auto_unlock(dev, ms);
+			credman_reset_rk(&inv.rk[i]);
+			continue;
+		}
+		from[i] = SIZE_MAX;
+		nfetch++;
+		if ((r = credman_get_next_rk_wait(dev, &inv.rk[i],
+		    ms)) != FIDO_OK)
+			goto fail;
+	}
+
+	fido_log_debug("%s: %zu/%zu rp(s) refetched", __func__, nfetch,
+	    inv.rp.n_rx);
+
+	/* move the credential sets that did not change */
+	for (size_t i = 0; i < inv.rp.n_rx; i++)
+		if ((j = from[i]) != SIZE_MAX) {
+			inv.rk[i] = old->rk[j];
+			memset(&old->rk[j], 0, sizeof(old->rk[j]));
+		}
+
+	inv.metadata = *metadata;
+	memcpy(inv.aaguid, old->aaguid, sizeof(inv.aaguid));
+	inv.synced = true;
+
+	credman_reset_inventory(old);
+	*old = inv;
+	fido_free(from);
+
+	return (FIDO_OK);
+fail:
+	fido_dev_auto_unlock(dev, ms);
+	credman_reset_inventory(&inv);
+	fido_free(from);
+
+	return (r);
+}
+
+int
+fido_credman_sync_dev_inventory(fido_dev_t *dev, fido_credman_inventory_t *inv,
+    const char *pin)
+{
+	fido_cbor_info_t	*info = NULL;
+	fido_blob_t		*token = NULL;
+	fido_credman_metadata_t	 metadata;
+	int			 r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (pin == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((info = fido_cbor_info_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if (fido_tx_hold(dev) < 0) {
+		fido_cbor_info_free(&info);
+		return (FIDO_ERR_TX);
+	}
+
+	if ((r = fido_dev_get_cbor_info_wait(dev, info, -1)) != FIDO_OK ||
+	    (r = credman_get_token(dev, pin, &token)) != FIDO_OK ||
+	    (r = credman_get_metadata_wait(dev, &metadata, token,
+	    -1)) != FIDO_OK)
+		goto out;
+
+	if (inv->synced == false ||
+	    memcmp(inv->aaguid, info->aaguid, sizeof(inv->aaguid)) != 0) {
+		fido_log_debug("%s: full sync", __func__);
+		if (metadata.rk_existing == 0)
+			credman_reset_inventory(inv);
+		else if ((r = credman_get_inventory_wait(dev, inv, token,
+		    -1)) != FIDO_OK) {
+			credman_reset_inventory(inv);
+			goto out;
+		}
+		inv->metadata = metadata;
+		memcpy(inv->aaguid, info->aaguid, sizeof(inv->aaguid));
+		inv->synced = true;
+		goto out;
+	}
+
+	r = credman_sync_inventory_wait(dev, inv, &metadata, token, -1);
+out:
+	fido_tx_release(dev);
+	fido_cbor_info_free(&info);
+	fido_blob_free(&token);
+
+	return (r);
 }
 
 fido_credman_rk_t *
 fido_credman_rk_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_rk_t)));
+	return (fido_calloc(1, sizeof(fido_credman_rk_t)));
 }
 
 void
@@ -631,7 +1267,7 @@ fido_credman_rk_free(fido_credman_rk_t **rk_p)
 		return;
 
 	credman_reset_rk(rk);
-	free(rk);
+	fido_free(rk);
 	*rk_p = NULL;
 }
 
@@ -653,7 +1289,7 @@ fido_credman_rk(const fido_credman_rk_t *rk, size_t idx)
 fido_credman_metadata_t *
 fido_credman_metadata_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_metadata_t)));
+	return (fido_calloc(1, sizeof(fido_credman_metadata_t)));
 }
 
 void
@@ -664,7 +1300,7 @@ fido_credman_metadata_free(fido_credman_metadata_t **metadata_p)
 	if (metadata_p == NULL || (metadata = *metadata_p) == NULL)
 		return;
 
-	free(metadata);
+	fido_free(metadata);
 	*metadata_p = NULL;
 }
 
@@ -683,7 +1319,7 @@ fido_credman_rk_remaining(const fido_credman_metadata_t *metadata)
 fido_credman_rp_t *
 fido_credman_rp_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_rp_t)));
+	return (fido_calloc(1, sizeof(fido_credman_rp_t)));
 }
 
 void
@@ -695,7 +1331,7 @@ fido_credman_rp_free(fido_credman_rp_t **rp_p)
 		return;
 
 	credman_reset_rp(rp);
-	free(rp);
+	fido_free(rp);
 	*rp_p = NULL;
 }
 
@@ -740,3 +1376,43 @@ fido_credman_rp_id_hash_ptr(const fido_credman_rp_t *rp, size_t idx)
 
 	return (rp->ptr[idx].rp_id_hash.ptr);
 }
+
+fido_credman_inventory_t *
+fido_credman_inventory_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_credman_inventory_t)));
+}
+
+void
+fido_credman_inventory_free(fido_credman_inventory_t **inv_p)
+{
+	fido_credman_inventory_t *inv;
+
+	if (inv_p == NULL || (inv = *inv_p) == NULL)
+		return;
+
+	credman_reset_inventory(inv);
+	fido_free(inv);
+	*inv_p = NULL;
+}
+
+const fido_credman_rp_t *
+fido_credman_inventory_rp(const fido_credman_inventory_t *inv)
+{
+	return (&inv->rp);
+}
+
+const fido_credman_metadata_t *
+fido_credman_inventory_metadata(const fido_credman_inventory_t *inv)
+{
+	return (&inv->metadata);
+}
+
+const fido_credman_rk_t *
+fido_credman_inventory_rk(const fido_credman_inventory_t *inv, size_t idx)
+{
+	if (idx >= inv->rk_len)
+		return (NULL);
+
+	return (&inv->rk[idx]);
+}
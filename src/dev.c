@@ -19,6 +19,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "fido.h"
 
@@ -84,16 +87,36 @@ fail:
 #error "please provide an implementation of obtain_nonce() for your platform"
 #endif /* _WIN32 */
 
-#ifndef TLS
-#define TLS
-#endif
-
 typedef struct dev_manifest_func_node {
 	dev_manifest_func_t manifest_func;
 	struct dev_manifest_func_node *next;
 } dev_manifest_func_node_t;
 
-static TLS dev_manifest_func_node_t *manifest_funcs = NULL;
+/*
+ * The registry of manifest functions is shared by all threads of the
+ * process. It is only walked with manifest_lock held; the functions
+ * themselves are called on a private snapshot, without the lock.
+ */
+static dev_manifest_func_node_t *manifest_funcs = NULL;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void
+manifest_lock_enter(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&manifest_lock);
+#endif
+}
+
+static void
+manifest_lock_leave(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&manifest_lock);
+#endif
+}
 
 static void
 find_manifest_func_node(dev_manifest_func_t f, dev_manifest_func_node_t **curr,
@@ -157,7 +180,13 @@ fido_dev_open_tx(fido_dev_t *dev, const char *path)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	if (dev->io.open == NULL || dev->io.close == NULL) {
+	if (dev->mux != NULL && path != NULL) {
+		fido_log_debug("%s: path=%s on mux", __func__, path);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((dev->mux == NULL && dev->broker == NULL &&
+	    dev->io.open == NULL) || dev->io.close == NULL) {
 		fido_log_debug("%s: NULL open/close", __func__);
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
@@ -167,12 +196,22 @@ fido_dev_open_tx(fido_dev_t *dev, const char *path)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((dev->io_handle = dev->io.open(path)) == NULL) {
+	if (dev->mux != NULL)
+		dev->io_handle = fido_mux_attach(dev->mux);
+	else if (dev->broker != NULL)
+		dev->io_handle = fido_broker_attach(dev->broker, path);
+	else
+		dev->io_handle = dev->io.open(path);
+
+	if (dev->io_handle == NULL) {
 		fido_log_debug("%s: dev->io.open", __func__);
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if (dev->io_own) {
+	if (dev->mux != NULL) {
+		dev->rx_len = fido_mux_rx_len(dev->mux);
+		dev->tx_len = fido_mux_tx_len(dev->mux);
+	} else if (dev->io_own) {
 		dev->rx_len = CTAP_MAX_REPORT_LEN;
 		dev->tx_len = CTAP_MAX_REPORT_LEN;
 	} else {
@@ -222,7 +261,7 @@ fido_dev_open_rx(fido_dev_t *dev, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_INIT, &dev->attr,
 	    sizeof(dev->attr), ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+		r = fido_rx_error(dev);
 		goto fail;
 	}
 
@@ -276,32 +315,42 @@ fido_dev_open_wait(fido_dev_t *dev, const char *path, int ms)
 {
 	int r;
 
-	if ((r = fido_dev_open_tx(dev, path)) != FIDO_OK ||
-	    (r = fido_dev_open_rx(dev, ms)) != FIDO_OK)
-		return (r);
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
 
-	return (FIDO_OK);
+	if ((r = fido_dev_open_tx(dev, path)) == FIDO_OK)
+		r = fido_dev_open_rx(dev, ms);
+
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 int
 fido_dev_register_manifest_func(const dev_manifest_func_t f)
 {
-	dev_manifest_func_node_t *prev, *curr, *n;
+	dev_manifest_func_node_t	*prev, *curr, *n;
+	int				 r = FIDO_OK;
+
+	manifest_lock_enter();
 
 	find_manifest_func_node(f, &curr, &prev);
 	if (curr != NULL)
-		return (FIDO_OK);
+		goto out;
 
-	if ((n = calloc(1, sizeof(*n))) == NULL) {
+	if ((n = fido_calloc(1, sizeof(*n))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
-		return (FIDO_ERR_INTERNAL);
+		r = FIDO_ERR_INTERNAL;
+		goto out;
 	}
 
 	n->manifest_func = f;
 	n->next = manifest_funcs;
 	manifest_funcs = n;
+out:
+	manifest_lock_leave();
 
-	return (FIDO_OK);
+	return (r);
 }
 
 void
@@ -309,42 +358,87 @@ fido_dev_unregister_manifest_func(const dev_manifest_func_t f)
 {
 	dev_manifest_func_node_t *prev, *curr;
 
+	manifest_lock_enter();
+
 	find_manifest_func_node(f, &curr, &prev);
-	if (curr == NULL)
-		return;
-	if (prev != NULL)
-		prev->next = curr->next;
-	else
-		manifest_funcs = curr->next;
+	if (curr != NULL) {
+		if (prev != NULL)
+			prev->next = curr->next;
+		else
+			manifest_funcs = curr->next;
+	}
+
+	manifest_lock_leave();
 
-	free(curr);
+	fido_free(curr);
+}
+
+static int
+manifest_snapshot(dev_manifest_func_t **fv, size_t *fc)
+{
+	dev_manifest_func_node_t	*curr;
+	size_t				 n = 0;
+	int				 r = FIDO_ERR_INTERNAL;
+
+	*fv = NULL;
+	*fc = 0;
+
+	manifest_lock_enter();
+
+	for (curr = manifest_funcs; curr != NULL; curr = curr->next)
+		n++;
+
+	if (n == 0) {
+		r = FIDO_OK;
+		goto fail;
+	}
+
+	if ((*fv = fido_calloc(n, sizeof(**fv))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		goto fail;
+	}
+
+	for (curr = manifest_funcs; curr != NULL; curr = curr->next)
+		(*fv)[(*fc)++] = curr->manifest_func;
+
+	r = FIDO_OK;
+fail:
+	manifest_lock_leave();
+
+	return (r);
 }
 
 int
 fido_dev_info_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
-	dev_manifest_func_node_t	*curr = NULL;
-	dev_manifest_func_t		 m_func;
-	size_t				 curr_olen;
-	int				 r;
+	dev_manifest_func_t	*fv = NULL;
+	size_t			 fc = 0;
+	size_t			 curr_olen;
+	int			 r;
 
 	*olen = 0;
 
 	if (fido_dev_register_manifest_func(fido_hid_manifest) != FIDO_OK)
 		return (FIDO_ERR_INTERNAL);
 
-	for (curr = manifest_funcs; curr != NULL; curr = curr->next) {
+	if ((r = manifest_snapshot(&fv, &fc)) != FIDO_OK)
+		return (r);
+
+	for (size_t i = 0; i < fc; i++) {
 		curr_olen = 0;
-		m_func = curr->manifest_func;
-		r = m_func(devlist + *olen, ilen - *olen, &curr_olen);
-		if (r != FIDO_OK)
-			return (r);
+		if ((r = fv[i](devlist + *olen, ilen - *olen,
+		    &curr_olen)) != FIDO_OK)
+			goto fail;
 		*olen += curr_olen;
 		if (*olen == ilen)
 			break;
 	}
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+fail:
+	fido_free(fv);
+
+	return (r);
 }
 
 int
@@ -362,18 +456,296 @@ fido_dev_open(fido_dev_t *dev, const char *path)
 	return (fido_dev_open_wait(dev, path, -1));
 }
 
+int
+fido_dev_open_mux(fido_dev_t *dev, fido_dev_mux_t *mux)
+{
+	if (dev->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	fido_free(dev->broker);
+	dev->broker = NULL;
+	dev->mux = mux;
+	dev->io = (fido_dev_io_t) {
+		NULL,
+		&fido_mux_detach,
+		&fido_mux_read,
+		&fido_mux_write,
+	};
+	memset(&dev->transport, 0, sizeof(dev->transport));
+
+	return (fido_dev_open_wait(dev, NULL, -1));
+}
+
+/*
+ * State shared by the workers of fido_dev_open_many(). Each worker
+ * claims the next device with a pending CTAPHID_INIT and completes its
+ * handshake, waiting up to 'ms' for each reply; devices are thus
+ * handled concurrently, up to OPEN_MANY_MAX_THREADS at a time.
+ */
+#define OPEN_MANY_MAX_THREADS	16
+
+struct open_many {
+	fido_dev_t	**devs;
+	int		 *status;
+	size_t		  ndevs;
+	size_t		  next;
+	int		  ms;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	  lock;
+#endif
+};
+
+static bool
+open_many_claim(struct open_many *om, size_t *idx)
+{
+	bool ok = false;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&om->lock);
+#endif
+	while (om->next < om->ndevs) {
+		*idx = om->next++;
+		if (om->status[*idx] == FIDO_OK) {
+			ok = true;
+			break;
+		}
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&om->lock);
+#endif
+
+	return (ok);
+}
+
+static void *
+open_many_worker(void *arg)
+{
+	struct open_many	*om = arg;
+	size_t			 idx;
+
+	while (open_many_claim(om, &idx)) {
+		om->status[idx] = fido_dev_open_rx(om->devs[idx], om->ms);
+		if (om->status[idx] != FIDO_OK)
+			fido_dev_free(&om->devs[idx]);
+	}
+
+	return (NULL);
+}
+
+int
+fido_dev_open_many(const fido_dev_info_t *devlist, size_t ndevs,
+    fido_dev_t **devs, int *status, int ms)
+{
+	struct open_many	 om;
+#ifdef HAVE_PTHREAD
+	pthread_t		 thread[OPEN_MANY_MAX_THREADS];
+	size_t			 nthreads = 0;
+#endif
+
+	if (devlist == NULL || devs == NULL || status == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memset(&om, 0, sizeof(om));
+	om.devs = devs;
+	om.status = status;
+	om.ndevs = ndevs;
+	om.ms = ms;
+
+	/* issue all nonces up front */
+	for (size_t i = 0; i < ndevs; i++) {
+		if ((devs[i] = fido_dev_new_with_info(&devlist[i])) == NULL) {
+			fido_log_debug("%s: fido_dev_new_with_info", __func__);
+			status[i] = FIDO_ERR_INTERNAL;
+			continue;
+		}
+		if ((status[i] = fido_dev_open_tx(devs[i],
+		    devs[i]->path)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_open_tx %s", __func__,
+			    devs[i]->path);
+			fido_dev_free(&devs[i]);
+			continue;
+		}
+		/* the reply is read by one of the workers */
+		fido_tx_handoff(devs[i]);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&om.lock, NULL) != 0) {
+		fido_log_debug("%s: pthread_mutex_init", __func__);
+		for (size_t i = 0; i < ndevs; i++) {
+			if (devs[i] != NULL)
+				fido_dev_close(devs[i]);
+			fido_dev_free(&devs[i]);
+		}
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	while (nthreads + 1 < OPEN_MANY_MAX_THREADS && nthreads + 1 < ndevs) {
+		if (pthread_create(&thread[nthreads], NULL, open_many_worker,
+		    &om) != 0) {
+			fido_log_debug("%s: pthread_create", __func__);
+			break;
+		}
+		nthreads++;
+	}
+#endif
+
+	/* the calling thread also takes part */
+	open_many_worker(&om);
+
+#ifdef HAVE_PTHREAD
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(thread[i], NULL);
+
+	pthread_mutex_destroy(&om.lock);
+#endif
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_close(fido_dev_t *dev)
 {
 	if (dev->io_handle == NULL || dev->io.close == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
+	fido_tx_unlock(dev);
 	dev->io.close(dev->io_handle);
 	dev->io_handle = NULL;
+	dev->lock_held = 0;
+	dev->lock_own = false;
+	dev->owner = 0;
+	fido_tx_forget(dev);
+
+	/* the session is gone; 'dev' no longer belongs to its mux */
+	if (dev->mux != NULL) {
+		dev->mux = NULL;
+		dev->io = (fido_dev_io_t) {
+			&fido_hid_open,
+			&fido_hid_close,
+			&fido_hid_read,
+			&fido_hid_write,
+		};
+		dev->io_own = false;
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_lock_tx(fido_dev_t *dev, uint8_t seconds)
+{
+	if (fido_tx(dev, CTAP_CMD_LOCK, &seconds, sizeof(seconds)) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_lock_rx(fido_dev_t *dev, int ms)
+{
+	unsigned char reply[FIDO_MAXMSG];
+
+	if (fido_rx(dev, CTAP_CMD_LOCK, &reply, sizeof(reply), ms) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (fido_rx_error(dev));
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_lock_wait(fido_dev_t *dev, int seconds, int ms)
+{
+	int r;
+
+	if (seconds < 0 || seconds > CTAP_LOCK_MAX_SECONDS)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((r = fido_dev_lock_tx(dev, (uint8_t)seconds)) != FIDO_OK ||
+	    (r = fido_dev_lock_rx(dev, ms)) != FIDO_OK)
+		return (r);
+
+	dev->lock_held = seconds;
+	dev->lock_own = false;
+	if (seconds != 0 && fido_time_now(&dev->lock_ts) < 0)
+		dev->lock_held = 0; /* refresh at the next opportunity */
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_lock(fido_dev_t *dev, int seconds)
+{
+	if (seconds < 1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (fido_dev_lock_wait(dev, seconds, -1));
+}
+
+int
+fido_dev_unlock(fido_dev_t *dev)
+{
+	return (fido_dev_lock_wait(dev, 0, -1));
+}
+
+int
+fido_dev_set_auto_lock(fido_dev_t *dev, int seconds)
+{
+	if (seconds < 0 || seconds > CTAP_LOCK_MAX_SECONDS)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	dev->lock_auto = seconds;
 
 	return (FIDO_OK);
 }
 
+/*
+ * Called before each step of a multi-step operation, starting with the
+ * request that opens it: take a channel lock, or refresh the one we hold
+ * once half of it has elapsed. A lock taken with fido_dev_lock() is the
+ * caller's, and is left alone while it lasts. Best effort; devices that
+ * do not implement CTAPHID_LOCK are left alone thereafter.
+ */
+void
+fido_dev_auto_lock(fido_dev_t *dev, int ms)
+{
+	int elapsed_ms;
+	int r;
+
+	if (dev->lock_auto == 0 || (dev->flags & FIDO_DEV_NO_LOCK))
+		return;
+
+	if (dev->lock_held != 0 && fido_time_delta_ms(&dev->lock_ts,
+	    &elapsed_ms) == 0 && elapsed_ms < dev->lock_held *
+	    (dev->lock_own ? 500 : 1000))
+		return;
+
+	if ((r = fido_dev_lock_wait(dev, dev->lock_auto, ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_lock_wait: %d", __func__, r);
+		if (r == FIDO_ERR_INVALID_COMMAND)
+			dev->flags |= FIDO_DEV_NO_LOCK;
+		return;
+	}
+
+	dev->lock_own = true;
+}
+
+/* release a lock taken by fido_dev_auto_lock(), if any */
+void
+fido_dev_auto_unlock(fido_dev_t *dev, int ms)
+{
+	if (dev->lock_held == 0 || dev->lock_own == false)
+		return;
+
+	if (fido_dev_lock_wait(dev, 0, ms) != FIDO_OK)
+		fido_log_debug("%s: fido_dev_lock_wait", __func__);
+}
+
 int
 fido_dev_cancel(fido_dev_t *dev)
 {
@@ -386,8 +758,78 @@ fido_dev_cancel(fido_dev_t *dev)
 	return (FIDO_OK);
 }
 
+static int
+fido_dev_ping_rx(fido_dev_t *dev, const unsigned char *ptr, size_t len, int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+
+	if ((reply_len = fido_rx(dev, CTAP_CMD_PING, &reply, sizeof(reply),
+	    ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (fido_rx_error(dev));
+	}
+
+	if ((size_t)reply_len != len || (len > 0 &&
+	    memcmp(reply, ptr, len) != 0)) {
+		fido_log_debug("%s: reply_len=%d, len=%zu", __func__,
+		    reply_len, len);
+		return (FIDO_ERR_RX);
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_ping_wait(fido_dev_t *dev, const unsigned char *ptr, size_t len,
+    int ms)
+{
+	if (fido_tx(dev, CTAP_CMD_PING, ptr, len) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (fido_dev_ping_rx(dev, ptr, len, ms));
+}
+
 int
-fido_dev_get_touch_begin(fido_dev_t *dev)
+fido_dev_ping(fido_dev_t *dev, const unsigned char *ptr, size_t len)
+{
+	if ((ptr == NULL && len != 0) || len > FIDO_MAXMSG)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (fido_dev_ping_wait(dev, ptr, len, -1));
+}
+
+static int
+fido_dev_wink_wait(fido_dev_t *dev, int ms)
+{
+	unsigned char reply[FIDO_MAXMSG];
+
+	if (fido_tx(dev, CTAP_CMD_WINK, NULL, 0) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	if (fido_rx(dev, CTAP_CMD_WINK, &reply, sizeof(reply), ms) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (fido_rx_error(dev));
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_wink(fido_dev_t *dev)
+{
+	if ((dev->attr.flags & FIDO_CAP_WINK) == 0)
+		return (FIDO_ERR_INVALID_COMMAND);
+
+	return (fido_dev_wink_wait(dev, -1));
+}
+
+static int
+dev_get_touch_begin(fido_dev_t *dev)
 {
 	fido_blob_t	 f;
 	cbor_item_t	*argv[9];
@@ -412,8 +854,8 @@ fido_dev_get_touch_begin(fido_dev_t *dev)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((rp.id = strdup(FIDO_DUMMY_RP_ID)) == NULL ||
-	    (user.name = strdup(FIDO_DUMMY_USER_NAME)) == NULL) {
+	if ((rp.id = fido_strdup(FIDO_DUMMY_RP_ID)) == NULL ||
+	    (user.name = fido_strdup(FIDO_DUMMY_USER_NAME)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		goto fail;
 	}
@@ -446,19 +888,22 @@ fido_dev_get_touch_begin(fido_dev_t *dev)
 		goto fail;
 	}
 
+	/* the reply is read by fido_dev_get_touch_status() */
+	fido_tx_handoff(dev);
+
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
-	free(rp.id);
-	free(user.name);
-	free(user.id.ptr);
+	fido_freezero(f.ptr, f.len);
+	fido_free(rp.id);
+	fido_free(user.name);
+	fido_free(user.id.ptr);
 
 	return (r);
 }
 
-int
-fido_dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
+static int
+dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
 {
 	int r;
 
@@ -485,6 +930,40 @@ fido_dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
 	return (FIDO_OK);
 }
 
+int
+fido_dev_get_touch_begin(fido_dev_t *dev)
+{
+	int r;
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+
+	if ((r = dev_get_touch_begin(dev)) != FIDO_OK) {
+		fido_tx_release(dev);
+		return (r);
+	}
+
+	/* released once fido_dev_get_touch_status() is done with it */
+	dev->arb_touch = true;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
+{
+	int r;
+
+	r = dev_get_touch_status(dev, touched, ms);
+
+	if ((r != FIDO_OK || *touched) && dev->arb_touch) {
+		dev->arb_touch = false;
+		fido_tx_release(dev);
+	}
+
+	return (r);
+}
+
 int
 fido_dev_set_io_functions(fido_dev_t *dev, const fido_dev_io_t *io)
 {
@@ -501,6 +980,54 @@ fido_dev_set_io_functions(fido_dev_t *dev, const fido_dev_io_t *io)
 
 	dev->io = *io;
 	dev->io_own = true;
+	dev->mux = NULL;
+	fido_free(dev->broker);
+	dev->broker = NULL;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_keepalive_handler(fido_dev_t *dev,
+    fido_dev_keepalive_handler_t *handler, void *arg)
+{
+	dev->keepalive = handler;
+	dev->keepalive_arg = arg;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_arbitration(fido_dev_t *dev, bool on, int ms)
+{
+	if (dev->arb_held) {
+		fido_log_debug("%s: transaction pending", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	dev->arb = on;
+	dev->arb_ms = ms;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_retry_policy(fido_dev_t *dev, int backoff_ms, int max_backoff_ms,
+    int deadline_ms)
+{
+	if (backoff_ms < 0 || max_backoff_ms < backoff_ms || deadline_ms < 0 ||
+	    (backoff_ms > 0 && deadline_ms == 0)) {
+		fido_log_debug("%s: backoff_ms=%d, max_backoff_ms=%d, "
+		    "deadline_ms=%d", __func__, backoff_ms, max_backoff_ms,
+		    deadline_ms);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	fido_tx_forget(dev);
+
+	dev->retry.backoff_ms = backoff_ms;
+	dev->retry.max_backoff_ms = max_backoff_ms;
+	dev->retry.deadline_ms = deadline_ms;
 
 	return (FIDO_OK);
 }
@@ -515,6 +1042,45 @@ fido_dev_set_transport_functions(fido_dev_t *dev, const fido_dev_transport_t *t)
 
 	dev->transport = *t;
 	dev->io_own = true;
+	dev->mux = NULL;
+	fido_free(dev->broker);
+	dev->broker = NULL;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_set_broker(fido_dev_t *dev, const char *path)
+{
+	char *broker;
+
+	if (dev->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (path == NULL) {
+		fido_log_debug("%s: NULL path", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((broker = fido_strdup(path)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	fido_free(dev->broker);
+	dev->broker = broker;
+	dev->io = (fido_dev_io_t) {
+		NULL,
+		&fido_broker_detach,
+		NULL,
+		NULL,
+	};
+	dev->transport = (fido_dev_transport_t) {
+		&fido_broker_rx,
+		&fido_broker_tx,
+	};
+	dev->io_own = true;
+	dev->mux = NULL;
 
 	return (FIDO_OK);
 }
@@ -531,10 +1097,11 @@ fido_dev_new(void)
 {
 	fido_dev_t *dev;
 
-	if ((dev = calloc(1, sizeof(*dev))) == NULL)
+	if ((dev = fido_calloc(1, sizeof(*dev))) == NULL)
 		return (NULL);
 
 	dev->cid = CTAP_CID_BROADCAST;
+	dev->stats_op = -1;
 	dev->io = (fido_dev_io_t) {
 		&fido_hid_open,
 		&fido_hid_close,
@@ -550,10 +1117,11 @@ fido_dev_new_with_info(const fido_dev_info_t *di)
 {
 	fido_dev_t *dev;
 
-	if ((dev = calloc(1, sizeof(*dev))) == NULL)
+	if ((dev = fido_calloc(1, sizeof(*dev))) == NULL)
 		return (NULL);
 
 	dev->cid = CTAP_CID_BROADCAST;
+	dev->stats_op = -1;
 
 	if (di->io.open == NULL || di->io.close == NULL ||
 	    di->io.read == NULL || di->io.write == NULL) {
@@ -563,9 +1131,10 @@ fido_dev_new_with_info(const fido_dev_info_t *di)
 	}
 
 	dev->io = di->io;
+	dev->io_own = di->io.open != fido_hid_open; /* fido_dev_info_set() */
 	dev->transport = di->transport;
 
-	if ((dev->path = strdup(di->path)) == NULL) {
+	if ((dev->path = fido_strdup(di->path)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		fido_dev_free(&dev);
 		return (NULL);
@@ -582,8 +1151,10 @@ fido_dev_free(fido_dev_t **dev_p)
 	if (dev_p == NULL || (dev = *dev_p) == NULL)
 		return;
 
-	free(dev->path);
-	free(dev);
+	fido_tx_forget(dev);
+	fido_free(dev->broker);
+	fido_free(dev->path);
+	fido_free(dev);
 
 	*dev_p = NULL;
 }
@@ -7,14 +7,281 @@
 #include <openssl/evp.h>
 #include <openssl/sha.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "fido.h"
 #include "fido/es256.h"
 
+/* an ephemeral key pair; sk is single-use */
+struct ecdh_key {
+	EVP_PKEY	*sk;
+	es256_pk_t	 pk;
+};
+
+static int
+ecdh_keygen(struct ecdh_key *k)
+{
+	es256_sk_t	*sk = NULL;
+	int		 ok = -1;
+
+	memset(k, 0, sizeof(*k));
+
+	if ((sk = es256_sk_new()) == NULL || es256_sk_create(sk) < 0 ||
+	    es256_derive_pk(sk, &k->pk) < 0) {
+		fido_log_debug("%s: es256_derive_pk", __func__);
+		goto fail;
+	}
+
+	if ((k->sk = es256_sk_to_EVP_PKEY(sk)) == NULL) {
+		fido_log_debug("%s: es256_sk_to_EVP_PKEY", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	es256_sk_free(&sk);
+
+	return (ok);
+}
+
+static void
+ecdh_key_free(struct ecdh_key *k)
+{
+	if (k->sk != NULL)
+		EVP_PKEY_free(k->sk);
+
+	explicit_bzero(k, sizeof(*k));
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * Process-wide pool of ephemeral key pairs, kept full by a background
+ * thread. A key is handed out at most once; when the pool is empty or
+ * not running, fido_do_ecdh() generates its key inline. If generating a
+ * key fails, the thread backs off and retries. The pool is discarded in
+ * the child of a fork(), which must not reuse its parent's keys.
+ */
+#define POOL_MIN_BACKOFF_MS	10
+#define POOL_MAX_BACKOFF_MS	1000
+
+static struct ecdh_pool {
+	struct ecdh_key	*key;
+	size_t		 nkeys;	/* capacity */
+	size_t		 count;	/* keys ready */
+	int		 running;
+	pthread_t	 thread;
+} pool;
+
+static pthread_mutex_t	pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	pool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t	pool_once = PTHREAD_ONCE_INIT;
+
+/* wait for up to 'ms' milliseconds, or until the pool is stopped */
+static void
+pool_sleep(int ms)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
+		return;
+
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	if (pool.running)
+		pthread_cond_timedwait(&pool_cond, &pool_lock, &ts);
+}
+
+static void *
+pool_fill(void *arg)
+{
+	struct ecdh_key	k;
+	int		backoff_ms = 0;
+
+	(void)arg;
+
+	pthread_mutex_lock(&pool_lock);
+
+	for (;;) {
+		while (pool.running && pool.count == pool.nkeys)
+			pthread_cond_wait(&pool_cond, &pool_lock);
+		if (!pool.running)
+			break;
+		pthread_mutex_unlock(&pool_lock);
+
+		if (ecdh_keygen(&k) < 0) {
+			fido_log_debug("%s: ecdh_keygen", __func__);
+			ecdh_key_free(&k);
+			if ((backoff_ms *= 2) < POOL_MIN_BACKOFF_MS)
+				backoff_ms = POOL_MIN_BACKOFF_MS;
+			else if (backoff_ms > POOL_MAX_BACKOFF_MS)
+				backoff_ms = POOL_MAX_BACKOFF_MS;
+			pthread_mutex_lock(&pool_lock);
+			pool_sleep(backoff_ms);
+			continue;
+		}
+
+		backoff_ms = 0;
+
+		pthread_mutex_lock(&pool_lock);
+		if (pool.running && pool.count < pool.nkeys)
+			pool.key[pool.count++] = k;
+		else
+			ecdh_key_free(&k);
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return (NULL);
+}
+
+static int
+pool_get(struct ecdh_key *k)
+{
+	int ok = -1;
+
+	pthread_mutex_lock(&pool_lock);
+
+	if (pool.running && pool.count > 0) {
+		*k = pool.key[--pool.count];
+		explicit_bzero(&pool.key[pool.count], sizeof(*k));
+		pthread_cond_signal(&pool_cond);
+		ok = 0;
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+
+	return (ok);
+}
+
+/*
+ * fork() handlers: keep the pool consistent across the fork, and empty
+ * it in the child, where the thread filling it doesn't exist.
+ */
+static void
+pool_prepare(void)
+{
+	pthread_mutex_lock(&pool_lock);
+}
+
+static void
+pool_parent(void)
+{
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static void
+pool_child(void)
+{
+	for (size_t i = 0; i < pool.count; i++)
+		ecdh_key_free(&pool.key[i]);
+	fido_free(pool.key);
+	memset(&pool, 0, sizeof(pool));
+	pthread_cond_init(&pool_cond, NULL);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+static void
+pool_atfork(void)
+{
+	if (pthread_atfork(pool_prepare, pool_parent, pool_child) != 0)
+		fido_log_debug("%s: pthread_atfork", __func__);
+}
+#else
 static int
-do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
+pool_get(struct ecdh_key *k)
+{
+	(void)k;
+
+	return (-1);
+}
+#endif /* HAVE_PTHREAD */
+
+int
+fido_ecdh_pool_start(size_t nkeys)
+{
+#ifdef HAVE_PTHREAD
+	int r;
+
+	if (nkeys == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (pthread_once(&pool_once, pool_atfork) != 0)
+		return (FIDO_ERR_INTERNAL);
+
+	pthread_mutex_lock(&pool_lock);
+
+	if (pool.key != NULL) {
+		fido_log_debug("%s: already running", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if ((pool.key = fido_calloc(nkeys, sizeof(*pool.key))) == NULL) {
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	pool.nkeys = nkeys;
+	pool.count = 0;
+	pool.running = 1;
+
+	if (pthread_create(&pool.thread, NULL, pool_fill, NULL) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		fido_free(pool.key);
+		memset(&pool, 0, sizeof(pool));
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	r = FIDO_OK;
+out:
+	pthread_mutex_unlock(&pool_lock);
+
+	return (r);
+#else
+	(void)nkeys;
+
+	return (FIDO_ERR_INTERNAL);
+#endif
+}
+
+void
+fido_ecdh_pool_stop(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&pool_lock);
+
+	if (pool.key == NULL || pool.running == 0) {
+		pthread_mutex_unlock(&pool_lock);
+		return;
+	}
+
+	pool.running = 0;
+	pthread_cond_broadcast(&pool_cond);
+	pthread_mutex_unlock(&pool_lock);
+
+	pthread_join(pool.thread, NULL);
+
+	pthread_mutex_lock(&pool_lock);
+	for (size_t i = 0; i < pool.count; i++)
+		ecdh_key_free(&pool.key[i]);
+	fido_free(pool.key);
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_unlock(&pool_lock);
+#endif
+}
+
+static int
+do_ecdh(EVP_PKEY *sk_evp, const es256_pk_t *pk, fido_blob_t **ecdh)
 {
 	EVP_PKEY	*pk_evp = NULL;
-	EVP_PKEY	*sk_evp = NULL;
 	EVP_PKEY_CTX	*ctx = NULL;
 	fido_blob_t	*secret = NULL;
 	int		 ok = -1;
@@ -26,10 +293,9 @@ do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
 	    (*ecdh = fido_blob_new()) == NULL)
 		goto fail;
 
-	/* wrap the keys as openssl objects */
-	if ((pk_evp = es256_pk_to_EVP_PKEY(pk)) == NULL ||
-	    (sk_evp = es256_sk_to_EVP_PKEY(sk)) == NULL) {
-		fido_log_debug("%s: es256_to_EVP_PKEY", __func__);
+	/* wrap the authenticator's key as an openssl object */
+	if ((pk_evp = es256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: es256_pk_to_EVP_PKEY", __func__);
 		goto fail;
 	}
 
@@ -43,7 +309,7 @@ do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
 
 	/* perform ecdh */
 	if (EVP_PKEY_derive(ctx, NULL, &secret->len) <= 0 ||
-	    (secret->ptr = calloc(1, secret->len)) == NULL ||
+	    (secret->ptr = fido_calloc(1, secret->len)) == NULL ||
 	    EVP_PKEY_derive(ctx, secret->ptr, &secret->len) <= 0) {
 		fido_log_debug("%s: EVP_PKEY_derive", __func__);
 		goto fail;
@@ -51,7 +317,7 @@ do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
 
 	/* use sha256 as a kdf on the resulting secret */
 	(*ecdh)->len = SHA256_DIGEST_LENGTH;
-	if (((*ecdh)->ptr = calloc(1, (*ecdh)->len)) == NULL ||
+	if (((*ecdh)->ptr = fido_calloc(1, (*ecdh)->len)) == NULL ||
 	    SHA256(secret->ptr, secret->len, (*ecdh)->ptr) != (*ecdh)->ptr) {
 		fido_log_debug("%s: sha256", __func__);
 		goto fail;
@@ -61,8 +327,6 @@ do_ecdh(const es256_sk_t *sk, const es256_pk_t *pk, fido_blob_t **ecdh)
 fail:
 	if (pk_evp != NULL)
 		EVP_PKEY_free(pk_evp);
-	if (sk_evp != NULL)
-		EVP_PKEY_free(sk_evp);
 	if (ctx != NULL)
 		EVP_PKEY_CTX_free(ctx);
 	if (ok < 0)
@@ -76,24 +340,28 @@ fail:
 int
 fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
 {
-	es256_sk_t	*sk = NULL; /* our private key */
+	struct ecdh_key	 k; /* our key pair */
 	es256_pk_t	*ak = NULL; /* authenticator's public key */
 	int		 r;
 
 	*pk = NULL; /* our public key; returned */
 	*ecdh = NULL; /* shared ecdh secret; returned */
 
-	if ((sk = es256_sk_new()) == NULL || (*pk = es256_pk_new()) == NULL) {
+	memset(&k, 0, sizeof(k));
+
+	if ((*pk = es256_pk_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if (es256_sk_create(sk) < 0 || es256_derive_pk(sk, *pk) < 0) {
-		fido_log_debug("%s: es256_derive_pk", __func__);
+	if (pool_get(&k) < 0 && ecdh_keygen(&k) < 0) {
+		fido_log_debug("%s: ecdh_keygen", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
+	**pk = k.pk;
+
 	if ((ak = es256_pk_new()) == NULL ||
 	    fido_dev_authkey(dev, ak) != FIDO_OK) {
 		fido_log_debug("%s: fido_dev_authkey", __func__);
@@ -101,7 +369,7 @@ fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
 		goto fail;
 	}
 
-	if (do_ecdh(sk, ak, ecdh) < 0) {
+	if (do_ecdh(k.sk, ak, ecdh) < 0) {
 		fido_log_debug("%s: do_ecdh", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -109,7 +377,7 @@ fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh)
 
 	r = FIDO_OK;
 fail:
-	es256_sk_free(&sk);
+	ecdh_key_free(&k);
 	es256_pk_free(&ak);
 
 	if (r != FIDO_OK) {
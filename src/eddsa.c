@@ -121,7 +121,7 @@ eddsa_pk_decode(const cbor_item_t *item, eddsa_pk_t *k)
 eddsa_pk_t *
 eddsa_pk_new(void)
 {
-	return (calloc(1, sizeof(eddsa_pk_t)));
+	return (fido_calloc(1, sizeof(eddsa_pk_t)));
 }
 
 void
@@ -132,8 +132,7 @@ eddsa_pk_free(eddsa_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	explicit_bzero(pk, sizeof(*pk));
-	free(pk);
+	fido_freezero(pk, sizeof(*pk));
 
 	*pkp = NULL;
 }
@@ -120,6 +120,8 @@ fido_strerr(int n)
 		return "FIDO_ERR_USER_PRESENCE_REQUIRED";
 	case FIDO_ERR_INTERNAL:
 		return "FIDO_ERR_INTERNAL";
+	case FIDO_ERR_INVALID_SIGCOUNT:
+		return "FIDO_ERR_INVALID_SIGCOUNT";
 	default:
 		return "FIDO_ERR_UNKNOWN";
 	}
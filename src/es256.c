@@ -136,7 +136,7 @@ fail:
 es256_sk_t *
 es256_sk_new(void)
 {
-	return (calloc(1, sizeof(es256_sk_t)));
+	return (fido_calloc(1, sizeof(es256_sk_t)));
 }
 
 void
@@ -147,8 +147,7 @@ es256_sk_free(es256_sk_t **skp)
 	if (skp == NULL || (sk = *skp) == NULL)
 		return;
 
-	explicit_bzero(sk, sizeof(*sk));
-	free(sk);
+	fido_freezero(sk, sizeof(*sk));
 
 	*skp = NULL;
 }
@@ -156,7 +155,7 @@ es256_sk_free(es256_sk_t **skp)
 es256_pk_t *
 es256_pk_new(void)
 {
-	return (calloc(1, sizeof(es256_pk_t)));
+	return (fido_calloc(1, sizeof(es256_pk_t)));
 }
 
 void
@@ -167,8 +166,7 @@ es256_pk_free(es256_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	explicit_bzero(pk, sizeof(*pk));
-	free(pk);
+	fido_freezero(pk, sizeof(*pk));
 
 	*pkp = NULL;
 }
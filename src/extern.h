@@ -79,6 +79,14 @@ void cbor_vector_free(cbor_item_t **, size_t);
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
 #endif
 
+/* memory allocation */
+void *fido_malloc(size_t);
+void *fido_calloc(size_t, size_t);
+void *fido_recallocarray(void *, size_t, size_t, size_t);
+char *fido_strdup(const char *);
+void fido_free(void *);
+void fido_freezero(void *, size_t);
+
 /* buf */
 int fido_buf_read(const unsigned char **, size_t *, void *, size_t);
 int fido_buf_write(unsigned char **, size_t *, const void *, size_t);
@@ -90,9 +98,34 @@ int fido_hid_read(void *, unsigned char *, size_t, int);
 int fido_hid_write(void *, const unsigned char *, size_t);
 size_t fido_hid_report_in_len(void *);
 size_t fido_hid_report_out_len(void *);
+int fido_hid_lock(void *, bool);
+void fido_hid_unlock(void *);
+
+/* hid multiplexer */
+void *fido_mux_attach(fido_dev_mux_t *);
+void  fido_mux_detach(void *);
+int fido_mux_read(void *, unsigned char *, size_t, int);
+int fido_mux_write(void *, const unsigned char *, size_t);
+size_t fido_mux_rx_len(const fido_dev_mux_t *);
+size_t fido_mux_tx_len(const fido_dev_mux_t *);
+
+/* device broker */
+void *fido_broker_attach(const char *, const char *);
+void  fido_broker_detach(void *);
+void  fido_broker_release(void *);
+int fido_broker_rx(fido_dev_t *, uint8_t, unsigned char *, size_t, int);
+int fido_broker_tx(fido_dev_t *, uint8_t, const unsigned char *, size_t);
 
 /* generic i/o */
 int fido_rx_cbor_status(fido_dev_t *, int);
+int fido_rx_error(const fido_dev_t *);
+void fido_tx_forget(fido_dev_t *);
+void fido_tx_handoff(fido_dev_t *);
+int fido_tx_hold(fido_dev_t *);
+void fido_tx_pass(fido_dev_t *);
+void fido_tx_release(fido_dev_t *);
+int fido_tx_take(fido_dev_t *);
+void fido_tx_unlock(fido_dev_t *);
 int fido_rx(fido_dev_t *, uint8_t, void *, size_t, int);
 int fido_tx(fido_dev_t *, uint8_t, const void *, size_t);
 
@@ -101,19 +134,32 @@ int fido_tx(fido_dev_t *, uint8_t, const void *, size_t);
 #define fido_log_init(...)	do { /* nothing */ } while (0)
 #define fido_log_debug(...)	do { /* nothing */ } while (0)
 #define fido_log_xxd(...)	do { /* nothing */ } while (0)
+#define fido_log_set_dev(...)	do { /* nothing */ } while (0)
 #else
 #ifdef __GNUC__
 void fido_log_init(void);
 void fido_log_debug(const char *, ...)
     __attribute__((__format__ (printf, 1, 2)));
 void fido_log_xxd(const void *, size_t);
+void fido_log_set_dev(const fido_dev_t *);
 #else
 void fido_log_init(void);
 void fido_log_debug(const char *, ...);
 void fido_log_xxd(const void *, size_t);
+void fido_log_set_dev(const fido_dev_t *);
 #endif /* __GNUC__ */
 #endif /* FIDO_NO_DIAGNOSTIC */
 
+/* time */
+int fido_time_now(struct timespec *);
+int fido_time_delta_ms(const struct timespec *, int *);
+int fido_time_delta_us(const struct timespec *, uint64_t *);
+int fido_time_sleep_ms(int);
+
+/* statistics */
+void fido_stats_tx(fido_dev_t *, uint8_t, const void *, size_t);
+void fido_stats_rx(fido_dev_t *);
+
 /* u2f */
 int u2f_register(fido_dev_t *, fido_cred_t *, int);
 int u2f_authenticate(fido_dev_t *, fido_assert_t *, int);
@@ -127,6 +173,10 @@ int fido_dev_get_pin_token(fido_dev_t *, const char *, const fido_blob_t *,
     const es256_pk_t *, fido_blob_t *);
 int fido_do_ecdh(fido_dev_t *, es256_pk_t **, fido_blob_t **);
 
+/* channel locking */
+void fido_dev_auto_lock(fido_dev_t *, int);
+void fido_dev_auto_unlock(fido_dev_t *, int);
+
 /* misc */
 void fido_assert_reset_rx(fido_assert_t *);
 void fido_assert_reset_tx(fido_assert_t *);
@@ -142,6 +192,9 @@ int fido_verify_sig_rs256(const fido_blob_t *, const rs256_pk_t *,
     const fido_blob_t *);
 int fido_verify_sig_eddsa(const fido_blob_t *, const eddsa_pk_t *,
     const fido_blob_t *);
+int fido_verify_sig_pkey(int, const fido_blob_t *, EVP_PKEY *,
+    const fido_blob_t *);
+int fido_assert_verify_pkey(const fido_assert_t *, size_t, int, EVP_PKEY *);
 int fido_get_signed_hash(int, fido_blob_t *, const fido_blob_t *,
     const fido_blob_t *);
 
@@ -162,6 +215,7 @@ uint32_t uniform_random(uint32_t);
 #define FIDO_DEV_PIN_SET	0x01
 #define FIDO_DEV_PIN_UNSET	0x02
 #define FIDO_DEV_CRED_PROT	0x04
+#define FIDO_DEV_NO_LOCK	0x08
 
 /* miscellanea */
 #define FIDO_DUMMY_CLIENTDATA	""
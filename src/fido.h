@@ -22,6 +22,7 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "iso7816.h"
 #include "extern.h"
+#include "trace.h"
 #endif
 
 #include "fido/err.h"
@@ -39,25 +40,54 @@ extern "C" {
 #endif
 
 fido_assert_t *fido_assert_new(void);
+fido_broker_t *fido_broker_new(void);
 fido_cred_t *fido_cred_new(void);
+fido_cred_store_t *fido_cred_store_new(void);
 fido_dev_t *fido_dev_new(void);
 fido_dev_t *fido_dev_new_with_info(const fido_dev_info_t *);
 fido_dev_info_t *fido_dev_info_new(size_t);
+fido_dev_mux_t *fido_dev_mux_new(void);
 fido_cbor_info_t *fido_cbor_info_new(void);
+fido_dev_stats_t *fido_dev_stats_new(void);
 
 void fido_assert_free(fido_assert_t **);
+void fido_broker_free(fido_broker_t **);
 void fido_cbor_info_free(fido_cbor_info_t **);
 void fido_cred_free(fido_cred_t **);
+void fido_cred_store_free(fido_cred_store_t **);
 void fido_dev_force_fido2(fido_dev_t *);
 void fido_dev_force_u2f(fido_dev_t *);
 void fido_dev_free(fido_dev_t **);
 void fido_dev_info_free(fido_dev_info_t **, size_t);
+void fido_dev_mux_free(fido_dev_mux_t **);
+void fido_dev_reset_stats(fido_dev_t *);
+void fido_dev_stats_free(fido_dev_stats_t **);
 
 /* fido_init() flags. */
 #define FIDO_DEBUG	0x01
 
+/* fido_set_log_level() levels. */
+#define FIDO_LOG_NONE	0 /* no diagnostics */
+#define FIDO_LOG_DEBUG	1 /* debug messages */
+#define FIDO_LOG_XXD	2 /* debug messages and hex dumps (default) */
+
 void fido_init(int);
+int fido_set_allocator(fido_malloc_t *, fido_realloc_t *, fido_free_t *);
 void fido_set_log_handler(fido_log_handler_t *);
+void fido_set_log_level(int);
+void fido_set_log_record_handler(fido_log_record_handler_t *);
+
+int fido_log_async_start(size_t);
+void fido_log_async_stop(void);
+
+const char *fido_log_record_msg(const fido_log_record_t *);
+const void *fido_log_record_dev(const fido_log_record_t *);
+int fido_log_record_level(const fido_log_record_t *);
+uint64_t fido_log_record_thread(const fido_log_record_t *);
+uint64_t fido_log_record_time_us(const fido_log_record_t *);
+
+int fido_ecdh_pool_start(size_t);
+void fido_ecdh_pool_stop(void);
 
 const unsigned char *fido_assert_authdata_ptr(const fido_assert_t *, size_t);
 const unsigned char *fido_assert_clientdata_hash_ptr(const fido_assert_t *);
@@ -95,6 +125,9 @@ const unsigned char *fido_cred_sig_ptr(const fido_cred_t *);
 const unsigned char *fido_cred_x5c_ptr(const fido_cred_t *);
 
 int fido_assert_allow_cred(fido_assert_t *, const unsigned char *, size_t);
+int fido_assert_export(const fido_assert_t *, unsigned char *, size_t,
+    size_t *);
+int fido_assert_import(fido_assert_t *, const unsigned char *, size_t);
 int fido_assert_set_authdata(fido_assert_t *, size_t, const unsigned char *,
     size_t);
 int fido_assert_set_authdata_raw(fido_assert_t *, size_t, const unsigned char *,
@@ -111,7 +144,15 @@ int fido_assert_set_up(fido_assert_t *, fido_opt_t);
 int fido_assert_set_uv(fido_assert_t *, fido_opt_t);
 int fido_assert_set_sig(fido_assert_t *, size_t, const unsigned char *, size_t);
 int fido_assert_verify(const fido_assert_t *, size_t, int, const void *);
+int fido_assert_verify_with_store(const fido_assert_t *, size_t,
+    const fido_cred_store_t *);
+int fido_broker_listen(fido_broker_t *, const char *);
+int fido_broker_run(fido_broker_t *);
+int fido_broker_set_hold_timeout(fido_broker_t *, int);
+int fido_broker_stop(fido_broker_t *);
 int fido_cred_exclude(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_export(const fido_cred_t *, unsigned char *, size_t, size_t *);
+int fido_cred_import(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_prot(const fido_cred_t *);
 int fido_cred_set_authdata(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_authdata_raw(fido_cred_t *, const unsigned char *, size_t);
@@ -129,24 +170,51 @@ int fido_cred_set_uv(fido_cred_t *, fido_opt_t);
 int fido_cred_type(const fido_cred_t *);
 int fido_cred_set_user(fido_cred_t *, const unsigned char *, size_t,
     const char *, const char *, const char *);
+int fido_cred_store_add(fido_cred_store_t *, const fido_cred_t *);
+int fido_cred_store_load(fido_cred_store_t *, const char *);
+int fido_cred_store_lookup(const fido_cred_store_t *, const unsigned char *,
+    size_t, int *, uint32_t *);
+int fido_cred_store_save(const fido_cred_store_t *, const char *);
+int fido_cred_store_set_sigcount_tracking(fido_cred_store_t *, bool);
 int fido_cred_set_x509(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_verify(const fido_cred_t *);
 int fido_cred_verify_self(const fido_cred_t *);
 int fido_dev_cancel(fido_dev_t *);
 int fido_dev_close(fido_dev_t *);
 int fido_dev_get_assert(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_batch(fido_dev_t *, fido_assert_t **, size_t,
+    const char *);
 int fido_dev_get_cbor_info(fido_dev_t *, fido_cbor_info_t *);
 int fido_dev_get_retry_count(fido_dev_t *, int *);
+int fido_dev_get_stats(const fido_dev_t *, fido_dev_stats_t *);
 int fido_dev_get_touch_begin(fido_dev_t *);
 int fido_dev_get_touch_status(fido_dev_t *, int *, int);
 int fido_dev_info_manifest(fido_dev_info_t *, size_t, size_t *);
+int fido_dev_info_set(fido_dev_info_t *, size_t, const char *, const char *,
+    const char *, const fido_dev_io_t *, const fido_dev_transport_t *);
+int fido_dev_lock(fido_dev_t *, int);
 int fido_dev_make_cred(fido_dev_t *, fido_cred_t *, const char *);
+int fido_dev_mux_close(fido_dev_mux_t *);
+int fido_dev_mux_open(fido_dev_mux_t *, const char *);
+int fido_dev_mux_set_io_functions(fido_dev_mux_t *, const fido_dev_io_t *);
+int fido_dev_open_many(const fido_dev_info_t *, size_t, fido_dev_t **,
+    int *, int);
+int fido_dev_open_mux(fido_dev_t *, fido_dev_mux_t *);
 int fido_dev_open_with_info(fido_dev_t *);
 int fido_dev_open(fido_dev_t *, const char *);
+int fido_dev_ping(fido_dev_t *, const unsigned char *, size_t);
 int fido_dev_reset(fido_dev_t *);
+int fido_dev_set_arbitration(fido_dev_t *, bool, int);
+int fido_dev_set_auto_lock(fido_dev_t *, int);
+int fido_dev_set_broker(fido_dev_t *, const char *);
 int fido_dev_set_io_functions(fido_dev_t *, const fido_dev_io_t *);
+int fido_dev_set_keepalive_handler(fido_dev_t *,
+    fido_dev_keepalive_handler_t *, void *);
 int fido_dev_set_pin(fido_dev_t *, const char *, const char *);
+int fido_dev_set_retry_policy(fido_dev_t *, int, int, int);
 int fido_dev_set_transport_functions(fido_dev_t *, const fido_dev_transport_t *);
+int fido_dev_unlock(fido_dev_t *);
+int fido_dev_wink(fido_dev_t *);
 
 size_t fido_assert_authdata_len(const fido_assert_t *, size_t);
 size_t fido_assert_clientdata_hash_len(const fido_assert_t *);
@@ -183,6 +251,18 @@ uint64_t fido_cbor_info_maxmsgsiz(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_maxcredcntlst(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_maxcredidlen(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_fwversion(const fido_cbor_info_t *);
+uint64_t fido_dev_stats_errors(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_keepalives(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_latency_bucket(const fido_dev_stats_t *, int, size_t);
+uint64_t fido_dev_stats_latency_count(const fido_dev_stats_t *, int);
+uint64_t fido_dev_stats_latency_max_us(const fido_dev_stats_t *, int);
+uint64_t fido_dev_stats_latency_total_us(const fido_dev_stats_t *, int);
+uint64_t fido_dev_stats_rx_bytes(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_retries(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_rx_reports(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_timeouts(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_tx_bytes(const fido_dev_stats_t *);
+uint64_t fido_dev_stats_tx_reports(const fido_dev_stats_t *);
 
 bool fido_dev_has_pin(const fido_dev_t *);
 bool fido_dev_is_fido2(const fido_dev_t *);
@@ -25,7 +25,11 @@
 extern "C" {
 #endif /* __cplusplus */
 
+typedef void fido_bio_enroll_cb_t(void *, uint8_t, uint8_t);
+
 #ifdef _FIDO_INTERNAL
+struct fido_bio_enroll_async;
+
 struct fido_bio_template {
 	fido_blob_t id;
 	char *name;
@@ -41,6 +45,9 @@ struct fido_bio_enroll {
 	uint8_t remaining_samples;
 	uint8_t last_status;
 	fido_blob_t *token;
+	fido_bio_enroll_cb_t *cb;            /* per-sample callback */
+	void *cb_arg;                        /* callback argument */
+	struct fido_bio_enroll_async *async; /* enrollment in progress */
 };
 
 struct fido_bio_info {
@@ -85,11 +92,18 @@ int fido_bio_dev_enroll_continue(fido_dev_t *, const fido_bio_template_t *,
     fido_bio_enroll_t *, uint32_t);
 int fido_bio_dev_enroll_remove(fido_dev_t *, const fido_bio_template_t *,
     const char *);
+int fido_bio_dev_enroll_start(fido_dev_t *, fido_bio_template_t *,
+    fido_bio_enroll_t *, uint32_t, const char *);
 int fido_bio_dev_get_info(fido_dev_t *, fido_bio_info_t *);
 int fido_bio_dev_get_template_array(fido_dev_t *, fido_bio_template_array_t *,
     const char *);
 int fido_bio_dev_set_template_name(fido_dev_t *, const fido_bio_template_t *,
     const char *);
+int fido_bio_enroll_cancel(fido_bio_enroll_t *);
+int fido_bio_enroll_fd(const fido_bio_enroll_t *);
+int fido_bio_enroll_set_cb(fido_bio_enroll_t *, fido_bio_enroll_cb_t *,
+    void *);
+int fido_bio_enroll_wait(fido_bio_enroll_t *, int);
 int fido_bio_template_set_id(fido_bio_template_t *, const unsigned char *,
     size_t);
 int fido_bio_template_set_name(fido_bio_template_t *, const char *);
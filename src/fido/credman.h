@@ -47,30 +47,60 @@ struct fido_credman_rk {
 	size_t n_alloc; /* number of allocated entries */
 	size_t n_rx;    /* number of populated entries */
 };
+
+struct fido_credman_inventory {
+	struct fido_credman_rp rp;  /* relying parties */
+	struct fido_credman_rk *rk; /* resident credentials, one set per rp */
+	size_t rk_len;
+	struct fido_credman_metadata metadata; /* as of the last sync */
+	unsigned char aaguid[16];   /* authenticator of the last sync */
+	bool synced;                /* mirrors an authenticator */
+};
 #endif
 
+typedef struct fido_credman_inventory fido_credman_inventory_t;
 typedef struct fido_credman_metadata fido_credman_metadata_t;
 typedef struct fido_credman_rk fido_credman_rk_t;
 typedef struct fido_credman_rp fido_credman_rp_t;
 
+typedef int fido_credman_rk_cb_t(void *, const fido_cred_t *, size_t);
+typedef int fido_credman_rp_cb_t(void *, const fido_credman_rp_t *, size_t);
+
 const char *fido_credman_rp_id(const fido_credman_rp_t *, size_t);
 const char *fido_credman_rp_name(const fido_credman_rp_t *, size_t);
 
 const fido_cred_t *fido_credman_rk(const fido_credman_rk_t *, size_t);
+const fido_credman_metadata_t *fido_credman_inventory_metadata(
+    const fido_credman_inventory_t *);
+const fido_credman_rk_t *fido_credman_inventory_rk(
+    const fido_credman_inventory_t *, size_t);
+const fido_credman_rp_t *fido_credman_inventory_rp(
+    const fido_credman_inventory_t *);
 const unsigned char *fido_credman_rp_id_hash_ptr(const fido_credman_rp_t *,
     size_t);
 
+fido_credman_inventory_t *fido_credman_inventory_new(void);
 fido_credman_metadata_t *fido_credman_metadata_new(void);
 fido_credman_rk_t *fido_credman_rk_new(void);
 fido_credman_rp_t *fido_credman_rp_new(void);
 
 int fido_credman_del_dev_rk(fido_dev_t *, const unsigned char *, size_t,
     const char *);
+int fido_credman_del_dev_rk_list(fido_dev_t *, const unsigned char * const *,
+    const size_t *, size_t, int *, const char *);
+int fido_credman_get_dev_inventory(fido_dev_t *, fido_credman_inventory_t *,
+    const char *);
 int fido_credman_get_dev_metadata(fido_dev_t *, fido_credman_metadata_t *,
     const char *);
 int fido_credman_get_dev_rk(fido_dev_t *, const char *, fido_credman_rk_t *,
     const char *);
 int fido_credman_get_dev_rp(fido_dev_t *, fido_credman_rp_t *, const char *);
+int fido_credman_iter_dev_rk(fido_dev_t *, const char *, fido_credman_rk_cb_t *,
+    void *, const char *);
+int fido_credman_iter_dev_rp(fido_dev_t *, fido_credman_rp_cb_t *, void *,
+    const char *);
+int fido_credman_sync_dev_inventory(fido_dev_t *, fido_credman_inventory_t *,
+    const char *);
 
 size_t fido_credman_rk_count(const fido_credman_rk_t *);
 size_t fido_credman_rp_count(const fido_credman_rp_t *);
@@ -79,6 +109,7 @@ size_t fido_credman_rp_id_hash_len(const fido_credman_rp_t *, size_t);
 uint64_t fido_credman_rk_existing(const fido_credman_metadata_t *);
 uint64_t fido_credman_rk_remaining(const fido_credman_metadata_t *);
 
+void fido_credman_inventory_free(fido_credman_inventory_t **);
 void fido_credman_metadata_free(fido_credman_metadata_t **);
 void fido_credman_rk_free(fido_credman_rk_t **);
 void fido_credman_rp_free(fido_credman_rp_t **);
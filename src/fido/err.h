@@ -65,6 +65,7 @@
 #define FIDO_ERR_INVALID_ARGUMENT	-7
 #define FIDO_ERR_USER_PRESENCE_REQUIRED	-8
 #define FIDO_ERR_INTERNAL		-9
+#define FIDO_ERR_INVALID_SIGCOUNT	-10
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,8 +22,16 @@
 #define CTAP_CMD_CBOR			0x10
 #define CTAP_CMD_CANCEL			0x11
 #define CTAP_KEEPALIVE			0x3b
+#define CTAP_CMD_ERROR			0x3f
 #define CTAP_FRAME_INIT			0x80
 
+/* CTAPHID keepalive status codes. */
+#define CTAP_KEEPALIVE_PROCESSING	0x01
+#define CTAP_KEEPALIVE_UPNEEDED		0x02
+
+/* Upper bound on the duration of a CTAPHID_LOCK, in seconds. */
+#define CTAP_LOCK_MAX_SECONDS		10
+
 /* CTAPHID CBOR command opcodes. */
 #define CTAP_CBOR_MAKECRED		0x01
 #define CTAP_CBOR_ASSERT		0x02
@@ -98,4 +106,28 @@
 #define FIDO_CRED_PROT_UV_OPTIONAL_WITH_ID	0x02
 #define FIDO_CRED_PROT_UV_REQUIRED		0x03
 
+/* Operations for which latency statistics are kept. */
+#define FIDO_STATS_OP_OTHER		0
+#define FIDO_STATS_OP_INIT		1
+#define FIDO_STATS_OP_PING		2
+#define FIDO_STATS_OP_WINK		3
+#define FIDO_STATS_OP_MAKECRED		4
+#define FIDO_STATS_OP_ASSERT		5
+#define FIDO_STATS_OP_NEXT_ASSERT	6
+#define FIDO_STATS_OP_GETINFO		7
+#define FIDO_STATS_OP_PIN_RETRIES	8
+#define FIDO_STATS_OP_PIN_KEYAGREEMENT	9
+#define FIDO_STATS_OP_PIN_SET		10
+#define FIDO_STATS_OP_PIN_CHANGE	11
+#define FIDO_STATS_OP_PIN_TOKEN		12
+#define FIDO_STATS_OP_RESET		13
+#define FIDO_STATS_OP_BIO_ENROLL	14
+#define FIDO_STATS_OP_CREDMAN		15
+#define FIDO_STATS_OP_U2F_REGISTER	16
+#define FIDO_STATS_OP_U2F_AUTH		17
+#define FIDO_STATS_NOPS			18
+
+/* Number of latency histogram buckets; bucket n counts [2^n, 2^(n+1)) us. */
+#define FIDO_STATS_NBUCKETS		24
+
 #endif /* !_FIDO_PARAM_H */
@@ -42,10 +42,24 @@ typedef enum {
 } fido_opt_t;
 
 typedef void fido_log_handler_t(const char *);
+typedef void *fido_malloc_t(size_t);
+typedef void *fido_realloc_t(void *, size_t);
+typedef void  fido_free_t(void *);
+
+typedef struct fido_log_record fido_log_record_t;
+typedef void fido_log_record_handler_t(const fido_log_record_t *);
+typedef void fido_dev_keepalive_handler_t(void *, uint8_t, int);
+
+typedef struct fido_dev_mux fido_dev_mux_t;
+typedef struct fido_broker fido_broker_t;
+typedef struct fido_cred_store fido_cred_store_t;
 
 #ifdef _FIDO_INTERNAL
+#include <time.h>
+
 #include "packed.h"
 #include "blob.h"
+#include "fido/param.h"
 
 /* COSE ES256 (ECDSA over P-256 with SHA-256) public key */
 typedef struct es256_pk {
@@ -208,6 +222,37 @@ struct fido_ctap_info {
 	uint8_t  flags;    /* capabilities flags; see FIDO_CAP_* */
 })
 
+typedef struct fido_stats_latency {
+	uint64_t count;                       /* completed operations */
+	uint64_t total_us;                    /* sum of latencies */
+	uint64_t max_us;                      /* worst latency */
+	uint64_t bucket[FIDO_STATS_NBUCKETS]; /* log2 histogram */
+} fido_stats_latency_t;
+
+typedef struct fido_dev_stats {
+	uint64_t             tx_reports; /* hid reports sent */
+	uint64_t             rx_reports; /* hid reports received */
+	uint64_t             tx_bytes;   /* hid report bytes sent */
+	uint64_t             rx_bytes;   /* hid report bytes received */
+	uint64_t             keepalives; /* keepalive frames received */
+	uint64_t             errors;     /* ctaphid error frames received */
+	uint64_t             timeouts;   /* hid reads that timed out */
+	uint64_t             retries;    /* requests retransmitted */
+	fido_stats_latency_t latency[FIDO_STATS_NOPS]; /* per operation */
+} fido_dev_stats_t;
+
+typedef struct fido_dev_retry {
+	int         backoff_ms;     /* initial backoff; 0 if disabled */
+	int         max_backoff_ms; /* upper bound on backoff */
+	int         deadline_ms;    /* upper bound on total delay */
+	bool        pending;        /* request may be retransmitted */
+	uint8_t     cmd;            /* pending request: command */
+	fido_blob_t msg;            /* pending request: payload */
+	int         next_ms;        /* next backoff */
+	struct timespec ts;         /* pending since */
+	uint64_t    jitter;         /* xorshift64 state */
+} fido_dev_retry_t;
+
 typedef struct fido_dev {
 	uint64_t              nonce;     /* issued nonce */
 	fido_ctap_info_t      attr;      /* device attributes */
@@ -220,6 +265,25 @@ typedef struct fido_dev {
 	size_t                tx_len;    /* length of HID output reports */
 	int                   flags;     /* internal flags; see FIDO_DEV_* */
 	fido_dev_transport_t  transport; /* transport functions */
+	fido_dev_keepalive_handler_t *keepalive;     /* keepalive handler */
+	void                         *keepalive_arg; /* keepalive argument */
+	fido_dev_stats_t              stats;         /* i/o statistics */
+	int                           stats_op;      /* pending operation */
+	struct timespec               stats_ts;      /* pending since */
+	fido_dev_mux_t               *mux;           /* shared hid handle */
+	int                           rx_err;        /* last CTAPHID_ERROR */
+	fido_dev_retry_t              retry;         /* busy retry policy */
+	bool                          arb;           /* arbitrate hid access */
+	int                           arb_ms;        /* arbitration deadline */
+	bool                          arb_held;      /* hid lock held */
+	int                           arb_depth;     /* hid lock hold count */
+	bool                          arb_touch;     /* held for touch request */
+	int                           lock_auto;     /* auto CTAPHID_LOCK, s */
+	int                           lock_held;     /* CTAPHID_LOCK held, s */
+	struct timespec               lock_ts;       /* lock held since */
+	bool                          lock_own;      /* taken by auto lock */
+	uintptr_t                     owner;         /* transaction owner */
+	char                         *broker;        /* broker socket path */
 } fido_dev_t;
 
 #else
@@ -228,6 +292,7 @@ typedef struct fido_cbor_info fido_cbor_info_t;
 typedef struct fido_cred fido_cred_t;
 typedef struct fido_dev fido_dev_t;
 typedef struct fido_dev_info fido_dev_info_t;
+typedef struct fido_dev_stats fido_dev_stats_t;
 typedef struct es256_pk es256_pk_t;
 typedef struct es256_sk es256_sk_t;
 typedef struct rs256_pk rs256_pk_t;
@@ -10,7 +10,7 @@
 fido_dev_info_t *
 fido_dev_info_new(size_t n)
 {
-	return (calloc(n, sizeof(fido_dev_info_t)));
+	return (fido_calloc(n, sizeof(fido_dev_info_t)));
 }
 
 void
@@ -23,16 +23,54 @@ fido_dev_info_free(fido_dev_info_t **devlist_p, size_t n)
 
 	for (size_t i = 0; i < n; i++) {
 		const fido_dev_info_t *di = &devlist[i];
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 	}
 
-	free(devlist);
+	fido_free(devlist);
 
 	*devlist_p = NULL;
 }
 
+int
+fido_dev_info_set(fido_dev_info_t *devlist, size_t i, const char *path,
+    const char *manufacturer, const char *product, const fido_dev_io_t *io,
+    const fido_dev_transport_t *transport)
+{
+	fido_dev_info_t	*di = &devlist[i];
+	char		*path_copy = NULL;
+	char		*manufacturer_copy = NULL;
+	char		*product_copy = NULL;
+
+	if (path == NULL || manufacturer == NULL || product == NULL ||
+	    io == NULL || io->open == NULL || io->close == NULL ||
+	    io->read == NULL || io->write == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((path_copy = fido_strdup(path)) == NULL ||
+	    (manufacturer_copy = fido_strdup(manufacturer)) == NULL ||
+	    (product_copy = fido_strdup(product)) == NULL) {
+		fido_free(path_copy);
+		fido_free(manufacturer_copy);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	fido_free(di->path);
+	fido_free(di->manufacturer);
+	fido_free(di->product);
+
+	memset(di, 0, sizeof(*di));
+	di->path = path_copy;
+	di->manufacturer = manufacturer_copy;
+	di->product = product_copy;
+	di->io = *io;
+	if (transport != NULL)
+		di->transport = *transport;
+
+	return (FIDO_OK);
+}
+
 const fido_dev_info_t *
 fido_dev_info_ptr(const fido_dev_info_t *devlist, size_t i)
 {
@@ -39,14 +39,14 @@ wcs_to_cs(const wchar_t *wcs)
 	char *cs;
 	size_t i;
 
-	if (wcs == NULL || (cs = calloc(fido_wcslen(wcs) + 1, 1)) == NULL)
+	if (wcs == NULL || (cs = fido_calloc(fido_wcslen(wcs) + 1, 1)) == NULL)
 		return NULL;
 
 	for (i = 0; i < fido_wcslen(wcs); i++) {
 		if (wcs[i] >= 128) {
 			/* give up on parsing non-ASCII text */
-			free(cs);
-			return strdup("hidapi device");
+			fido_free(cs);
+			return fido_strdup("hidapi device");
 		}
 		cs[i] = (char)wcs[i];
 	}
@@ -60,26 +60,26 @@ copy_info(fido_dev_info_t *di, const struct hid_device_info *d)
 	memset(di, 0, sizeof(*di));
 
 	if (d->path != NULL)
-		di->path = strdup(d->path);
+		di->path = fido_strdup(d->path);
 	else
-		di->path = strdup("");
+		di->path = fido_strdup("");
 
 	if (d->manufacturer_string != NULL)
 		di->manufacturer = wcs_to_cs(d->manufacturer_string);
 	else
-		di->manufacturer = strdup("");
+		di->manufacturer = fido_strdup("");
 
 	if (d->product_string != NULL)
 		di->product = wcs_to_cs(d->product_string);
 	else
-		di->product = strdup("");
+		di->product = fido_strdup("");
 
 	if (di->path == NULL ||
 	    di->manufacturer == NULL ||
 	    di->product == NULL) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 		return -1;
 	}
@@ -242,12 +242,12 @@ fido_hid_open(const char *path)
 {
 	struct hid_hidapi *ctx;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		return (NULL);
 	}
 
 	if ((ctx->handle = hid_open_path(path)) == NULL) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
@@ -262,7 +262,7 @@ fido_hid_close(void *handle)
 	struct hid_hidapi *ctx = handle;
 
 	hid_close(ctx->handle);
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -334,3 +334,18 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_lock(void *handle, bool wait)
+{
+	(void)handle;
+	(void)wait;
+
+	return (0); /* no arbitration */
+}
+
+void
+fido_hid_unlock(void *handle)
+{
+	(void)handle;
+}
@@ -6,7 +6,10 @@
 
 #include <sys/types.h>
 
+#include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <linux/hidraw.h>
 #include <linux/input.h>
 
@@ -14,6 +17,8 @@
 #include <fcntl.h>
 #include <libudev.h>
 #include <poll.h>
+#include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -23,6 +28,7 @@ struct hid_linux {
 	int	fd;
 	size_t	report_in_len;
 	size_t	report_out_len;
+	int	qfd;	/* lock queue, or -1 */
 };
 
 static int
@@ -195,7 +201,7 @@ parse_uevent(const char *uevent, int *bus, int16_t *vendor_id,
 	short unsigned int	 y;
 	short unsigned int	 z;
 
-	if ((s = cp = strdup(uevent)) == NULL)
+	if ((s = cp = fido_strdup(uevent)) == NULL)
 		return (-1);
 
 	while ((p = strsep(&cp, "\n")) != NULL && *p != '\0') {
@@ -210,7 +216,7 @@ parse_uevent(const char *uevent, int *bus, int16_t *vendor_id,
 		}
 	}
 
-	free(s);
+	fido_free(s);
 
 	return (ok);
 }
@@ -227,7 +233,7 @@ get_parent_attr(struct udev_device *dev, const char *subsystem,
 	    udev_device_get_sysattr_value(parent, attr)) == NULL)
 		return (NULL);
 
-	return (strdup(value));
+	return (fido_strdup(value));
 }
 
 static char *
@@ -268,7 +274,7 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 	}
 #endif
 
-	di->path = strdup(path);
+	di->path = fido_strdup(path);
 	di->manufacturer = get_usb_attr(dev, "manufacturer");
 	di->product = get_usb_attr(dev, "product");
 
@@ -280,12 +286,12 @@ fail:
 	if (dev != NULL)
 		udev_device_unref(dev);
 
-	free(uevent);
+	fido_free(uevent);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -351,11 +357,13 @@ fido_hid_open(const char *path)
 	struct hid_linux		*ctx;
 	struct hidraw_report_descriptor	 hrd;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
 		return (NULL);
 
+	ctx->qfd = -1;
+
 	if ((ctx->fd = open(path, O_RDWR)) < 0) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
@@ -375,8 +383,13 @@ fido_hid_close(void *handle)
 {
 	struct hid_linux *ctx = handle;
 
+	if (ctx->qfd != -1) {
+		fido_hid_unlock(ctx);
+		close(ctx->qfd);
+	}
+
 	close(ctx->fd);
-	free(ctx);
+	fido_free(ctx);
 }
 
 static int
@@ -457,10 +470,14 @@ fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 
 	if (waitfd(ctx->fd, ms) < 0) {
 		fido_log_debug("%s: fd not ready", __func__);
+		fido_trace3(hid__read, ctx->fd, len, -1);
 		return (-1);
 	}
 
-	if ((r = read(ctx->fd, buf, len)) < 0 || (size_t)r != len) {
+	r = read(ctx->fd, buf, len);
+	fido_trace3(hid__read, ctx->fd, len, r);
+
+	if (r < 0 || (size_t)r != len) {
 		fido_log_debug("%s: read", __func__);
 		return (-1);
 	}
@@ -479,7 +496,10 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 		return (-1);
 	}
 
-	if ((r = write(ctx->fd, buf, len)) < 0 || (size_t)r != len) {
+	r = write(ctx->fd, buf, len);
+	fido_trace3(hid__write, ctx->fd, len, r);
+
+	if (r < 0 || (size_t)r != len) {
 		fido_log_debug("%s: write", __func__);
 		return (-1);
 	}
@@ -502,3 +522,169 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+/*
+ * Processes waiting for the lock of a device queue up in a small file in
+ * HID_LOCK_DIR, named after the device number, and only the process at
+ * the head of the queue may take the lock; waiters are thus served in
+ * the order they arrived. The file is only accessed under flock(2).
+ * Entries left by processes that are gone are dropped by the next
+ * process looking at the queue, and the lock itself is released by the
+ * kernel, so a waiter or holder exiting doesn't stall the others. Should
+ * the queue be unavailable, the lock is taken unqueued.
+ */
+#define HID_LOCK_DIR	"/tmp"
+#define HID_LOCK_MAXQ	64
+#define HID_LOCK_MAX_BACKOFF_MS	8
+
+struct hid_lock_queue {
+	uint32_t	n;
+	uint32_t	pad;
+	struct {
+		int32_t		pid;
+		uint32_t	pad;
+		uint64_t	handle;	/* tells handles of a process apart */
+	} e[HID_LOCK_MAXQ];
+};
+
+static int
+lock_queue_open(struct hid_linux *ctx)
+{
+	struct stat	st;
+	char		path[128];
+	int		r;
+
+	if (ctx->qfd != -1)
+		return (0);
+
+	if (fstat(ctx->fd, &st) != 0 || (r = snprintf(path, sizeof(path),
+	    "%s/libfido2-lock-%u-%u", HID_LOCK_DIR, major(st.st_rdev),
+	    minor(st.st_rdev))) < 0 || (size_t)r >= sizeof(path))
+		return (-1);
+
+	if ((ctx->qfd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+	    0666)) < 0) {
+		fido_log_debug("%s: open %s: %s", __func__, path,
+		    strerror(errno));
+		return (-1);
+	}
+
+	/* shared with other users of the device; fails if not ours */
+	(void)fchmod(ctx->qfd, 0666);
+
+	if (fstat(ctx->qfd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		fido_log_debug("%s: %s", __func__, path);
+		close(ctx->qfd);
+		ctx->qfd = -1;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Find 'ctx' in the queue, adding it at the tail if 'add' is set, or
+ * removing it if 'remove' is set. Returns its position, or -1.
+ */
+static int
+lock_queue_update(struct hid_linux *ctx, bool add, bool remove)
+{
+	struct hid_lock_queue	q;
+	const int32_t		pid = (int32_t)getpid();
+	const uint64_t		handle = (uint64_t)(uintptr_t)ctx;
+	ssize_t			n;
+	uint32_t		i;
+	uint32_t		j;
+	int			pos = -1;
+
+	while (flock(ctx->qfd, LOCK_EX) != 0)
+		if (errno != EINTR)
+			return (-1);
+
+	memset(&q, 0, sizeof(q));
+	if ((n = pread(ctx->qfd, &q, sizeof(q), 0)) < 0 ||
+	    (size_t)n != sizeof(q) || q.n > HID_LOCK_MAXQ)
+		q.n = 0;
+
+	/* drop ourselves if asked to, and whoever is gone */
+	for (i = j = 0; i < q.n; i++) {
+		if (q.e[i].pid == pid && q.e[i].handle == handle) {
+			if (remove)
+				continue;
+			pos = (int)j;
+		} else if (kill(q.e[i].pid, 0) != 0 && errno == ESRCH)
+			continue;
+		q.e[j++] = q.e[i];
+	}
+	q.n = j;
+
+	if (pos < 0 && add && q.n < HID_LOCK_MAXQ) {
+		q.e[q.n].pid = pid;
+		q.e[q.n].pad = 0;
+		q.e[q.n].handle = handle;
+		pos = (int)q.n++;
+	}
+
+	if (pwrite(ctx->qfd, &q, sizeof(q), 0) != (ssize_t)sizeof(q)) {
+		fido_log_debug("%s: pwrite: %s", __func__, strerror(errno));
+		pos = -1;
+	}
+
+	flock(ctx->qfd, LOCK_UN);
+
+	return (pos);
+}
+
+static int
+lock_fd(int fd, bool wait)
+{
+	while (flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+		if (errno == EINTR)
+			continue;
+		if (errno != EWOULDBLOCK)
+			fido_log_debug("%s: flock: %s", __func__,
+			    strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+fido_hid_lock(void *handle, bool wait)
+{
+	struct hid_linux	*ctx = handle;
+	int			 pos;
+	int			 ms = 1;
+
+	if (lock_queue_open(ctx) < 0)
+		return (lock_fd(ctx->fd, wait));
+
+	/* queued until fido_hid_unlock() */
+	while ((pos = lock_queue_update(ctx, true, false)) != 0) {
+		if (pos < 0) {
+			fido_log_debug("%s: queue unavailable", __func__);
+			return (lock_fd(ctx->fd, wait));
+		}
+		if (!wait)
+			return (-1);
+		if (fido_time_sleep_ms(ms) < 0)
+			return (-1);
+		if ((ms *= 2) > HID_LOCK_MAX_BACKOFF_MS)
+			ms = HID_LOCK_MAX_BACKOFF_MS;
+	}
+
+	return (lock_fd(ctx->fd, wait));
+}
+
+void
+fido_hid_unlock(void *handle)
+{
+	struct hid_linux *ctx = handle;
+
+	if (flock(ctx->fd, LOCK_UN) != 0)
+		fido_log_debug("%s: flock: %s", __func__, strerror(errno));
+
+	if (ctx->qfd != -1)
+		lock_queue_update(ctx, false, true);
+}
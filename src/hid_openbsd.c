@@ -6,6 +6,7 @@
 
 #include <sys/types.h>
 
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <dev/usb/usb.h>
 
@@ -75,12 +76,12 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 			fido_hid_read,
 			fido_hid_write,
 		};
-		if ((di->path = strdup(path)) == NULL ||
-		    (di->manufacturer = strdup(udi.udi_vendor)) == NULL ||
-		    (di->product = strdup(udi.udi_product)) == NULL) {
-			free(di->path);
-			free(di->manufacturer);
-			free(di->product);
+		if ((di->path = fido_strdup(path)) == NULL ||
+		    (di->manufacturer = fido_strdup(udi.udi_vendor)) == NULL ||
+		    (di->product = fido_strdup(udi.udi_product)) == NULL) {
+			fido_free(di->path);
+			fido_free(di->manufacturer);
+			fido_free(di->product);
 			explicit_bzero(di, sizeof(*di));
 			return FIDO_ERR_INTERNAL;
 		}
@@ -153,9 +154,9 @@ fido_hid_open(const char *path)
 {
 	struct hid_openbsd *ret = NULL;
 
-	if ((ret = calloc(1, sizeof(*ret))) == NULL ||
+	if ((ret = fido_calloc(1, sizeof(*ret))) == NULL ||
 	    (ret->fd = open(path, O_RDWR)) < 0) {
-		free(ret);
+		fido_free(ret);
 		return (NULL);
 	}
 	ret->report_in_len = ret->report_out_len = CTAP_MAX_REPORT_LEN;
@@ -181,7 +182,7 @@ fido_hid_close(void *handle)
 	struct hid_openbsd *ctx = (struct hid_openbsd *)handle;
 
 	close(ctx->fd);
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -238,3 +239,29 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_lock(void *handle, bool wait)
+{
+	struct hid_openbsd *ctx = handle;
+
+	while (flock(ctx->fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+		if (errno == EINTR)
+			continue;
+		if (errno != EWOULDBLOCK)
+			fido_log_debug("%s: flock: %s", __func__,
+			    strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+void
+fido_hid_unlock(void *handle)
+{
+	struct hid_openbsd *ctx = handle;
+
+	if (flock(ctx->fd, LOCK_UN) != 0)
+		fido_log_debug("%s: flock: %s", __func__, strerror(errno));
+}
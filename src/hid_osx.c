@@ -137,7 +137,7 @@ get_str(IOHIDDeviceRef dev, char **manufacturer, char **product)
 		goto fail;
 	}
 
-	if ((*manufacturer = strdup(buf)) == NULL) {
+	if ((*manufacturer = fido_strdup(buf)) == NULL) {
 		fido_log_debug("%s: strdup manufacturer", __func__);
 		goto fail;
 	}
@@ -147,7 +147,7 @@ get_str(IOHIDDeviceRef dev, char **manufacturer, char **product)
 		goto fail;
 	}
 
-	if ((*product = strdup(buf)) == NULL) {
+	if ((*product = fido_strdup(buf)) == NULL) {
 		fido_log_debug("%s: strdup product", __func__);
 		goto fail;
 	}
@@ -155,8 +155,8 @@ get_str(IOHIDDeviceRef dev, char **manufacturer, char **product)
 	ok = 0;
 fail:
 	if (ok < 0) {
-		free(*manufacturer);
-		free(*product);
+		fido_free(*manufacturer);
+		fido_free(*product);
 		*manufacturer = NULL;
 		*product = NULL;
 	}
@@ -180,7 +180,7 @@ get_path(IOHIDDeviceRef dev)
 		return (NULL);
 	}
 
-	return (strdup(path));
+	return (fido_strdup(path));
 }
 
 static bool
@@ -219,9 +219,9 @@ copy_info(fido_dev_info_t *di, IOHIDDeviceRef dev)
 	if (get_id(dev, &di->vendor_id, &di->product_id) < 0 ||
 	    get_str(dev, &di->manufacturer, &di->product) < 0 ||
 	    (di->path = get_path(dev)) == NULL) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 		return (-1);
 	}
@@ -267,7 +267,7 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 
 	devcnt = (size_t)n;
 
-	if ((devs = calloc(devcnt, sizeof(*devs))) == NULL) {
+	if ((devs = fido_calloc(devcnt, sizeof(*devs))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
@@ -294,7 +294,7 @@ fail:
 	if (devset != NULL)
 		CFRelease(devset);
 
-	free(devs);
+	fido_free(devs);
 
 	return (r);
 }
@@ -371,7 +371,7 @@ fido_hid_open(const char *path)
 	int			 ok = -1;
 	int			 r;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
@@ -457,7 +457,7 @@ fail:
 			close(ctx->report_pipe[0]);
 		if (ctx->report_pipe[1] != -1)
 			close(ctx->report_pipe[1]);
-		free(ctx);
+		fido_free(ctx);
 		ctx = NULL;
 	}
 
@@ -486,7 +486,7 @@ fido_hid_close(void *handle)
 	close(ctx->report_pipe[0]);
 	close(ctx->report_pipe[1]);
 
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -554,3 +554,18 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_lock(void *handle, bool wait)
+{
+	(void)handle;
+	(void)wait;
+
+	return (0); /* no arbitration */
+}
+
+void
+fido_hid_unlock(void *handle)
+{
+	(void)handle;
+}
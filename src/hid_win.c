@@ -142,7 +142,7 @@ get_str(HANDLE dev, char **manufacturer, char **product)
 		goto fail;
 	}
 
-	if ((*manufacturer = malloc((size_t)utf8_len)) == NULL) {
+	if ((*manufacturer = fido_malloc((size_t)utf8_len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -164,7 +164,7 @@ get_str(HANDLE dev, char **manufacturer, char **product)
 		goto fail;
 	}
 
-	if ((*product = malloc((size_t)utf8_len)) == NULL) {
+	if ((*product = fido_malloc((size_t)utf8_len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -178,8 +178,8 @@ get_str(HANDLE dev, char **manufacturer, char **product)
 	ok = 0;
 fail:
 	if (ok < 0) {
-		free(*manufacturer);
-		free(*product);
+		fido_free(*manufacturer);
+		fido_free(*product);
 		*manufacturer = NULL;
 		*product = NULL;
 	}
@@ -209,7 +209,7 @@ get_path(HDEVINFO devinfo, SP_DEVICE_INTERFACE_DATA *ifdata)
 		goto fail;
 	}
 
-	if ((ifdetail = malloc(len)) == NULL) {
+	if ((ifdetail = fido_malloc(len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -223,13 +223,13 @@ get_path(HDEVINFO devinfo, SP_DEVICE_INTERFACE_DATA *ifdata)
 		goto fail;
 	}
 
-	if ((path = strdup(ifdetail->DevicePath)) == NULL) {
+	if ((path = fido_strdup(ifdetail->DevicePath)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		goto fail;
 	}
 
 fail:
-	free(ifdetail);
+	fido_free(ifdetail);
 
 	return (path);
 }
@@ -259,7 +259,7 @@ hid_ok(HDEVINFO devinfo, DWORD idx)
 		goto fail;
 	}
 
-	if ((parent = malloc(len)) == NULL) {
+	if ((parent = fido_malloc(len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -273,7 +273,7 @@ hid_ok(HDEVINFO devinfo, DWORD idx)
 
 	ok = wcsncmp(parent, L"USB\\", 4) == 0;
 fail:
-	free(parent);
+	fido_free(parent);
 
 	return (ok);
 }
@@ -326,9 +326,9 @@ fail:
 		CloseHandle(dev);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -386,7 +386,7 @@ fido_hid_open(const char *path)
 {
 	struct hid_win *ctx;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
 		return (NULL);
 
 	ctx->dev = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
@@ -394,7 +394,7 @@ fido_hid_open(const char *path)
 	    FILE_FLAG_OVERLAPPED, NULL);
 
 	if (ctx->dev == INVALID_HANDLE_VALUE) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
@@ -430,7 +430,7 @@ fido_hid_close(void *handle)
 
 	explicit_bzero(ctx->report, sizeof(ctx->report));
 	CloseHandle(ctx->dev);
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -528,3 +528,18 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len - 1);
 }
+
+int
+fido_hid_lock(void *handle, bool wait)
+{
+	(void)handle;
+	(void)wait;
+
+	return (0); /* no arbitration */
+}
+
+void
+fido_hid_unlock(void *handle)
+{
+	(void)handle;
+}
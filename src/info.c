@@ -36,7 +36,7 @@ decode_versions(const cbor_item_t *item, fido_str_array_t *v)
 		return (-1);
 	}
 
-	v->ptr = calloc(cbor_array_size(item), sizeof(char *));
+	v->ptr = fido_calloc(cbor_array_size(item), sizeof(char *));
 	if (v->ptr == NULL)
 		return (-1);
 
@@ -77,7 +77,7 @@ decode_extensions(const cbor_item_t *item, fido_str_array_t *e)
 		return (-1);
 	}
 
-	e->ptr = calloc(cbor_array_size(item), sizeof(char *));
+	e->ptr = fido_calloc(cbor_array_size(item), sizeof(char *));
 	if (e->ptr == NULL)
 		return (-1);
 
@@ -142,8 +142,8 @@ decode_options(const cbor_item_t *item, fido_opt_array_t *o)
 		return (-1);
 	}
 
-	o->name = calloc(cbor_map_size(item), sizeof(char *));
-	o->value = calloc(cbor_map_size(item), sizeof(bool));
+	o->name = fido_calloc(cbor_map_size(item), sizeof(char *));
+	o->value = fido_calloc(cbor_map_size(item), sizeof(bool));
 	if (o->name == NULL || o->value == NULL)
 		return (-1);
 
@@ -181,7 +181,7 @@ decode_protocols(const cbor_item_t *item, fido_byte_array_t *p)
 		return (-1);
 	}
 
-	p->ptr = calloc(cbor_array_size(item), sizeof(uint8_t));
+	p->ptr = fido_calloc(cbor_array_size(item), sizeof(uint8_t));
 	if (p->ptr == NULL)
 		return (-1);
 
@@ -258,7 +258,7 @@ fido_dev_get_cbor_info_rx(fido_dev_t *dev, fido_cbor_info_t *ci, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	return (cbor_parse_reply(reply, (size_t)reply_len, ci,
@@ -290,16 +290,16 @@ fido_dev_get_cbor_info(fido_dev_t *dev, fido_cbor_info_t *ci)
 fido_cbor_info_t *
 fido_cbor_info_new(void)
 {
-	return (calloc(1, sizeof(fido_cbor_info_t)));
+	return (fido_calloc(1, sizeof(fido_cbor_info_t)));
 }
 
 static void
 free_str_array(fido_str_array_t *sa)
 {
 	for (size_t i = 0; i < sa->len; i++)
-		free(sa->ptr[i]);
+		fido_free(sa->ptr[i]);
 
-	free(sa->ptr);
+	fido_free(sa->ptr);
 	sa->ptr = NULL;
 	sa->len = 0;
 }
@@ -308,10 +308,10 @@ static void
 free_opt_array(fido_opt_array_t *oa)
 {
 	for (size_t i = 0; i < oa->len; i++)
-		free(oa->name[i]);
+		fido_free(oa->name[i]);
 
-	free(oa->name);
-	free(oa->value);
+	fido_free(oa->name);
+	fido_free(oa->value);
 	oa->name = NULL;
 	oa->value = NULL;
 }
@@ -319,7 +319,7 @@ free_opt_array(fido_opt_array_t *oa)
 static void
 free_byte_array(fido_byte_array_t *ba)
 {
-	free(ba->ptr);
+	fido_free(ba->ptr);
 
 	ba->ptr = NULL;
 	ba->len = 0;
@@ -337,7 +337,7 @@ fido_cbor_info_free(fido_cbor_info_t **ci_p)
 	free_str_array(&ci->extensions);
 	free_opt_array(&ci->options);
 	free_byte_array(&ci->protocols);
-	free(ci);
+	fido_free(ci);
 
 	*ci_p = NULL;
 }
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "fido.h"
@@ -33,21 +34,64 @@ struct frame {
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 #endif
 
+#ifndef TLS
+#define TLS
+#endif
+
+/* CTAPHID_ERROR codes, as per section 8.1.9.1.6 of the fido2 ctap spec */
+static int
+rx_error_code(uint8_t code)
+{
+	switch (code) {
+	case FIDO_ERR_INVALID_COMMAND:
+	case FIDO_ERR_INVALID_PARAMETER:
+	case FIDO_ERR_INVALID_LENGTH:
+	case FIDO_ERR_INVALID_SEQ:
+	case FIDO_ERR_TIMEOUT:
+	case FIDO_ERR_CHANNEL_BUSY:
+	case FIDO_ERR_LOCK_REQUIRED:
+	case FIDO_ERR_INVALID_CHANNEL:
+		return (code);
+	default:
+		return (FIDO_ERR_ERR_OTHER);
+	}
+}
+
+static int
+tx_report(fido_dev_t *d, const unsigned char *pkt, size_t len)
+{
+	const struct frame	*fp = (const struct frame *)(pkt + 1);
+	int			 n;
+
+	if ((n = d->io.write(d->io_handle, pkt, len)) < 0 || (size_t)n != len)
+		return (-1);
+
+	/*
+	 * CTAPHID_CANCEL may be sent by a thread other than the one using
+	 * 'd', which would race on the counters; it isn't counted.
+	 */
+	if (fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_CMD_CANCEL))
+		return (0);
+
+	d->stats.tx_reports++;
+	d->stats.tx_bytes += d->tx_len;
+
+	return (0);
+}
+
 static int
 tx_empty(fido_dev_t *d, uint8_t cmd)
 {
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
 	const size_t	 len = d->tx_len + 1;
-	int		 n;
 
 	memset(&pkt, 0, sizeof(pkt));
 	fp = (struct frame *)(pkt + 1);
 	fp->cid = d->cid;
 	fp->body.init.cmd = CTAP_FRAME_INIT | cmd;
 
-	if (len > sizeof(pkt) || (n = d->io.write(d->io_handle, pkt,
-	    len)) < 0 || (size_t)n != len)
+	if (len > sizeof(pkt) || tx_report(d, pkt, len) < 0)
 		return (-1);
 
 	return (0);
@@ -59,7 +103,6 @@ tx_preamble(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
 	const size_t	 len = d->tx_len + 1;
-	int		 n;
 
 	if (d->tx_len - CTAP_INIT_HEADER_LEN > sizeof(fp->body.init.data))
 		return (0);
@@ -73,8 +116,7 @@ tx_preamble(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 	count = MIN(count, d->tx_len - CTAP_INIT_HEADER_LEN);
 	memcpy(&fp->body.init.data, buf, count);
 
-	if (len > sizeof(pkt) || (n = d->io.write(d->io_handle, pkt,
-	    len)) < 0 || (size_t)n != len)
+	if (len > sizeof(pkt) || tx_report(d, pkt, len) < 0)
 		return (0);
 
 	return (count);
@@ -86,7 +128,6 @@ tx_frame(fido_dev_t *d, uint8_t seq, const void *buf, size_t count)
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
 	const size_t	 len = d->tx_len + 1;
-	int		 n;
 
 	if (d->tx_len - CTAP_CONT_HEADER_LEN > sizeof(fp->body.cont.data))
 		return (0);
@@ -98,8 +139,7 @@ tx_frame(fido_dev_t *d, uint8_t seq, const void *buf, size_t count)
 	count = MIN(count, d->tx_len - CTAP_CONT_HEADER_LEN);
 	memcpy(&fp->body.cont.data, buf, count);
 
-	if (len > sizeof(pkt) || (n = d->io.write(d->io_handle, pkt,
-	    len)) < 0 || (size_t)n != len)
+	if (len > sizeof(pkt) || tx_report(d, pkt, len) < 0)
 		return (0);
 
 	return (count);
@@ -129,13 +169,9 @@ tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
 	return (0);
 }
 
-int
-fido_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
+static int
+transport_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 {
-	fido_log_debug("%s: d=%p, cmd=0x%02x, buf=%p, count=%zu", __func__,
-	    (void *)d, cmd, (const void *)buf, count);
-	fido_log_xxd(buf, count);
-
 	if (d->transport.tx != NULL)
 		return (d->transport.tx(d, cmd, buf, count));
 	if (d->io_handle == NULL || d->io.write == NULL || count > UINT16_MAX) {
@@ -146,31 +182,386 @@ fido_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 	return (count == 0 ? tx_empty(d, cmd) : tx(d, cmd, buf, count));
 }
 
+void
+fido_tx_forget(fido_dev_t *d)
+{
+	fido_dev_retry_t *p = &d->retry;
+
+	if (p->msg.ptr != NULL) {
+		fido_freezero(p->msg.ptr, p->msg.len);
+	}
+
+	p->msg.ptr = NULL;
+	p->msg.len = 0;
+	p->pending = false;
+}
+
+/* keep a copy of the request, should it have to be retransmitted */
+static void
+tx_remember(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
+{
+	fido_dev_retry_t *p = &d->retry;
+
+	fido_tx_forget(d);
+
+	if (p->backoff_ms <= 0)
+		return;
+
+	if (count > 0 && fido_blob_set(&p->msg, buf, count) < 0)
+		return;
+
+	if (fido_time_now(&p->ts) < 0) {
+		fido_tx_forget(d);
+		return;
+	}
+
+	p->cmd = cmd;
+	p->next_ms = p->backoff_ms;
+	p->pending = true;
+}
+
+/*
+ * Serialise whole operations with other processes using the same
+ * device: take the (advisory) hid lock before sending a request, and
+ * keep it until fido_rx() returns or, if the request is part of a
+ * library call bracketed by fido_tx_hold() and fido_tx_release(), until
+ * the call completes. Without a deadline, we block; otherwise, we poll
+ * with a short, bounded backoff. Where the platform queues waiters (see
+ * hid_linux.c), a poller keeps its place in the queue between attempts,
+ * and gives it up on timeout.
+ */
+#define TX_LOCK_MAX_BACKOFF_MS	8
+
+static int
+tx_lock(fido_dev_t *d)
+{
+	struct timespec	ts_start;
+	int		elapsed_ms;
+	int		ms = 1;
+
+	if (d->arb == false || d->arb_held || d->io_own || d->mux != NULL)
+		return (0);
+
+	if (d->arb_ms < 0) {
+		if (fido_hid_lock(d->io_handle, true) < 0)
+			goto fail;
+		d->arb_held = true;
+		return (0);
+	}
+
+	if (fido_time_now(&ts_start) < 0)
+		return (-1);
+
+	while (fido_hid_lock(d->io_handle, false) < 0) {
+		if (fido_time_delta_ms(&ts_start, &elapsed_ms) < 0 ||
+		    elapsed_ms >= d->arb_ms) {
+			fido_log_debug("%s: timeout", __func__);
+			goto fail;
+		}
+		if (fido_time_sleep_ms(MIN(ms, d->arb_ms - elapsed_ms)) < 0)
+			goto fail;
+		ms = MIN(ms * 2, TX_LOCK_MAX_BACKOFF_MS);
+	}
+
+	d->arb_held = true;
+
+	return (0);
+fail:
+	/* leave the queue, if any */
+	fido_hid_unlock(d->io_handle);
+
+	return (-1);
+}
+
+void
+fido_tx_unlock(fido_dev_t *d)
+{
+	d->arb_depth = 0;
+	d->arb_touch = false;
+
+	if (d->broker != NULL && d->io_handle != NULL)
+		fido_broker_release(d->io_handle);
+
+	if (d->arb_held == false)
+		return;
+
+	if (d->io_handle != NULL)
+		fido_hid_unlock(d->io_handle);
+
+	d->arb_held = false;
+}
+
+/*
+ * A fido_dev_t may only be used by one thread at a time; see
+ * fido_dev_open(3). A transaction belongs to the thread that sent its
+ * request until fido_rx() returns, and a library call bracketed by
+ * fido_tx_hold() and fido_tx_release() belongs to the thread that
+ * started it until it completes: another thread sending or receiving in
+ * between would interleave frames on the wire, or requests with those of
+ * the call, and corrupt the state kept in 'd', so it is refused, and
+ * aborts the process in debug builds. A transaction handed off with
+ * fido_tx_handoff() may be completed by any thread, and a call passed on
+ * with fido_tx_pass() carried on by any thread. CTAPHID_CANCEL is exempt,
+ * as it is meant to be sent while another thread is waiting for a reply.
+ *
+ * Threads are told apart by the address of a thread-local variable; the
+ * low bits of 'd->owner' mark a transaction as handed off, or a call as
+ * passed on.
+ */
+#define DEV_HANDOFF	((uintptr_t)1)
+#define DEV_PASSED	((uintptr_t)2)
+#define DEV_FLAGS	(DEV_HANDOFF | DEV_PASSED)
+
+static TLS int dev_thread;
+
+/* take 'd' unless owned by another thread, without any of 'flags' set */
+static int
+dev_claim(fido_dev_t *d, uintptr_t flags, const char *who)
+{
+#ifdef __GNUC__
+	uintptr_t	self = (uintptr_t)&dev_thread;
+	uintptr_t	owner;
+
+	owner = __atomic_load_n(&d->owner, __ATOMIC_ACQUIRE);
+	do {
+		if (owner != 0 && (owner & ~DEV_FLAGS) != self &&
+		    (owner & flags) == 0) {
+			fido_log_debug("%s: dev=%p in use by another thread",
+			    who, (void *)d);
+#ifdef FIDO_ASSERT_OWNERSHIP
+			abort();
+#endif
+			return (-1);
+		}
+	} while (__atomic_compare_exchange_n(&d->owner, &owner, self, false,
+	    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) == false);
+#else
+	(void)d;
+	(void)flags;
+	(void)who;
+#endif
+
+	return (0);
+}
+
+static void
+dev_set_owner(fido_dev_t *d, uintptr_t flags)
+{
+#ifdef __GNUC__
+	uintptr_t owner = flags == 0 ? 0 : (uintptr_t)&dev_thread | flags;
+
+	__atomic_store_n(&d->owner, owner, __ATOMIC_RELEASE);
+#else
+	(void)d;
+	(void)flags;
+#endif
+}
+
+static int
+dev_enter(fido_dev_t *d, uint8_t cmd, bool rx, const char *who)
+{
+	if (cmd == CTAP_CMD_CANCEL)
+		return (0);
+
+	return (dev_claim(d, rx ? DEV_HANDOFF : 0, who));
+}
+
+static void
+dev_leave(fido_dev_t *d, uint8_t cmd)
+{
+	if (cmd == CTAP_CMD_CANCEL)
+		return;
+
+	if (d->arb_depth == 0)
+		dev_set_owner(d, 0);
+	else if (d->arb_touch)
+		dev_set_owner(d, DEV_HANDOFF); /* touch request still pending */
+	/* otherwise, the call under way keeps it */
+}
+
+/*
+ * Keep the hid lock, or a broker's device, across the transactions of
+ * a library call, e.g. between obtaining a pinToken and using it, or
+ * between authenticatorGetAssertion and authenticatorGetNextAssertion.
+ * The calling thread owns 'd' until the call completes; fails if another
+ * thread does. Calls nest; the lock is released by the outermost
+ * fido_tx_release().
+ */
+int
+fido_tx_hold(fido_dev_t *d)
+{
+	if (dev_claim(d, 0, __func__) < 0)
+		return (-1);
+
+	if (d->arb_touch) {
+		/* abandoned touch request; its hold becomes ours */
+		d->arb_touch = false;
+		return (0);
+	}
+
+	d->arb_depth++;
+
+	return (0);
+}
+
+void
+fido_tx_release(fido_dev_t *d)
+{
+	if (d->arb_depth > 0 && --d->arb_depth == 0) {
+		fido_tx_unlock(d);
+		dev_set_owner(d, 0);
+	}
+}
+
+/*
+ * The call held by the calling thread is carried on by another, e.g. a
+ * worker; the thread calling fido_tx_take() next takes it over.
+ */
+void
+fido_tx_pass(fido_dev_t *d)
+{
+	dev_set_owner(d, DEV_PASSED);
+}
+
+int
+fido_tx_take(fido_dev_t *d)
+{
+	return (dev_claim(d, DEV_PASSED, __func__));
+}
+
+/*
+ * The request sent by the calling thread is left pending on return from
+ * a public call, e.g. fido_dev_get_touch_begin(); let whichever thread
+ * calls next receive its reply.
+ */
+void
+fido_tx_handoff(fido_dev_t *d)
+{
+#ifdef __GNUC__
+	uintptr_t self = (uintptr_t)&dev_thread;
+
+	__atomic_compare_exchange_n(&d->owner, &self, self | DEV_HANDOFF,
+	    false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+#else
+	(void)d;
+#endif
+}
+
+int
+fido_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
+{
+	int r;
+
+	if (dev_enter(d, cmd, false, __func__) < 0)
+		return (-1);
+
+	fido_log_set_dev(d);
+	fido_log_debug("%s: d=%p, cmd=0x%02x, buf=%p, count=%zu", __func__,
+	    (void *)d, cmd, (const void *)buf, count);
+	fido_log_xxd(buf, count);
+
+	fido_stats_tx(d, cmd, buf, count);
+	fido_trace3(tx__start, d->cid, cmd, count);
+
+	if (cmd != CTAP_CMD_CANCEL) {
+		if (tx_lock(d) < 0) {
+			fido_log_debug("%s: tx_lock", __func__);
+			r = -1;
+			goto out;
+		}
+		tx_remember(d, cmd, buf, count);
+	}
+
+	if ((r = transport_tx(d, cmd, buf, count)) < 0 &&
+	    cmd != CTAP_CMD_CANCEL && d->arb_depth == 0)
+		fido_tx_unlock(d);
+out:
+	fido_trace3(tx__done, d->cid, cmd, r);
+	fido_log_set_dev(NULL);
+
+	/* on success, the transaction is ours until fido_rx() returns */
+	if (r < 0)
+		dev_leave(d, cmd);
+
+	return (r);
+}
+
 static int
 rx_frame(fido_dev_t *d, struct frame *fp, int ms)
 {
-	int n;
+	struct timespec	ts_start;
+	int		elapsed_ms;
+	int		n;
 
 	memset(fp, 0, sizeof(*fp));
 
-	if (d->rx_len > sizeof(*fp) || (n = d->io.read(d->io_handle,
-	    (unsigned char *)fp, d->rx_len, ms)) < 0 || (size_t)n != d->rx_len)
+	if (d->rx_len > sizeof(*fp) || (ms >= 0 &&
+	    fido_time_now(&ts_start) < 0))
 		return (-1);
 
+	if ((n = d->io.read(d->io_handle, (unsigned char *)fp, d->rx_len,
+	    ms)) < 0 || (size_t)n != d->rx_len) {
+		if (ms >= 0 && fido_time_delta_ms(&ts_start, &elapsed_ms) == 0 &&
+		    elapsed_ms >= ms)
+			d->stats.timeouts++;
+		return (-1);
+	}
+
+	d->stats.rx_reports++;
+	d->stats.rx_bytes += d->rx_len;
+
 	return (0);
 }
 
+static void
+rx_keepalive(fido_dev_t *d, const struct frame *fp,
+    const struct timespec *ts_start)
+{
+	int elapsed_ms;
+
+	if (d->keepalive == NULL)
+		return;
+
+	if (fido_time_delta_ms(ts_start, &elapsed_ms) < 0)
+		elapsed_ms = -1;
+
+	fido_log_debug("%s: status=0x%02x, elapsed_ms=%d", __func__,
+	    fp->body.init.data[0], elapsed_ms);
+
+	d->keepalive(d->keepalive_arg, fp->body.init.data[0], elapsed_ms);
+}
+
 static int
 rx_preamble(fido_dev_t *d, uint8_t cmd, struct frame *fp, int ms)
 {
-	do {
+	struct timespec ts_start;
+
+	memset(&ts_start, 0, sizeof(ts_start));
+
+	if (d->keepalive != NULL && fido_time_now(&ts_start) < 0)
+		return (-1);
+
+	for (;;) {
 		if (rx_frame(d, fp, ms) < 0)
 			return (-1);
 #ifdef FIDO_FUZZ
 		fp->cid = d->cid;
 #endif
-	} while (fp->cid == d->cid &&
-	    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_KEEPALIVE));
+		if (fp->cid != d->cid ||
+		    fp->body.init.cmd != (CTAP_FRAME_INIT | CTAP_KEEPALIVE))
+			break;
+		d->stats.keepalives++;
+		rx_keepalive(d, fp, &ts_start);
+	}
+
+	if (fp->cid == d->cid &&
+	    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_CMD_ERROR)) {
+		d->stats.errors++;
+		d->rx_err = rx_error_code(fp->body.init.data[0]);
+		fido_log_debug("%s: CTAPHID_ERROR 0x%02x", __func__,
+		    fp->body.init.data[0]);
+		return (-1);
+	}
 
 	if (d->rx_len > sizeof(*fp))
 		return (-1);
@@ -262,28 +653,121 @@ rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int ms)
 	return ((int)r);
 }
 
+static int
+transport_rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
+{
+	if (d->transport.rx != NULL)
+		return (d->transport.rx(d, cmd, buf, count, ms));
+	if (d->io_handle == NULL || d->io.read == NULL || count > UINT16_MAX) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (-1);
+	}
+
+	return (rx(d, cmd, buf, count, ms));
+}
+
+/* xorshift64; the jitter need not be unpredictable, merely uncorrelated */
+static int
+rx_jitter(fido_dev_retry_t *p, int ms)
+{
+	uint64_t x;
+
+	if (ms < 2)
+		return (ms);
+
+	if ((x = p->jitter) == 0)
+		x = (uint64_t)(uintptr_t)p ^ (uint64_t)p->ts.tv_nsec ^
+		    0x9e3779b97f4a7c15ULL;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	p->jitter = x;
+
+	/* somewhere in [ms/2, ms] */
+	return (ms / 2 + (int)(x % (uint64_t)(ms - ms / 2 + 1)));
+}
+
+/*
+ * The authenticator is busy with another channel. Wait a jittered,
+ * exponentially increasing amount of time and retransmit the pending
+ * request, unless doing so would exceed the retry deadline.
+ */
+static int
+rx_retry(fido_dev_t *d)
+{
+	fido_dev_retry_t	*p = &d->retry;
+	int			 elapsed_ms;
+	int			 ms;
+
+	if (d->rx_err != FIDO_ERR_CHANNEL_BUSY || p->pending == false)
+		return (-1);
+
+	if (fido_time_delta_ms(&p->ts, &elapsed_ms) < 0 ||
+	    elapsed_ms >= p->deadline_ms)
+		return (-1);
+
+	ms = MIN(rx_jitter(p, p->next_ms), p->deadline_ms - elapsed_ms);
+	p->next_ms = MIN(p->next_ms, p->max_backoff_ms / 2) * 2;
+
+	fido_log_debug("%s: busy, retrying in %d ms", __func__, ms);
+
+	if (fido_time_sleep_ms(ms) < 0 ||
+	    transport_tx(d, p->cmd, p->msg.ptr, p->msg.len) < 0) {
+		fido_log_debug("%s: retransmit", __func__);
+		return (-1);
+	}
+
+	d->stats.retries++;
+
+	return (0);
+}
+
 int
 fido_rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int ms)
 {
 	int n;
 
+	if (dev_enter(d, cmd, true, __func__) < 0)
+		return (-1);
+
+	fido_log_set_dev(d);
 	fido_log_debug("%s: d=%p, cmd=0x%02x, buf=%p, count=%zu, ms=%d",
 	    __func__, (void *)d, cmd, (const void *)buf, count, ms);
 
-	if (d->transport.rx != NULL)
-		return (d->transport.rx(d, cmd, buf, count, ms));
-	if (d->io_handle == NULL || d->io.read == NULL || count > UINT16_MAX) {
-		fido_log_debug("%s: invalid argument", __func__);
-		return (-1);
-	}
-	if ((n = rx(d, cmd, buf, count, ms)) >= 0) {
+	fido_trace4(rx__start, d->cid, cmd, count, ms);
+
+	do {
+		d->rx_err = 0;
+		n = transport_rx(d, cmd, buf, count, ms);
+	} while (n < 0 && rx_retry(d) == 0);
+
+	if (n >= 0) {
 		fido_log_debug("%s: buf=%p, len=%d", __func__, (void *)buf, n);
 		fido_log_xxd(buf, (size_t)n);
+		fido_stats_rx(d);
 	}
 
+	/* no longer retransmitted; don't keep the request around */
+	fido_tx_forget(d);
+
+	/* transaction complete, failed or timed out */
+	if (d->arb_depth == 0)
+		fido_tx_unlock(d);
+
+	fido_trace3(rx__done, d->cid, cmd, n);
+	fido_log_set_dev(NULL);
+	dev_leave(d, cmd);
+
 	return (n);
 }
 
+int
+fido_rx_error(const fido_dev_t *d)
+{
+	return (d->rx_err != 0 ? d->rx_err : FIDO_ERR_RX);
+}
+
 int
 fido_rx_cbor_status(fido_dev_t *d, int ms)
 {
@@ -293,7 +777,7 @@ fido_rx_cbor_status(fido_dev_t *d, int ms)
 	if ((reply_len = fido_rx(d, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0 || (size_t)reply_len < 1) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(d));
 	}
 
 	return (reply[0]);
@@ -15,7 +15,7 @@ iso7816_new(uint8_t ins, uint8_t p1, uint16_t payload_len)
 
 	alloc_len = sizeof(iso7816_apdu_t) + payload_len + 2; /* le1 le2 */
 
-	if ((apdu = calloc(1, alloc_len)) == NULL)
+	if ((apdu = fido_calloc(1, alloc_len)) == NULL)
 		return (NULL);
 
 	apdu->alloc_len = alloc_len;
@@ -37,8 +37,7 @@ iso7816_free(iso7816_apdu_t **apdu_p)
 	if (apdu_p == NULL || (apdu = *apdu_p) == NULL)
 		return;
 
-	explicit_bzero(apdu, apdu->alloc_len);
-	free(apdu);
+	fido_freezero(apdu, apdu->alloc_len);
 
 	*apdu_p = NULL;
 }
@@ -9,6 +9,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+#define LOG_ASYNC
+#include <pthread.h>
+#endif
+
 #include "fido.h"
 
 #ifndef FIDO_NO_DIAGNOSTIC
@@ -17,12 +22,38 @@
 #define XXDROW	128
 #define LINELEN	256
 
+struct fido_log_record {
+	int		 level;   /* FIDO_LOG_DEBUG or FIDO_LOG_XXD */
+	uint64_t	 time_us; /* monotonic timestamp, in microseconds */
+	uint64_t	 thread;  /* id of the emitting thread */
+	const void	*dev;     /* identity of the device, never dereferenced */
+	const char	*msg;     /* message, without trailing newline */
+};
+
 #ifndef TLS
 #define TLS
 #endif
 
-static TLS int logging;
-static TLS fido_log_handler_t *log_handler;
+#ifdef __GNUC__
+#define LOG_LOAD(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define LOG_STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#else
+#define LOG_LOAD(x)	(x)
+#define LOG_STORE(x, v)	((x) = (v))
+#endif
+
+/*
+ * Logging configuration is process-wide, so that fido_init() and the
+ * fido_set_log_*() calls made on one thread apply to all of them. The
+ * device and thread being logged are per-thread.
+ */
+static int logging;
+static int log_level;
+static fido_log_handler_t *log_handler;
+static fido_log_record_handler_t *log_record_handler;
+static TLS const fido_dev_t *log_dev;
+static TLS uint64_t log_thread;
+static uint64_t log_thread_seq;
 
 static void
 log_on_stderr(const char *str)
@@ -30,11 +61,236 @@ log_on_stderr(const char *str)
 	fprintf(stderr, "%s", str);
 }
 
+static uint64_t
+log_thread_id(void)
+{
+	if (log_thread == 0) {
+#ifdef __GNUC__
+		log_thread = __atomic_add_fetch(&log_thread_seq, 1,
+		    __ATOMIC_RELAXED);
+#else
+		log_thread = ++log_thread_seq;
+#endif
+	}
+
+	return (log_thread);
+}
+
+static uint64_t
+log_time_us(void)
+{
+	struct timespec ts;
+
+	/* not fido_time_now(), which logs its failures */
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0 || ts.tv_sec < 0 ||
+	    ts.tv_nsec < 0)
+		return (0);
+
+	return ((uint64_t)ts.tv_sec * 1000000ULL +
+	    (uint64_t)ts.tv_nsec / 1000ULL);
+}
+
+static void
+log_deliver(fido_log_handler_t *handler,
+    fido_log_record_handler_t *record_handler, const fido_log_record_t *rec)
+{
+	char line[LINELEN + 1];
+
+	if (record_handler != NULL) {
+		record_handler(rec);
+		return;
+	}
+
+	if (handler != NULL) {
+		snprintf(line, sizeof(line), "%s\n", rec->msg);
+		handler(line);
+	}
+}
+
+#ifdef LOG_ASYNC
+/*
+ * Bounded, lock-free multi-producer ring of log records, drained by a
+ * single background thread. Each slot carries a sequence number: a slot
+ * is free for the producer that claimed position 'pos' when seq == pos,
+ * and ready for the consumer when seq == pos + 1. Producers never block;
+ * if the ring is full, the record is dropped and accounted for. A
+ * producer is counted in 'users' while it may touch the ring; the
+ * background thread only exits, and the ring is only freed, once
+ * 'running' is clear and no producer is left. A record's device may be
+ * freed before the record is drained; only its address is kept.
+ */
+#define LOG_DRAIN_MS	10
+
+struct log_slot {
+	uint64_t	 seq;
+	int		 level;
+	uint64_t	 time_us;
+	uint64_t	 thread;
+	const void	*dev;
+	char		 msg[LINELEN];
+};
+
+static struct log_ring {
+	struct log_slot			*slot;
+	uint64_t			 mask;
+	uint64_t			 head;    /* next position to claim */
+	uint64_t			 tail;    /* next position to drain */
+	uint64_t			 dropped; /* records lost to a full ring */
+	uint64_t			 users;   /* producers in ring_put() */
+	int				 running;
+	pthread_t			 thread;
+	fido_log_handler_t		*handler;
+	fido_log_record_handler_t	*record_handler;
+} ring;
+
+static int
+ring_put(int level, const char *msg, uint64_t time_us, uint64_t thread,
+    const void *dev)
+{
+	struct log_slot	*s;
+	uint64_t	 pos;
+	uint64_t	 seq;
+
+	pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		s = &ring.slot[pos & ring.mask];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&ring.head, &pos,
+			    pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (seq < pos) {
+			__atomic_add_fetch(&ring.dropped, 1, __ATOMIC_RELAXED);
+			return (-1); /* full */
+		} else
+			pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+	}
+
+	s->level = level;
+	s->time_us = time_us;
+	s->thread = thread;
+	s->dev = dev;
+	strlcpy(s->msg, msg, sizeof(s->msg));
+
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return (0);
+}
+
+static int
+ring_get(void)
+{
+	struct log_slot		*s;
+	fido_log_record_t	 rec;
+
+	s = &ring.slot[ring.tail & ring.mask];
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != ring.tail + 1)
+		return (-1); /* empty */
+
+	rec.level = s->level;
+	rec.time_us = s->time_us;
+	rec.thread = s->thread;
+	rec.dev = s->dev;
+	rec.msg = s->msg;
+
+	log_deliver(ring.handler, ring.record_handler, &rec);
+
+	__atomic_store_n(&s->seq, ring.tail + ring.mask + 1, __ATOMIC_RELEASE);
+	ring.tail++;
+
+	return (0);
+}
+
+static void *
+ring_drain(void *arg)
+{
+	struct timespec	ts;
+	uint64_t	dropped;
+	char		msg[LINELEN];
+
+	(void)arg;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = LOG_DRAIN_MS * 1000000L;
+
+	for (;;) {
+		while (ring_get() == 0)
+			continue;
+		if ((dropped = __atomic_exchange_n(&ring.dropped, 0,
+		    __ATOMIC_RELAXED)) != 0) {
+			fido_log_record_t rec;
+			snprintf(msg, sizeof(msg), "%s: %llu records dropped",
+			    __func__, (unsigned long long)dropped);
+			rec.level = FIDO_LOG_DEBUG;
+			rec.time_us = log_time_us();
+			rec.thread = 0;
+			rec.dev = NULL;
+			rec.msg = msg;
+			log_deliver(ring.handler, ring.record_handler, &rec);
+		}
+		if (__atomic_load_n(&ring.running, __ATOMIC_SEQ_CST) == 0 &&
+		    __atomic_load_n(&ring.users, __ATOMIC_SEQ_CST) == 0) {
+			while (ring_get() == 0)
+				continue;
+			break;
+		}
+		nanosleep(&ts, NULL);
+	}
+
+	return (NULL);
+}
+#endif /* LOG_ASYNC */
+
+static void
+log_emit(int level, const char *msg)
+{
+	fido_log_record_t	rec;
+	uint64_t		time_us;
+
+	time_us = log_time_us();
+
+#ifdef LOG_ASYNC
+	__atomic_add_fetch(&ring.users, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring.running, __ATOMIC_SEQ_CST)) {
+		ring_put(level, msg, time_us, log_thread_id(), log_dev);
+		__atomic_sub_fetch(&ring.users, 1, __ATOMIC_RELEASE);
+		return;
+	}
+	__atomic_sub_fetch(&ring.users, 1, __ATOMIC_RELEASE);
+#endif
+
+	rec.level = level;
+	rec.time_us = time_us;
+	rec.thread = log_thread_id();
+	rec.dev = log_dev;
+	rec.msg = msg;
+
+	log_deliver(LOG_LOAD(log_handler), LOG_LOAD(log_record_handler), &rec);
+}
+
+static int
+log_enabled(int level)
+{
+	if (!LOG_LOAD(logging) || LOG_LOAD(log_level) < level)
+		return (0);
+
+	return (LOG_LOAD(log_handler) != NULL ||
+	    LOG_LOAD(log_record_handler) != NULL);
+}
+
 void
 fido_log_init(void)
 {
-	logging = 1;
-	log_handler = log_on_stderr;
+	LOG_STORE(log_level, FIDO_LOG_XXD);
+	LOG_STORE(log_handler, log_on_stderr);
+	LOG_STORE(logging, 1);
+}
+
+void
+fido_log_set_dev(const fido_dev_t *dev)
+{
+	log_dev = dev;
 }
 
 void
@@ -44,16 +300,16 @@ fido_log_debug(const char *fmt, ...)
 	va_list ap;
 	int r;
 
-	if (!logging || log_handler == NULL)
+	if (!log_enabled(FIDO_LOG_DEBUG))
 		return;
 
 	va_start(ap, fmt);
-	r = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+	r = vsnprintf(line, sizeof(line), fmt, ap);
 	va_end(ap);
-	if (r < 0 || (size_t)r >= sizeof(line) - 1)
+	if (r < 0 || (size_t)r >= sizeof(line))
 		return;
-	strlcat(line, "\n", sizeof(line));
-	log_handler(line);
+
+	log_emit(FIDO_LOG_DEBUG, line);
 }
 
 void
@@ -63,7 +319,7 @@ fido_log_xxd(const void *buf, size_t count)
 	char row[XXDROW];
 	char xxd[XXDLEN];
 
-	if (!logging || log_handler == NULL || count == 0)
+	if (count == 0 || !log_enabled(FIDO_LOG_XXD))
 		return;
 
 	*row = '\0';
@@ -76,7 +332,7 @@ fido_log_xxd(const void *buf, size_t count)
 			snprintf(xxd, sizeof(xxd), " %02x", *ptr++);
 		strlcat(row, xxd, sizeof(row));
 		if (i % 16 == 15 || i == count - 1) {
-			fido_log_debug("%s", row);
+			log_emit(FIDO_LOG_XXD, row);
 			*row = '\0';
 		}
 	}
@@ -86,7 +342,115 @@ void
 fido_set_log_handler(fido_log_handler_t *handler)
 {
 	if (handler != NULL)
-		log_handler = handler;
+		LOG_STORE(log_handler, handler);
+}
+
+void
+fido_set_log_record_handler(fido_log_record_handler_t *handler)
+{
+	LOG_STORE(log_record_handler, handler);
+}
+
+void
+fido_set_log_level(int level)
+{
+	LOG_STORE(log_level, level);
+}
+
+int
+fido_log_record_level(const fido_log_record_t *rec)
+{
+	return (rec->level);
+}
+
+uint64_t
+fido_log_record_time_us(const fido_log_record_t *rec)
+{
+	return (rec->time_us);
+}
+
+uint64_t
+fido_log_record_thread(const fido_log_record_t *rec)
+{
+	return (rec->thread);
+}
+
+const void *
+fido_log_record_dev(const fido_log_record_t *rec)
+{
+	return (rec->dev);
+}
+
+const char *
+fido_log_record_msg(const fido_log_record_t *rec)
+{
+	return (rec->msg);
+}
+
+int
+fido_log_async_start(size_t nrecords)
+{
+#ifdef LOG_ASYNC
+	size_t n;
+
+	if (__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE) ||
+	    ring.slot != NULL) {
+		fido_log_debug("%s: already running", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/* round up to a power of two */
+	for (n = 1; n < nrecords; n <<= 1)
+		if (n > SIZE_MAX / 2 / sizeof(*ring.slot))
+			return (FIDO_ERR_INVALID_ARGUMENT);
+	if (n < 2)
+		n = 2;
+
+	if ((ring.slot = fido_calloc(n, sizeof(*ring.slot))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < n; i++)
+		ring.slot[i].seq = i;
+
+	ring.mask = n - 1;
+	ring.head = 0;
+	ring.tail = 0;
+	ring.dropped = 0;
+	ring.handler = LOG_LOAD(log_handler);
+	ring.record_handler = LOG_LOAD(log_record_handler);
+
+	__atomic_store_n(&ring.running, 1, __ATOMIC_RELEASE);
+
+	if (pthread_create(&ring.thread, NULL, ring_drain, NULL) != 0) {
+		__atomic_store_n(&ring.running, 0, __ATOMIC_RELEASE);
+		fido_free(ring.slot);
+		ring.slot = NULL;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+#else
+	(void)nrecords;
+
+	return (FIDO_ERR_INTERNAL);
+#endif
+}
+
+void
+fido_log_async_stop(void)
+{
+#ifdef LOG_ASYNC
+	if (ring.slot == NULL)
+		return;
+
+	/* the drain thread outlives producers still in ring_put() */
+	__atomic_store_n(&ring.running, 0, __ATOMIC_SEQ_CST);
+	pthread_join(ring.thread, NULL);
+
+	/* 'users' is left alone; it may be in use by a late producer */
+	fido_free(ring.slot);
+	ring.slot = NULL;
+#endif
 }
 
 #endif /* !FIDO_NO_DIAGNOSTIC */
@@ -0,0 +1,719 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <string.h>
+#include "fido.h"
+
+/*
+ * Flat, versioned representation of fido_assert_t and fido_cred_t, meant
+ * to be handed between processes. A 12-byte header (magic, version, three
+ * reserved bytes, and the big-endian length of the payload) is followed
+ * by the payload: big-endian 32-bit integers, and byte strings prefixed
+ * by their 32-bit length, with MARSHAL_NULL standing for a NULL string.
+ * Authenticator data is carried both raw and decoded; the decoded copy
+ * is checked against the fixed-offset fields of the raw one, and the
+ * attested credential key of a credential is decoded again. Extension
+ * outputs, which verification compares against the extensions asked
+ * for, are not carried at all: they are decoded from the raw copy on
+ * import. Decrypted hmac-secrets are not carried. The layout does not
+ * depend on the host.
+ */
+
+#define MARSHAL_VERSION		1
+#define MARSHAL_HDR_LEN		12
+#define MARSHAL_NULL		UINT32_MAX
+#define MARSHAL_MIN_STMT_LEN	(7 * 4 + 32 + 1 + 4)
+
+static const unsigned char assert_magic[4] = { 'F', 'I', 'D', 'A' };
+static const unsigned char cred_magic[4] = { 'F', 'I', 'D', 'C' };
+
+struct marshal {
+	unsigned char	*ptr; /* NULL: only measure */
+	size_t		 len;
+	size_t		 off;
+	int		 err;
+};
+
+struct unmarshal {
+	const unsigned char	*ptr;
+	size_t			 len;
+};
+
+static void
+put(struct marshal *m, const void *data, size_t n)
+{
+	if (m->err || n > SIZE_MAX - m->off) {
+		m->err = 1;
+		return;
+	}
+
+	if (m->ptr != NULL) {
+		if (m->off + n > m->len) {
+			m->err = 1;
+			return;
+		}
+		if (n > 0)
+			memcpy(m->ptr + m->off, data, n);
+	}
+
+	m->off += n;
+}
+
+static void
+put_u8(struct marshal *m, uint8_t v)
+{
+	put(m, &v, sizeof(v));
+}
+
+static void
+put_u32(struct marshal *m, uint32_t v)
+{
+	unsigned char b[4];
+
+	b[0] = (unsigned char)(v >> 24);
+	b[1] = (unsigned char)(v >> 16);
+	b[2] = (unsigned char)(v >> 8);
+	b[3] = (unsigned char)v;
+
+	put(m, b, sizeof(b));
+}
+
+static void
+put_int(struct marshal *m, int v)
+{
+	put_u32(m, (uint32_t)v);
+}
+
+static void
+put_bytes(struct marshal *m, const void *ptr, size_t len)
+{
+	if (len >= MARSHAL_NULL) {
+		m->err = 1;
+		return;
+	}
+
+	put_u32(m, (uint32_t)len);
+	put(m, ptr, len);
+}
+
+static void
+put_blob(struct marshal *m, const fido_blob_t *b)
+{
+	put_bytes(m, b->ptr, b->len);
+}
+
+static void
+put_str(struct marshal *m, const char *s)
+{
+	if (s == NULL)
+		put_u32(m, MARSHAL_NULL);
+	else
+		put_bytes(m, s, strlen(s));
+}
+
+static void
+put_authdata(struct marshal *m, const fido_authdata_t *ad)
+{
+	put(m, ad->rp_id_hash, sizeof(ad->rp_id_hash));
+	put_u8(m, ad->flags);
+	put_u32(m, ad->sigcount);
+}
+
+static void
+put_user(struct marshal *m, const fido_user_t *u)
+{
+	put_blob(m, &u->id);
+	put_str(m, u->icon);
+	put_str(m, u->name);
+	put_str(m, u->display_name);
+}
+
+static int
+get(struct unmarshal *u, void *dst, size_t n)
+{
+	return (fido_buf_read(&u->ptr, &u->len, dst, n));
+}
+
+static int
+get_u8(struct unmarshal *u, uint8_t *v)
+{
+	return (get(u, v, sizeof(*v)));
+}
+
+static int
+get_u32(struct unmarshal *u, uint32_t *v)
+{
+	unsigned char b[4];
+
+	if (get(u, b, sizeof(b)) < 0)
+		return (-1);
+
+	*v = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 |
+	    (uint32_t)b[2] << 8 | (uint32_t)b[3];
+
+	return (0);
+}
+
+static int
+get_int(struct unmarshal *u, int *v)
+{
+	uint32_t x;
+
+	if (get_u32(u, &x) < 0)
+		return (-1);
+
+	*v = (int)(int32_t)x;
+
+	return (0);
+}
+
+static int
+get_len(struct unmarshal *u, size_t *len)
+{
+	uint32_t x;
+
+	if (get_u32(u, &x) < 0 || x == MARSHAL_NULL || x > u->len)
+		return (-1);
+
+	*len = x;
+
+	return (0);
+}
+
+static int
+get_blob(struct unmarshal *u, fido_blob_t *b)
+{
+	size_t len;
+
+	if (get_len(u, &len) < 0)
+		return (-1);
+
+	if (len > 0 && fido_blob_set(b, u->ptr, len) < 0)
+		return (-1);
+
+	u->ptr += len;
+	u->len -= len;
+
+	return (0);
+}
+
+static int
+get_str(struct unmarshal *u, char **s)
+{
+	uint32_t x;
+
+	if (get_u32(u, &x) < 0)
+		return (-1);
+
+	if (x == MARSHAL_NULL)
+		return (0);
+
+	if (x > u->len || memchr(u->ptr, '\0', x) != NULL ||
+	    (*s = fido_calloc(1, (size_t)x + 1)) == NULL)
+		return (-1);
+
+	memcpy(*s, u->ptr, x);
+	u->ptr += x;
+	u->len -= x;
+
+	return (0);
+}
+
+static int
+get_opt(struct unmarshal *u, fido_opt_t *opt)
+{
+	uint32_t x;
+
+	if (get_u32(u, &x) < 0 || (x != FIDO_OPT_OMIT && x != FIDO_OPT_FALSE &&
+	    x != FIDO_OPT_TRUE))
+		return (-1);
+
+	*opt = (fido_opt_t)x;
+
+	return (0);
+}
+
+static int
+get_authdata(struct unmarshal *u, fido_authdata_t *ad)
+{
+	uint32_t sigcount;
+
+	if (get(u, ad->rp_id_hash, sizeof(ad->rp_id_hash)) < 0 ||
+	    get_u8(u, &ad->flags) < 0 || get_u32(u, &sigcount) < 0)
+		return (-1);
+
+	ad->sigcount = sigcount;
+
+	return (0);
+}
+
+static int
+get_user(struct unmarshal *u, fido_user_t *user)
+{
+	if (get_blob(u, &user->id) < 0 || get_str(u, &user->icon) < 0 ||
+	    get_str(u, &user->name) < 0 || get_str(u, &user->display_name) < 0)
+		return (-1);
+
+	return (0);
+}
+
+static bool
+is_zero(const void *ptr, size_t len)
+{
+	const unsigned char *p = ptr;
+
+	for (size_t i = 0; i < len; i++)
+		if (p[i] != 0)
+			return (false);
+
+	return (true);
+}
+
+/*
+ * Point 'ptr' at the authenticator data wrapped by 'cbor', a definite
+ * CBOR byte string, and check its fixed-offset fields against 'ad'.
+ */
+static int
+check_authdata(const fido_blob_t *cbor, const fido_authdata_t *ad,
+    const unsigned char **ptr, size_t *len)
+{
+	fido_authdata_t	raw;
+	uint64_t	n = 0;
+	size_t		k;
+	uint8_t		b;
+
+	*ptr = cbor->ptr;
+	*len = cbor->len;
+
+	/* major type 2, length in the initial byte or up to 8 more */
+	if (fido_buf_read(ptr, len, &b, sizeof(b)) < 0 || (b & 0xe0) != 0x40)
+		return (-1);
+	if ((b & 0x1f) < 24)
+		n = b & 0x1f;
+	else if ((b & 0x1f) <= 27) {
+		k = (size_t)1 << ((b & 0x1f) - 24);
+		while (k-- > 0) {
+			if (fido_buf_read(ptr, len, &b, sizeof(b)) < 0)
+				return (-1);
+			n = n << 8 | b;
+		}
+	} else
+		return (-1);
+
+	if (n != *len || fido_buf_read(ptr, len, &raw, sizeof(raw)) < 0)
+		return (-1);
+
+	if (memcmp(raw.rp_id_hash, ad->rp_id_hash,
+	    sizeof(raw.rp_id_hash)) != 0 || raw.flags != ad->flags ||
+	    be32toh(raw.sigcount) != ad->sigcount)
+		return (-1);
+
+	return (0);
+}
+
+/* check the attested credential data that follows 'ptr' against 'ac' */
+static int
+check_attcred(const unsigned char *ptr, size_t len, const fido_attcred_t *ac)
+{
+	cbor_item_t		*item = NULL;
+	struct cbor_load_result	 cbor;
+	fido_attcred_t		 raw;
+	uint16_t		 id_len;
+	int			 ok = -1;
+
+	memset(&raw, 0, sizeof(raw));
+
+	if (fido_buf_read(&ptr, &len, raw.aaguid, sizeof(raw.aaguid)) < 0 ||
+	    fido_buf_read(&ptr, &len, &id_len, sizeof(id_len)) < 0 ||
+	    memcmp(raw.aaguid, ac->aaguid, sizeof(raw.aaguid)) != 0 ||
+	    (size_t)be16toh(id_len) != ac->id.len || ac->id.len > len ||
+	    (ac->id.len > 0 && memcmp(ptr, ac->id.ptr, ac->id.len) != 0))
+		return (-1);
+
+	ptr += ac->id.len;
+	len -= ac->id.len;
+
+	if ((item = cbor_load(ptr, len, &cbor)) == NULL) {
+		fido_log_debug("%s: cbor_load", __func__);
+		goto fail;
+	}
+
+	if (cbor_decode_pubkey(item, &raw.type, &raw.pubkey) < 0 ||
+	    raw.type != ac->type ||
+	    memcmp(&raw.pubkey, &ac->pubkey, sizeof(raw.pubkey)) != 0) {
+		fido_log_debug("%s: pubkey", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	explicit_bzero(&raw, sizeof(raw));
+
+	return (ok);
+}
+
+/* decode the extension outputs of the raw authenticator data 'cbor' */
+static int
+assert_authdata_ext(const fido_blob_t *cbor, int *ext)
+{
+	cbor_item_t		*item = NULL;
+	struct cbor_load_result	 cl;
+	fido_blob_t		 raw;
+	fido_blob_t		 hmac;
+	fido_authdata_t		 ad;
+	int			 ok = -1;
+
+	memset(&raw, 0, sizeof(raw));
+	memset(&hmac, 0, sizeof(hmac));
+
+	if ((item = cbor_load(cbor->ptr, cbor->len, &cl)) == NULL ||
+	    cl.read != cbor->len ||
+	    cbor_decode_assert_authdata(item, &raw, &ad, ext, &hmac) < 0) {
+		fido_log_debug("%s: cbor_decode_assert_authdata", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	fido_free(raw.ptr);
+	fido_freezero(hmac.ptr, hmac.len);
+
+	return (ok);
+}
+
+static int
+cred_authdata_ext(const fido_blob_t *cbor, int cose_alg, fido_cred_ext_t *ext)
+{
+	cbor_item_t		*item = NULL;
+	struct cbor_load_result	 cl;
+	fido_blob_t		 raw;
+	fido_authdata_t		 ad;
+	fido_attcred_t		 ac;
+	int			 ok = -1;
+
+	memset(&raw, 0, sizeof(raw));
+	memset(&ac, 0, sizeof(ac));
+	memset(ext, 0, sizeof(*ext));
+
+	if ((item = cbor_load(cbor->ptr, cbor->len, &cl)) == NULL ||
+	    cl.read != cbor->len ||
+	    cbor_decode_cred_authdata(item, cose_alg, &raw, &ad, &ac,
+	    ext) < 0) {
+		fido_log_debug("%s: cbor_decode_cred_authdata", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	fido_free(raw.ptr);
+	fido_free(ac.id.ptr);
+
+	return (ok);
+}
+
+static int
+marshal_finish(const unsigned char magic[4], unsigned char *buf,
+    size_t buflen, size_t *outlen, void (*payload)(struct marshal *,
+    const void *), const void *obj)
+{
+	struct marshal m;
+
+	/* measure */
+	memset(&m, 0, sizeof(m));
+	payload(&m, obj);
+	if (m.err || m.off > UINT32_MAX || m.off > SIZE_MAX - MARSHAL_HDR_LEN) {
+		fido_log_debug("%s: payload", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	*outlen = MARSHAL_HDR_LEN + m.off;
+
+	if (buf == NULL)
+		return (FIDO_OK);
+	if (buflen < *outlen) {
+		fido_log_debug("%s: buflen=%zu, outlen=%zu", __func__, buflen,
+		    *outlen);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	memcpy(buf, magic, 4);
+	buf[4] = MARSHAL_VERSION;
+	memset(buf + 5, 0, 3);
+	buf[8] = (unsigned char)(m.off >> 24);
+	buf[9] = (unsigned char)(m.off >> 16);
+	buf[10] = (unsigned char)(m.off >> 8);
+	buf[11] = (unsigned char)m.off;
+
+	/* write */
+	memset(&m, 0, sizeof(m));
+	m.ptr = buf + MARSHAL_HDR_LEN;
+	m.len = *outlen - MARSHAL_HDR_LEN;
+	payload(&m, obj);
+	if (m.err || m.off != m.len) {
+		fido_log_debug("%s: write", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+unmarshal_start(const unsigned char magic[4], const unsigned char *buf,
+    size_t len, struct unmarshal *u)
+{
+	uint32_t payload_len;
+
+	if (buf == NULL || len < MARSHAL_HDR_LEN ||
+	    memcmp(buf, magic, 4) != 0 || buf[4] != MARSHAL_VERSION) {
+		fido_log_debug("%s: header", __func__);
+		return (-1);
+	}
+
+	u->ptr = buf + 8;
+	u->len = 4;
+	if (get_u32(u, &payload_len) < 0 ||
+	    payload_len != len - MARSHAL_HDR_LEN) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (-1);
+	}
+
+	u->ptr = buf + MARSHAL_HDR_LEN;
+	u->len = payload_len;
+
+	return (0);
+}
+
+static void
+assert_payload(struct marshal *m, const void *obj)
+{
+	const fido_assert_t	*assert = obj;
+	const fido_assert_stmt	*stmt;
+
+	put_str(m, assert->rp_id);
+	put_blob(m, &assert->cdh);
+	put_int(m, assert->up);
+	put_int(m, assert->uv);
+	put_int(m, assert->ext);
+
+	if (assert->stmt_len > UINT32_MAX) {
+		m->err = 1;
+		return;
+	}
+
+	put_u32(m, (uint32_t)assert->stmt_len);
+
+	for (size_t i = 0; i < assert->stmt_len; i++) {
+		stmt = &assert->stmt[i];
+		put_blob(m, &stmt->id);
+		put_user(m, &stmt->user);
+		put_blob(m, &stmt->authdata_cbor);
+		put_authdata(m, &stmt->authdata);
+		put_blob(m, &stmt->sig);
+	}
+}
+
+int
+fido_assert_export(const fido_assert_t *assert, unsigned char *buf,
+    size_t buflen, size_t *outlen)
+{
+	if (outlen == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (marshal_finish(assert_magic, buf, buflen, outlen,
+	    assert_payload, assert));
+}
+
+int
+fido_assert_import(fido_assert_t *assert, const unsigned char *buf,
+    size_t len)
+{
+	struct unmarshal	 u;
+	fido_assert_stmt	*stmt;
+	const unsigned char	*ad;
+	size_t			 ad_len;
+	uint32_t		 n;
+	int			 ext;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	fido_assert_reset_tx(assert);
+	fido_assert_reset_rx(assert);
+
+	if (unmarshal_start(assert_magic, buf, len, &u) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (get_str(&u, &assert->rp_id) < 0 ||
+	    get_blob(&u, &assert->cdh) < 0 ||
+	    get_opt(&u, &assert->up) < 0 ||
+	    get_opt(&u, &assert->uv) < 0 ||
+	    get_int(&u, &ext) < 0 ||
+	    get_u32(&u, &n) < 0 ||
+	    n > u.len / MARSHAL_MIN_STMT_LEN) {
+		fido_log_debug("%s: assert", __func__);
+		goto fail;
+	}
+
+	assert->ext = ext;
+
+	if (n > 0 && fido_assert_set_count(assert, n) != FIDO_OK) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		stmt = &assert->stmt[i];
+		if (get_blob(&u, &stmt->id) < 0 ||
+		    get_user(&u, &stmt->user) < 0 ||
+		    get_blob(&u, &stmt->authdata_cbor) < 0 ||
+		    get_authdata(&u, &stmt->authdata) < 0 ||
+		    get_blob(&u, &stmt->sig) < 0) {
+			fido_log_debug("%s: stmt %zu", __func__, i);
+			goto fail;
+		}
+		/* the decoded authenticator data must match the raw one */
+		if (stmt->authdata_cbor.len == 0 ?
+		    !is_zero(&stmt->authdata, sizeof(stmt->authdata)) :
+		    check_authdata(&stmt->authdata_cbor, &stmt->authdata, &ad,
+		    &ad_len) < 0 || assert_authdata_ext(&stmt->authdata_cbor,
+		    &stmt->authdata_ext) < 0) {
+			fido_log_debug("%s: stmt %zu authdata", __func__, i);
+			goto fail;
+		}
+	}
+
+	if (u.len != 0) {
+		fido_log_debug("%s: %zu trailing bytes", __func__, u.len);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK) {
+		fido_assert_reset_tx(assert);
+		fido_assert_reset_rx(assert);
+	}
+
+	return (r);
+}
+
+static void
+cred_payload(struct marshal *m, const void *obj)
+{
+	const fido_cred_t *cred = obj;
+
+	put_blob(m, &cred->cdh);
+	put_str(m, cred->rp.id);
+	put_str(m, cred->rp.name);
+	put_user(m, &cred->user);
+	put_int(m, cred->rk);
+	put_int(m, cred->uv);
+	put_int(m, cred->ext.mask);
+	put_int(m, cred->ext.prot);
+	put_int(m, cred->type);
+	put_str(m, cred->fmt);
+	put_blob(m, &cred->authdata_cbor);
+	put_authdata(m, &cred->authdata);
+	put(m, cred->attcred.aaguid, sizeof(cred->attcred.aaguid));
+	put_blob(m, &cred->attcred.id);
+	put_int(m, cred->attcred.type);
+	put_bytes(m, &cred->attcred.pubkey, sizeof(cred->attcred.pubkey));
+	put_blob(m, &cred->attstmt.x5c);
+	put_blob(m, &cred->attstmt.sig);
+}
+
+int
+fido_cred_export(const fido_cred_t *cred, unsigned char *buf, size_t buflen,
+    size_t *outlen)
+{
+	if (outlen == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (marshal_finish(cred_magic, buf, buflen, outlen, cred_payload,
+	    cred));
+}
+
+int
+fido_cred_import(fido_cred_t *cred, const unsigned char *buf, size_t len)
+{
+	struct unmarshal	 u;
+	const unsigned char	*ad;
+	size_t			 ad_len;
+	size_t			 pk_len;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	fido_cred_reset_tx(cred);
+	fido_cred_reset_rx(cred);
+
+	if (unmarshal_start(cred_magic, buf, len, &u) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (get_blob(&u, &cred->cdh) < 0 ||
+	    get_str(&u, &cred->rp.id) < 0 ||
+	    get_str(&u, &cred->rp.name) < 0 ||
+	    get_user(&u, &cred->user) < 0 ||
+	    get_opt(&u, &cred->rk) < 0 ||
+	    get_opt(&u, &cred->uv) < 0 ||
+	    get_int(&u, &cred->ext.mask) < 0 ||
+	    get_int(&u, &cred->ext.prot) < 0 ||
+	    get_int(&u, &cred->type) < 0 ||
+	    get_str(&u, &cred->fmt) < 0 ||
+	    get_blob(&u, &cred->authdata_cbor) < 0 ||
+	    get_authdata(&u, &cred->authdata) < 0 ||
+	    get(&u, cred->attcred.aaguid, sizeof(cred->attcred.aaguid)) < 0 ||
+	    get_blob(&u, &cred->attcred.id) < 0 ||
+	    get_int(&u, &cred->attcred.type) < 0 ||
+	    get_len(&u, &pk_len) < 0 ||
+	    pk_len != sizeof(cred->attcred.pubkey) ||
+	    get(&u, &cred->attcred.pubkey, pk_len) < 0 ||
+	    get_blob(&u, &cred->attstmt.x5c) < 0 ||
+	    get_blob(&u, &cred->attstmt.sig) < 0) {
+		fido_log_debug("%s: cred", __func__);
+		goto fail;
+	}
+
+	/* the decoded authenticator data must match the raw one */
+	if (cred->authdata_cbor.len == 0) {
+		if (!is_zero(&cred->authdata, sizeof(cred->authdata)) ||
+		    !is_zero(&cred->attcred.aaguid,
+		    sizeof(cred->attcred.aaguid)) ||
+		    !is_zero(&cred->attcred.pubkey,
+		    sizeof(cred->attcred.pubkey)) ||
+		    cred->attcred.id.len != 0 || cred->attcred.type != 0) {
+			fido_log_debug("%s: no authdata", __func__);
+			goto fail;
+		}
+	} else if (check_authdata(&cred->authdata_cbor, &cred->authdata, &ad,
+	    &ad_len) < 0 ||
+	    (cred->authdata.flags & CTAP_AUTHDATA_ATT_CRED) == 0 ||
+	    check_attcred(ad, ad_len, &cred->attcred) < 0 ||
+	    cred_authdata_ext(&cred->authdata_cbor, cred->attcred.type,
+	    &cred->authdata_ext) < 0) {
+		fido_log_debug("%s: authdata", __func__);
+		goto fail;
+	}
+
+	if (u.len != 0) {
+		fido_log_debug("%s: %zu trailing bytes", __func__, u.len);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK) {
+		fido_cred_reset_tx(cred);
+		fido_cred_reset_rx(cred);
+	}
+
+	return (r);
+}
@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+
+/*
+ * A fido_dev_mux_t owns a single HID handle and shares it between any
+ * number of fido_dev_t sessions, each of which talks on its own CTAPHID
+ * channel. Sessions see the mux through ordinary fido_dev_io_t read and
+ * write functions: writes are passed through to the device, and reads
+ * are served from a per-session queue of reports, fed by whichever
+ * session happens to be reading from the device at the time.
+ *
+ * Since an authenticator processes one transaction at a time, a session
+ * must own the device to send a request; sessions waiting for it queue up
+ * and are served in order. Ownership passes to the next session once the
+ * full reply has been received on the owner's channel, reading it has
+ * failed or timed out, or the owner is closed. A session that waits for
+ * longer than MUX_WAIT_MS leaves the queue and fails its request.
+ *
+ * A mux freed with sessions still attached leaves them orphaned: their
+ * 'mux' is cleared, requests on them fail, and closing them only frees
+ * the session.
+ */
+
+#define MUX_MAXQUEUE	256	/* reports queued per session */
+#define MUX_WAIT_MS	60000	/* wait for ownership of the device */
+
+struct mux_report {
+	struct mux_report	*next;
+	size_t			 len;
+	unsigned char		 data[CTAP_MAX_REPORT_LEN];
+};
+
+struct mux_session {
+	struct mux_session	*next;
+	struct fido_dev_mux	*mux;
+	uint32_t		 cid;          /* channel in use */
+	uint64_t		 nonce;        /* CTAPHID_INIT nonce */
+	bool			 init_pending; /* awaiting CTAPHID_INIT reply */
+	struct mux_report	*head;         /* queued reports */
+	struct mux_report	*tail;
+	size_t			 qlen;
+	size_t			 rx_left;      /* reply bytes yet to arrive */
+	struct mux_session	*wnext;        /* next session waiting */
+};
+
+struct fido_dev_mux {
+	void			*io_handle; /* shared i/o handle */
+	fido_dev_io_t		 io;        /* i/o functions */
+	bool			 io_own;    /* mux has own io functions */
+	size_t			 rx_len;    /* length of HID input reports */
+	size_t			 tx_len;    /* length of HID output reports */
+	struct mux_session	*session;   /* attached sessions */
+	size_t			 nsessions;
+	struct mux_session	*owner;     /* session with a transaction */
+	struct mux_session	*waitq;     /* sessions waiting, in order */
+	bool			 reading;   /* a session is reading */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 cond;
+#endif
+};
+
+static void
+mux_lock(fido_dev_mux_t *mux)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&mux->lock);
+#else
+	(void)mux;
+#endif
+}
+
+static void
+mux_unlock(fido_dev_mux_t *mux)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&mux->lock);
+#else
+	(void)mux;
+#endif
+}
+
+static void
+mux_wakeup(fido_dev_mux_t *mux)
+{
+#ifdef HAVE_PTHREAD
+	pthread_cond_broadcast(&mux->cond);
+#else
+	(void)mux;
+#endif
+}
+
+/* wait for up to 'ms' milliseconds (or forever if negative) */
+static int
+mux_wait(fido_dev_mux_t *mux, int ms)
+{
+#ifdef HAVE_PTHREAD
+	struct timespec ts;
+
+	if (ms < 0)
+		return (pthread_cond_wait(&mux->cond, &mux->lock) != 0 ? -1 : 0);
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
+		return (-1);
+
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	return (pthread_cond_timedwait(&mux->cond, &mux->lock, &ts) != 0 ?
+	    -1 : 0);
+#else
+	(void)mux;
+	(void)ms;
+
+	return (-1); /* nobody else can make progress */
+#endif
+}
+
+/* milliseconds left until 'ms' have elapsed since 'ts_start' */
+static int
+mux_ms_left(const struct timespec *ts_start, int ms)
+{
+	int elapsed_ms;
+
+	if (ms < 0)
+		return (-1);
+	if (fido_time_delta_ms(ts_start, &elapsed_ms) < 0 || elapsed_ms >= ms)
+		return (0);
+
+	return (ms - elapsed_ms);
+}
+
+/* hand the device over to the next session waiting for it, if any */
+static void
+mux_release(fido_dev_mux_t *mux, struct mux_session *s)
+{
+	if (mux->owner != s)
+		return;
+
+	if ((mux->owner = mux->waitq) != NULL) {
+		mux->waitq = mux->owner->wnext;
+		mux->owner->wnext = NULL;
+	}
+
+	mux_wakeup(mux);
+}
+
+/* leave the queue of sessions waiting for the device */
+static void
+mux_unqueue(fido_dev_mux_t *mux, struct mux_session *s)
+{
+	struct mux_session **pp;
+
+	for (pp = &mux->waitq; *pp != NULL; pp = &(*pp)->wnext)
+		if (*pp == s) {
+			*pp = s->wnext;
+			s->wnext = NULL;
+			break;
+		}
+}
+
+/* wait for the device to be handed over to 's'; called locked */
+static int
+mux_acquire(fido_dev_mux_t *mux, struct mux_session *s)
+{
+	struct mux_session	**pp;
+	struct timespec		  ts_start;
+	int			  ms_left;
+
+	if (mux->owner == s)
+		return (0);
+
+	if (mux->owner == NULL && mux->waitq == NULL) {
+		mux->owner = s;
+		return (0);
+	}
+
+	if (fido_time_now(&ts_start) < 0)
+		return (-1);
+
+	for (pp = &mux->waitq; *pp != NULL; pp = &(*pp)->wnext)
+		continue;
+	*pp = s;
+
+	while (mux->owner != s)
+		if ((ms_left = mux_ms_left(&ts_start, MUX_WAIT_MS)) == 0 ||
+		    mux_wait(mux, ms_left) < 0) {
+			if (mux->owner == s)
+				break;
+			mux_unqueue(mux, s);
+			return (-1);
+		}
+
+	return (0);
+}
+
+static void
+mux_flush(struct mux_session *s)
+{
+	struct mux_report *r;
+
+	while ((r = s->head) != NULL) {
+		s->head = r->next;
+		fido_freezero(r, sizeof(*r));
+	}
+
+	s->tail = NULL;
+	s->qlen = 0;
+}
+
+static struct mux_session *
+mux_route(fido_dev_mux_t *mux, const unsigned char *pkt)
+{
+	struct mux_session	*s;
+	uint32_t		 cid;
+	uint32_t		 new_cid;
+	uint64_t		 nonce;
+
+	memcpy(&cid, pkt, sizeof(cid));
+
+	if (cid == CTAP_CID_BROADCAST &&
+	    pkt[4] == (CTAP_FRAME_INIT | CTAP_CMD_INIT)) {
+		/* nonce at offset 7, new channel at offset 15 */
+		memcpy(&nonce, pkt + 7, sizeof(nonce));
+		memcpy(&new_cid, pkt + 15, sizeof(new_cid));
+		for (s = mux->session; s != NULL; s = s->next)
+			if (s->init_pending && s->nonce == nonce) {
+				s->init_pending = false;
+				s->cid = new_cid;
+				return (s);
+			}
+		return (NULL);
+	}
+
+	for (s = mux->session; s != NULL; s = s->next)
+		if (s->cid == cid && !s->init_pending)
+			return (s);
+
+	return (NULL);
+}
+
+/* account for an incoming report, handing over the ticket if complete */
+static void
+mux_track(fido_dev_mux_t *mux, struct mux_session *s, const unsigned char *pkt)
+{
+	size_t payload_len;
+	size_t n;
+
+	if (mux->owner != s)
+		return;
+
+	if (pkt[4] & CTAP_FRAME_INIT) {
+		if (pkt[4] == (CTAP_FRAME_INIT | CTAP_KEEPALIVE))
+			return;
+		payload_len = (size_t)((pkt[5] << 8) | pkt[6]);
+		n = mux->rx_len - CTAP_INIT_HEADER_LEN;
+		s->rx_left = payload_len > n ? payload_len - n : 0;
+	} else {
+		n = mux->rx_len - CTAP_CONT_HEADER_LEN;
+		s->rx_left = s->rx_left > n ? s->rx_left - n : 0;
+	}
+
+	if (s->rx_left == 0)
+		mux_release(mux, s);
+}
+
+static int
+mux_enqueue(struct mux_session *s, const unsigned char *pkt, size_t len)
+{
+	struct mux_report *r;
+
+	if (s->qlen >= MUX_MAXQUEUE || len > sizeof(r->data)) {
+		fido_log_debug("%s: cid=0x%x, qlen=%zu", __func__, s->cid,
+		    s->qlen);
+		return (-1);
+	}
+
+	if ((r = fido_calloc(1, sizeof(*r))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		return (-1);
+	}
+
+	memcpy(r->data, pkt, len);
+	r->len = len;
+
+	if (s->tail != NULL)
+		s->tail->next = r;
+	else
+		s->head = r;
+
+	s->tail = r;
+	s->qlen++;
+
+	return (0);
+}
+
+static int
+mux_dequeue(struct mux_session *s, unsigned char *buf, size_t len)
+{
+	struct mux_report	*r;
+	int			 n;
+
+	if ((r = s->head) == NULL)
+		return (-1);
+
+	if ((s->head = r->next) == NULL)
+		s->tail = NULL;
+
+	s->qlen--;
+
+	n = (int)(len < r->len ? len : r->len);
+	memcpy(buf, r->data, (size_t)n);
+	fido_freezero(r, sizeof(*r));
+
+	return (n);
+}
+
+/* read one report from the device and route it; called locked */
+static int
+mux_pump(fido_dev_mux_t *mux, struct mux_session *self, unsigned char *buf,
+    size_t len, int ms)
+{
+	unsigned char		 pkt[CTAP_MAX_REPORT_LEN];
+	struct mux_session	*s;
+	int			 n;
+
+	if (mux->rx_len > sizeof(pkt))
+		return (-1);
+
+	mux->reading = true;
+	mux_unlock(mux);
+	n = mux->io.read(mux->io_handle, pkt, mux->rx_len, ms);
+	mux_lock(mux);
+	mux->reading = false;
+	mux_wakeup(mux);
+
+	if (n < 0 || (size_t)n != mux->rx_len)
+		return (-1);
+
+	if ((s = mux_route(mux, pkt)) == NULL) {
+		fido_log_debug("%s: dropping report", __func__);
+		fido_log_xxd(pkt, mux->rx_len);
+		return (0);
+	}
+
+	mux_track(mux, s, pkt);
+
+	if (s == self) {
+		n = (int)(len < mux->rx_len ? len : mux->rx_len);
+		memcpy(buf, pkt, (size_t)n);
+		return (n);
+	}
+
+	if (mux_enqueue(s, pkt, mux->rx_len) < 0)
+		fido_log_debug("%s: mux_enqueue", __func__);
+
+	return (0);
+}
+
+void *
+fido_mux_attach(fido_dev_mux_t *mux)
+{
+	struct mux_session *s;
+
+	if (mux->io_handle == NULL) {
+		fido_log_debug("%s: mux not open", __func__);
+		return (NULL);
+	}
+
+	if ((s = fido_calloc(1, sizeof(*s))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		return (NULL);
+	}
+
+	s->mux = mux;
+	s->cid = CTAP_CID_BROADCAST;
+
+	mux_lock(mux);
+	s->next = mux->session;
+	mux->session = s;
+	mux->nsessions++;
+	mux_unlock(mux);
+
+	return (s);
+}
+
+void
+fido_mux_detach(void *handle)
+{
+	struct mux_session	*s = handle;
+	fido_dev_mux_t		*mux = s->mux;
+	struct mux_session	**pp;
+
+	if (mux == NULL)
+		goto out;
+
+	mux_lock(mux);
+
+	for (pp = &mux->session; *pp != NULL; pp = &(*pp)->next)
+		if (*pp == s) {
+			*pp = s->next;
+			mux->nsessions--;
+			break;
+		}
+
+	mux_unqueue(mux, s);
+	mux_release(mux, s);
+	mux_unlock(mux);
+out:
+	mux_flush(s);
+	fido_free(s);
+}
+
+int
+fido_mux_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct mux_session	*s = handle;
+	fido_dev_mux_t		*mux = s->mux;
+	struct timespec		 ts_start;
+	int			 ms_left;
+	int			 n;
+
+	if (mux == NULL) {
+		fido_log_debug("%s: orphaned session", __func__);
+		return (-1);
+	}
+
+	memset(&ts_start, 0, sizeof(ts_start));
+
+	if (ms >= 0 && fido_time_now(&ts_start) < 0)
+		return (-1);
+
+	mux_lock(mux);
+
+	for (;;) {
+		if ((n = mux_dequeue(s, buf, len)) >= 0)
+			break;
+		if ((ms_left = mux_ms_left(&ts_start, ms)) == 0 && ms >= 0) {
+			n = -1;
+			break;
+		}
+		if (mux->reading) {
+			if (mux_wait(mux, ms_left) < 0 &&
+			    mux_ms_left(&ts_start, ms) == 0) {
+				n = -1;
+				break;
+			}
+			continue;
+		}
+		if ((n = mux_pump(mux, s, buf, len, ms_left)) != 0)
+			break;
+	}
+
+	/* the transaction has been abandoned; let the next session in */
+	if (n < 0)
+		mux_release(mux, s);
+
+	mux_unlock(mux);
+
+	return (n);
+}
+
+int
+fido_mux_write(void *handle, const unsigned char *buf, size_t len)
+{
+	struct mux_session	*s = handle;
+	fido_dev_mux_t		*mux = s->mux;
+	uint32_t		 cid;
+	uint8_t			 cmd;
+	int			 n;
+
+	if (mux == NULL) {
+		fido_log_debug("%s: orphaned session", __func__);
+		return (-1);
+	}
+
+	/* buf[0] is the report id */
+	if (len < 1 + CTAP_INIT_HEADER_LEN + sizeof(s->nonce)) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (-1);
+	}
+
+	memcpy(&cid, buf + 1, sizeof(cid));
+	cmd = buf[5];
+
+	mux_lock(mux);
+
+	if ((cmd & CTAP_FRAME_INIT) && cmd != (CTAP_FRAME_INIT |
+	    CTAP_CMD_CANCEL) && mux_acquire(mux, s) < 0) {
+		fido_log_debug("%s: busy", __func__);
+		mux_unlock(mux);
+		return (-1);
+	}
+
+	if (cmd == (CTAP_FRAME_INIT | CTAP_CMD_INIT) &&
+	    cid == CTAP_CID_BROADCAST) {
+		memcpy(&s->nonce, buf + 1 + CTAP_INIT_HEADER_LEN,
+		    sizeof(s->nonce));
+		s->init_pending = true;
+		mux_flush(s);
+	}
+
+	s->cid = cid;
+	n = mux->io.write(mux->io_handle, buf, len);
+
+	if (n < 0 || (size_t)n != len)
+		mux_release(mux, s);
+
+	mux_unlock(mux);
+
+	return (n);
+}
+
+size_t
+fido_mux_rx_len(const fido_dev_mux_t *mux)
+{
+	return (mux->rx_len);
+}
+
+size_t
+fido_mux_tx_len(const fido_dev_mux_t *mux)
+{
+	return (mux->tx_len);
+}
+
+fido_dev_mux_t *
+fido_dev_mux_new(void)
+{
+	fido_dev_mux_t *mux;
+
+	if ((mux = fido_calloc(1, sizeof(*mux))) == NULL)
+		return (NULL);
+
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&mux->lock, NULL) != 0) {
+		fido_free(mux);
+		return (NULL);
+	}
+	if (pthread_cond_init(&mux->cond, NULL) != 0) {
+		pthread_mutex_destroy(&mux->lock);
+		fido_free(mux);
+		return (NULL);
+	}
+#endif
+
+	mux->io = (fido_dev_io_t) {
+		&fido_hid_open,
+		&fido_hid_close,
+		&fido_hid_read,
+		&fido_hid_write,
+	};
+
+	return (mux);
+}
+
+void
+fido_dev_mux_free(fido_dev_mux_t **mux_p)
+{
+	fido_dev_mux_t		*mux;
+	struct mux_session	*s;
+
+	if (mux_p == NULL || (mux = *mux_p) == NULL)
+		return;
+
+	if (mux->nsessions != 0)
+		fido_log_debug("%s: nsessions=%zu", __func__, mux->nsessions);
+
+	for (s = mux->session; s != NULL; s = s->next)
+		s->mux = NULL;
+
+	if (mux->io_handle != NULL)
+		mux->io.close(mux->io_handle);
+
+#ifdef HAVE_PTHREAD
+	pthread_cond_destroy(&mux->cond);
+	pthread_mutex_destroy(&mux->lock);
+#endif
+	fido_free(mux);
+
+	*mux_p = NULL;
+}
+
+int
+fido_dev_mux_set_io_functions(fido_dev_mux_t *mux, const fido_dev_io_t *io)
+{
+	if (mux->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (io == NULL || io->open == NULL || io->close == NULL ||
+	    io->read == NULL || io->write == NULL) {
+		fido_log_debug("%s: NULL function", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	mux->io = *io;
+	mux->io_own = true;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_mux_open(fido_dev_mux_t *mux, const char *path)
+{
+	if (mux->io_handle != NULL) {
+		fido_log_debug("%s: handle=%p", __func__, mux->io_handle);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((mux->io_handle = mux->io.open(path)) == NULL) {
+		fido_log_debug("%s: mux->io.open", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if (mux->io_own) {
+		mux->rx_len = CTAP_MAX_REPORT_LEN;
+		mux->tx_len = CTAP_MAX_REPORT_LEN;
+	} else {
+		mux->rx_len = fido_hid_report_in_len(mux->io_handle);
+		mux->tx_len = fido_hid_report_out_len(mux->io_handle);
+	}
+
+	if (mux->rx_len < CTAP_MIN_REPORT_LEN ||
+	    mux->rx_len > CTAP_MAX_REPORT_LEN ||
+	    mux->tx_len < CTAP_MIN_REPORT_LEN ||
+	    mux->tx_len > CTAP_MAX_REPORT_LEN) {
+		fido_log_debug("%s: rx_len=%zu, tx_len=%zu", __func__,
+		    mux->rx_len, mux->tx_len);
+		mux->io.close(mux->io_handle);
+		mux->io_handle = NULL;
+		return (FIDO_ERR_RX);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_mux_close(fido_dev_mux_t *mux)
+{
+	if (mux->io_handle == NULL || mux->nsessions != 0) {
+		fido_log_debug("%s: handle=%p, nsessions=%zu", __func__,
+		    mux->io_handle, mux->nsessions);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	mux->io.close(mux->io_handle);
+	mux->io_handle = NULL;
+
+	return (FIDO_OK);
+}
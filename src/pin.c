@@ -71,7 +71,7 @@ fido_dev_get_pin_token_tx(fido_dev_t *dev, const char *pin,
 fail:
 	cbor_vector_free(argv, nitems(argv));
 	fido_blob_free(&p);
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -105,7 +105,7 @@ fido_dev_get_uv_token_tx(fido_dev_t *dev, const es256_pk_t *pk)
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -128,7 +128,7 @@ fido_dev_get_pin_token_rx(fido_dev_t *dev, const fido_blob_t *ecdh,
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+		r = fido_rx_error(dev);
 		goto fail;
 	}
 
@@ -169,7 +169,7 @@ fido_dev_get_uv_token_rx(fido_dev_t *dev, const  fido_blob_t *ecdh,
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+		r = fido_rx_error(dev);
 		goto fail;
 	}
 
@@ -199,23 +199,29 @@ fido_dev_get_pin_token_wait(fido_dev_t *dev, const char *pin,
 {
 	int r;
 
+	fido_trace1(pin__token__start, dev->cid);
+
 #ifdef FIDO_UVTOKEN
 	if (getenv("FIDO_UVTOKEN") != NULL) {
 		if ((r = fido_dev_get_uv_token_tx(dev, pk)) != FIDO_OK ||
 		    (r = fido_dev_get_uv_token_rx(dev, ecdh, token, ms)) != FIDO_OK)
-			return (r);
+			goto out;
 	} else {
 		if ((r = fido_dev_get_pin_token_tx(dev, pin, ecdh, pk)) != FIDO_OK ||
 		    (r = fido_dev_get_pin_token_rx(dev, ecdh, token, ms)) != FIDO_OK)
-			return (r);
+			goto out;
 	}
 #else
 	if ((r = fido_dev_get_pin_token_tx(dev, pin, ecdh, pk)) != FIDO_OK ||
 	    (r = fido_dev_get_pin_token_rx(dev, ecdh, token, ms)) != FIDO_OK)
-		return (r);
+		goto out;
 #endif
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+out:
+	fido_trace2(pin__token__done, dev->cid, r);
+
+	return (r);
 }
 
 int
@@ -241,7 +247,8 @@ pad64(const char *pin, fido_blob_t **ppin)
 		return (FIDO_ERR_INTERNAL);
 
 	ppin_len = (pin_len + 63U) & ~63U;
-	if (ppin_len < pin_len || ((*ppin)->ptr = calloc(1, ppin_len)) == NULL) {
+	if (ppin_len < pin_len ||
+	    ((*ppin)->ptr = fido_calloc(1, ppin_len)) == NULL) {
 		fido_blob_free(ppin);
 		return (FIDO_ERR_INTERNAL);
 	}
@@ -308,7 +315,7 @@ fail:
 	fido_blob_free(&ppin);
 	fido_blob_free(&ecdh);
 	fido_blob_free(&opin);
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 
@@ -360,7 +367,7 @@ fail:
 	es256_pk_free(&pk);
 	fido_blob_free(&ppin);
 	fido_blob_free(&ecdh);
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -394,7 +401,14 @@ fido_dev_set_pin_wait(fido_dev_t *dev, const char *pin, const char *oldpin,
 int
 fido_dev_set_pin(fido_dev_t *dev, const char *pin, const char *oldpin)
 {
-	return (fido_dev_set_pin_wait(dev, pin, oldpin, -1));
+	int r;
+
+	if (fido_tx_hold(dev) < 0)
+		return (FIDO_ERR_TX);
+	r = fido_dev_set_pin_wait(dev, pin, oldpin, -1);
+	fido_tx_release(dev);
+
+	return (r);
 }
 
 static int
@@ -446,7 +460,7 @@ fido_dev_get_retry_count_tx(fido_dev_t *dev)
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_freezero(f.ptr, f.len);
 
 	return (r);
 }
@@ -463,7 +477,7 @@ fido_dev_get_retry_count_rx(fido_dev_t *dev, int *retries, int ms)
 	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
 	    ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
+		return (fido_rx_error(dev));
 	}
 
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, retries,
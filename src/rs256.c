@@ -89,7 +89,7 @@ rs256_pk_decode(const cbor_item_t *item, rs256_pk_t *k)
 rs256_pk_t *
 rs256_pk_new(void)
 {
-	return (calloc(1, sizeof(rs256_pk_t)));
+	return (fido_calloc(1, sizeof(rs256_pk_t)));
 }
 
 void
@@ -100,8 +100,7 @@ rs256_pk_free(rs256_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	explicit_bzero(pk, sizeof(*pk));
-	free(pk);
+	fido_freezero(pk, sizeof(*pk));
 
 	*pkp = NULL;
 }
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include "fido.h"
+
+/* clientPin subcommands, as per section 5.5 of the fido2 ctap spec */
+#define PIN_GET_RETRIES		0x01
+#define PIN_GET_KEY_AGREEMENT	0x02
+#define PIN_SET_PIN		0x03
+#define PIN_CHANGE_PIN		0x04
+#define PIN_GET_PIN_TOKEN	0x05
+
+static int
+stats_client_pin_op(const unsigned char *ptr, size_t len)
+{
+	/*
+	 * cbor_build_frame() emits the parameters in ascending key order;
+	 * key 0x01 is the pin protocol, key 0x02 the subcommand.
+	 */
+	if (len < 6 || (ptr[1] & 0xe0) != 0xa0 || ptr[2] != 0x01 ||
+	    ptr[3] != 0x01 || ptr[4] != 0x02)
+		return (FIDO_STATS_OP_OTHER);
+
+	switch (ptr[5]) {
+	case PIN_GET_RETRIES:
+		return (FIDO_STATS_OP_PIN_RETRIES);
+	case PIN_GET_KEY_AGREEMENT:
+		return (FIDO_STATS_OP_PIN_KEYAGREEMENT);
+	case PIN_SET_PIN:
+		return (FIDO_STATS_OP_PIN_SET);
+	case PIN_CHANGE_PIN:
+		return (FIDO_STATS_OP_PIN_CHANGE);
+	case PIN_GET_PIN_TOKEN:
+		return (FIDO_STATS_OP_PIN_TOKEN);
+	default:
+		return (FIDO_STATS_OP_OTHER);
+	}
+}
+
+static int
+stats_cbor_op(const unsigned char *ptr, size_t len)
+{
+	if (len < 1)
+		return (FIDO_STATS_OP_OTHER);
+
+	switch (ptr[0]) {
+	case CTAP_CBOR_MAKECRED:
+		return (FIDO_STATS_OP_MAKECRED);
+	case CTAP_CBOR_ASSERT:
+		return (FIDO_STATS_OP_ASSERT);
+	case CTAP_CBOR_NEXT_ASSERT:
+		return (FIDO_STATS_OP_NEXT_ASSERT);
+	case CTAP_CBOR_GETINFO:
+		return (FIDO_STATS_OP_GETINFO);
+	case CTAP_CBOR_CLIENT_PIN:
+		return (stats_client_pin_op(ptr, len));
+	case CTAP_CBOR_RESET:
+		return (FIDO_STATS_OP_RESET);
+	case CTAP_CBOR_BIO_ENROLL_PRE:
+		return (FIDO_STATS_OP_BIO_ENROLL);
+	case CTAP_CBOR_CRED_MGMT_PRE:
+		return (FIDO_STATS_OP_CREDMAN);
+	default:
+		return (FIDO_STATS_OP_OTHER);
+	}
+}
+
+static int
+stats_u2f_op(const unsigned char *ptr, size_t len)
+{
+	/* ptr[1] holds the instruction byte of the iso7816 header */
+	if (len < 2)
+		return (FIDO_STATS_OP_OTHER);
+
+	switch (ptr[1]) {
+	case U2F_CMD_REGISTER:
+		return (FIDO_STATS_OP_U2F_REGISTER);
+	case U2F_CMD_AUTH:
+		return (FIDO_STATS_OP_U2F_AUTH);
+	default:
+		return (FIDO_STATS_OP_OTHER);
+	}
+}
+
+static int
+stats_op(uint8_t cmd, const unsigned char *ptr, size_t len)
+{
+	switch (cmd) {
+	case CTAP_CMD_INIT:
+		return (FIDO_STATS_OP_INIT);
+	case CTAP_CMD_PING:
+		return (FIDO_STATS_OP_PING);
+	case CTAP_CMD_WINK:
+		return (FIDO_STATS_OP_WINK);
+	case CTAP_CMD_CBOR:
+		return (stats_cbor_op(ptr, len));
+	case CTAP_CMD_MSG:
+		return (stats_u2f_op(ptr, len));
+	default:
+		return (FIDO_STATS_OP_OTHER);
+	}
+}
+
+static size_t
+stats_bucket(uint64_t us)
+{
+	size_t n = 0;
+
+	while (us > 1 && n < FIDO_STATS_NBUCKETS - 1) {
+		us >>= 1;
+		n++;
+	}
+
+	return (n);
+}
+
+void
+fido_stats_tx(fido_dev_t *dev, uint8_t cmd, const void *buf, size_t count)
+{
+	if (cmd == CTAP_CMD_CANCEL)
+		return; /* not a transaction of its own */
+
+	dev->stats_op = -1;
+
+	if (fido_time_now(&dev->stats_ts) < 0)
+		return;
+
+	dev->stats_op = stats_op(cmd, buf, count);
+}
+
+void
+fido_stats_rx(fido_dev_t *dev)
+{
+	fido_stats_latency_t	*l;
+	uint64_t		 us;
+	const int		 op = dev->stats_op;
+
+	if (op < 0 || op >= FIDO_STATS_NOPS)
+		return;
+
+	dev->stats_op = -1;
+
+	if (fido_time_delta_us(&dev->stats_ts, &us) < 0)
+		return;
+
+	l = &dev->stats.latency[op];
+	l->count++;
+	l->total_us += us;
+	if (us > l->max_us)
+		l->max_us = us;
+	l->bucket[stats_bucket(us)]++;
+}
+
+fido_dev_stats_t *
+fido_dev_stats_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_dev_stats_t)));
+}
+
+void
+fido_dev_stats_free(fido_dev_stats_t **stats_p)
+{
+	fido_dev_stats_t *stats;
+
+	if (stats_p == NULL || (stats = *stats_p) == NULL)
+		return;
+
+	fido_free(stats);
+
+	*stats_p = NULL;
+}
+
+int
+fido_dev_get_stats(const fido_dev_t *dev, fido_dev_stats_t *stats)
+{
+	if (stats == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memcpy(stats, &dev->stats, sizeof(*stats));
+
+	return (FIDO_OK);
+}
+
+void
+fido_dev_reset_stats(fido_dev_t *dev)
+{
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->stats_op = -1;
+}
+
+uint64_t
+fido_dev_stats_tx_reports(const fido_dev_stats_t *stats)
+{
+	return (stats->tx_reports);
+}
+
+uint64_t
+fido_dev_stats_rx_reports(const fido_dev_stats_t *stats)
+{
+	return (stats->rx_reports);
+}
+
+uint64_t
+fido_dev_stats_tx_bytes(const fido_dev_stats_t *stats)
+{
+	return (stats->tx_bytes);
+}
+
+uint64_t
+fido_dev_stats_rx_bytes(const fido_dev_stats_t *stats)
+{
+	return (stats->rx_bytes);
+}
+
+uint64_t
+fido_dev_stats_keepalives(const fido_dev_stats_t *stats)
+{
+	return (stats->keepalives);
+}
+
+uint64_t
+fido_dev_stats_errors(const fido_dev_stats_t *stats)
+{
+	return (stats->errors);
+}
+
+uint64_t
+fido_dev_stats_timeouts(const fido_dev_stats_t *stats)
+{
+	return (stats->timeouts);
+}
+
+uint64_t
+fido_dev_stats_retries(const fido_dev_stats_t *stats)
+{
+	return (stats->retries);
+}
+
+uint64_t
+fido_dev_stats_latency_count(const fido_dev_stats_t *stats, int op)
+{
+	if (op < 0 || op >= FIDO_STATS_NOPS)
+		return (0);
+
+	return (stats->latency[op].count);
+}
+
+uint64_t
+fido_dev_stats_latency_total_us(const fido_dev_stats_t *stats, int op)
+{
+	if (op < 0 || op >= FIDO_STATS_NOPS)
+		return (0);
+
+	return (stats->latency[op].total_us);
+}
+
+uint64_t
+fido_dev_stats_latency_max_us(const fido_dev_stats_t *stats, int op)
+{
+	if (op < 0 || op >= FIDO_STATS_NOPS)
+		return (0);
+
+	return (stats->latency[op].max_us);
+}
+
+uint64_t
+fido_dev_stats_latency_bucket(const fido_dev_stats_t *stats, int op,
+    size_t idx)
+{
+	if (op < 0 || op >= FIDO_STATS_NOPS || idx >= FIDO_STATS_NBUCKETS)
+		return (0);
+
+	return (stats->latency[op].bucket[idx]);
+}
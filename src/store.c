@@ -0,0 +1,852 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include <openssl/rand.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/es256.h"
+#include "fido/rs256.h"
+#include "fido/eddsa.h"
+
+/*
+ * A fido_cred_store_t maps credential ids to the public key, COSE
+ * algorithm and signature counter of the corresponding credentials, so
+ * that assertions can be verified without the caller having to look up
+ * and decode keys.
+ *
+ * Stores are saved as an open-addressing hash table that is used in place
+ * once loaded: fido_cred_store_load() maps the file and checks its
+ * header, and lookups read entries straight from the mapping. Credentials
+ * added afterwards are kept in memory, in front of the mapped table, until
+ * the store is saved again. Public keys are stored decoded, and the
+ * EVP_PKEY built from a key is kept with the store after its first use.
+ *
+ * File layout; all integers are big-endian:
+ *
+ *   header   "FIDS", version, 3 reserved bytes, seed, nbuckets, nentries,
+ *            data_len, 8 reserved bytes
+ *   buckets  nbuckets x u32: 1 + index of entry, or 0 if empty
+ *   entries  nentries x STORE_ENTRY_LEN: hash, type, sigcount, id_off,
+ *            id_len, key_len, key[STORE_MAXKEY]
+ *   data     credential ids, data_len bytes
+ *
+ * The hash is FNV-1a, seeded per store so that credential ids chosen by
+ * authenticators cannot be made to collide across stores.
+ *
+ * With fido_cred_store_set_sigcount_tracking(), signature counters are
+ * tracked in memory as assertions are verified, and written out when the
+ * store is saved. A counter is a u64 holding SIGCOUNT_SET and the last
+ * counter seen, or 0 if none was seen since the file was loaded; it is
+ * advanced with compare-and-swap, so that concurrent verifications of a
+ * credential agree on which counter values are fresh.
+ */
+
+#define STORE_MAGIC		"FIDS"
+#define STORE_VERSION		1
+#define STORE_HDR_LEN		32
+#define STORE_ENTRY_LEN		(6 * 4 + STORE_MAXKEY)
+#define STORE_MAXKEY		264	/* rs256: n + e, padded */
+#define STORE_MAXID		1024	/* credential id length */
+#define STORE_MAXENTRIES	(1U << 24)
+#define STORE_MINBUCKETS	16
+#define SIGCOUNT_SET		((uint64_t)1 << 32)
+
+#ifdef __GNUC__
+#define SIGCOUNT_LOAD(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SIGCOUNT_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SIGCOUNT_CAS(p, e, v)	__atomic_compare_exchange_n((p), (e), (v), \
+    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define SIGCOUNT_LOAD(p)	(*(p))
+#define SIGCOUNT_STORE(p, v)	(*(p) = (v))
+#define SIGCOUNT_CAS(p, e, v)	(*(p) == *(e) ? (*(p) = (v), true) : \
+    (*(e) = *(p), false))
+#endif
+
+struct store_rec {
+	struct store_rec	*next;
+	uint32_t		 hash;
+	int			 type;
+	uint64_t		 sigcount; /* SIGCOUNT_SET | counter */
+	unsigned char		*id;
+	size_t			 id_len;
+	unsigned char		 key[STORE_MAXKEY];
+	size_t			 key_len;
+	EVP_PKEY		*pkey; /* built on first use */
+};
+
+/* what a lookup yields, from either the mapping or memory */
+struct store_ref {
+	int			 type;
+	uint32_t		 sigcount; /* as loaded or added */
+	uint64_t		*tracked;
+	const unsigned char	*key;
+	size_t			 key_len;
+	EVP_PKEY		**pkey;
+};
+
+struct fido_cred_store {
+	uint32_t		  seed;
+	/* credentials added with fido_cred_store_add() */
+	struct store_rec	**rec;
+	size_t			  rec_nbuckets;
+	size_t			  rec_count;
+	bool			  track_sigcount;
+	/* loaded file */
+	unsigned char		 *map;
+	size_t			  map_len;
+	uint32_t		  map_seed;
+	uint32_t		  nbuckets;
+	uint32_t		  nentries;
+	uint32_t		  data_len;
+	const unsigned char	 *buckets;
+	const unsigned char	 *entries;
+	const unsigned char	 *data;
+	EVP_PKEY		**map_pkey; /* per entry, built on first use */
+	uint64_t		 *map_sigcount; /* per entry, tracked */
+};
+
+static uint32_t
+get_u32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+static void
+put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static uint32_t
+store_hash(uint32_t seed, const unsigned char *id, size_t id_len)
+{
+	uint32_t h = 2166136261U ^ seed;
+
+	for (size_t i = 0; i < id_len; i++) {
+		h ^= id[i];
+		h *= 16777619U;
+	}
+
+	return (h);
+}
+
+static size_t
+key_len(int type)
+{
+	switch (type) {
+	case COSE_ES256:
+		return (sizeof(es256_pk_t));
+	case COSE_RS256:
+		return (sizeof(rs256_pk_t));
+	case COSE_EDDSA:
+		return (sizeof(eddsa_pk_t));
+	default:
+		return (0);
+	}
+}
+
+static EVP_PKEY *
+key_to_pkey(int type, const unsigned char *key, size_t len)
+{
+	es256_pk_t	es256;
+	rs256_pk_t	rs256;
+	eddsa_pk_t	eddsa;
+
+	if (len == 0 || len != key_len(type))
+		return (NULL);
+
+	switch (type) {
+	case COSE_ES256:
+		memcpy(&es256, key, sizeof(es256));
+		return (es256_pk_to_EVP_PKEY(&es256));
+	case COSE_RS256:
+		memcpy(&rs256, key, sizeof(rs256));
+		return (rs256_pk_to_EVP_PKEY(&rs256));
+	case COSE_EDDSA:
+		memcpy(&eddsa, key, sizeof(eddsa));
+		return (eddsa_pk_to_EVP_PKEY(&eddsa));
+	default:
+		return (NULL);
+	}
+}
+
+static struct store_rec *
+rec_lookup(const fido_cred_store_t *store, const unsigned char *id,
+    size_t id_len)
+{
+	struct store_rec	*rec;
+	uint32_t		 h;
+
+	if (store->rec_count == 0)
+		return (NULL);
+
+	h = store_hash(store->seed, id, id_len);
+
+	for (rec = store->rec[h % store->rec_nbuckets]; rec != NULL;
+	    rec = rec->next)
+		if (rec->hash == h && rec->id_len == id_len &&
+		    memcmp(rec->id, id, id_len) == 0)
+			return (rec);
+
+	return (NULL);
+}
+
+static int
+rec_grow(fido_cred_store_t *store)
+{
+	struct store_rec	**rec;
+	struct store_rec	 *r;
+	size_t			  n;
+
+	if (store->rec_count < store->rec_nbuckets)
+		return (0);
+
+	n = store->rec_nbuckets ? store->rec_nbuckets * 2 : STORE_MINBUCKETS;
+	if ((rec = fido_calloc(n, sizeof(*rec))) == NULL)
+		return (-1);
+
+	for (size_t i = 0; i < store->rec_nbuckets; i++)
+		while ((r = store->rec[i]) != NULL) {
+			store->rec[i] = r->next;
+			r->next = rec[r->hash % n];
+			rec[r->hash % n] = r;
+		}
+
+	fido_free(store->rec);
+	store->rec = rec;
+	store->rec_nbuckets = n;
+
+	return (0);
+}
+
+/* index of the mapped entry for id, or -1 */
+static int64_t
+map_lookup(const fido_cred_store_t *store, const unsigned char *id,
+    size_t id_len)
+{
+	const unsigned char	*e;
+	uint32_t		 h;
+	uint32_t		 b;
+	uint32_t		 mask;
+	uint64_t		 off;
+
+	if (store->map == NULL || store->nentries == 0)
+		return (-1);
+
+	h = store_hash(store->map_seed, id, id_len);
+	mask = store->nbuckets - 1;
+
+	for (uint32_t i = 0, j = h & mask; i < store->nbuckets; i++,
+	    j = (j + 1) & mask) {
+		if ((b = get_u32(store->buckets + (size_t)j * 4)) == 0)
+			break;
+		if (b > store->nentries) {
+			fido_log_debug("%s: invalid bucket %u", __func__, j);
+			break;
+		}
+		e = store->entries + (size_t)(b - 1) * STORE_ENTRY_LEN;
+		off = (uint64_t)get_u32(e + 12) + get_u32(e + 16);
+		if (get_u32(e) != h || get_u32(e + 16) != id_len ||
+		    off > store->data_len)
+			continue;
+		if (memcmp(store->data + get_u32(e + 12), id, id_len) == 0)
+			return ((int64_t)b - 1);
+	}
+
+	return (-1);
+}
+
+static int
+store_lookup(const fido_cred_store_t *store, const unsigned char *id,
+    size_t id_len, struct store_ref *ref)
+{
+	struct store_rec	*rec;
+	const unsigned char	*e;
+	int64_t			 idx;
+
+	memset(ref, 0, sizeof(*ref));
+
+	if (id == NULL || id_len == 0 || id_len > STORE_MAXID)
+		return (-1);
+
+	if ((rec = rec_lookup(store, id, id_len)) != NULL) {
+		ref->type = rec->type;
+		ref->sigcount = (uint32_t)rec->sigcount;
+		ref->tracked = &rec->sigcount;
+		ref->key = rec->key;
+		ref->key_len = rec->key_len;
+		ref->pkey = &rec->pkey;
+		return (0);
+	}
+
+	if ((idx = map_lookup(store, id, id_len)) < 0)
+		return (-1);
+
+	e = store->entries + (size_t)idx * STORE_ENTRY_LEN;
+	ref->type = (int)get_u32(e + 4);
+	ref->sigcount = get_u32(e + 8);
+	ref->key = e + 24;
+	ref->key_len = get_u32(e + 20);
+	ref->pkey = &store->map_pkey[idx];
+	ref->tracked = &store->map_sigcount[idx];
+
+	if (ref->key_len > STORE_MAXKEY || ref->key_len != key_len(ref->type)) {
+		fido_log_debug("%s: invalid entry %lld", __func__,
+		    (long long)idx);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+store_unmap(fido_cred_store_t *store)
+{
+	if (store->map_pkey != NULL) {
+		for (uint32_t i = 0; i < store->nentries; i++)
+			if (store->map_pkey[i] != NULL)
+				EVP_PKEY_free(store->map_pkey[i]);
+		fido_free(store->map_pkey);
+	}
+
+	fido_free(store->map_sigcount);
+
+	if (store->map != NULL) {
+#ifdef _WIN32
+		fido_free(store->map);
+#else
+		munmap(store->map, store->map_len);
+#endif
+	}
+
+	store->map = NULL;
+	store->map_len = 0;
+	store->map_pkey = NULL;
+	store->map_sigcount = NULL;
+	store->nbuckets = 0;
+	store->nentries = 0;
+	store->data_len = 0;
+}
+
+fido_cred_store_t *
+fido_cred_store_new(void)
+{
+	fido_cred_store_t *store;
+
+	if ((store = fido_calloc(1, sizeof(*store))) == NULL)
+		return (NULL);
+
+	if (RAND_bytes((unsigned char *)&store->seed,
+	    sizeof(store->seed)) != 1) {
+		fido_log_debug("%s: RAND_bytes", __func__);
+		fido_free(store);
+		return (NULL);
+	}
+
+	return (store);
+}
+
+void
+fido_cred_store_free(fido_cred_store_t **store_p)
+{
+	fido_cred_store_t	*store;
+	struct store_rec	*rec;
+
+	if (store_p == NULL || (store = *store_p) == NULL)
+		return;
+
+	store_unmap(store);
+
+	for (size_t i = 0; i < store->rec_nbuckets; i++)
+		while ((rec = store->rec[i]) != NULL) {
+			store->rec[i] = rec->next;
+			if (rec->pkey != NULL)
+				EVP_PKEY_free(rec->pkey);
+			fido_free(rec->id);
+			fido_free(rec);
+		}
+
+	fido_free(store->rec);
+	fido_free(store);
+
+	*store_p = NULL;
+}
+
+int
+fido_cred_store_add(fido_cred_store_t *store, const fido_cred_t *cred)
+{
+	const fido_attcred_t	*ac = &cred->attcred;
+	struct store_rec	*rec;
+	size_t			 len;
+
+	if (ac->id.ptr == NULL || ac->id.len == 0 ||
+	    ac->id.len > STORE_MAXID || (len = key_len(ac->type)) == 0) {
+		fido_log_debug("%s: invalid credential", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((rec = rec_lookup(store, ac->id.ptr, ac->id.len)) != NULL) {
+		/* replace */
+		if (rec->pkey != NULL) {
+			EVP_PKEY_free(rec->pkey);
+			rec->pkey = NULL;
+		}
+	} else {
+		if (store->rec_count >= STORE_MAXENTRIES ||
+		    rec_grow(store) < 0 ||
+		    (rec = fido_calloc(1, sizeof(*rec))) == NULL)
+			return (FIDO_ERR_INTERNAL);
+		if ((rec->id = fido_malloc(ac->id.len)) == NULL) {
+			fido_free(rec);
+			return (FIDO_ERR_INTERNAL);
+		}
+		memcpy(rec->id, ac->id.ptr, ac->id.len);
+		rec->id_len = ac->id.len;
+		rec->hash = store_hash(store->seed, rec->id, rec->id_len);
+		rec->next = store->rec[rec->hash % store->rec_nbuckets];
+		store->rec[rec->hash % store->rec_nbuckets] = rec;
+		store->rec_count++;
+	}
+
+	rec->type = ac->type;
+	SIGCOUNT_STORE(&rec->sigcount, SIGCOUNT_SET | cred->authdata.sigcount);
+	rec->key_len = len;
+	memset(rec->key, 0, sizeof(rec->key));
+	memcpy(rec->key, &ac->pubkey, len);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_store_set_sigcount_tracking(fido_cred_store_t *store, bool track)
+{
+	store->track_sigcount = track;
+
+	return (FIDO_OK);
+}
+
+/* the last counter seen for a credential */
+static uint32_t
+ref_sigcount(const struct store_ref *ref)
+{
+	uint64_t v = SIGCOUNT_LOAD(ref->tracked);
+
+	return ((v & SIGCOUNT_SET) ? (uint32_t)v : ref->sigcount);
+}
+
+/*
+ * Record sigcount as the counter of a credential, unless it does not
+ * exceed the last one seen. Authenticators without a counter always
+ * report 0, which is accepted as long as no other value was seen.
+ */
+static int
+ref_track_sigcount(const struct store_ref *ref, uint32_t sigcount)
+{
+	uint64_t	cur = SIGCOUNT_LOAD(ref->tracked);
+	uint32_t	last;
+
+	do {
+		last = (cur & SIGCOUNT_SET) ? (uint32_t)cur : ref->sigcount;
+		if (sigcount <= last && (sigcount != 0 || last != 0)) {
+			fido_log_debug("%s: sigcount=%u, last=%u", __func__,
+			    sigcount, last);
+			return (FIDO_ERR_INVALID_SIGCOUNT);
+		}
+	} while (SIGCOUNT_CAS(ref->tracked, &cur,
+	    SIGCOUNT_SET | sigcount) == false);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_store_lookup(const fido_cred_store_t *store, const unsigned char *id,
+    size_t id_len, int *type, uint32_t *sigcount)
+{
+	struct store_ref ref;
+
+	if (store_lookup(store, id, id_len, &ref) < 0)
+		return (FIDO_ERR_NO_CREDENTIALS);
+
+	if (type != NULL)
+		*type = ref.type;
+	if (sigcount != NULL)
+		*sigcount = ref_sigcount(&ref);
+
+	return (FIDO_OK);
+}
+
+static int
+load_file(const char *path, unsigned char **map, size_t *len)
+{
+#ifdef _WIN32
+	FILE	*f;
+	long	 n;
+
+	*map = NULL;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		return (-1);
+	if (fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < STORE_HDR_LEN ||
+	    fseek(f, 0, SEEK_SET) != 0 ||
+	    (*map = fido_malloc((size_t)n)) == NULL ||
+	    fread(*map, 1, (size_t)n, f) != (size_t)n) {
+		fido_free(*map);
+		*map = NULL;
+		fclose(f);
+		return (-1);
+	}
+
+	fclose(f);
+	*len = (size_t)n;
+
+	return (0);
+#else
+	struct stat	st;
+	void		*p;
+	int		fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return (-1);
+	if (fstat(fd, &st) < 0 || st.st_size < STORE_HDR_LEN ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		return (-1);
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return (-1);
+
+	*map = p;
+	*len = (size_t)st.st_size;
+
+	return (0);
+#endif
+}
+
+int
+fido_cred_store_load(fido_cred_store_t *store, const char *path)
+{
+	const unsigned char	*p;
+	uint64_t		 len;
+	int			 r;
+
+	store_unmap(store);
+
+	if (path == NULL || load_file(path, &store->map,
+	    &store->map_len) < 0) {
+		fido_log_debug("%s: load_file", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	p = store->map;
+
+	if (memcmp(p, STORE_MAGIC, 4) != 0 || p[4] != STORE_VERSION) {
+		fido_log_debug("%s: magic/version", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	store->map_seed = get_u32(p + 8);
+	store->nbuckets = get_u32(p + 12);
+	store->nentries = get_u32(p + 16);
+	store->data_len = get_u32(p + 20);
+
+	len = STORE_HDR_LEN + (uint64_t)store->nbuckets * 4 +
+	    (uint64_t)store->nentries * STORE_ENTRY_LEN + store->data_len;
+
+	/* a free bucket ends every probe sequence */
+	if (store->nbuckets < STORE_MINBUCKETS ||
+	    (store->nbuckets & (store->nbuckets - 1)) != 0 ||
+	    store->nentries > STORE_MAXENTRIES ||
+	    store->nentries >= store->nbuckets || len != store->map_len) {
+		fido_log_debug("%s: invalid header", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	store->buckets = p + STORE_HDR_LEN;
+	store->entries = store->buckets + (size_t)store->nbuckets * 4;
+	store->data = store->entries + (size_t)store->nentries *
+	    STORE_ENTRY_LEN;
+
+	if (store->nentries > 0 && ((store->map_pkey =
+	    fido_calloc(store->nentries, sizeof(*store->map_pkey))) == NULL ||
+	    (store->map_sigcount = fido_calloc(store->nentries,
+	    sizeof(*store->map_sigcount))) == NULL)) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	return (FIDO_OK);
+fail:
+	store_unmap(store);
+
+	return (r);
+}
+
+static void
+put_entry(unsigned char *img, uint32_t nbuckets, uint32_t idx,
+    uint32_t seed, int type, uint32_t sigcount, const unsigned char *id,
+    uint32_t id_len, uint32_t id_off, const unsigned char *key,
+    uint32_t klen)
+{
+	unsigned char	*buckets = img + STORE_HDR_LEN;
+	unsigned char	*e;
+	uint32_t	 h = store_hash(seed, id, id_len);
+	uint32_t	 j = h & (nbuckets - 1);
+	uint32_t	 nentries = get_u32(img + 16);
+
+	e = buckets + (size_t)nbuckets * 4 + (size_t)idx * STORE_ENTRY_LEN;
+	put_u32(e, h);
+	put_u32(e + 4, (uint32_t)type);
+	put_u32(e + 8, sigcount);
+	put_u32(e + 12, id_off);
+	put_u32(e + 16, id_len);
+	put_u32(e + 20, klen);
+	memcpy(e + 24, key, klen);
+	memcpy(buckets + (size_t)nbuckets * 4 +
+	    (size_t)nentries * STORE_ENTRY_LEN + id_off, id, id_len);
+
+	while (get_u32(buckets + (size_t)j * 4) != 0)
+		j = (j + 1) & (nbuckets - 1);
+
+	put_u32(buckets + (size_t)j * 4, idx + 1);
+}
+
+int
+fido_cred_store_save(const fido_cred_store_t *store, const char *path)
+{
+	const unsigned char	*e;
+	struct store_rec	*rec;
+	struct store_ref	 ref;
+	unsigned char		*img = NULL;
+	char			*tmp = NULL;
+	size_t			 tmp_len;
+	FILE			*f = NULL;
+	uint64_t		 data_len = 0;
+	uint64_t		 len;
+	uint32_t		 n = 0;
+	uint32_t		 nbuckets = STORE_MINBUCKETS;
+	uint32_t		 off = 0;
+	uint32_t		 idx = 0;
+	int			 ok = -1;
+	int			 r;
+
+	if (path == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	/* credentials in memory shadow those in the mapped file */
+	for (size_t i = 0; i < store->rec_nbuckets; i++)
+		for (rec = store->rec[i]; rec != NULL; rec = rec->next) {
+			n++;
+			data_len += rec->id_len;
+		}
+	for (uint32_t i = 0; i < store->nentries; i++) {
+		e = store->entries + (size_t)i * STORE_ENTRY_LEN;
+		if (get_u32(e + 16) > STORE_MAXID ||
+		    (uint64_t)get_u32(e + 12) + get_u32(e + 16) >
+		    store->data_len || rec_lookup(store, store->data +
+		    get_u32(e + 12), get_u32(e + 16)) != NULL)
+			continue;
+		n++;
+		data_len += get_u32(e + 16);
+	}
+
+	if (n > STORE_MAXENTRIES || data_len > UINT32_MAX) {
+		fido_log_debug("%s: n=%u, data_len=%llu", __func__, n,
+		    (unsigned long long)data_len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	while (nbuckets / 2 < n)
+		nbuckets *= 2;
+
+	len = STORE_HDR_LEN + (uint64_t)nbuckets * 4 +
+	    (uint64_t)n * STORE_ENTRY_LEN + data_len;
+
+	tmp_len = strlen(path) + sizeof(".tmp");
+
+	if (len > SIZE_MAX || (img = fido_calloc(1, (size_t)len)) == NULL ||
+	    (tmp = fido_malloc(tmp_len)) == NULL) {
+		fido_free(img);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	snprintf(tmp, tmp_len, "%s.tmp", path);
+
+	memcpy(img, STORE_MAGIC, 4);
+	img[4] = STORE_VERSION;
+	put_u32(img + 8, store->seed);
+	put_u32(img + 12, nbuckets);
+	put_u32(img + 16, n);
+	put_u32(img + 20, (uint32_t)data_len);
+
+	for (size_t i = 0; i < store->rec_nbuckets; i++)
+		for (rec = store->rec[i]; rec != NULL; rec = rec->next) {
+			put_entry(img, nbuckets, idx++, store->seed, rec->type,
+			    (uint32_t)SIGCOUNT_LOAD(&rec->sigcount), rec->id,
+			    (uint32_t)rec->id_len, off, rec->key,
+			    (uint32_t)rec->key_len);
+			off += (uint32_t)rec->id_len;
+		}
+	for (uint32_t i = 0; i < store->nentries; i++) {
+		e = store->entries + (size_t)i * STORE_ENTRY_LEN;
+		if (get_u32(e + 16) > STORE_MAXID ||
+		    (uint64_t)get_u32(e + 12) + get_u32(e + 16) >
+		    store->data_len || rec_lookup(store, store->data +
+		    get_u32(e + 12), get_u32(e + 16)) != NULL)
+			continue;
+		if (get_u32(e + 20) > STORE_MAXKEY) {
+			fido_log_debug("%s: invalid entry %u", __func__, i);
+			r = FIDO_ERR_INVALID_ARGUMENT;
+			goto fail;
+		}
+		ref.sigcount = get_u32(e + 8);
+		ref.tracked = &store->map_sigcount[i];
+		put_entry(img, nbuckets, idx++, store->seed,
+		    (int)get_u32(e + 4), ref_sigcount(&ref), store->data +
+		    get_u32(e + 12), get_u32(e + 16), off, e + 24,
+		    get_u32(e + 20));
+		off += get_u32(e + 16);
+	}
+
+	/* write a new file, and move it into place */
+	if ((f = fopen(tmp, "wb")) == NULL ||
+	    fwrite(img, 1, (size_t)len, f) != (size_t)len ||
+	    fflush(f) != 0) {
+		fido_log_debug("%s: write %s", __func__, tmp);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+#ifdef HAVE_UNISTD_H
+	if (fsync(fileno(f)) != 0) {
+		fido_log_debug("%s: fsync", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+#endif
+	ok = fclose(f);
+	f = NULL;
+#ifdef _WIN32
+	if (ok == 0)
+		remove(path);
+#endif
+	if (ok != 0 || rename(tmp, path) != 0) {
+		fido_log_debug("%s: rename %s", __func__, tmp);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (f != NULL)
+		fclose(f);
+	if (r != FIDO_OK)
+		remove(tmp);
+
+	fido_free(tmp);
+	fido_free(img);
+
+	return (r);
+}
+
+/*
+ * The EVP_PKEY of a credential is built on first use and kept, so that
+ * it is not rebuilt on every verification. Concurrent verifications may
+ * race to build it; the loser frees its copy.
+ */
+static EVP_PKEY *
+ref_pkey(const struct store_ref *ref, bool *cached)
+{
+	EVP_PKEY *pkey;
+#ifdef __GNUC__
+	EVP_PKEY *prev = NULL;
+
+	if ((pkey = __atomic_load_n(ref->pkey, __ATOMIC_ACQUIRE)) != NULL) {
+		*cached = true;
+		return (pkey);
+	}
+#endif
+
+	*cached = false;
+
+	if ((pkey = key_to_pkey(ref->type, ref->key, ref->key_len)) == NULL)
+		return (NULL);
+
+#ifdef __GNUC__
+	if (__atomic_compare_exchange_n(ref->pkey, &prev, pkey, false,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) == false) {
+		EVP_PKEY_free(pkey);
+		pkey = prev;
+	}
+	*cached = true;
+#endif
+
+	return (pkey);
+}
+
+int
+fido_assert_verify_with_store(const fido_assert_t *assert, size_t idx,
+    const fido_cred_store_t *store)
+{
+	const fido_blob_t	*id;
+	struct store_ref	 ref;
+	EVP_PKEY		*pkey;
+	bool			 cached;
+	int			 r;
+
+	if (idx >= assert->stmt_len)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	id = &assert->stmt[idx].id;
+
+	/* the authenticator may omit the id if it was the only one allowed */
+	if (fido_blob_is_empty(id) && assert->allow_list.len == 1)
+		id = &assert->allow_list.ptr[0];
+
+	if (store_lookup(store, id->ptr, id->len, &ref) < 0) {
+		fido_log_debug("%s: unknown credential", __func__);
+		return (FIDO_ERR_NO_CREDENTIALS);
+	}
+
+	if ((pkey = ref_pkey(&ref, &cached)) == NULL) {
+		fido_log_debug("%s: ref_pkey", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	r = fido_assert_verify_pkey(assert, idx, ref.type, pkey);
+
+	if (cached == false)
+		EVP_PKEY_free(pkey);
+
+	/* only a verified statement may advance the counter */
+	if (r == FIDO_OK && store->track_sigcount)
+		r = ref_track_sigcount(&ref,
+		    assert->stmt[idx].authdata.sigcount);
+
+	return (r);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static int
+timespec_to_ms(const struct timespec *ts, int upper_bound)
+{
+	int64_t x;
+	int64_t y;
+
+	if (ts->tv_sec < 0 || ts->tv_sec > INT64_MAX / 1000LL ||
+	    ts->tv_nsec < 0 || ts->tv_nsec / 1000000LL > INT64_MAX)
+		return (upper_bound);
+
+	x = ts->tv_sec * 1000LL;
+	y = ts->tv_nsec / 1000000LL;
+
+	if (INT64_MAX - x < y || x + y > upper_bound)
+		return (upper_bound);
+
+	return (int)(x + y);
+}
+
+int
+fido_time_now(struct timespec *ts_now)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts_now) != 0) {
+		fido_log_debug("%s: clock_gettime: %s", __func__,
+		    strerror(errno));
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+fido_time_delta_ms(const struct timespec *ts_start, int *ms)
+{
+	struct timespec ts_now;
+	struct timespec ts_delta;
+
+	if (fido_time_now(&ts_now) != 0)
+		return (-1);
+
+	timespecsub(&ts_now, ts_start, &ts_delta);
+	*ms = timespec_to_ms(&ts_delta, INT_MAX);
+
+	return (0);
+}
+
+int
+fido_time_delta_us(const struct timespec *ts_start, uint64_t *us)
+{
+	struct timespec ts_now;
+	struct timespec ts_delta;
+
+	if (fido_time_now(&ts_now) != 0)
+		return (-1);
+
+	timespecsub(&ts_now, ts_start, &ts_delta);
+	if (ts_delta.tv_sec < 0 || ts_delta.tv_nsec < 0) {
+		*us = 0;
+		return (0);
+	}
+
+	*us = (uint64_t)ts_delta.tv_sec * 1000000ULL +
+	    (uint64_t)ts_delta.tv_nsec / 1000ULL;
+
+	return (0);
+}
+
+int
+fido_time_sleep_ms(int ms)
+{
+#ifdef _WIN32
+	if (ms > 0)
+		Sleep((DWORD)ms);
+#else
+	struct timespec ts;
+
+	if (ms <= 0)
+		return (0);
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+
+	while (nanosleep(&ts, &ts) != 0)
+		if (errno != EINTR) {
+			fido_log_debug("%s: nanosleep: %s", __func__,
+			    strerror(errno));
+			return (-1);
+		}
+#endif
+
+	return (0);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+ * Statically defined tracepoints under the "libfido2" provider. When built
+ * with -DUSE_USDT=ON, each probe compiles to a single nop and a note in the
+ * ELF binary, which perf(1), bpftrace(8) and friends can attach to at
+ * runtime. Otherwise, probes expand to nothing.
+ */
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+#define fido_trace0(name)		DTRACE_PROBE(libfido2, name)
+#define fido_trace1(name, a)		DTRACE_PROBE1(libfido2, name, a)
+#define fido_trace2(name, a, b)		DTRACE_PROBE2(libfido2, name, a, b)
+#define fido_trace3(name, a, b, c)	DTRACE_PROBE3(libfido2, name, a, b, c)
+#define fido_trace4(name, a, b, c, d)	DTRACE_PROBE4(libfido2, name, a, b, c, d)
+#else
+#define fido_trace0(...)	do { /* nothing */ } while (0)
+#define fido_trace1(...)	do { /* nothing */ } while (0)
+#define fido_trace2(...)	do { /* nothing */ } while (0)
+#define fido_trace3(...)	do { /* nothing */ } while (0)
+#define fido_trace4(...)	do { /* nothing */ } while (0)
+#endif /* USE_USDT */
+
+#endif /* !_TRACE_H */
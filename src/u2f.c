@@ -29,12 +29,11 @@ static int
 sig_get(fido_blob_t *sig, const unsigned char **buf, size_t *len)
 {
 	sig->len = *len; /* consume the whole buffer */
-	if ((sig->ptr = calloc(1, sig->len)) == NULL ||
+	if ((sig->ptr = fido_calloc(1, sig->len)) == NULL ||
 	    fido_buf_read(buf, len, sig->ptr, sig->len) < 0) {
 		fido_log_debug("%s: fido_buf_read", __func__);
 		if (sig->ptr != NULL) {
-			explicit_bzero(sig->ptr, sig->len);
-			free(sig->ptr);
+			fido_freezero(sig->ptr, sig->len);
 			sig->ptr = NULL;
 			sig->len = 0;
 			return (-1);
@@ -64,7 +63,7 @@ x5c_get(fido_blob_t *x5c, const unsigned char **buf, size_t *len)
 	}
 
 	/* read accordingly */
-	if ((x5c->ptr = calloc(1, x5c->len)) == NULL ||
+	if ((x5c->ptr = fido_calloc(1, x5c->len)) == NULL ||
 	    fido_buf_read(buf, len, x5c->ptr, x5c->len) < 0) {
 		fido_log_debug("%s: fido_buf_read", __func__);
 		goto fail;
@@ -76,7 +75,7 @@ fail:
 		X509_free(cert);
 
 	if (ok < 0) {
-		free(x5c->ptr);
+		fido_free(x5c->ptr);
 		x5c->ptr = NULL;
 		x5c->len = 0;
 	}
@@ -158,7 +157,7 @@ send_dummy_register(fido_dev_t *dev, int ms)
 		}
 		if (fido_rx(dev, CTAP_CMD_MSG, &reply, sizeof(reply), ms) < 2) {
 			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
+			r = fido_rx_error(dev);
 			goto fail;
 		}
 		if (usleep((unsigned)(ms == -1 ? 100 : ms) * 1000) < 0) {
@@ -224,7 +223,7 @@ key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
 	}
 	if (fido_rx(dev, CTAP_CMD_MSG, &reply, sizeof(reply), ms) != 2) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+		r = fido_rx_error(dev);
 		goto fail;
 	}
 
@@ -334,7 +333,7 @@ do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
 		if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, &reply,
 		    sizeof(reply), ms)) < 2) {
 			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
+			r = fido_rx_error(dev);
 			goto fail;
 		}
 		if (usleep((unsigned)(ms == -1 ? 100 : ms) * 1000) < 0) {
@@ -442,7 +441,7 @@ encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
 
 	len = authdata_blob.len = sizeof(authdata) + sizeof(attcred_raw) +
 	    kh_len + pk_blob.len;
-	ptr = authdata_blob.ptr = calloc(1, authdata_blob.len);
+	ptr = authdata_blob.ptr = fido_calloc(1, authdata_blob.len);
 
 	fido_log_debug("%s: ptr=%p, len=%zu", __func__, (void *)ptr, len);
 
@@ -474,12 +473,10 @@ fail:
 		cbor_decref(&authdata_cbor);
 
 	if (pk_blob.ptr) {
-		explicit_bzero(pk_blob.ptr, pk_blob.len);
-		free(pk_blob.ptr);
+		fido_freezero(pk_blob.ptr, pk_blob.len);
 	}
 	if (authdata_blob.ptr) {
-		explicit_bzero(authdata_blob.ptr, authdata_blob.len);
-		free(authdata_blob.ptr);
+		fido_freezero(authdata_blob.ptr, authdata_blob.len);
 	}
 
 	return (ok);
@@ -520,7 +517,7 @@ parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 	/* pubkey + key handle */
 	if (fido_buf_read(&reply, &len, &pubkey, sizeof(pubkey)) < 0 ||
 	    fido_buf_read(&reply, &len, &kh_len, sizeof(kh_len)) < 0 ||
-	    (kh = calloc(1, kh_len)) == NULL ||
+	    (kh = fido_calloc(1, kh_len)) == NULL ||
 	    fido_buf_read(&reply, &len, kh, kh_len) < 0) {
 		fido_log_debug("%s: fido_buf_read", __func__);
 		goto fail;
@@ -552,20 +549,16 @@ parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 	r = FIDO_OK;
 fail:
 	if (kh) {
-		explicit_bzero(kh, kh_len);
-		free(kh);
+		fido_freezero(kh, kh_len);
 	}
 	if (x5c.ptr) {
-		explicit_bzero(x5c.ptr, x5c.len);
-		free(x5c.ptr);
+		fido_freezero(x5c.ptr, x5c.len);
 	}
 	if (sig.ptr) {
-		explicit_bzero(sig.ptr, sig.len);
-		free(sig.ptr);
+		fido_freezero(sig.ptr, sig.len);
 	}
 	if (ad.ptr) {
-		explicit_bzero(ad.ptr, ad.len);
-		free(ad.ptr);
+		fido_freezero(ad.ptr, ad.len);
 	}
 
 	return (r);
@@ -641,7 +634,7 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 		if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, &reply,
 		    sizeof(reply), ms)) < 2) {
 			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
+			r = fido_rx_error(dev);
 			goto fail;
 		}
 		if (usleep((unsigned)(ms == -1 ? 100 : ms) * 1000) < 0) {
@@ -713,12 +706,10 @@ u2f_authenticate_single(fido_dev_t *dev, const fido_blob_t *key_id,
 	r = FIDO_OK;
 fail:
 	if (sig.ptr) {
-		explicit_bzero(sig.ptr, sig.len);
-		free(sig.ptr);
+		fido_freezero(sig.ptr, sig.len);
 	}
 	if (ad.ptr) {
-		explicit_bzero(ad.ptr, ad.len);
-		free(ad.ptr);
+		fido_freezero(ad.ptr, ad.len);
 	}
 
 	return (r);
@@ -813,6 +804,9 @@ u2f_get_touch_begin(fido_dev_t *dev)
 		goto fail;
 	}
 
+	/* the reply is read by u2f_get_touch_status() */
+	fido_tx_handoff(dev);
+
 	r = FIDO_OK;
 fail:
 	iso7816_free(&apdu);
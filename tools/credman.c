@@ -152,46 +152,59 @@ credman_list_rk(char *path, const char *rp_id)
 	exit(0);
 }
 
+struct find_rk {
+	const void	*cred_id_ptr;
+	size_t		 cred_id_len;
+	bool		 found;
+};
+
+static int
+find_rk(void *arg, const fido_cred_t *cred, size_t total)
+{
+	struct find_rk *f = arg;
+
+	(void)total;
+
+	if (fido_cred_id_ptr(cred) == NULL)
+		errx(1, "output error");
+	if (f->cred_id_len != fido_cred_id_len(cred) ||
+	    memcmp(f->cred_id_ptr, fido_cred_id_ptr(cred), f->cred_id_len))
+		return (0); /* continue */
+
+	print_cred(stdout, fido_cred_type(cred), cred);
+	f->found = true;
+
+	return (1); /* stop */
+}
+
 int
 credman_print_rk(fido_dev_t *dev, const char *path, char *rp_id, char *cred_id)
 {
-	const fido_cred_t *cred = NULL;
-	fido_credman_rk_t *rk = NULL;
+	struct find_rk f;
 	char pin[1024];
 	void *cred_id_ptr = NULL;
 	size_t cred_id_len = 0;
 	int r;
 
-	if ((rk = fido_credman_rk_new()) == NULL)
-		errx(1, "fido_credman_rk_new");
 	if (base64_decode(cred_id, &cred_id_ptr, &cred_id_len) < 0)
 		errx(1, "base64_decode");
 
+	memset(&f, 0, sizeof(f));
+	f.cred_id_ptr = cred_id_ptr;
+	f.cred_id_len = cred_id_len;
+
 	read_pin(path, pin, sizeof(pin));
-	r = fido_credman_get_dev_rk(dev, rp_id, rk, pin);
+	r = fido_credman_iter_dev_rk(dev, rp_id, find_rk, &f, pin);
 	explicit_bzero(pin, sizeof(pin));
 
 	if (r != FIDO_OK)
-		errx(1, "fido_credman_get_dev_rk: %s", fido_strerr(r));
-
-	for (size_t i = 0; i < fido_credman_rk_count(rk); i++) {
-		if ((cred = fido_credman_rk(rk, i)) == NULL ||
-		    fido_cred_id_ptr(cred) == NULL)
-			errx(1, "output error");
-		if (cred_id_len != fido_cred_id_len(cred) ||
-		    memcmp(cred_id_ptr, fido_cred_id_ptr(cred), cred_id_len))
-			continue;
-		print_cred(stdout, fido_cred_type(cred), cred);
-		goto out;
-	}
+		errx(1, "fido_credman_iter_dev_rk: %s", fido_strerr(r));
+	if (f.found == false)
+		errx(1, "credential not found");
 
-	errx(1, "credential not found");
-
-out:
 	free(cred_id_ptr);
 	cred_id_ptr = NULL;
 
-	fido_credman_rk_free(&rk);
 	fido_dev_close(dev);
 	fido_dev_free(&dev);
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Serve the FIDO devices of this host to unprivileged clients; see
+ * fido2-broker(1).
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fido.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../openbsd-compat/openbsd-compat.h"
+
+static fido_broker_t *broker;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fido2-broker [-d] [-m mode] socket\n");
+	exit(1);
+}
+
+static void
+stop(int signo)
+{
+	(void)signo;
+
+	fido_broker_stop(broker);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction	 sa;
+	const char		*path;
+	char			*ep;
+	long			 mode = -1;
+	int			 flags = 0;
+	int			 ch;
+	int			 r;
+
+	while ((ch = getopt(argc, argv, "dm:")) != -1) {
+		switch (ch) {
+		case 'd':
+			flags = FIDO_DEBUG;
+			break;
+		case 'm':
+			errno = 0;
+			mode = strtol(optarg, &ep, 8);
+			if (errno != 0 || *ep != '\0' || mode < 0 ||
+			    mode > 0777)
+				errx(1, "invalid mode: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage();
+
+	path = argv[0];
+
+	fido_init(flags);
+
+	if ((broker = fido_broker_new()) == NULL)
+		errx(1, "fido_broker_new");
+
+	/* a stale socket from a previous run */
+	if (unlink(path) < 0 && errno != ENOENT)
+		err(1, "unlink %s", path);
+
+	if ((r = fido_broker_listen(broker, path)) != FIDO_OK)
+		errx(1, "fido_broker_listen %s: %s", path, fido_strerr(r));
+
+	if (mode != -1 && chmod(path, (mode_t)mode) < 0)
+		err(1, "chmod %s", path);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(SIGINT, &sa, NULL) < 0 ||
+	    sigaction(SIGTERM, &sa, NULL) < 0)
+		err(1, "sigaction");
+
+	signal(SIGPIPE, SIG_IGN);
+
+	r = fido_broker_run(broker);
+	fido_broker_free(&broker);
+
+	if (r != FIDO_OK)
+		errx(1, "fido_broker_run: %s", fido_strerr(r));
+
+	exit(0);
+}
@@ -23,6 +23,7 @@ usage(void)
 "       fido2-token -I [-cd] [-k rp_id -i cred_id] device\n"
 "       fido2-token -L [-der] [-k rp_id] [device]\n"
 "       fido2-token -S [-de] [-i template_id -n template_name] device\n"
+"       fido2-token -T [-d] [-n count] [device]\n"
 "       fido2-token -V\n"
 	);
 
@@ -83,6 +84,8 @@ main(int argc, char **argv)
 		return (token_reset(device));
 	case 'S':
 		return (token_set(argc, argv, device));
+	case 'T':
+		return (token_ping(argc, argv, device));
 	case 'V':
 		fprintf(stderr, "%d.%d.%d\n", _FIDO_MAJOR, _FIDO_MINOR,
 		    _FIDO_PATCH);
@@ -356,6 +356,125 @@ token_list(int argc, char **argv, char *path)
 	exit(0);
 }
 
+static uint64_t
+elapsed_us(const struct timespec *t0, const struct timespec *t1)
+{
+	int64_t us;
+
+	us = ((int64_t)t1->tv_sec - (int64_t)t0->tv_sec) * 1000000 +
+	    ((int64_t)t1->tv_nsec - (int64_t)t0->tv_nsec) / 1000;
+
+	return (us < 0 ? 0 : (uint64_t)us);
+}
+
+static int
+cmp_us(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static int
+ping_dev(const char *path, int count)
+{
+	fido_dev_t	*dev = NULL;
+	unsigned char	*buf = NULL;
+	uint64_t	*lat = NULL;
+	uint64_t	 total;
+	struct timespec	 t0;
+	struct timespec	 t1;
+	size_t		 n;
+	int		 r;
+	int		 ok = -1;
+
+	n = (size_t)count;
+
+	if ((buf = malloc(FIDO_MAXMSG)) == NULL ||
+	    (lat = calloc(n, sizeof(*lat))) == NULL)
+		errx(1, "malloc");
+
+	for (size_t i = 0; i < FIDO_MAXMSG; i++)
+		buf[i] = (unsigned char)i;
+
+	dev = open_dev(path);
+
+	for (size_t len = 1; len <= FIDO_MAXMSG; len <<= 1) {
+		total = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (clock_gettime(CLOCK_MONOTONIC, &t0) != 0)
+				err(1, "clock_gettime");
+			if ((r = fido_dev_ping(dev, buf, len)) != FIDO_OK) {
+				warnx("%s: fido_dev_ping len=%zu: %s", path,
+				    len, fido_strerr(r));
+				goto out;
+			}
+			if (clock_gettime(CLOCK_MONOTONIC, &t1) != 0)
+				err(1, "clock_gettime");
+			lat[i] = elapsed_us(&t0, &t1);
+			total += lat[i];
+		}
+		qsort(lat, n, sizeof(*lat), cmp_us);
+		printf("%s: len=%zu, median=%lluus, p99=%lluus, %llu bytes/s\n",
+		    path, len, (unsigned long long)lat[n / 2],
+		    (unsigned long long)lat[(n * 99) / 100],
+		    (unsigned long long)(total ? (len * n * 1000000) / total :
+		    0));
+	}
+
+	ok = 0;
+out:
+	fido_dev_close(dev);
+	fido_dev_free(&dev);
+
+	free(buf);
+	free(lat);
+
+	return (ok);
+}
+
+int
+token_ping(int argc, char **argv, char *path)
+{
+	fido_dev_info_t	*devlist;
+	size_t		 ndevs;
+	int		 count = 100;
+	int		 ch;
+	int		 r;
+	int		 status = 0;
+
+	optind = 1;
+
+	while ((ch = getopt(argc, argv, TOKEN_OPT)) != -1) {
+		switch (ch) {
+		case 'n':
+			if ((count = base10(optarg)) < 1)
+				errx(1, "-n: invalid count");
+			break;
+		default:
+			break; /* ignore */
+		}
+	}
+
+	if (path != NULL)
+		exit(ping_dev(path, count) < 0);
+
+	if ((devlist = fido_dev_info_new(64)) == NULL)
+		errx(1, "fido_dev_info_new");
+	if ((r = fido_dev_info_manifest(devlist, 64, &ndevs)) != FIDO_OK)
+		errx(1, "fido_dev_info_manifest: %s (0x%x)", fido_strerr(r), r);
+
+	for (size_t i = 0; i < ndevs; i++)
+		if (ping_dev(fido_dev_info_path(fido_dev_info_ptr(devlist, i)),
+		    count) < 0)
+			status = 1;
+
+	fido_dev_info_free(&devlist, ndevs);
+
+	exit(status);
+}
+
 int
 token_delete(int argc, char **argv, char *path)
 {
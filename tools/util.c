@@ -142,11 +142,16 @@ fido_dev_t *
 open_dev(const char *path)
 {
 	fido_dev_t *dev;
+	const char *broker;
 	int r;
 
 	if ((dev = fido_dev_new()) == NULL)
 		errx(1, "fido_dev_new");
 
+	if ((broker = getenv("FIDO_BROKER")) != NULL &&
+	    (r = fido_dev_set_broker(dev, broker)) != FIDO_OK)
+		errx(1, "fido_dev_set_broker %s: %s", broker, fido_strerr(r));
+
 	r = fido_dev_open(dev, path);
 	if (r != FIDO_OK)
 		errx(1, "fido_dev_open %s: %s", path, fido_strerr(r));